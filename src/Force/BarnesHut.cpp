@@ -1,19 +1,94 @@
 #include "BarnesHut.hpp"
+#include "../Particle/Morton.hpp"
 
 #include <algorithm>
+#include <bit>
 #include <cmath>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
 
 #include <omp.h>
 
 Gravity_BarnesHut::Gravity_BarnesHut( double const theta,
-                                      std::size_t const leaf_bucket )
+                                      std::size_t const leaf_bucket,
+                                      BH_Build const build,
+                                      std::size_t const group_size,
+                                      simd::Isa const isa,
+                                      BH_Options const options )
 : theta_{ theta }
 , leaf_bucket_{ leaf_bucket }
-{ }
+, build_{ build }
+, group_size_{ std::max( group_size, std::size_t{ 1 } ) }
+, isa_{ std::min( isa, simd::detect() ) }
+, kernel_{ direct::select( isa ) }
+, pot_kernel_{ direct::select( isa, true ) }
+, expansion_{ options.expansion }
+, refit_tolerance_{ std::max( options.refit_tolerance, 0.0 ) }
+, alpha_{ std::max( options.alpha, 0.0 ) }
+, traversal_{ options.traversal }
+, symmetric_kernel_{ direct::select_symmetric( isa ) }
+{
+    if ( traversal_ == BH_Traversal::Dual && alpha_ > 0.0 ) {
+        throw std::runtime_error( "Gravity_BarnesHut: the dual traversal needs the geometric test (alpha = 0)" );
+    }
+}
+
+void Gravity_BarnesHut::set_short_range( double const r_split ) {
+    if ( r_split > 0.0 && expansion_ != BH_Expansion::Monopole ) {
+        throw std::runtime_error( "Gravity_BarnesHut: short-range mode needs the monopole expansion" );
+    }
+    if ( r_split > 0.0 && traversal_ == BH_Traversal::Dual ) {
+        throw std::runtime_error( "Gravity_BarnesHut: short-range mode needs the group traversal" );
+    }
+    short_range_ = std::max( r_split, 0.0 );
+}
+
+// Cubic root box centered on the AABB midpoint, sized to enclose every
+// active body. A cube keeps octant subdivisions geometrically clean.
+static void root_box( double const* RESTRICT px, double const* RESTRICT py, double const* RESTRICT pz,
+                      std::size_t const N,
+                      double &cx, double &cy, double &cz, double &half ) {
+    double min_x{ px[0] }, max_x{ px[0] };
+    double min_y{ py[0] }, max_y{ py[0] };
+    double min_z{ pz[0] }, max_z{ pz[0] };
+
+    #pragma omp parallel for reduction( min:min_x, min_y, min_z ) reduction( max:max_x, max_y, max_z ) \
+                             schedule( static ) if ( N >= config::OMP_THRESHOLD )
+    for ( std::size_t i = 1; i < N; ++i ) {
+        min_x = std::min( min_x, px[i] ); max_x = std::max( max_x, px[i] );
+        min_y = std::min( min_y, py[i] ); max_y = std::max( max_y, py[i] );
+        min_z = std::min( min_z, pz[i] ); max_z = std::max( max_z, pz[i] );
+    }
+    cx = 0.5 * ( min_x + max_x );
+    cy = 0.5 * ( min_y + max_y );
+    cz = 0.5 * ( min_z + max_z );
+    half = 0.5 * std::max( { max_x - min_x, max_y - min_y, max_z - min_z } );
+    if ( half <= 0.0 ) half = 1.0;  // All particles coincident; degenerate but well-defined.
+    half *= 1.0 + 1e-12;            // Pad so positions on the boundary fall inside.
+}
+
+// First particle of a leaf bucket whose particles are consecutive in
+// memory, else -1.
+static int contiguous_run( int const* RESTRICT indices, int const begin, int const count ) {
+    for ( int b{ 1 }; b < count; ++b ) {
+        if ( indices[begin + b] != indices[begin] + b ) return -1;
+    }
+    return indices[begin];
+}
 
 
 void Gravity_BarnesHut::build_tree( Particles const &particles ) const {
-    std::size_t const N{ particles.num_particles() };
+    if ( build_ == BH_Build::Morton ) {
+        if ( refit_tolerance_ > 0.0 && refit( particles ) ) return;
+        build_morton( particles );
+        ++builds_;
+        return;
+    }
+    ++builds_;
+
+    // Only active particles are sources, so only they enter the tree.
+    std::size_t const N{ particles.num_active() };
 
     double const* RESTRICT px{ particles.pos_x() };
     double const* RESTRICT py{ particles.pos_y() };
@@ -21,37 +96,225 @@ void Gravity_BarnesHut::build_tree( Particles const &particles ) const {
     double const* RESTRICT mass{ particles.mass() };
 
     nodes_.clear();
+    cold_.clear();
     indices_.resize( N );
     for ( std::size_t i{}; i < N; ++i ) indices_[i] = static_cast<int>( i );
     scratch_.resize( N );
 
     if ( N == 0 ) return;
 
-    // Cubic root box centered on the AABB midpoint, sized to enclose every
-    // body. A cube keeps octant subdivisions geometrically clean.
-    double min_x{ px[0] }, max_x{ px[0] };
-    double min_y{ py[0] }, max_y{ py[0] };
-    double min_z{ pz[0] }, max_z{ pz[0] };
-    for ( std::size_t i{ 1 }; i < N; ++i ) {
-        min_x = std::min( min_x, px[i] ); max_x = std::max( max_x, px[i] );
-        min_y = std::min( min_y, py[i] ); max_y = std::max( max_y, py[i] );
-        min_z = std::min( min_z, pz[i] ); max_z = std::max( max_z, pz[i] );
+    double cx{}, cy{}, cz{}, half{};
+    root_box( px, py, pz, N, cx, cy, cz, half );
+
+    // Split the top of the tree with one task per octant, down to parts
+    // of at most TASK_CUTOFF particles, each built serially into its
+    // thread's arena. Parts own disjoint spans of indices_ and scratch_.
+    arenas_.resize( static_cast<std::size_t>( omp_get_max_threads() ) );
+    for ( Build_Arena &arena : arenas_ ) {
+        arena.nodes.clear();
+        arena.cold.clear();
+    }
+    parts_.clear();
+    parts_.push_back( { 0, static_cast<int>( N ), cx, cy, cz, half, 0, -1, 0, -1, 0, 0, 0 } );
+
+    #pragma omp parallel if ( N >= config::OMP_THRESHOLD )
+    #pragma omp single
+    split_part( 0, parts_[0], px, py, pz, mass );
+
+    stitch_parts( px, py, pz, mass );
+}
+
+
+// Counting sort of indices[begin, end) into the 8 octants about (bcx, bcy,
+// bcz) through scratch; octant index = (x>=cx) | ((y>=cy)<<1) | ((z>=cz)<<2).
+static void sort_octants( int* RESTRICT indices, int* RESTRICT scratch,
+                          int const begin, int const end,
+                          double const bcx, double const bcy, double const bcz,
+                          double const* RESTRICT px, double const* RESTRICT py, double const* RESTRICT pz,
+                          int ( &counts )[8] ) {
+    for ( int k{}; k < 8; ++k ) counts[k] = 0;
+    for ( int k{ begin }; k < end; ++k ) {
+        int const i{ indices[k] };
+        int const oct{ ( px[i] >= bcx ? 1 : 0 )
+                     | ( py[i] >= bcy ? 2 : 0 )
+                     | ( pz[i] >= bcz ? 4 : 0 ) };
+        ++counts[oct];
     }
-    double const cx{ 0.5 * ( min_x + max_x ) };
-    double const cy{ 0.5 * ( min_y + max_y ) };
-    double const cz{ 0.5 * ( min_z + max_z ) };
-    double half{ 0.5 * std::max( { max_x - min_x, max_y - min_y, max_z - min_z } ) };
-    if ( half <= 0.0 ) half = 1.0;  // All particles coincident; degenerate but well-defined.
-    half *= 1.0 + 1e-12;            // Pad so positions on the boundary fall inside.
 
-    nodes_.emplace_back();
-    build_recursive( 0, 0, static_cast<int>( N ),
-                     cx, cy, cz, half, 0,
-                     px, py, pz, mass );
+    int offsets[8]{};
+    offsets[0] = begin;
+    for ( int k{ 1 }; k < 8; ++k ) offsets[k] = offsets[k-1] + counts[k-1];
+
+    for ( int k{ begin }; k < end; ++k ) {
+        int const i{ indices[k] };
+        int const oct{ ( px[i] >= bcx ? 1 : 0 )
+                     | ( py[i] >= bcy ? 2 : 0 )
+                     | ( pz[i] >= bcz ? 4 : 0 ) };
+        scratch[ offsets[oct]++ ] = i;
+    }
+    for ( int k{ begin }; k < end; ++k ) indices[k] = scratch[k];
+}
+
+
+void Gravity_BarnesHut::split_part( int const part_id, Build_Part const part,
+                                    double const* RESTRICT px, double const* RESTRICT py, double const* RESTRICT pz,
+                                    double const* RESTRICT mass ) const {
+    int const count{ part.end - part.begin };
+
+    // Small enough: the whole subtree goes into this thread's arena. No
+    // task is created in here, so nothing else runs on the thread between
+    // reading the arena's size and filling it.
+    if ( count <= TASK_CUTOFF || count <= static_cast<int>( leaf_bucket_ ) || part.depth >= MAX_DEPTH ) {
+        int const thread{ omp_get_thread_num() };
+        Build_Arena &arena{ arenas_[static_cast<std::size_t>( thread )] };
+        int const offset{ static_cast<int>( arena.nodes.size() ) };
+        arena.nodes.emplace_back();
+        arena.cold.emplace_back();
+        build_recursive( arena, offset, part.begin, part.end,
+                         part.cx, part.cy, part.cz, part.half, part.depth,
+                         px, py, pz, mass );
+        int const size{ static_cast<int>( arena.nodes.size() ) - offset };
+
+        #pragma omp critical( bh_parts )
+        {
+            parts_[part_id].thread = thread;
+            parts_[part_id].offset = offset;
+            parts_[part_id].size = size;
+        }
+        return;
+    }
+
+    int counts[8]{};
+    sort_octants( indices_.data(), scratch_.data(), part.begin, part.end,
+                  part.cx, part.cy, part.cz, px, py, pz, counts );
+
+    // Children are appended as one block, in octant order. parts_ may
+    // reallocate here, so it is only touched under the lock and children
+    // are handed to their tasks by value.
+    Build_Part children[8]{};
+    int num_children{};
+    std::uint8_t octants{};
+    double const child_half{ 0.5 * part.half };
+    int start{ part.begin };
+    for ( int k{}; k < 8; ++k ) {
+        if ( counts[k] > 0 ) {
+            children[num_children++] = { start, start + counts[k],
+                                         part.cx + ( ( k & 1 ) ? child_half : -child_half ),
+                                         part.cy + ( ( k & 2 ) ? child_half : -child_half ),
+                                         part.cz + ( ( k & 4 ) ? child_half : -child_half ),
+                                         child_half, part.depth + 1, -1, 0, -1, 0, 0, 0 };
+            octants = static_cast<std::uint8_t>( octants | ( 1u << k ) );
+        }
+        start += counts[k];
+    }
+
+    int first_child;
+    #pragma omp critical( bh_parts )
+    {
+        first_child = static_cast<int>( parts_.size() );
+        parts_[part_id].first_child = first_child;
+        parts_[part_id].octants = octants;
+        for ( int c{}; c < num_children; ++c ) parts_.push_back( children[c] );
+    }
+
+    for ( int c{}; c < num_children; ++c ) {
+        Build_Part const child{ children[c] };
+        int const child_id{ first_child + c };
+        #pragma omp task firstprivate( child, child_id )
+        split_part( child_id, child, px, py, pz, mass );
+    }
+}
+
+
+void Gravity_BarnesHut::stitch_parts( double const* RESTRICT px, double const* RESTRICT py,
+                                      double const* RESTRICT pz, double const* RESTRICT mass ) const {
+    // Depth-first numbering of the parts: subtree sizes bottom-up, then
+    // each split part hands its children consecutive blocks after itself.
+    auto sizes = [this]( auto &self, int const p ) -> int {
+        Build_Part &part{ parts_[p] };
+        if ( part.thread >= 0 ) return part.size;
+        int size{ 1 };
+        for ( int c{}; c < std::popcount( part.octants ); ++c ) size += self( self, part.first_child + c );
+        part.size = size;
+        return size;
+    };
+    auto number = [this]( auto &self, int const p, int const node ) -> void {
+        Build_Part &part{ parts_[p] };
+        part.node = node;
+        if ( part.thread >= 0 ) return;
+        int next{ node + 1 };
+        for ( int c{}; c < std::popcount( part.octants ); ++c ) {
+            self( self, part.first_child + c, next );
+            next += parts_[part.first_child + c].size;
+        }
+    };
+    int const num_nodes{ sizes( sizes, 0 ) };
+    number( number, 0, 0 );
+
+    nodes_.resize( static_cast<std::size_t>( num_nodes ) );
+    cold_.resize( static_cast<std::size_t>( num_nodes ) );
+
+    // Arena subtrees are copied into place in parallel, shifting their
+    // skip indices from arena to pool positions.
+    int const num_parts{ static_cast<int>( parts_.size() ) };
+    #pragma omp parallel for schedule( dynamic ) if ( static_cast<std::size_t>( num_nodes ) >= config::OMP_THRESHOLD )
+    for ( int p = 0; p < num_parts; ++p ) {
+        Build_Part const &part{ parts_[p] };
+        if ( part.thread < 0 ) continue;
+        Build_Arena const &arena{ arenas_[static_cast<std::size_t>( part.thread )] };
+        int const shift{ part.node - part.offset };
+        for ( int k{}; k < part.size; ++k ) {
+            BHNode n{ arena.nodes[static_cast<std::size_t>( part.offset + k )] };
+            n.skip += shift;
+            nodes_[static_cast<std::size_t>( part.node + k )] = n;
+            cold_[static_cast<std::size_t>( part.node + k )] = arena.cold[static_cast<std::size_t>( part.offset + k )];
+        }
+    }
+
+    // Split parts are written last, children first, as build_recursive
+    // would have written them.
+    auto finish = [&]( auto &self, int const p ) -> void {
+        Build_Part const part{ parts_[p] };
+        if ( part.thread >= 0 ) return;
+        for ( int c{}; c < std::popcount( part.octants ); ++c ) self( self, part.first_child + c );
+
+        BHNode &n{ nodes_[part.node] };
+        BHNode_Cold &cold{ cold_[part.node] };
+        cold.box_cx = part.cx; cold.box_cy = part.cy; cold.box_cz = part.cz;
+        n.half_width = part.half;
+        n.skip = part.node + part.size;
+        n.first = -1;
+        n.count = 0;
+        n.run = -1;
+        n.octants = part.octants;
+
+        double m_sum{};
+        double cx_sum{}, cy_sum{}, cz_sum{};
+        for ( int c{ part.node + 1 }; c < n.skip; c = nodes_[c].skip ) {
+            BHNode const &ch{ nodes_[c] };
+            m_sum  += ch.total_mass;
+            cx_sum += ch.total_mass * ch.com_x;
+            cy_sum += ch.total_mass * ch.com_y;
+            cz_sum += ch.total_mass * ch.com_z;
+        }
+        n.total_mass = m_sum;
+        if ( m_sum > 0.0 ) {
+            n.com_x = cx_sum / m_sum;
+            n.com_y = cy_sum / m_sum;
+            n.com_z = cz_sum / m_sum;
+        } else {
+            n.com_x = part.cx; n.com_y = part.cy; n.com_z = part.cz;
+        }
+        if ( expansion_ == BH_Expansion::Quadrupole ) {
+            quadrupole( nodes_.data(), cold_.data(), part.node, px, py, pz, mass );
+        }
+    };
+    finish( finish, 0 );
 }
 
 
 void Gravity_BarnesHut::build_recursive(
+    Build_Arena &arena,
     int const node_id,
     int const begin, int const end,
     double const bcx, double const bcy, double const bcz,
@@ -59,13 +322,16 @@ void Gravity_BarnesHut::build_recursive(
     double const* RESTRICT px, double const* RESTRICT py, double const* RESTRICT pz,
     double const* RESTRICT mass ) const
 {
+    std::vector<BHNode> &nodes{ arena.nodes };
+    std::vector<BHNode_Cold> &cold_nodes{ arena.cold };
     int const count{ end - begin };
 
     {
-        BHNode &n{ nodes_[node_id] };
-        n.box_cx = bcx; n.box_cy = bcy; n.box_cz = bcz;
+        BHNode &n{ nodes[node_id] };
         n.half_width = half;
-        for ( int k{}; k < 8; ++k ) n.children[k] = -1;
+        n.octants = 0;
+        BHNode_Cold &cold{ cold_nodes[node_id] };
+        cold.box_cx = bcx; cold.box_cy = bcy; cold.box_cz = bcz;
     }
 
     // Leaf condition: small bucket or hit depth cap (degenerate clusters).
@@ -80,7 +346,7 @@ void Gravity_BarnesHut::build_recursive(
             cy_sum += m * py[i];
             cz_sum += m * pz[i];
         }
-        BHNode &n{ nodes_[node_id] };
+        BHNode &n{ nodes[node_id] };
         n.total_mass = m_sum;
         if ( m_sum > 0.0 ) {
             n.com_x = cx_sum / m_sum;
@@ -89,39 +355,34 @@ void Gravity_BarnesHut::build_recursive(
         } else {
             n.com_x = bcx; n.com_y = bcy; n.com_z = bcz;
         }
-        n.children[0] = -1;
-        n.children[1] = begin;
-        n.children[2] = count;
+        n.skip = node_id + 1;
+        n.first = begin;
+        n.count = count;
+        n.run = contiguous_run( indices_.data(), begin, count );
+        if ( expansion_ == BH_Expansion::Quadrupole ) {
+            quadrupole( nodes.data(), cold_nodes.data(), node_id, px, py, pz, mass );
+        }
         return;
     }
 
-    // Counting-sort indices_[begin..end) into 8 octants.
-    // Octant index = (x>=cx) | ((y>=cy)<<1) | ((z>=cz)<<2).
     int counts[8]{};
-    for ( int k{ begin }; k < end; ++k ) {
-        int const i{ indices_[k] };
-        int const oct{ ( px[i] >= bcx ? 1 : 0 )
-                     | ( py[i] >= bcy ? 2 : 0 )
-                     | ( pz[i] >= bcz ? 4 : 0 ) };
-        ++counts[oct];
-    }
+    sort_octants( indices_.data(), scratch_.data(), begin, end, bcx, bcy, bcz, px, py, pz, counts );
 
-    int starts[8]{};
-    int offsets[8]{};
-    starts[0] = begin;
-    for ( int k{ 1 }; k < 8; ++k ) starts[k] = starts[k-1] + counts[k-1];
-    for ( int k{}; k < 8; ++k ) offsets[k] = starts[k];
-
-    for ( int k{ begin }; k < end; ++k ) {
-        int const i{ indices_[k] };
-        int const oct{ ( px[i] >= bcx ? 1 : 0 )
-                     | ( py[i] >= bcy ? 2 : 0 )
-                     | ( pz[i] >= bcz ? 4 : 0 ) };
-        scratch_[ offsets[oct]++ ] = i;
+    // Children follow depth-first: each is appended just before its own
+    // recursive call, so a subtree occupies the nodes up to its skip.
+    // Re-access nodes through nodes[id] after each call, since growth
+    // may have reallocated the arena.
+    std::uint8_t octants{};
+    for ( int k{}; k < 8; ++k ) {
+        if ( counts[k] > 0 ) octants = static_cast<std::uint8_t>( octants | ( 1u << k ) );
     }
-    for ( int k{ begin }; k < end; ++k ) indices_[k] = scratch_[k];
+    nodes[node_id].first = -1;
+    nodes[node_id].count = 0;
+    nodes[node_id].run = -1;
+    nodes[node_id].octants = octants;
 
     double const child_half{ 0.5 * half };
+    int start{ begin };
     for ( int k{}; k < 8; ++k ) {
         if ( counts[k] == 0 ) continue;
 
@@ -129,32 +390,28 @@ void Gravity_BarnesHut::build_recursive(
         double const ccy{ bcy + ( ( k & 2 ) ? child_half : -child_half ) };
         double const ccz{ bcz + ( ( k & 4 ) ? child_half : -child_half ) };
 
-        // Reserve child node id BEFORE the recursive call. Re-access parent
-        // through nodes_[node_id] AFTER the call, since emplace_back may
-        // have reallocated the underlying buffer.
-        int const child_id{ static_cast<int>( nodes_.size() ) };
-        nodes_.emplace_back();
-        nodes_[node_id].children[k] = child_id;
-
-        build_recursive( child_id,
-                         starts[k], starts[k] + counts[k],
+        int const child_id{ static_cast<int>( nodes.size() ) };
+        nodes.emplace_back();
+        cold_nodes.emplace_back();
+        build_recursive( arena, child_id,
+                         start, start + counts[k],
                          ccx, ccy, ccz, child_half, depth + 1,
                          px, py, pz, mass );
+        start += counts[k];
     }
+    nodes[node_id].skip = static_cast<int>( nodes.size() );
 
     // Combine child COMs into this node's COM.
     double m_sum{};
     double cx_sum{}, cy_sum{}, cz_sum{};
-    for ( int k{}; k < 8; ++k ) {
-        int const child_id{ nodes_[node_id].children[k] };
-        if ( child_id < 0 ) continue;
-        BHNode const &c{ nodes_[child_id] };
-        m_sum  += c.total_mass;
-        cx_sum += c.total_mass * c.com_x;
-        cy_sum += c.total_mass * c.com_y;
-        cz_sum += c.total_mass * c.com_z;
-    }
-    BHNode &n{ nodes_[node_id] };
+    for ( int c{ node_id + 1 }; c < nodes[node_id].skip; c = nodes[c].skip ) {
+        BHNode const &ch{ nodes[c] };
+        m_sum  += ch.total_mass;
+        cx_sum += ch.total_mass * ch.com_x;
+        cy_sum += ch.total_mass * ch.com_y;
+        cz_sum += ch.total_mass * ch.com_z;
+    }
+    BHNode &n{ nodes[node_id] };
     n.total_mass = m_sum;
     if ( m_sum > 0.0 ) {
         n.com_x = cx_sum / m_sum;
@@ -163,79 +420,732 @@ void Gravity_BarnesHut::build_recursive(
     } else {
         n.com_x = bcx; n.com_y = bcy; n.com_z = bcz;
     }
+    if ( expansion_ == BH_Expansion::Quadrupole ) {
+        quadrupole( nodes.data(), cold_nodes.data(), node_id, px, py, pz, mass );
+    }
 }
 
 
-void Gravity_BarnesHut::traverse_for_particle(
-    std::size_t const i,
+void Gravity_BarnesHut::quadrupole(
+    BHNode const* RESTRICT nodes, BHNode_Cold* RESTRICT cold,
+    int const node_id,
     double const* RESTRICT px, double const* RESTRICT py, double const* RESTRICT pz,
-    double const* RESTRICT mass,
-    double &a_xi, double &a_yi, double &a_zi ) const
+    double const* RESTRICT mass ) const
 {
-    constexpr double eps_sq{ config::EPS * config::EPS };
-    constexpr double G{ config::G };
+    BHNode const &n{ nodes[node_id] };
+    double q[6]{};
+
+    // Adds the point-mass term m (3 d d^T - |d|^2 I) for offset d from the
+    // node's centre of mass.
+    auto add_point = [&q]( double const m, double const dx, double const dy, double const dz ) {
+        double const d_sq{ dx*dx + dy*dy + dz*dz };
+        q[0] += m * ( 3.0 * dx * dx - d_sq );
+        q[1] += m * 3.0 * dx * dy;
+        q[2] += m * 3.0 * dx * dz;
+        q[3] += m * ( 3.0 * dy * dy - d_sq );
+        q[4] += m * 3.0 * dy * dz;
+        q[5] += m * ( 3.0 * dz * dz - d_sq );
+    };
+
+    if ( n.leaf() ) {
+        for ( int b{ n.first }; b < n.first + n.count; ++b ) {
+            int const i{ indices_[b] };
+            add_point( mass[i], px[i] - n.com_x, py[i] - n.com_y, pz[i] - n.com_z );
+        }
+    } else {
+        // Parallel-axis shift of each child's moment to this centre of mass.
+        for ( int c{ node_id + 1 }; c < n.skip; c = nodes[c].skip ) {
+            BHNode const &ch{ nodes[c] };
+            for ( int k{}; k < 6; ++k ) q[k] += cold[c].quad[k];
+            add_point( ch.total_mass, ch.com_x - n.com_x, ch.com_y - n.com_y, ch.com_z - n.com_z );
+        }
+    }
+    for ( int k{}; k < 6; ++k ) cold[node_id].quad[k] = q[k];
+}
+
+
+void Gravity_BarnesHut::build_morton( Particles const &particles ) const {
+    std::size_t const N{ particles.num_active() };
+
+    double const* RESTRICT px{ particles.pos_x() };
+    double const* RESTRICT py{ particles.pos_y() };
+    double const* RESTRICT pz{ particles.pos_z() };
+
+    // Keys are generated in the previous build's order. Bodies rarely change
+    // cells between steps, so the sort usually finds them (nearly) in place.
+    if ( indices_.size() != N ) {
+        indices_.resize( N );
+        std::iota( indices_.begin(), indices_.end(), 0 );
+    }
+    nodes_.clear();
+
+    if ( N == 0 ) return;
+
+    double cx{}, cy{}, cz{}, half{};
+    root_box( px, py, pz, N, cx, cy, cz, half );
+
+    // Every 3-bit key digit is an octant index in the recursive build's
+    // convention (see morton::encode).
+    double const scale{ morton::CELLS / ( 2.0 * half ) };
+    double const lo_x{ cx - half }, lo_y{ cy - half }, lo_z{ cz - half };
+
+    // Keys are computed in particle order, streaming the positions, then
+    // gathered into the previous order: one scattered read per body
+    // instead of three.
+    keys_.resize( N );
+    key_scratch_.resize( N );
+    {
+        std::uint64_t* RESTRICT by_particle{ key_scratch_.data() };
+        std::uint64_t* RESTRICT keys{ keys_.data() };
+        int const* RESTRICT order{ indices_.data() };
+
+        #pragma omp parallel if ( N >= config::OMP_THRESHOLD )
+        {
+            #pragma omp for schedule( static )
+            for ( std::size_t i = 0; i < N; ++i ) {
+                by_particle[i] = morton::encode( px[i], py[i], pz[i], lo_x, lo_y, lo_z, scale );
+            }
+
+            #pragma omp for schedule( static )
+            for ( std::size_t k = 0; k < N; ++k ) {
+                keys[k] = by_particle[order[k]];
+            }
+        }
+    }
+
+    sort_keys( keys_, indices_ );
+
+    std::uint64_t const* RESTRICT keys{ keys_.data() };
+
+    // Topology, breadth-first: an internal node splits into the runs of its
+    // next key digit, found by binary search in the sorted keys. Ranges are
+    // stored by index, so growth of ranges_ never invalidates anything.
+    int const bucket{ static_cast<int>( leaf_bucket_ ) };
+    ranges_.clear();
+    level_begin_.clear();
+    ranges_.push_back( { 0, static_cast<int>( N ), -1, 0, 0, 0, 0 } );
+
+    for ( std::size_t level_start{}; level_start < ranges_.size(); ) {
+        level_begin_.push_back( static_cast<int>( level_start ) );
+        std::size_t const level_end{ ranges_.size() };
+
+        for ( std::size_t r{ level_start }; r < level_end; ++r ) {
+            int const begin{ ranges_[r].begin };
+            int const end{ ranges_[r].end };
+            int const level{ ranges_[r].level };
+            if ( end - begin <= bucket || level == KEY_LEVELS ) continue;
+
+            int const shift{ 3 * ( KEY_LEVELS - 1 - level ) };
+            auto const digit_of = [shift]( std::uint64_t const key ) {
+                return static_cast<unsigned>( ( key >> shift ) & 7 );
+            };
+
+            ranges_[r].first_child = static_cast<int>( ranges_.size() );
+            std::uint8_t octants{};
+            for ( int b{ begin }; b < end; ) {
+                unsigned const digit{ digit_of( keys[b] ) };
+                int const e{ static_cast<int>( std::partition_point( keys + b, keys + end,
+                    [&]( std::uint64_t const key ) { return digit_of( key ) <= digit; } ) - keys ) };
+                octants = static_cast<std::uint8_t>( octants | ( 1u << digit ) );
+                ranges_.push_back( { b, e, -1, 0, 0, static_cast<std::uint8_t>( level + 1 ), 0 } );
+                b = e;
+            }
+            ranges_[r].octants = octants;
+        }
+        level_start = level_end;
+    }
+    level_begin_.push_back( static_cast<int>( ranges_.size() ) );
+    std::size_t const num_levels{ level_begin_.size() - 1 };
+
+    // Depth-first numbering: subtree sizes bottom-up, then each range
+    // hands its children consecutive blocks after its own node, top-down.
+    // Either way a range writes only itself or its children, so the ranges
+    // of a level are independent.
+    for ( std::size_t l{ num_levels }; l-- > 0; ) {
+        int const first{ level_begin_[l] };
+        int const last{ level_begin_[l + 1] };
+
+        #pragma omp parallel for schedule( static ) if ( static_cast<std::size_t>( last - first ) >= config::OMP_THRESHOLD )
+        for ( int k = first; k < last; ++k ) {
+            Morton_Range &r{ ranges_[k] };
+            int const child_end{ r.first_child + std::popcount( r.octants ) };
+            r.size = 1;
+            for ( int c{ r.first_child }; c < child_end; ++c ) r.size += ranges_[c].size;
+        }
+    }
+    for ( std::size_t l{}; l < num_levels; ++l ) {
+        int const first{ level_begin_[l] };
+        int const last{ level_begin_[l + 1] };
+
+        #pragma omp parallel for schedule( static ) if ( static_cast<std::size_t>( last - first ) >= config::OMP_THRESHOLD )
+        for ( int k = first; k < last; ++k ) {
+            Morton_Range const &r{ ranges_[k] };
+            int const child_end{ r.first_child + std::popcount( r.octants ) };
+            int next{ r.node + 1 };
+            for ( int c{ r.first_child }; c < child_end; ++c ) {
+                ranges_[c].node = next;
+                next += ranges_[c].size;
+            }
+        }
+    }
+
+    // The pool is sized exactly, once per build; its capacity carries over,
+    // so steady-state builds never allocate.
+    std::size_t const num_nodes{ ranges_.size() };
+    nodes_.resize( num_nodes );
+    cold_.resize( num_nodes );
+
+    #pragma omp parallel for schedule( static ) if ( num_nodes >= config::OMP_THRESHOLD )
+    for ( std::size_t k = 0; k < num_nodes; ++k ) {
+        Morton_Range const &r{ ranges_[k] };
+        BHNode &n{ nodes_[r.node] };
+        BHNode_Cold &cold{ cold_[r.node] };
+
+        // The node's cell is the key prefix above its level.
+        std::uint64_t const prefix{ keys[r.begin] >> ( 3 * ( KEY_LEVELS - r.level ) ) };
+        double const width{ 2.0 * half / static_cast<double>( 1 << r.level ) };
+        cold.box_cx = lo_x + ( static_cast<double>( morton::compact_bits( prefix ) ) + 0.5 ) * width;
+        cold.box_cy = lo_y + ( static_cast<double>( morton::compact_bits( prefix >> 1 ) ) + 0.5 ) * width;
+        cold.box_cz = lo_z + ( static_cast<double>( morton::compact_bits( prefix >> 2 ) ) + 0.5 ) * width;
+        n.half_width = 0.5 * width;
+
+        n.skip = r.node + r.size;
+        n.octants = r.octants;
+        if ( r.octants == 0 ) {
+            n.first = r.begin;
+            n.count = r.end - r.begin;
+            n.run = contiguous_run( indices_.data(), r.begin, r.end - r.begin );
+        } else {
+            n.first = -1;
+            n.count = 0;
+            n.run = -1;
+        }
+    }
+
+    root_half_ = half;
+    fit_nodes( particles );
+}
+
+
+std::size_t Gravity_BarnesHut::fit_nodes( Particles const &particles ) const {
+    double const* RESTRICT px{ particles.pos_x() };
+    double const* RESTRICT py{ particles.pos_y() };
+    double const* RESTRICT pz{ particles.pos_z() };
+    double const* RESTRICT mass{ particles.mass() };
+    int const* RESTRICT order{ indices_.data() };
+
+    // Nodes within a level are independent. A node's half_width is its
+    // cell's, grown to the largest offset (per axis) of any particle from
+    // the cell centre, so the opening test still bounds the node's extent.
+    std::size_t escaped{};
+    for ( std::size_t l{ level_begin_.size() - 1 }; l-- > 0; ) {
+        std::size_t const first{ static_cast<std::size_t>( level_begin_[l] ) };
+        std::size_t const last{ static_cast<std::size_t>( level_begin_[l + 1] ) };
+
+        #pragma omp parallel for schedule( static ) reduction( +:escaped ) \
+                                 if ( last - first >= config::OMP_THRESHOLD )
+        for ( std::size_t k = first; k < last; ++k ) {
+            int const node_id{ ranges_[k].node };
+            BHNode &n{ nodes_[node_id] };
+            BHNode_Cold const &cold{ cold_[node_id] };
+            double const cell_half{ std::ldexp( root_half_, -static_cast<int>( ranges_[k].level ) ) };
+            double m_sum{};
+            double cx_sum{}, cy_sum{}, cz_sum{};
+            double extent{};
+            if ( n.leaf() ) {
+                for ( int b{ n.first }; b < n.first + n.count; ++b ) {
+                    int const i{ order[b] };
+                    double const m{ mass[i] };
+                    m_sum  += m;
+                    cx_sum += m * px[i];
+                    cy_sum += m * py[i];
+                    cz_sum += m * pz[i];
+                    double const offset{ std::max( { std::abs( px[i] - cold.box_cx ),
+                                                     std::abs( py[i] - cold.box_cy ),
+                                                     std::abs( pz[i] - cold.box_cz ) } ) };
+                    if ( offset > cell_half ) ++escaped;
+                    extent = std::max( extent, offset );
+                }
+            } else {
+                for ( int c{ node_id + 1 }; c < n.skip; c = nodes_[c].skip ) {
+                    BHNode const &ch{ nodes_[c] };
+                    BHNode_Cold const &ch_cold{ cold_[c] };
+                    m_sum  += ch.total_mass;
+                    cx_sum += ch.total_mass * ch.com_x;
+                    cy_sum += ch.total_mass * ch.com_y;
+                    cz_sum += ch.total_mass * ch.com_z;
+                    extent = std::max( extent, ch.half_width + std::max( { std::abs( ch_cold.box_cx - cold.box_cx ),
+                                                                           std::abs( ch_cold.box_cy - cold.box_cy ),
+                                                                           std::abs( ch_cold.box_cz - cold.box_cz ) } ) );
+                }
+            }
+            n.half_width = std::max( cell_half, extent );
+            n.total_mass = m_sum;
+            if ( m_sum > 0.0 ) {
+                n.com_x = cx_sum / m_sum;
+                n.com_y = cy_sum / m_sum;
+                n.com_z = cz_sum / m_sum;
+            } else {
+                n.com_x = cold.box_cx; n.com_y = cold.box_cy; n.com_z = cold.box_cz;
+            }
+            if ( expansion_ == BH_Expansion::Quadrupole ) {
+                quadrupole( nodes_.data(), cold_.data(), node_id, px, py, pz, mass );
+            }
+        }
+    }
+    return escaped;
+}
+
+
+bool Gravity_BarnesHut::refit( Particles const &particles ) const {
+    std::size_t const N{ particles.num_active() };
+    if ( nodes_.empty() || indices_.size() != N ) return false;
+
+    std::size_t const escaped{ fit_nodes( particles ) };
+    return static_cast<double>( escaped ) <= refit_tolerance_ * static_cast<double>( N );
+}
+
+
+void Gravity_BarnesHut::sort_keys( std::vector<std::uint64_t> &key_list, std::vector<int> &order_list ) const {
+    std::size_t const N{ key_list.size() };
+
+    // Nearly sorted input, the usual case between steps: insertion with a
+    // bounded number of moves, falling back to radix if the budget runs out.
+    // An interrupted pass leaves keys and indices consistent.
+    {
+        std::uint64_t* RESTRICT keys{ key_list.data() };
+        int* RESTRICT order{ order_list.data() };
+
+        std::size_t descents{};
+        for ( std::size_t k{ 1 }; k < N; ++k ) descents += keys[k] < keys[k - 1];
+        if ( descents == 0 ) return;
+
+        if ( descents <= N / 64 ) {
+            std::size_t budget{ 8 * N };
+            bool sorted{ true };
+            for ( std::size_t k{ 1 }; k < N && sorted; ++k ) {
+                std::uint64_t const key{ keys[k] };
+                int const idx{ order[k] };
+                std::size_t m{ k };
+                while ( m > 0 && keys[m - 1] > key ) {
+                    if ( budget-- == 0 ) { sorted = false; break; }
+                    keys[m] = keys[m - 1];
+                    order[m] = order[m - 1];
+                    --m;
+                }
+                keys[m] = key;
+                order[m] = idx;
+            }
+            if ( sorted ) return;
+        }
+    }
+
+    // LSD radix sort, 8 bits per pass. Passes over a digit that is the same
+    // for every key (the high bits of a compact cluster) are skipped. Each
+    // thread histograms and scatters its own chunk; offsets are laid out
+    // digit-major, thread-minor, so every pass is stable.
+    std::uint64_t any{}, all{ ~std::uint64_t{} };
+    for ( std::size_t k{}; k < N; ++k ) {
+        any |= key_list[k];
+        all &= key_list[k];
+    }
+    std::uint64_t const varying{ any ^ all };
+
+    key_scratch_.resize( N );
+    scratch_.resize( N );
+    histogram_.resize( 256 * static_cast<std::size_t>( omp_get_max_threads() ) );
+
+    for ( int shift{}; shift < 64; shift += 8 ) {
+        if ( ( ( varying >> shift ) & 0xff ) == 0 ) continue;
+
+        std::uint64_t const* RESTRICT src{ key_list.data() };
+        int const* RESTRICT src_idx{ order_list.data() };
+        std::uint64_t* RESTRICT dst{ key_scratch_.data() };
+        int* RESTRICT dst_idx{ scratch_.data() };
+        std::size_t* RESTRICT hist{ histogram_.data() };
+
+        #pragma omp parallel if ( N >= config::OMP_THRESHOLD )
+        {
+            std::size_t const T{ static_cast<std::size_t>( omp_get_num_threads() ) };
+            std::size_t const t{ static_cast<std::size_t>( omp_get_thread_num() ) };
+            std::size_t const k_begin{ N * t / T };
+            std::size_t const k_end{ N * ( t + 1 ) / T };
+            std::size_t* RESTRICT own{ hist + 256 * t };
+
+            std::fill( own, own + 256, std::size_t{} );
+            for ( std::size_t k{ k_begin }; k < k_end; ++k ) ++own[( src[k] >> shift ) & 0xff];
+
+            #pragma omp barrier
+            #pragma omp single
+            {
+                std::size_t offset{};
+                for ( std::size_t d{}; d < 256; ++d ) {
+                    for ( std::size_t u{}; u < T; ++u ) {
+                        std::size_t const c{ hist[256 * u + d] };
+                        hist[256 * u + d] = offset;
+                        offset += c;
+                    }
+                }
+            }
+
+            for ( std::size_t k{ k_begin }; k < k_end; ++k ) {
+                std::size_t const pos{ own[( src[k] >> shift ) & 0xff]++ };
+                dst[pos] = src[k];
+                dst_idx[pos] = src_idx[k];
+            }
+        }
+
+        key_list.swap( key_scratch_ );
+        order_list.swap( scratch_ );
+    }
+}
 
+
+void Gravity_BarnesHut::build_groups( Particles const &particles ) const {
+    std::size_t const N{ particles.num_particles() };
+    std::size_t const N_a{ particles.num_active() };
+    int const num_nodes{ static_cast<int>( nodes_.size() ) };
+    int const G{ static_cast<int>( group_size_ ) };
+
+    // Subtree spans in indices_. Both builds place children after their
+    // parent and keep each subtree's particles contiguous, so one reverse
+    // pass suffices.
+    node_range_.resize( nodes_.size() );
+    for ( int k{ num_nodes - 1 }; k >= 0; --k ) {
+        BHNode const &n{ nodes_[k] };
+        if ( n.leaf() ) {
+            node_range_[k] = { n.first, n.first + n.count };
+            continue;
+        }
+        BH_Range r{ std::numeric_limits<int>::max(), 0 };
+        for ( int c{ k + 1 }; c < n.skip; c = nodes_[c].skip ) {
+            r.begin = std::min( r.begin, node_range_[c].begin );
+            r.end = std::max( r.end, node_range_[c].end );
+        }
+        node_range_[k] = r;
+    }
+
+    // Active groups: the largest subtrees with at most G particles, in
+    // tree order, so members_ is indices_ itself.
+    groups_.clear();
+    members_.assign( indices_.begin(), indices_.end() );
+    for ( int node_id{}; node_id < num_nodes; ) {
+        BHNode const &n{ nodes_[node_id] };
+        BH_Range const r{ node_range_[node_id] };
+        if ( n.leaf() || r.end - r.begin <= G ) {
+            groups_.push_back( r );
+            node_id = n.skip;
+        } else {
+            ++node_id;
+        }
+    }
+
+    active_groups_ = static_cast<int>( groups_.size() );
+
+    // Passive groups: runs of G particles in the Morton order of their own
+    // bounding cube, so they are compact whatever order the slots are in.
+    // As in the Morton build, keys are sorted from the previous call's order.
+    // With fewer than SORTED_PASSIVE_GROUPS groups' worth of active bodies,
+    // a group's walk opens nearly every active leaf however compact it is,
+    // so runs of consecutive slots cost the same and skip the keys.
+    std::size_t const P{ N - N_a };
+    bool const sorted{ N_a >= SORTED_PASSIVE_GROUPS * group_size_ };
+    if ( passive_order_.size() != P || !sorted ) {
+        passive_order_.resize( P );
+        std::iota( passive_order_.begin(), passive_order_.end(), 0 );
+    }
+    if ( P > 0 && sorted ) {
+        double const* RESTRICT px{ particles.pos_x() + N_a };
+        double const* RESTRICT py{ particles.pos_y() + N_a };
+        double const* RESTRICT pz{ particles.pos_z() + N_a };
+        double cx{}, cy{}, cz{}, half{};
+        root_box( px, py, pz, P, cx, cy, cz, half );
+        double const scale{ morton::CELLS / ( 2.0 * half ) };
+
+        passive_keys_.resize( P );
+        key_scratch_.resize( P );
+        std::uint64_t* RESTRICT by_particle{ key_scratch_.data() };
+        std::uint64_t* RESTRICT keys{ passive_keys_.data() };
+        int const* RESTRICT order{ passive_order_.data() };
+
+        #pragma omp parallel if ( P >= config::OMP_THRESHOLD )
+        {
+            #pragma omp for schedule( static )
+            for ( std::size_t i = 0; i < P; ++i ) {
+                by_particle[i] = morton::encode( px[i], py[i], pz[i], cx - half, cy - half, cz - half, scale );
+            }
+
+            #pragma omp for schedule( static )
+            for ( std::size_t k = 0; k < P; ++k ) {
+                keys[k] = by_particle[order[k]];
+            }
+        }
+
+        sort_keys( passive_keys_, passive_order_ );
+    }
+
+    for ( std::size_t k{}; k < P; k += group_size_ ) {
+        int const begin{ static_cast<int>( members_.size() ) };
+        for ( std::size_t j{ k }; j < std::min( k + group_size_, P ); ++j ) {
+            members_.push_back( static_cast<int>( N_a ) + passive_order_[j] );
+        }
+        groups_.push_back( { begin, static_cast<int>( members_.size() ) } );
+    }
+
+    group_of_.resize( N );
+    for ( std::size_t g{}; g < groups_.size(); ++g ) {
+        for ( int m{ groups_[g].begin }; m < groups_[g].end; ++m ) {
+            group_of_[members_[m]] = static_cast<int>( g );
+        }
+    }
+}
+
+
+std::size_t Gravity_BarnesHut::collect_interactions(
+    Group_Task const &task, int const* RESTRICT targets,
+    double const* RESTRICT px, double const* RESTRICT py,
+    double const* RESTRICT pz, double const* RESTRICT mass,
+    std::size_t const* RESTRICT ids, Interaction_List &list ) const
+{
     double const theta_sq{ theta_ * theta_ };
+    int const group{ task.group };
+    bool const active{ group < active_groups_ };
 
-    double const pxi{ px[i] }, pyi{ py[i] }, pzi{ pz[i] };
+    // Bounding box of the whole group, whichever members are evaluated.
+    int const* RESTRICT members{ members_.data() };
+    BH_Range const g{ groups_[group] };
+    double lo_x{ px[members[g.begin]] }, hi_x{ lo_x };
+    double lo_y{ py[members[g.begin]] }, hi_y{ lo_y };
+    double lo_z{ pz[members[g.begin]] }, hi_z{ lo_z };
+    for ( int m{ g.begin + 1 }; m < g.end; ++m ) {
+        int const i{ members[m] };
+        lo_x = std::min( lo_x, px[i] ); hi_x = std::max( hi_x, px[i] );
+        lo_y = std::min( lo_y, py[i] ); hi_y = std::max( hi_y, py[i] );
+        lo_z = std::min( lo_z, pz[i] ); hi_z = std::max( hi_z, pz[i] );
+    }
+
+    // Relative opening bound alpha * min |a| / G over the members; zero
+    // (geometric test) if any member has no previous acceleration.
+    double tolerance{};
+    if ( alpha_ > 0.0 && accel_.size() == group_of_.size() ) {
+        double a_min{ accel_[ids[members[g.begin]]] };
+        for ( int m{ g.begin + 1 }; m < g.end; ++m ) a_min = std::min( a_min, accel_[ids[members[m]]] );
+        tolerance = alpha_ * a_min / config::G;
+    }
+    bool const relative{ tolerance > 0.0 };
 
-    // A balanced octree at N=131k has depth ~6, so 256 stack frames covers
-    // MAX_DEPTH=32 with a wide margin (worst case 7 siblings per level).
-    int stack[256];
-    int sp{ 0 };
-    stack[sp++] = 0;
+    // Arrays grow geometrically and are never shrunk.
+    list.size = 0;
+    auto push = [&list]( double const x, double const y, double const z, double const m ) {
+        if ( list.size == list.x.size() ) {
+            std::size_t const capacity{ std::max( std::size_t{ 256 }, 2 * list.size ) };
+            list.x.resize( capacity ); list.y.resize( capacity );
+            list.z.resize( capacity ); list.m.resize( capacity );
+        }
+        std::size_t const k{ list.size++ };
+        list.x[k] = x; list.y[k] = y; list.z[k] = z; list.m[k] = m;
+    };
+
+    bool const quad{ expansion_ == BH_Expansion::Quadrupole };
+    list.quad_size = 0;
+    auto push_quad = [&list]( BHNode const &n, BHNode_Cold const &cold ) {
+        if ( list.quad_size == list.qx.size() ) {
+            std::size_t const capacity{ std::max( std::size_t{ 64 }, 2 * list.quad_size ) };
+            for ( auto *v : { &list.qx, &list.qy, &list.qz, &list.qxx, &list.qxy,
+                              &list.qxz, &list.qyy, &list.qyz, &list.qzz } ) {
+                v->resize( capacity );
+            }
+        }
+        std::size_t const k{ list.quad_size++ };
+        list.qx[k] = n.com_x; list.qy[k] = n.com_y; list.qz[k] = n.com_z;
+        list.qxx[k] = cold.quad[0]; list.qxy[k] = cold.quad[1]; list.qxz[k] = cold.quad[2];
+        list.qyy[k] = cold.quad[3]; list.qyz[k] = cold.quad[4]; list.qzz[k] = cold.quad[5];
+    };
+
+    for ( int k{ task.begin }; k < task.end; ++k ) {
+        int const i{ targets[k] };
+        push( px[i], py[i], pz[i], mass[i] );
+    }
+    std::size_t const K{ list.size };
+    std::size_t const first_source{ active ? 0 : K };
+
+    // An active group's members are sources as well; those not evaluated
+    // follow the targets. Its own leaves are then skipped in the walk, so
+    // each member appears once and the kernels' self-term mask holds.
+    if ( active && K < static_cast<std::size_t>( g.end - g.begin ) ) {
+        for ( int m{ g.begin }; m < g.end; ++m ) {
+            int const i{ members[m] };
+            if ( std::find( targets + task.begin, targets + task.end, i ) == targets + task.end ) {
+                push( px[i], py[i], pz[i], mass[i] );
+            }
+        }
+    }
 
-    while ( sp > 0 ) {
-        int const node_id{ stack[--sp] };
+    // Threaded walk over the depth-first pool: an opened node continues at
+    // node_id + 1, anything else at its skip, and the walk ends past the
+    // root's subtree, i.e. at the end of the pool.
+    // Short-range walk: a node whose cell lies wholly beyond the cutoff
+    // from the group's box is dropped with its subtree.
+    double const cutoff{ SHORT_RANGE_CUTOFF * short_range_ };
+    int const num_nodes{ static_cast<int>( nodes_.size() ) };
+
+    // Gap between a node's cell (grown by refits to cover its bodies) and
+    // the group's box; zero where they overlap.
+    auto cell_gap_sq = [&]( int const node_id ) {
+        BHNode_Cold const &cell{ cold_[static_cast<std::size_t>( node_id )] };
+        double const h{ nodes_[node_id].half_width };
+        double const gx{ std::max( { lo_x - cell.box_cx - h, 0.0, cell.box_cx - h - hi_x } ) };
+        double const gy{ std::max( { lo_y - cell.box_cy - h, 0.0, cell.box_cy - h - hi_y } ) };
+        double const gz{ std::max( { lo_z - cell.box_cz - h, 0.0, cell.box_cz - h - hi_z } ) };
+        return gx*gx + gy*gy + gz*gz;
+    };
+
+    for ( int node_id{}; node_id < num_nodes; ) {
         BHNode const &n{ nodes_[node_id] };
 
-        if ( n.children[0] == -1 ) {
-            // Leaf bucket: sum each particle, masking the self-term.
-            int const first{ n.children[1] };
-            int const cnt{ n.children[2] };
-            for ( int b{}; b < cnt; ++b ) {
-                int const j{ indices_[ first + b ] };
-                double const mask{ ( static_cast<std::size_t>( j ) == i ) ? 0.0 : 1.0 };
-                Gravity::accumulate_pairwise(
-                    pxi, pyi, pzi,
-                    px[j], py[j], pz[j], mass[j],
-                    a_xi, a_yi, a_zi,
-                    G, eps_sq, mask
-                );
+        if ( cutoff > 0.0 && cell_gap_sq( node_id ) > cutoff * cutoff ) {
+            node_id = n.skip;
+            continue;
+        }
+
+        if ( n.leaf() ) {
+            // Leaf bucket: every particle joins the list. Groups are unions
+            // of whole leaves, so one check skips the group's own. Buckets
+            // stored contiguously (see Morton_Reorder) are copied directly.
+            int const first{ n.first };
+            int const cnt{ n.count };
+            node_id = n.skip;
+            if ( active && group_of_[indices_[first]] == group ) continue;
+            if ( n.run >= 0 ) {
+                for ( int j{ n.run }; j < n.run + cnt; ++j ) {
+                    push( px[j], py[j], pz[j], mass[j] );
+                }
+            } else {
+                for ( int b{}; b < cnt; ++b ) {
+                    int const j{ indices_[ first + b ] };
+                    push( px[j], py[j], pz[j], mass[j] );
+                }
             }
             continue;
         }
 
-        // MAC: open if (2 * half_width)^2 >= theta^2 * d^2, else approximate.
-        double const dx{ n.com_x - pxi };
-        double const dy{ n.com_y - pyi };
-        double const dz{ n.com_z - pzi };
+        // Group MAC: accept if (2 * half_width)^2 < theta^2 * d^2 with d the
+        // distance from the centre of mass to the nearest point of the
+        // group's box, a lower bound on every member's distance.
+        double const dx{ std::max( { lo_x - n.com_x, 0.0, n.com_x - hi_x } ) };
+        double const dy{ std::max( { lo_y - n.com_y, 0.0, n.com_y - hi_y } ) };
+        double const dz{ std::max( { lo_z - n.com_z, 0.0, n.com_z - hi_z } ) };
         double const d_sq{ dx*dx + dy*dy + dz*dz };
         double const s{ 2.0 * n.half_width };
 
-        if ( s * s < theta_sq * d_sq ) {
-            Gravity::accumulate_pairwise(
-                pxi, pyi, pzi,
-                n.com_x, n.com_y, n.com_z, n.total_mass,
-                a_xi, a_yi, a_zi,
-                G, eps_sq, 1.0
-            );
+        // Relative test: M s^2 <= tolerance * d^4, one more factor s / d
+        // for quadrupoles, and the node clear of the group (s < d).
+        bool accept;
+        if ( relative ) {
+            double const bound{ tolerance * d_sq * d_sq };
+            double const error{ n.total_mass * s * s * ( quad ? s / std::sqrt( d_sq ) : 1.0 ) };
+            accept = s * s < d_sq && error <= bound;
         } else {
-            for ( int k{}; k < 8; ++k ) {
-                int const child_id{ n.children[k] };
-                if ( child_id >= 0 ) stack[sp++] = child_id;
-            }
+            accept = s * s < theta_sq * d_sq;
+        }
+
+        // A cell overlapping the group's box may hold members or bodies
+        // right next to them, however far its centre of mass lies: accepting
+        // it would count the members twice and collapse their neighbours.
+        // Possible above theta = 1/sqrt(3), or with the relative test.
+        if ( accept && cell_gap_sq( node_id ) == 0.0 ) accept = false;
+
+        if ( accept ) {
+            push( n.com_x, n.com_y, n.com_z, n.total_mass );
+            if ( quad ) push_quad( n, cold_[node_id] );
+            node_id = n.skip;
+        } else {
+            ++node_id;
         }
     }
+
+    return first_source;
 }
 
 
-void Gravity_BarnesHut::apply( Particles &particles ) const {
-    std::size_t const N{ particles.num_particles() };
-    if ( N == 0 ) return;
+// Quadrupole correction of the accepted nodes for staged targets [0, K):
+//   phi = -G/2 (r.Q.r) / R^5,   a = G ( Q.r / R^5 - 5/2 (r.Q.r) r / R^7 ),
+// with r from the node's centre of mass to the target and R softened as in
+// the monopole term.
+template <bool POTENTIAL, typename List>
+static inline void quadrupole_impl( List &list, std::size_t const K ) {
+    constexpr double eps_sq{ config::EPS * config::EPS };
+    constexpr double G{ config::G };
 
-    build_tree( particles );
+    std::size_t const L{ list.quad_size };
+    double const* RESTRICT qx{ list.qx.data() };
+    double const* RESTRICT qy{ list.qy.data() };
+    double const* RESTRICT qz{ list.qz.data() };
+    double const* RESTRICT qxx{ list.qxx.data() };
+    double const* RESTRICT qxy{ list.qxy.data() };
+    double const* RESTRICT qxz{ list.qxz.data() };
+    double const* RESTRICT qyy{ list.qyy.data() };
+    double const* RESTRICT qyz{ list.qyz.data() };
+    double const* RESTRICT qzz{ list.qzz.data() };
+
+    for ( std::size_t k{}; k < K; ++k ) {
+        double const xk{ list.x[k] }, yk{ list.y[k] }, zk{ list.z[k] };
+        double a_x{}, a_y{}, a_z{}, phi{};
+
+        #pragma omp simd reduction( +:a_x, a_y, a_z, phi )
+        for ( std::size_t j = 0; j < L; ++j ) {
+            double const rx{ xk - qx[j] };
+            double const ry{ yk - qy[j] };
+            double const rz{ zk - qz[j] };
+
+            double const R_sq{ rx*rx + ry*ry + rz*rz + eps_sq };
+            double const R_inv{ 1.0 / std::sqrt( R_sq ) };
+            double const R_inv_sq{ R_inv * R_inv };
+            double const R_inv_5{ R_inv_sq * R_inv_sq * R_inv };
+
+            double const Qr_x{ qxx[j] * rx + qxy[j] * ry + qxz[j] * rz };
+            double const Qr_y{ qxy[j] * rx + qyy[j] * ry + qyz[j] * rz };
+            double const Qr_z{ qxz[j] * rx + qyz[j] * ry + qzz[j] * rz };
+            double const rQr{ rx * Qr_x + ry * Qr_y + rz * Qr_z };
+
+            double const s{ 2.5 * rQr * R_inv_5 * R_inv_sq };
+            a_x += Qr_x * R_inv_5 - s * rx;
+            a_y += Qr_y * R_inv_5 - s * ry;
+            a_z += Qr_z * R_inv_5 - s * rz;
+            if constexpr ( POTENTIAL ) phi -= 0.5 * rQr * R_inv_5;
+        }
+
+        list.ax[k] += G * a_x;
+        list.ay[k] += G * a_y;
+        list.az[k] += G * a_z;
+        if constexpr ( POTENTIAL ) list.pot[k] += G * phi;
+    }
+}
 
+// The same loop compiled for each ISA, so the compiler vectorises the node
+// loop at the host's width; see simd::detect.
+template <bool POTENTIAL, typename List>
+TARGET_AVX512 static void quadrupole_avx512( List &list, std::size_t const K ) {
+    quadrupole_impl<POTENTIAL>( list, K );
+}
+
+template <bool POTENTIAL, typename List>
+TARGET_AVX2 static void quadrupole_avx2( List &list, std::size_t const K ) {
+    quadrupole_impl<POTENTIAL>( list, K );
+}
+
+template <bool POTENTIAL, typename List>
+static void add_quadrupoles( List &list, std::size_t const K, simd::Isa const isa ) {
+    switch ( isa ) {
+        case simd::Isa::AVX512: quadrupole_avx512<POTENTIAL>( list, K ); return;
+        case simd::Isa::AVX2:   quadrupole_avx2<POTENTIAL>( list, K );   return;
+        case simd::Isa::Scalar: quadrupole_impl<POTENTIAL>( list, K );   return;
+    }
+}
+
+
+template <bool POTENTIAL>
+void Gravity_BarnesHut::traverse_groups( Particles &particles, int const* RESTRICT targets ) const {
     double const* RESTRICT px{ particles.pos_x() };
     double const* RESTRICT py{ particles.pos_y() };
     double const* RESTRICT pz{ particles.pos_z() };
@@ -244,26 +1154,592 @@ void Gravity_BarnesHut::apply( Particles &particles ) const {
     double* RESTRICT ax{ particles.acc_x() };
     double* RESTRICT ay{ particles.acc_y() };
     double* RESTRICT az{ particles.acc_z() };
+    double* RESTRICT pot{ particles.pot() };
+
+    Direct_Kernel const kernel{ POTENTIAL ? pot_kernel_ : kernel_ };
+    Short_Range_Kernel const short_kernel{ direct::select_short_range( isa_ ) };
+
+    std::size_t const num_tasks{ tasks_.size() };
+    std::size_t const num_targets{ num_tasks > 0 ? static_cast<std::size_t>( tasks_.back().end ) : 0 };
+    lists_.resize( static_cast<std::size_t>( omp_get_max_threads() ) );
+    zones_.resize( static_cast<std::size_t>( omp_get_max_threads() ) );
+    bool const predicted{ cost_.size() == particles.num_particles() };
+    if ( !predicted ) cost_.assign( particles.num_particles(), 0.0 );
+    double* RESTRICT cost{ cost_.data() };
+    if ( alpha_ > 0.0 && accel_.size() != particles.num_particles() ) {
+        accel_.assign( particles.num_particles(), 0.0 );
+    }
+    double* RESTRICT accel{ alpha_ > 0.0 ? accel_.data() : nullptr };
+    std::size_t const* RESTRICT ids{ particles.ids().data() };
+
+    // The tree is read-only here; each task writes only its own targets.
+    #pragma omp parallel if ( num_targets >= config::OMP_THRESHOLD )
+    {
+        Interaction_List &list{ lists_[static_cast<std::size_t>( omp_get_thread_num() )] };
 
-    // Traversal cost varies per particle (clustered regions open more nodes),
-    // so dynamic schedule keeps load balanced. Tree is read-only during
-    // traversal so no synchronization is required.
-    if ( N >= config::OMP_THRESHOLD ) {
-        #pragma omp parallel for schedule( dynamic, 32 )
-        for ( std::size_t i = 0; i < N; ++i ) {
-            double a_xi{}, a_yi{}, a_zi{};
-            traverse_for_particle( i, px, py, pz, mass, a_xi, a_yi, a_zi );
-            ax[i] += a_xi;
-            ay[i] += a_yi;
-            az[i] += a_zi;
+        // Cost zones: tasks are in tree order, so splitting them into one
+        // contiguous run per thread keeps each thread's groups spatially
+        // coherent. The runs are cut at equal predicted cost, the targets'
+        // interaction counts from the previous call (or their number on
+        // the first), since walks in clustered regions cost far more.
+        #pragma omp single
+        {
+            int const T{ omp_get_num_threads() };
+            task_cost_.resize( num_tasks + 1 );
+            task_cost_[0] = 0.0;
+            for ( std::size_t t{}; t < num_tasks; ++t ) {
+                Group_Task const task{ tasks_[t] };
+                double c{ static_cast<double>( task.end - task.begin ) };
+                if ( predicted ) {
+                    for ( int k{ task.begin }; k < task.end; ++k ) c += cost[targets[k]];
+                }
+                task_cost_[t + 1] = task_cost_[t] + c;
+            }
+            std::size_t begin{};
+            for ( int z{}; z < T; ++z ) {
+                double const goal{ task_cost_[num_tasks] * ( z + 1 ) / T };
+                std::size_t const end{ z + 1 == T ? num_tasks : static_cast<std::size_t>(
+                    std::lower_bound( task_cost_.begin() + static_cast<std::ptrdiff_t>( begin ),
+                                      task_cost_.end(), goal ) - task_cost_.begin() ) };
+                zones_[z] = { static_cast<int>( begin ), static_cast<int>( std::min( end, num_tasks ) ) };
+                begin = std::min( end, num_tasks );
+            }
+        }
+
+        // Each thread claims tasks from the front of its own zone. Once it
+        // is empty, the thread joins the zone with the most tasks left,
+        // which absorbs the residual imbalance of the prediction.
+        int zone{ omp_get_thread_num() };
+        for ( ;; ) {
+            int t;
+            #pragma omp atomic capture
+            t = zones_[zone].next++;
+
+            if ( t >= zones_[zone].end ) {
+                int most{ 0 };
+                zone = -1;
+                for ( int z{}; z < omp_get_num_threads(); ++z ) {
+                    int next;
+                    #pragma omp atomic read
+                    next = zones_[z].next;
+                    if ( zones_[z].end - next > most ) {
+                        most = zones_[z].end - next;
+                        zone = z;
+                    }
+                }
+                if ( zone < 0 ) break;
+                continue;
+            }
+
+            Group_Task const task{ tasks_[t] };
+            std::size_t const first_source{ collect_interactions( task, targets, px, py, pz, mass, ids, list ) };
+
+            std::size_t const K{ static_cast<std::size_t>( task.end - task.begin ) };
+            if ( list.ax.size() < K ) {
+                list.ax.resize( K ); list.ay.resize( K ); list.az.resize( K ); list.pot.resize( K );
+            }
+            std::fill_n( list.ax.begin(), K, 0.0 );
+            std::fill_n( list.ay.begin(), K, 0.0 );
+            std::fill_n( list.az.begin(), K, 0.0 );
+            std::fill_n( list.pot.begin(), K, 0.0 );
+
+            Direct_Arrays const arrays{ list.x.data(), list.y.data(), list.z.data(), list.m.data(),
+                                        list.ax.data(), list.ay.data(), list.az.data(), list.pot.data() };
+            if ( short_range_ > 0.0 ) {
+                short_kernel( arrays, 0, K, first_source, list.size, short_range_ );
+            } else {
+                kernel( arrays, 0, K, first_source, list.size );
+            }
+            if ( list.quad_size > 0 ) add_quadrupoles<POTENTIAL>( list, K, isa_ );
+
+            // Every target of the group costs one kernel row over the
+            // sources, plus the quadrupole terms.
+            double const interactions{ static_cast<double>( list.size - first_source + list.quad_size ) };
+            for ( std::size_t k{}; k < K; ++k ) {
+                int const i{ targets[task.begin + static_cast<int>( k )] };
+                ax[i] += list.ax[k];
+                ay[i] += list.ay[k];
+                az[i] += list.az[k];
+                if constexpr ( POTENTIAL ) pot[i] += list.pot[k];
+                cost[i] = interactions;
+                if ( accel ) {
+                    accel[ids[i]] = std::sqrt( list.ax[k] * list.ax[k] + list.ay[k] * list.ay[k]
+                                        + list.az[k] * list.az[k] );
+                }
+            }
         }
+    }
+}
+
+
+bool Gravity_BarnesHut::open_pair( Node_Pair const pair, std::vector<Node_Pair> &out ) const {
+    BHNode const &A{ nodes_[pair.a] };
+    if ( pair.a == pair.b ) {
+        if ( A.leaf() ) return false;
+        // Each child with itself and with every later sibling.
+        for ( int c{ pair.a + 1 }; c < A.skip; c = nodes_[c].skip ) {
+            out.push_back( { c, c } );
+            for ( int d{ nodes_[c].skip }; d < A.skip; d = nodes_[d].skip ) out.push_back( { c, d } );
+        }
+        return true;
+    }
+
+    BHNode const &B{ nodes_[pair.b] };
+    if ( A.leaf() && B.leaf() ) return false;
+    if ( !A.leaf() && ( B.leaf() || radius_[pair.a] >= radius_[pair.b] ) ) {
+        for ( int c{ pair.a + 1 }; c < A.skip; c = nodes_[c].skip ) out.push_back( { c, pair.b } );
     } else {
-        for ( std::size_t i = 0; i < N; ++i ) {
-            double a_xi{}, a_yi{}, a_zi{};
-            traverse_for_particle( i, px, py, pz, mass, a_xi, a_yi, a_zi );
-            ax[i] += a_xi;
-            ay[i] += a_yi;
-            az[i] += a_zi;
+        for ( int c{ pair.b + 1 }; c < B.skip; c = nodes_[c].skip ) out.push_back( { pair.a, c } );
+    }
+    return true;
+}
+
+
+// Walks one pair down to accepted pairs, whose series go to the nodes, and
+// direct pairs, summed into the workspace's particle accumulators. With
+// POTENTIAL the direct pairs take the one-sided potential kernel both
+// ways, as the symmetric kernel has no potential.
+template <bool POTENTIAL, bool QUADRUPOLE>
+void Gravity_BarnesHut::dual_walk( Node_Pair const task, Direct_Arrays const &arrays,
+                                   Dual_Workspace &work ) const {
+    constexpr double G{ config::G };
+    constexpr double eps_sq{ config::EPS * config::EPS };
+    double const theta_sq{ theta_ * theta_ };
+    BHNode const* RESTRICT nodes{ nodes_.data() };
+    BHNode_Cold const* RESTRICT cold{ cold_.data() };
+    double const* RESTRICT radius{ radius_.data() };
+    BH_Range const* RESTRICT range{ node_range_.data() };
+    int* RESTRICT slot{ work.slot.data() };
+    std::vector<Node_Pair> &stack{ work.stack };
+
+    // Index of node k's field in this workspace, added on first touch.
+    auto field_of = [&work, slot]( int const k ) {
+        if ( slot[k] < 0 ) {
+            slot[k] = static_cast<int>( work.fields.size() );
+            work.touched.push_back( k );
+            work.fields.push_back( Dual_Field{} );
+        }
+        return static_cast<std::size_t>( slot[k] );
+    };
+
+    stack.clear();
+    stack.push_back( task );
+    while ( !stack.empty() ) {
+        Node_Pair const pair{ stack.back() };
+        stack.pop_back();
+        std::size_t const a_begin{ static_cast<std::size_t>( range[pair.a].begin ) };
+        std::size_t const a_end{ static_cast<std::size_t>( range[pair.a].end ) };
+        std::size_t const n_a{ a_end - a_begin };
+
+        if ( pair.a == pair.b ) {
+            if ( n_a * ( n_a - 1 ) / 2 <= DUAL_DIRECT_PAIRS || !open_pair( pair, stack ) ) {
+                if constexpr ( POTENTIAL ) {
+                    pot_kernel_( arrays, a_begin, a_end, a_begin, a_end );
+                } else {
+                    symmetric_kernel_( arrays, a_begin, a_end, a_begin, a_end );
+                }
+            }
+            continue;
+        }
+
+        BHNode const &A{ nodes[pair.a] };
+        BHNode const &B{ nodes[pair.b] };
+        double const dx{ B.com_x - A.com_x };
+        double const dy{ B.com_y - A.com_y };
+        double const dz{ B.com_z - A.com_z };
+        double const d_sq{ dx*dx + dy*dy + dz*dz };
+        double const r_sum{ radius[pair.a] + radius[pair.b] };
+
+        if ( r_sum * r_sum < theta_sq * d_sq ) {
+            // Derivatives of the pull per unit mass towards d = B - A, the
+            // same for both sides up to sign: first (g3 d) and second (t)
+            // order, and third (u, with quadrupoles). Each side scales them
+            // by the other's mass, so M_A a_A + M_B a_B = 0.
+            double const R_inv{ 1.0 / std::sqrt( d_sq + eps_sq ) };
+            double const R_inv_sq{ R_inv * R_inv };
+            double const g3{ G * R_inv * R_inv_sq };
+            double const g5{ 3.0 * g3 * R_inv_sq };
+            double const fx{ g3 * dx }, fy{ g3 * dy }, fz{ g3 * dz };
+            double const t[6]{ g5 * dx * dx - g3, g5 * dx * dy, g5 * dx * dz,
+                               g5 * dy * dy - g3, g5 * dy * dz, g5 * dz * dz - g3 };
+            double const m_a{ A.total_mass }, m_b{ B.total_mass };
+
+            // Both slots first: adding B's field may move A's.
+            std::size_t const s_a{ field_of( pair.a ) };
+            std::size_t const s_b{ field_of( pair.b ) };
+            Dual_Field &f_a{ work.fields[s_a] };
+            Dual_Field &f_b{ work.fields[s_b] };
+            f_a.ax += m_b * fx; f_a.ay += m_b * fy; f_a.az += m_b * fz;
+            f_b.ax -= m_a * fx; f_b.ay -= m_a * fy; f_b.az -= m_a * fz;
+            for ( int k{}; k < 6; ++k ) {
+                f_a.t[k] += m_b * t[k];
+                f_b.t[k] += m_a * t[k];
+            }
+            if constexpr ( POTENTIAL ) {
+                f_a.pot -= G * m_b * R_inv;
+                f_b.pot -= G * m_a * R_inv;
+            }
+
+            // Each side's quadrupole at the other's centre of mass, as in
+            // quadrupole_impl with r = -d for A and r = d for B, and the
+            // monopole's second-order term, whose sum over the other
+            // side's particles is what balances it.
+            if constexpr ( QUADRUPOLE ) {
+                double const g7{ 5.0 * g5 * R_inv_sq };
+                double const u[10]{
+                    g7 * dx * dx * dx - 3.0 * g5 * dx, g7 * dx * dx * dy - g5 * dy, g7 * dx * dx * dz - g5 * dz,
+                    g7 * dx * dy * dy - g5 * dx,       g7 * dx * dy * dz,           g7 * dx * dz * dz - g5 * dx,
+                    g7 * dy * dy * dy - 3.0 * g5 * dy, g7 * dy * dy * dz - g5 * dz, g7 * dy * dz * dz - g5 * dy,
+                    g7 * dz * dz * dz - 3.0 * g5 * dz };
+                for ( int k{}; k < 10; ++k ) {
+                    f_a.d[k] += m_b * u[k];
+                    f_b.d[k] -= m_a * u[k];
+                }
+
+                double const g5_q{ g3 * R_inv_sq };
+                double const s{ 2.5 * g5_q * R_inv_sq };
+                double const* RESTRICT q_a{ cold[pair.a].quad };
+                double const* RESTRICT q_b{ cold[pair.b].quad };
+                double const qb_x{ q_b[0] * dx + q_b[1] * dy + q_b[2] * dz };
+                double const qb_y{ q_b[1] * dx + q_b[3] * dy + q_b[4] * dz };
+                double const qb_z{ q_b[2] * dx + q_b[4] * dy + q_b[5] * dz };
+                double const dqb{ dx * qb_x + dy * qb_y + dz * qb_z };
+                double const qa_x{ q_a[0] * dx + q_a[1] * dy + q_a[2] * dz };
+                double const qa_y{ q_a[1] * dx + q_a[3] * dy + q_a[4] * dz };
+                double const qa_z{ q_a[2] * dx + q_a[4] * dy + q_a[5] * dz };
+                double const dqa{ dx * qa_x + dy * qa_y + dz * qa_z };
+                f_a.ax += s * dqb * dx - g5_q * qb_x;
+                f_a.ay += s * dqb * dy - g5_q * qb_y;
+                f_a.az += s * dqb * dz - g5_q * qb_z;
+                f_b.ax += g5_q * qa_x - s * dqa * dx;
+                f_b.ay += g5_q * qa_y - s * dqa * dy;
+                f_b.az += g5_q * qa_z - s * dqa * dz;
+                if constexpr ( POTENTIAL ) {
+                    f_a.pot -= 0.5 * g5_q * dqb;
+                    f_b.pot -= 0.5 * g5_q * dqa;
+                }
+            }
+            continue;
+        }
+
+        std::size_t const b_begin{ static_cast<std::size_t>( range[pair.b].begin ) };
+        std::size_t const b_end{ static_cast<std::size_t>( range[pair.b].end ) };
+        if ( n_a * ( b_end - b_begin ) <= DUAL_DIRECT_PAIRS || !open_pair( pair, stack ) ) {
+            if constexpr ( POTENTIAL ) {
+                pot_kernel_( arrays, a_begin, a_end, b_begin, b_end );
+                pot_kernel_( arrays, b_begin, b_end, a_begin, a_end );
+            } else if ( a_begin < b_begin ) {
+                // Subtree spans are disjoint, so every j of the later span
+                // is past every i of the earlier one.
+                symmetric_kernel_( arrays, a_begin, a_end, b_begin, b_end );
+            } else {
+                symmetric_kernel_( arrays, b_begin, b_end, a_begin, a_end );
+            }
+        }
+    }
+}
+
+
+template <bool POTENTIAL>
+void Gravity_BarnesHut::traverse_dual( Particles &particles ) const {
+    std::size_t const N_a{ particles.num_active() };
+    int const num_nodes{ static_cast<int>( nodes_.size() ) };
+
+    double const* RESTRICT px{ particles.pos_x() };
+    double const* RESTRICT py{ particles.pos_y() };
+    double const* RESTRICT pz{ particles.pos_z() };
+    double const* RESTRICT mass{ particles.mass() };
+    double* RESTRICT ax{ particles.acc_x() };
+    double* RESTRICT ay{ particles.acc_y() };
+    double* RESTRICT az{ particles.acc_z() };
+    double* RESTRICT pot{ particles.pot() };
+
+    // Stage the active particles in tree order. Rounded to a cache line so
+    // neighbouring threads' accumulators never share one.
+    std::size_t const stride{ ( N_a + 7 ) / 8 * 8 };
+    dual_staging_.resize( 4 * stride );
+    double* RESTRICT x{ dual_staging_.data() };
+    double* RESTRICT y{ x + stride };
+    double* RESTRICT z{ x + 2 * stride };
+    double* RESTRICT m{ x + 3 * stride };
+    int const* RESTRICT indices{ indices_.data() };
+
+    #pragma omp parallel for schedule( static ) if ( N_a >= config::OMP_THRESHOLD )
+    for ( std::size_t s = 0; s < N_a; ++s ) {
+        int const i{ indices[s] };
+        x[s] = px[i]; y[s] = py[i]; z[s] = pz[i]; m[s] = mass[i];
+    }
+
+    // Bounding radii, deepest first: a leaf's farthest particle from its
+    // centre of mass, else the farthest child sphere, capped by the cell
+    // (every particle lies within half_width of the cell centre).
+    radius_.resize( nodes_.size() );
+    for ( int k{ num_nodes - 1 }; k >= 0; --k ) {
+        BHNode const &n{ nodes_[k] };
+        double r{};
+        if ( n.leaf() ) {
+            for ( int s{ node_range_[k].begin }; s < node_range_[k].end; ++s ) {
+                double const dx{ x[s] - n.com_x }, dy{ y[s] - n.com_y }, dz{ z[s] - n.com_z };
+                r = std::max( r, dx*dx + dy*dy + dz*dz );
+            }
+            radius_[k] = std::sqrt( r );
+            continue;
+        }
+        for ( int c{ k + 1 }; c < n.skip; c = nodes_[c].skip ) {
+            double const dx{ nodes_[c].com_x - n.com_x };
+            double const dy{ nodes_[c].com_y - n.com_y };
+            double const dz{ nodes_[c].com_z - n.com_z };
+            r = std::max( r, std::sqrt( dx*dx + dy*dy + dz*dz ) + radius_[c] );
+        }
+        BHNode_Cold const &cell{ cold_[k] };
+        double const dx{ cell.box_cx - n.com_x }, dy{ cell.box_cy - n.com_y }, dz{ cell.box_cz - n.com_z };
+        radius_[k] = std::min( r, std::sqrt( dx*dx + dy*dy + dz*dz ) + std::sqrt( 3.0 ) * n.half_width );
+    }
+
+    // Open the top of the walk serially into tasks of at most task_size
+    // particles per pair, so the dynamic schedule has pieces to balance.
+    bool const parallel{ N_a >= config::OMP_THRESHOLD };
+    int const threads{ parallel ? omp_get_max_threads() : 1 };
+    std::size_t const task_size{ threads > 1 ? std::max( N_a / ( 8 * static_cast<std::size_t>( threads ) ),
+                                                         std::size_t{ 256 } )
+                                             : N_a };
+    double const theta_sq{ theta_ * theta_ };
+    dual_work_.resize( static_cast<std::size_t>( threads ) );
+    dual_tasks_.clear();
+    std::vector<Node_Pair> &pending{ dual_work_[0].stack };
+    pending.assign( 1, { 0, 0 } );
+    while ( !pending.empty() ) {
+        Node_Pair const pair{ pending.back() };
+        pending.pop_back();
+        BHNode const &A{ nodes_[pair.a] };
+        BHNode const &B{ nodes_[pair.b] };
+        std::size_t size{ static_cast<std::size_t>( node_range_[pair.a].end - node_range_[pair.a].begin ) };
+        bool accepted{ false };
+        if ( pair.a != pair.b ) {
+            size += static_cast<std::size_t>( node_range_[pair.b].end - node_range_[pair.b].begin );
+            double const dx{ B.com_x - A.com_x }, dy{ B.com_y - A.com_y }, dz{ B.com_z - A.com_z };
+            double const r_sum{ radius_[pair.a] + radius_[pair.b] };
+            accepted = r_sum * r_sum < theta_sq * ( dx*dx + dy*dy + dz*dz );
+        }
+        if ( size <= task_size || accepted || !open_pair( pair, pending ) ) dual_tasks_.push_back( pair );
+    }
+
+    std::size_t const num_tasks{ dual_tasks_.size() };
+
+    // Series f at offset r: the acceleration a + T r + D:rr / 2, the
+    // potential phi - r.(a + T r / 2 + D:rr / 6), and D r, added to dt.
+    auto evaluate = []( Dual_Field const &f, double const rx, double const ry, double const rz,
+                        double (&a)[3], double &phi, double (&dt)[6] ) {
+        double const* t{ f.t };
+        double const* d{ f.d };
+        double const tx{ t[0] * rx + t[1] * ry + t[2] * rz };
+        double const ty{ t[1] * rx + t[3] * ry + t[4] * rz };
+        double const tz{ t[2] * rx + t[4] * ry + t[5] * rz };
+        double const dr[6]{ d[0] * rx + d[1] * ry + d[2] * rz, d[1] * rx + d[3] * ry + d[4] * rz,
+                            d[2] * rx + d[4] * ry + d[5] * rz, d[3] * rx + d[6] * ry + d[7] * rz,
+                            d[4] * rx + d[7] * ry + d[8] * rz, d[5] * rx + d[8] * ry + d[9] * rz };
+        double const dx{ 0.5 * ( dr[0] * rx + dr[1] * ry + dr[2] * rz ) };
+        double const dy{ 0.5 * ( dr[1] * rx + dr[3] * ry + dr[4] * rz ) };
+        double const dz{ 0.5 * ( dr[2] * rx + dr[4] * ry + dr[5] * rz ) };
+        a[0] = f.ax + tx + dx;
+        a[1] = f.ay + ty + dy;
+        a[2] = f.az + tz + dz;
+        phi = f.pot - ( f.ax + 0.5 * tx + dx / 3.0 ) * rx - ( f.ay + 0.5 * ty + dy / 3.0 ) * ry
+                    - ( f.az + 0.5 * tz + dz / 3.0 ) * rz;
+        for ( int q{}; q < 6; ++q ) dt[q] += dr[q];
+    };
+
+    // Subtrees of at most task_size particles own the merge and push-down
+    // below their roots; preorder puts every node above them first.
+    dual_roots_.clear();
+    for ( int k{}; k < num_nodes; ) {
+        if ( nodes_[k].leaf() || static_cast<std::size_t>( node_range_[k].end - node_range_[k].begin ) <= task_size ) {
+            dual_roots_.push_back( k );
+            k = nodes_[k].skip;
+        } else {
+            ++k;
+        }
+    }
+    std::size_t const num_roots{ dual_roots_.size() };
+    dual_fields_.resize( nodes_.size() );
+    Dual_Field* RESTRICT fields{ dual_fields_.data() };
+
+    auto add = []( Dual_Field &g, Dual_Field const &f ) {
+        g.ax += f.ax; g.ay += f.ay; g.az += f.az;
+        for ( int c{}; c < 6; ++c ) g.t[c] += f.t[c];
+        for ( int c{}; c < 10; ++c ) g.d[c] += f.d[c];
+        g.pot += f.pot;
+    };
+
+    // Adds node k's series to each child's, re-expanded about the
+    // child's centre of mass.
+    auto push_down = [&]( int const k ) {
+        BHNode const &n{ nodes_[k] };
+        Dual_Field const f{ fields[k] };
+        for ( int c{ k + 1 }; c < n.skip; c = nodes_[c].skip ) {
+            Dual_Field &g{ fields[c] };
+            double a[3], phi;
+            evaluate( f, nodes_[c].com_x - n.com_x, nodes_[c].com_y - n.com_y, nodes_[c].com_z - n.com_z,
+                      a, phi, g.t );
+            g.ax += a[0]; g.ay += a[1]; g.az += a[2];
+            for ( int q{}; q < 6; ++q ) g.t[q] += f.t[q];
+            for ( int q{}; q < 10; ++q ) g.d[q] += f.d[q];
+            if constexpr ( POTENTIAL ) g.pot += phi;
+        }
+    };
+
+    #pragma omp parallel num_threads( threads ) if ( parallel )
+    {
+        // The team may be smaller than requested; only its workspaces are used.
+        int const team{ omp_get_num_threads() };
+        Dual_Workspace &work{ dual_work_[static_cast<std::size_t>( omp_get_thread_num() )] };
+        work.acc.assign( 4 * stride, 0.0 );
+        work.slot.resize( nodes_.size(), -1 );
+        work.touched.clear();
+        work.fields.clear();
+        double* RESTRICT acc{ work.acc.data() };
+        Direct_Arrays const arrays{ x, y, z, m, acc, acc + stride, acc + 2 * stride, acc + 3 * stride };
+
+        // Pairs differ widely in cost; the symmetric updates land in this
+        // thread's accumulators whichever thread owns the nodes. The tasks
+        // are in walk order, so guided chunks of neighbouring pairs keep
+        // each thread's touched nodes few.
+        #pragma omp for schedule( guided ) nowait
+        for ( std::size_t t = 0; t < num_tasks; ++t ) {
+            if ( expansion_ == BH_Expansion::Quadrupole ) {
+                dual_walk<POTENTIAL, true>( dual_tasks_[t], arrays, work );
+            } else {
+                dual_walk<POTENTIAL, false>( dual_tasks_[t], arrays, work );
+            }
+        }
+        std::sort( work.touched.begin(), work.touched.end() );
+        #pragma omp barrier
+
+        // The nodes above the subtrees, parents first, once they and the
+        // roots are cleared.
+        #pragma omp single
+        {
+            for ( int k{}; k < num_nodes; ) {
+                fields[k] = Dual_Field{};
+                k = std::binary_search( dual_roots_.begin(), dual_roots_.end(), k ) ? nodes_[k].skip : k + 1;
+            }
+            for ( int k{}; k < num_nodes; ) {
+                if ( std::binary_search( dual_roots_.begin(), dual_roots_.end(), k ) ) {
+                    k = nodes_[k].skip;
+                    continue;
+                }
+                for ( int w{}; w < team; ++w ) {
+                    Dual_Workspace const &other{ dual_work_[static_cast<std::size_t>( w )] };
+                    int const s{ other.slot[k] };
+                    if ( s >= 0 ) add( fields[k], other.fields[static_cast<std::size_t>( s )] );
+                }
+                push_down( k );
+                ++k;
+            }
+        }
+
+        // Each subtree merges the threads' fields for its nodes, pushes
+        // the series down and evaluates it at its leaves' particles, plus
+        // their direct sums.
+        #pragma omp for schedule( dynamic, 1 )
+        for ( std::size_t r = 0; r < num_roots; ++r ) {
+            int const root{ dual_roots_[r] };
+            int const end{ nodes_[root].skip };
+            std::fill( fields + root + 1, fields + end, Dual_Field{} );
+            for ( int w{}; w < team; ++w ) {
+                Dual_Workspace const &other{ dual_work_[static_cast<std::size_t>( w )] };
+                auto it{ std::lower_bound( other.touched.begin(), other.touched.end(), root ) };
+                for ( ; it != other.touched.end() && *it < end; ++it ) {
+                    add( fields[*it], other.fields[static_cast<std::size_t>( other.slot[*it] )] );
+                }
+            }
+
+            for ( int k{ root }; k < end; ++k ) {
+                BHNode const &n{ nodes_[k] };
+                if ( !n.leaf() ) {
+                    push_down( k );
+                    continue;
+                }
+                Dual_Field const f{ fields[k] };
+                for ( int s{ node_range_[k].begin }; s < node_range_[k].end; ++s ) {
+                    double a[3], phi, unused[6]{};
+                    evaluate( f, x[s] - n.com_x, y[s] - n.com_y, z[s] - n.com_z, a, phi, unused );
+                    double a_x{ a[0] }, a_y{ a[1] }, a_z{ a[2] };
+                    for ( int w{}; w < team; ++w ) {
+                        double const* RESTRICT src{ dual_work_[static_cast<std::size_t>( w )].acc.data() };
+                        a_x += src[s];
+                        a_y += src[stride + s];
+                        a_z += src[2 * stride + s];
+                        if constexpr ( POTENTIAL ) phi += src[3 * stride + s];
+                    }
+                    int const i{ indices[s] };
+                    ax[i] += a_x;
+                    ay[i] += a_y;
+                    az[i] += a_z;
+                    if constexpr ( POTENTIAL ) pot[i] += phi;
+                }
+            }
         }
+
+        for ( int const k : work.touched ) work.slot[static_cast<std::size_t>( k )] = -1;
+    }
+}
+
+
+void Gravity_BarnesHut::apply( Particles &particles ) const {
+    if ( particles.num_active() == 0 ) return;
+
+    double const started{ omp_get_wtime() };
+    build_tree( particles );
+    build_groups( particles );
+    double const built{ omp_get_wtime() };
+    build_seconds_ += built - started;
+
+    // The dual walk covers the active particles; passive groups are
+    // always walked one-sided.
+    bool const dual{ traversal_ == BH_Traversal::Dual };
+    tasks_.clear();
+    for ( std::size_t g{ dual ? static_cast<std::size_t>( active_groups_ ) : 0 }; g < groups_.size(); ++g ) {
+        tasks_.push_back( { static_cast<int>( g ), groups_[g].begin, groups_[g].end } );
     }
+
+    if ( potential() && supports_potential() ) {
+        if ( dual ) traverse_dual<true>( particles );
+        if ( !tasks_.empty() ) traverse_groups<true>( particles, members_.data() );
+    } else {
+        if ( dual ) traverse_dual<false>( particles );
+        if ( !tasks_.empty() ) traverse_groups<false>( particles, members_.data() );
+    }
+    traversal_seconds_ += omp_get_wtime() - built;
+}
+
+
+void Gravity_BarnesHut::apply_subset( Particles &particles, std::vector<std::size_t> const &targets ) const {
+    if ( particles.num_active() == 0 || targets.empty() ) return;
+
+    double const started{ omp_get_wtime() };
+    build_tree( particles );
+    build_groups( particles );
+    double const built{ omp_get_wtime() };
+    build_seconds_ += built - started;
+
+    // Counting sort of the targets by group: one task per group that holds
+    // a target, summing for its listed targets only.
+    std::size_t const num_groups{ groups_.size() };
+    std::vector<int> &start{ group_start_ };
+    start.assign( num_groups + 1, 0 );
+    for ( std::size_t const i : targets ) ++start[group_of_[i] + 1];
+    for ( std::size_t g{}; g < num_groups; ++g ) start[g + 1] += start[g];
+
+    subset_targets_.resize( targets.size() );
+    tasks_.clear();
+    for ( std::size_t g{}; g < num_groups; ++g ) {
+        if ( start[g + 1] > start[g] ) tasks_.push_back( { static_cast<int>( g ), start[g], start[g + 1] } );
+    }
+    for ( std::size_t const i : targets ) {
+        subset_targets_[start[group_of_[i]]++] = static_cast<int>( i );
+    }
+
+    traverse_groups<false>( particles, subset_targets_.data() );
+    traversal_seconds_ += omp_get_wtime() - built;
 }
@@ -1,40 +1,196 @@
 #pragma once
 
 #include "Force.hpp"
+#include "../Particle/Morton.hpp"
 
 #include <vector>
 #include <cstddef>
+#include <cstdint>
 
-// One node of the Barnes-Hut octree.
-// Internal nodes: children[k] is a node index for octant k, or -1 if empty.
-// Leaf nodes:     children[0] = -1 (sentinel), children[1] = first index into
-//                 indices_, children[2] = bucket count.
-// Disambiguation: a node is a leaf iff children[0] == -1.
-struct BHNode {
+// One node of the Barnes-Hut octree, holding what a traversal step reads
+// in one 64-byte line. Nodes are stored depth-first, so an internal node's
+// first child is the next node, and `skip` is the node after its subtree:
+// a walk descends to node + 1 or moves on to skip, with no stack. The
+// children of node k are k + 1, then each one's skip, up to k's skip.
+// `octants` marks the non-empty octants; a leaf has none and holds `count`
+// particles from indices_[first]. When those are also consecutive in
+// memory (see Morton_Reorder), `run` is the first of them, else -1.
+struct alignas( 64 ) BHNode {
     double com_x, com_y, com_z;
     double total_mass;
-    double box_cx, box_cy, box_cz;
     double half_width;
-    int children[8];
+    int skip;
+    int first;
+    int count;
+    int run;
+    std::uint8_t octants;
+
+    [[nodiscard]] bool leaf() const { return octants == 0; }
+};
+static_assert( sizeof( BHNode ) == 64 );
+
+// Per-node data the traversal does not read, indexed like the nodes: the
+// cell centre, and the traceless quadrupole sum m (3 x x^T - |x|^2 I) about
+// the centre of mass as xx, xy, xz, yy, yz, zz, only set by quadrupole
+// trees and only read for accepted nodes.
+struct BHNode_Cold {
+    double box_cx, box_cy, box_cz;
+    double quad[6];
 };
 
+// Tree construction strategy.
+//   Recursive: top-down recursive counting sort into octants, one node
+//              appended at a time.
+//   Morton:    63-bit Morton keys (21 bits per axis), sorted with a parallel
+//              LSD radix sort that is skipped or replaced by an insertion
+//              pass when the previous order is (nearly) still sorted. Nodes
+//              are read off the sorted key ranges level by level, numbered
+//              depth-first into a pool sized once per build, and moments
+//              are combined bottom-up.
+//              The tree stops at 21 levels, the key resolution.
+//
+// Both builds are parallel: Recursive splits the top of the tree with one
+// OpenMP task per octant and builds small subtrees in per-thread arenas,
+// stitched into the pool afterwards; Morton sorts and fits level by level.
+//
+// With a refit tolerance (Morton build only), later calls keep the topology
+// and indices_ and only refit each node bottom-up: mass, centre of mass and
+// a half_width grown to enclose particles that have left the node's cell.
+// The tree is rebuilt once more than refit_tolerance * N_active particles
+// sit outside their leaf cell, so the build runs once per several steps
+// rather than once per force call.
+enum class BH_Build { Recursive, Morton };
+
+// Far-field expansion of an accepted node. Quadrupole adds the second
+// moment to the monopole, so the force error at a given theta drops by
+// roughly a factor theta and larger opening angles reach the same accuracy.
+enum class BH_Expansion { Monopole, Quadrupole };
+
+// How the tree is walked for the active particles.
+//   Groups: one walk per target group, described below.
+//   Dual:   one walk of the tree against itself (Dehnen's cell-cell
+//           scheme). Cells A and B interact as a pair when
+//           r_A + r_B < theta d, with r the radius around the centre of
+//           mass that bounds the cell and d the distance between centres;
+//           else the larger is opened, down to pairs of subtrees small
+//           enough for the symmetric direct kernel. An accepted pair adds
+//           each cell's field to the other as a Taylor series about its
+//           centre of mass: the monopole to first order, or with
+//           quadrupole trees the monopole to second order plus the
+//           quadrupole, so both sides keep every term up to the same total
+//           order. The series are pushed down the tree once at the end.
+//           Every pair is visited once and the two sides get equal and
+//           opposite forces, so the total force vanishes to rounding and
+//           linear momentum is conserved. Passive particles and
+//           apply_subset still use the group walk.
+enum class BH_Traversal { Groups, Dual };
+
+// The options past the tree shape and kernel, set by name, e.g.
+// { .expansion = BH_Expansion::Quadrupole, .traversal = BH_Traversal::Dual }.
+// refit_tolerance is described under BH_Build, alpha under the class.
+struct BH_Options {
+    BH_Expansion expansion{ BH_Expansion::Monopole };
+    double refit_tolerance{ 0.0 };
+    double alpha{ 0.0 };
+    BH_Traversal traversal{ BH_Traversal::Groups };
+};
+
+// Forces are evaluated per group of nearby targets rather than per
+// particle. A group is the largest subtree holding at most group_size
+// active particles (or group_size passive particles adjacent in Morton
+// order, or in slot order when there are few active particles).
+// The tree is walked once per group with a conservative opening test, the
+// distance from a node's centre of mass to the group's bounding box, so
+// every member sees a node only where it would pass the per-particle test,
+// and a node whose cell overlaps that box is always opened. Accepted
+// nodes and the particles of opened leaves form one interaction list,
+// staged behind the group's members and summed with the direct kernel for
+// `isa` (targets in vector lanes, one broadcast per source).
+//
+// With alpha > 0 the geometric test gives way to a relative one: a node is
+// accepted when its estimated force error, G M s^2 / d^4 (G M s^3 / d^5
+// with quadrupoles) for a node of width s, is at most alpha times the
+// smallest acceleration any group member received from the previous call,
+// and s < d. Nodes far from strong fields are then opened less, so the
+// error is a uniform fraction of each particle's acceleration. Groups
+// without a previous acceleration, as on the first call, use theta.
 class Gravity_BarnesHut : public Force {
 public:
+    // Throws std::runtime_error for a dual traversal with alpha > 0.
     explicit Gravity_BarnesHut( double const theta = 0.5,
-                                std::size_t const leaf_bucket = 8 );
+                                std::size_t const leaf_bucket = 8,
+                                BH_Build const build = BH_Build::Morton,
+                                std::size_t const group_size = 64,
+                                simd::Isa const isa = simd::detect(),
+                                BH_Options const options = {} );
 
     void apply( Particles &particles ) const override;
 
+    // Potential from the same expansion as the force: monopole, plus the
+    // quadrupole term with BH_Expansion::Quadrupole. The short-range kernel
+    // has no potential, so short-range mode reports none.
+    [[nodiscard]] bool supports_potential() const override { return short_range_ == 0.0; }
+
+    // Rebuilds the tree from every active source, then walks it for the
+    // groups holding a listed target, summing for those targets only. The
+    // groups match apply()'s, so the forces do too.
+    [[nodiscard]] bool supports_subset() const override { return true; }
+    void apply_subset( Particles &particles, std::vector<std::size_t> const &targets ) const override;
+
+    // Short-range mode for TreePM: with r_split > 0 every pair force is
+    // scaled by erfc(r / 2 r_s) + r / (r_s sqrt(pi)) exp(-r^2 / 4 r_s^2),
+    // the complement of Gravity_PM's long-range part, and nodes beyond
+    // SHORT_RANGE_CUTOFF * r_s of a group are skipped. 0 restores full
+    // Newtonian gravity. Throws std::runtime_error for quadrupole trees
+    // and dual traversals.
+    // Potential mode adds nothing while the mode is on.
+    static constexpr double SHORT_RANGE_CUTOFF{ direct::SHORT_RANGE_CUTOFF };
+    void set_short_range( double const r_split );
+    [[nodiscard]] double short_range() const { return short_range_; }
+
     [[nodiscard]] double theta() const { return theta_; }
     [[nodiscard]] std::size_t leaf_bucket() const { return leaf_bucket_; }
+    [[nodiscard]] BH_Build build() const { return build_; }
+    [[nodiscard]] std::size_t group_size() const { return group_size_; }
+    [[nodiscard]] simd::Isa isa() const { return isa_; }
+    [[nodiscard]] BH_Expansion expansion() const { return expansion_; }
+    [[nodiscard]] double refit_tolerance() const { return refit_tolerance_; }
+    [[nodiscard]] double alpha() const { return alpha_; }
+
+    [[nodiscard]] BH_Traversal traversal() const { return traversal_; }
+
+    // Full tree builds so far; with refitting, fewer than force calls.
+    [[nodiscard]] std::size_t builds() const { return builds_; }
+
+    // Wall time of all calls so far, split into tree work (build or
+    // refit, and target groups) and traversal.
+    [[nodiscard]] double build_seconds() const { return build_seconds_; }
+    [[nodiscard]] double traversal_seconds() const { return traversal_seconds_; }
+
+    // Interactions each particle took at its last evaluation: the cost
+    // model of the load balancing (empty before the first call).
+    [[nodiscard]] std::vector<double> const &costs() const { return cost_; }
 
 private:
     double theta_;
     std::size_t leaf_bucket_;
+    BH_Build build_;
+    std::size_t group_size_;
+    simd::Isa isa_;
+    Direct_Kernel kernel_;
+    Direct_Kernel pot_kernel_;
+    BH_Expansion expansion_;
+    double refit_tolerance_;
+    double alpha_;
+    double short_range_{};
+    BH_Traversal traversal_;
+    Direct_Kernel symmetric_kernel_;
 
-    // Tree state. Rebuilt every apply(); capacity is sticky to avoid
-    // re-allocation across integration steps.
+    // Tree state. Rebuilt or, with a refit tolerance, refit on each apply()
+    // (see BH_Build); capacity is sticky to avoid re-allocation across
+    // integration steps.
     mutable std::vector<BHNode> nodes_;
+    mutable std::vector<BHNode_Cold> cold_;
     mutable std::vector<int> indices_;
     mutable std::vector<int> scratch_;
 
@@ -42,19 +198,229 @@ private:
     // bucket leaf at this depth; the only correctness fallback in the build.
     static constexpr int MAX_DEPTH{ 32 };
 
+    // Morton build state, breadth-first. Range k covers sorted keys
+    // [begin, end) at `level` and becomes nodes_[node], the root of a
+    // subtree of `size` nodes; its non-empty octants are the set bits of
+    // `octants`, whose ranges are stored consecutively from `first_child`.
+    struct Morton_Range {
+        int begin, end;
+        int first_child;
+        int node, size;
+        std::uint8_t level, octants;
+    };
+
+    static constexpr int KEY_LEVELS{ morton::LEVELS };
+
+    mutable std::vector<std::uint64_t> keys_;
+    mutable std::vector<std::uint64_t> key_scratch_;
+    mutable std::vector<std::size_t> histogram_;
+    mutable std::vector<Morton_Range> ranges_;
+    mutable std::vector<int> level_begin_;
+
+    // Root cell half-width of the last Morton build; range k's cell has
+    // half-width root_half_ / 2^ranges_[k].level whatever refits did to
+    // its node's half_width.
+    mutable double root_half_{};
+    mutable std::size_t builds_{};
+    mutable double build_seconds_{};
+    mutable double traversal_seconds_{};
+
     void build_tree( Particles const &particles ) const;
+    void build_morton( Particles const &particles ) const;
+    // Sorts key_list, carrying order_list along, from their current order;
+    // key_scratch_ and scratch_ are the radix buffers.
+    void sort_keys( std::vector<std::uint64_t> &key_list, std::vector<int> &order_list ) const;
 
-    // Always re-access nodes via nodes_[id]; never hold a reference across
-    // recursive calls, since vector growth invalidates references.
-    void build_recursive( int const node_id,
+    // Sets every node's moments and half_width from the current positions,
+    // deepest level first; returns the number of particles outside their
+    // leaf cell.
+    std::size_t fit_nodes( Particles const &particles ) const;
+
+    // Refits the last Morton tree. Returns false, leaving the tree to be
+    // rebuilt, if there is none for this many active particles or too many
+    // have left their leaf cells.
+    bool refit( Particles const &particles ) const;
+
+    // Recursive build state. The top of the tree is split in parallel,
+    // one task per octant, into parts; a part of at most TASK_CUTOFF
+    // particles is built serially by build_recursive into the arena of
+    // the thread that took it, at [offset, offset + size). The parts are
+    // then numbered depth-first and the arenas copied into nodes_, with
+    // node the part's position there. Split parts (thread < 0) hold their
+    // children at parts_[first_child], one per set bit of `octants`.
+    static constexpr int TASK_CUTOFF{ 4096 };
+
+    struct Build_Arena {
+        std::vector<BHNode> nodes;
+        std::vector<BHNode_Cold> cold;
+    };
+    struct Build_Part {
+        int begin, end;
+        double cx, cy, cz, half;
+        int depth;
+        int first_child;
+        std::uint8_t octants;
+        int thread, offset, size;
+        int node;
+    };
+    mutable std::vector<Build_Arena> arenas_;
+    mutable std::vector<Build_Part> parts_;
+
+    void split_part( int const part_id, Build_Part const part,
+                     double const* RESTRICT px, double const* RESTRICT py, double const* RESTRICT pz,
+                     double const* RESTRICT mass ) const;
+    void stitch_parts( double const* RESTRICT px, double const* RESTRICT py, double const* RESTRICT pz,
+                       double const* RESTRICT mass ) const;
+
+    // Always re-access nodes via arena.nodes[id]; never hold a reference
+    // across recursive calls, since vector growth invalidates references.
+    void build_recursive( Build_Arena &arena,
+                          int const node_id,
                           int const begin, int const end,
                           double const bcx, double const bcy, double const bcz,
                           double const half, int const depth,
                           double const* RESTRICT px, double const* RESTRICT py, double const* RESTRICT pz,
                           double const* RESTRICT mass ) const;
 
-    void traverse_for_particle( std::size_t const i,
-                                double const* RESTRICT px, double const* RESTRICT py, double const* RESTRICT pz,
-                                double const* RESTRICT mass,
-                                double &a_xi, double &a_yi, double &a_zi ) const;
+    // Target groups, rebuilt with the tree. Group g holds
+    // members_[groups_[g].begin, groups_[g].end); group_of_[i] is the group
+    // of particle i. Groups [0, active_groups_) are subtrees of active
+    // particles, the rest hold passive ones: passive_order_ lists the
+    // passive slots (less num_active) in the Morton order of their own
+    // bounding cube and is kept between calls to seed the next sort. That
+    // order is only built from SORTED_PASSIVE_GROUPS groups' worth of active
+    // bodies up; below it passive groups are runs of consecutive slots.
+    static constexpr std::size_t SORTED_PASSIVE_GROUPS{ 8 };
+    struct BH_Range {
+        int begin, end;
+    };
+    mutable std::vector<BH_Range> node_range_;    // subtree span in indices_
+    mutable std::vector<BH_Range> groups_;
+    mutable std::vector<int> members_;
+    mutable std::vector<int> group_of_;
+    mutable std::vector<std::uint64_t> passive_keys_;
+    mutable std::vector<int> passive_order_;
+    mutable int active_groups_{};
+
+    // One unit of traversal work: walk group `group` and sum the result for
+    // targets [begin, end) of the target array.
+    struct Group_Task {
+        int group;
+        int begin, end;
+    };
+    mutable std::vector<Group_Task> tasks_;
+
+    // Load balancing. cost_[i] is the number of interactions particle i
+    // took at its last evaluation; a reorder of the particle arrays only
+    // blurs the prediction for one call. task_cost_ holds prefix sums of
+    // the predicted task costs, and zone z of the current traversal covers
+    // tasks [next, end) still to be claimed.
+    struct alignas( 64 ) Cost_Zone {
+        int next, end;
+    };
+    mutable std::vector<double> cost_;
+    mutable std::vector<double> task_cost_;
+    mutable std::vector<Cost_Zone> zones_;
+
+    // |a| of each particle from this force at its last evaluation, read by
+    // the relative opening test (only kept with alpha > 0). Indexed by
+    // Particles::ids(), so it follows its body when the arrays are
+    // reordered.
+    mutable std::vector<double> accel_;
+    mutable std::vector<int> subset_targets_;
+    mutable std::vector<int> group_start_;
+
+    // Per-thread kernel staging: the task's targets in [0, K), then (for
+    // an active group) its other members, then the interaction list. The
+    // first `size` entries are in use; a* and pot cover the targets.
+    // Accepted nodes of a quadrupole tree also enter the quadrupole list
+    // (q*: centre of mass and moment), whose correction is summed after
+    // the monopole kernel.
+    struct Interaction_List {
+        std::vector<double> x, y, z, m;
+        std::vector<double> ax, ay, az, pot;
+        std::size_t size{};
+        std::vector<double> qx, qy, qz, qxx, qxy, qxz, qyy, qyz, qzz;
+        std::size_t quad_size{};
+    };
+    mutable std::vector<Interaction_List> lists_;
+
+    // Sets cold[node_id].quad from its leaf particles or its children;
+    // the node's and children's centres of mass must be current.
+    void quadrupole( BHNode const* RESTRICT nodes, BHNode_Cold* RESTRICT cold,
+                     int const node_id,
+                     double const* RESTRICT px, double const* RESTRICT py, double const* RESTRICT pz,
+                     double const* RESTRICT mass ) const;
+
+    void build_groups( Particles const &particles ) const;
+
+    // Stages the task's targets and walks the tree for its group; returns
+    // the first source slot (0 for active groups, whose members are sources
+    // too, else K). `ids` keys accel_.
+    std::size_t collect_interactions( Group_Task const &task, int const* RESTRICT targets,
+                                      double const* RESTRICT px, double const* RESTRICT py,
+                                      double const* RESTRICT pz, double const* RESTRICT mass,
+                                      std::size_t const* RESTRICT ids, Interaction_List &list ) const;
+
+    // POTENTIAL also accumulates the potential into pot.
+    template <bool POTENTIAL>
+    void traverse_groups( Particles &particles, int const* RESTRICT targets ) const;
+
+    // Dual-tree state. The active particles are staged in tree order
+    // (x, y, z, m), so the particles of node k are
+    // the span node_range_[k]. radius_[k] bounds their distance from the
+    // node's centre of mass.
+    //
+    // A node pair with a == b stands for the node with itself. Pairs of
+    // at most DUAL_DIRECT_PAIRS particle pairs are summed directly.
+    static constexpr int DUAL_DIRECT_PAIRS{ 256 };
+
+    struct Node_Pair {
+        int a, b;
+    };
+
+    // Far field of the accepted pairs about a node's centre of mass: the
+    // acceleration, its gradient (xx, xy, xz, yy, yz, zz), its second
+    // derivatives (xxx, xxy, xxz, xyy, xyz, xzz, yyy, yyz, yzz, zzz; only
+    // with quadrupoles) and the potential.
+    struct Dual_Field {
+        double ax, ay, az;
+        double t[6];
+        double d[10];
+        double pot;
+    };
+
+    // Per-thread walk state: the pair stack, accumulators for the staged
+    // particles (x, y, z, pot) and fields for only the nodes this thread's
+    // pairs touched. slot[k] indexes node k's field, or is -1; it is all
+    // -1 between walks, so only the touched entries are ever reset.
+    struct Dual_Workspace {
+        std::vector<Node_Pair> stack;
+        std::vector<double> acc;
+        std::vector<int> slot;
+        std::vector<int> touched;
+        std::vector<Dual_Field> fields;
+    };
+
+    // The walk's fields merged across threads, and the subtrees the merge
+    // and push-down are split into: each task owns [root, skip) of
+    // dual_roots_, and the nodes above them are done first.
+    mutable std::vector<double> radius_;
+    mutable std::vector<double> dual_staging_;
+    mutable std::vector<Node_Pair> dual_tasks_;
+    mutable std::vector<Dual_Workspace> dual_work_;
+    mutable std::vector<Dual_Field> dual_fields_;
+    mutable std::vector<int> dual_roots_;
+
+    // Pushes the pairs that replace `pair` once its larger node (or, for
+    // a node with itself, the node) is opened; false if it is a leaf.
+    bool open_pair( Node_Pair const pair, std::vector<Node_Pair> &out ) const;
+
+    // Walks the tree against itself for the active particles and adds
+    // the result to their accelerations (and potentials).
+    template <bool POTENTIAL>
+    void traverse_dual( Particles &particles ) const;
+
+    template <bool POTENTIAL, bool QUADRUPOLE>
+    void dual_walk( Node_Pair const task, Direct_Arrays const &arrays, Dual_Workspace &work ) const;
 };
@@ -0,0 +1,178 @@
+#include "BarnesHutTuner.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <limits>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+
+// Search grid. Thetas are tried widest first, so each bucket stops at the
+// cheapest angle that meets the budget.
+static constexpr std::array<double, 9> THETAS{ 1.0, 0.9, 0.8, 0.7, 0.6, 0.5, 0.4, 0.3, 0.2 };
+static constexpr std::array<std::size_t, 4> LEAF_BUCKETS{ 4, 8, 16, 32 };
+
+// Full calls on the tuning copy: the first sorts from scratch, later ones
+// start from that order as later steps do. The faster of two of those is
+// taken, which filters out most scheduling noise.
+static double time_call( Gravity_BarnesHut const &force, Particles &p ) {
+    force.apply( p );
+    double seconds{ std::numeric_limits<double>::infinity() };
+    for ( int r{}; r < 2; ++r ) {
+        auto const start{ std::chrono::steady_clock::now() };
+        force.apply( p );
+        seconds = std::min( seconds, std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count() );
+    }
+    return seconds;
+}
+
+Gravity_BarnesHut_Tuned::Gravity_BarnesHut_Tuned( double const error_budget,
+                                                  std::size_t const retune_every,
+                                                  std::size_t const samples,
+                                                  BH_Expansion const expansion,
+                                                  simd::Isa const isa,
+                                                  std::ostream *const log )
+: error_budget_{ error_budget }
+, retune_every_{ retune_every }
+, samples_{ samples }
+, expansion_{ expansion }
+, isa_{ std::min( isa, simd::detect() ) }
+, log_{ log }
+, force_{ 0.5, 8, BH_Build::Morton, 64, isa_, { .expansion = expansion } }
+{
+    if ( !( error_budget > 0.0 ) || samples == 0 ) {
+        throw std::runtime_error( "Gravity_BarnesHut_Tuned: needs error_budget > 0 and samples >= 1" );
+    }
+}
+
+
+Gravity_BarnesHut_Tuned::Sample_Error Gravity_BarnesHut_Tuned::sample_error( Gravity_BarnesHut const &force ) const {
+    Particles &p{ *scratch_ };
+    for ( std::size_t const i : sample_ ) p.acc_x()[i] = p.acc_y()[i] = p.acc_z()[i] = 0.0;
+    force.apply_subset( p, sample_ );
+
+    double sum{}, worst{};
+    for ( std::size_t s{}; s < sample_.size(); ++s ) {
+        std::size_t const i{ sample_[s] };
+        double const ex{ exact_[3*s] }, ey{ exact_[3*s + 1] }, ez{ exact_[3*s + 2] };
+        double const dx{ p.acc_x()[i] - ex }, dy{ p.acc_y()[i] - ey }, dz{ p.acc_z()[i] - ez };
+        double const norm_sq{ ex*ex + ey*ey + ez*ez };
+        if ( norm_sq > 0.0 ) {
+            double const rel_sq{ ( dx*dx + dy*dy + dz*dz ) / norm_sq };
+            sum += rel_sq;
+            worst = std::max( worst, rel_sq );
+        }
+    }
+    return { std::sqrt( sum / static_cast<double>( sample_.size() ) ), std::sqrt( worst ) };
+}
+
+
+void Gravity_BarnesHut_Tuned::tune( Particles const &particles ) const {
+    std::size_t const N{ particles.num_particles() };
+    std::size_t const N_a{ particles.num_active() };
+
+    if ( !scratch_ || scratch_->num_particles() != N ) scratch_.emplace( N );
+    Particles &p{ *scratch_ };
+    p.set_num_active( N_a );
+    std::copy_n( particles.pos_x(), N, p.pos_x() );
+    std::copy_n( particles.pos_y(), N, p.pos_y() );
+    std::copy_n( particles.pos_z(), N, p.pos_z() );
+    std::copy_n( particles.mass(), N, p.mass() );
+
+    // Exact accelerations of a fresh random subset, active or passive,
+    // drawn by selection sampling: index i is kept with probability
+    // (samples still needed) / (indices left), which yields S sorted
+    // distinct indices.
+    std::size_t const S{ std::min( samples_, N ) };
+    sample_.clear();
+    for ( std::size_t i{}; i < N && sample_.size() < S; ++i ) {
+        std::uniform_int_distribution<std::size_t> left{ 0, N - i - 1 };
+        if ( left( rng_ ) < S - sample_.size() ) sample_.push_back( i );
+    }
+    exact_.assign( 3 * S, 0.0 );
+
+    double const* RESTRICT px{ p.pos_x() };
+    double const* RESTRICT py{ p.pos_y() };
+    double const* RESTRICT pz{ p.pos_z() };
+    double const* RESTRICT mass{ p.mass() };
+    constexpr double eps_sq{ config::EPS * config::EPS };
+
+    #pragma omp parallel for schedule( static ) if ( N_a >= config::OMP_THRESHOLD )
+    for ( std::size_t s = 0; s < S; ++s ) {
+        std::size_t const i{ sample_[s] };
+        double a_x{}, a_y{}, a_z{};
+        for ( std::size_t j{}; j < N_a; ++j ) {
+            Gravity::accumulate_pairwise( px[i], py[i], pz[i], px[j], py[j], pz[j], mass[j],
+                                          a_x, a_y, a_z, config::G, eps_sq, i == j ? 0.0 : 1.0 );
+        }
+        exact_[3*s] = a_x; exact_[3*s + 1] = a_y; exact_[3*s + 2] = a_z;
+    }
+
+    // Per bucket, the widest theta within budget; the most accurate pair
+    // seen is the fallback if none is.
+    BH_Tuning best{ THETAS.back(), LEAF_BUCKETS.front(), std::numeric_limits<double>::infinity(),
+                    std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity() };
+    BH_Tuning most_accurate{ best };
+    bool met{ false };
+
+    for ( std::size_t const bucket : LEAF_BUCKETS ) {
+        for ( double const theta : THETAS ) {
+            Gravity_BarnesHut const candidate{ theta, bucket, BH_Build::Morton, 64, isa_,
+                                               { .expansion = expansion_ } };
+            Sample_Error const error{ sample_error( candidate ) };
+            if ( error.rms < most_accurate.error ) most_accurate = { theta, bucket, error.rms, error.worst, 0.0 };
+            if ( error.rms > error_budget_ || error.worst > WORST_ERROR_FACTOR * error_budget_ ) continue;
+
+            double const seconds{ time_call( candidate, p ) };
+            if ( seconds < best.seconds ) best = { theta, bucket, error.rms, error.worst, seconds };
+            met = true;
+            break;
+        }
+    }
+
+    if ( !met ) {
+        best = most_accurate;
+        best.seconds = time_call( Gravity_BarnesHut{ best.theta, best.leaf_bucket, BH_Build::Morton, 64,
+                                                     isa_, { .expansion = expansion_ } }, p );
+    }
+
+    if ( best.theta != force_.theta() || best.leaf_bucket != force_.leaf_bucket() ) {
+        force_ = Gravity_BarnesHut{ best.theta, best.leaf_bucket, BH_Build::Morton, 64, isa_,
+                                    { .expansion = expansion_ } };
+    }
+    tuning_ = best;
+    ++tunes_;
+
+    if ( log_ ) {
+        std::ostringstream line;
+        line << "Barnes-Hut tuner: theta " << std::fixed << std::setprecision( 2 ) << best.theta
+             << ", leaf bucket " << best.leaf_bucket
+             << ", RMS force error " << std::scientific << std::setprecision( 2 ) << best.error
+             << " (worst " << best.worst_error << ")"
+             << ( met ? " within" : " over" ) << " budget " << error_budget_
+             << ", " << std::fixed << std::setprecision( 3 ) << 1e3 * best.seconds << " ms per force call\n";
+        *log_ << line.str();
+    }
+}
+
+
+void Gravity_BarnesHut_Tuned::apply( Particles &particles ) const {
+    if ( particles.num_active() == 0 ) return;
+
+    if ( calls_ == 0 || ( retune_every_ > 0 && calls_ % retune_every_ == 0 ) ) tune( particles );
+    ++calls_;
+
+    force_.set_potential( potential() );
+    force_.apply( particles );
+}
+
+
+void Gravity_BarnesHut_Tuned::apply_subset( Particles &particles, std::vector<std::size_t> const &targets ) const {
+    if ( particles.num_active() == 0 || targets.empty() ) return;
+
+    if ( tunes_ == 0 ) tune( particles );
+    force_.apply_subset( particles, targets );
+}
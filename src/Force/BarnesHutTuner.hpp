@@ -0,0 +1,96 @@
+#pragma once
+
+#include "BarnesHut.hpp"
+
+#include <vector>
+#include <cstddef>
+#include <iosfwd>
+#include <optional>
+#include <random>
+
+// One tuning decision: the chosen opening angle and leaf bucket, the RMS
+// and worst relative force error they gave on the sampled particles, and
+// the measured time of one full force call.
+struct BH_Tuning {
+    double theta;
+    std::size_t leaf_bucket;
+    double error;
+    double worst_error;
+    double seconds;
+};
+
+// Barnes-Hut with theta and leaf_bucket chosen at run time. On the first
+// call, and then every `retune_every` calls (0: never again), a random
+// subset of `samples` particles is summed exactly with
+// Gravity::accumulate_pairwise. Each leaf bucket on the grid is paired with
+// the widest theta whose RMS relative force error on the subset is within
+// `error_budget`, and whose worst error is within WORST_ERROR_FACTOR times
+// that (tried through apply_subset, which walks only the sampled groups),
+// and the pair whose full force call is fastest wins. The worst-error
+// check keeps a theta out whose RMS hides a few badly wrong bodies. If no pair
+// meets the budget, the most accurate one is used. Each decision is
+// written to `log` when one is given.
+//
+// Tuning runs on a private copy of the positions, so the caller's
+// accelerations only ever receive the chosen tree's forces.
+class Gravity_BarnesHut_Tuned : public Force {
+public:
+    // Throws std::runtime_error unless error_budget > 0 and samples >= 1.
+    explicit Gravity_BarnesHut_Tuned( double const error_budget = 1e-3,
+                                      std::size_t const retune_every = 0,
+                                      std::size_t const samples = 256,
+                                      BH_Expansion const expansion = BH_Expansion::Monopole,
+                                      simd::Isa const isa = simd::detect(),
+                                      std::ostream *const log = nullptr );
+
+    void apply( Particles &particles ) const override;
+
+    [[nodiscard]] bool supports_potential() const override { return true; }
+
+    // Uses the current choice, tuning first if there is none yet.
+    [[nodiscard]] bool supports_subset() const override { return true; }
+    void apply_subset( Particles &particles, std::vector<std::size_t> const &targets ) const override;
+
+    [[nodiscard]] double error_budget() const { return error_budget_; }
+    [[nodiscard]] std::size_t retune_every() const { return retune_every_; }
+    [[nodiscard]] std::size_t samples() const { return samples_; }
+
+    // The current choice (all zero before the first call), and how many
+    // times the tuner has run.
+    [[nodiscard]] BH_Tuning const &tuning() const { return tuning_; }
+    [[nodiscard]] std::size_t tunes() const { return tunes_; }
+
+    // The force in use.
+    [[nodiscard]] Gravity_BarnesHut const &force() const { return force_; }
+
+private:
+    double error_budget_;
+    std::size_t retune_every_;
+    std::size_t samples_;
+    BH_Expansion expansion_;
+    simd::Isa isa_;
+    std::ostream *log_;
+
+    mutable Gravity_BarnesHut force_;
+    mutable BH_Tuning tuning_{};
+    mutable std::size_t tunes_{};
+    mutable std::size_t calls_{};
+
+    // Tuning state: the position copy, the sampled indices and their
+    // exact accelerations (x, y, z per sample).
+    mutable std::optional<Particles> scratch_;
+    mutable std::vector<std::size_t> sample_;
+    mutable std::vector<double> exact_;
+    mutable std::mt19937_64 rng_{ 1 };
+
+    void tune( Particles const &particles ) const;
+
+    static constexpr double WORST_ERROR_FACTOR{ 20.0 };
+
+    // RMS and worst relative error of `force` over the sampled particles
+    // of scratch_.
+    struct Sample_Error {
+        double rms, worst;
+    };
+    Sample_Error sample_error( Gravity_BarnesHut const &force ) const;
+};
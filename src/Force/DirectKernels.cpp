@@ -0,0 +1,1067 @@
+#include "DirectKernels.hpp"
+#include "Force.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#if NBODY_X86
+    // GCC 12 flags the _mm512_undefined_*() pass-through operands inside the
+    // AVX-512 intrinsic headers as (maybe-)uninitialized; the lanes are never read.
+    #if defined(__GNUC__) && !defined(__clang__)
+        #pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+        #pragma GCC diagnostic ignored "-Wuninitialized"
+    #endif
+    #include <immintrin.h>
+#endif
+
+namespace direct {
+
+// POT additionally accumulates the softened potential -G m_j / R into
+// arrays.pot; the flag is a template parameter so the force-only loops are
+// unchanged.
+template <bool POT>
+static inline void scalar_impl( Direct_Arrays const &arrays,
+                                std::size_t const i_begin, std::size_t const i_end,
+                                std::size_t const j_begin, std::size_t const j_end ) {
+    constexpr double eps_sq{ config::EPS * config::EPS };
+    constexpr double G{ config::G };
+
+    double const* RESTRICT px{ arrays.px };
+    double const* RESTRICT py{ arrays.py };
+    double const* RESTRICT pz{ arrays.pz };
+    double const* RESTRICT mass{ arrays.mass };
+
+    for ( std::size_t i = i_begin; i < i_end; ++i ) {
+        double const pxi{ px[i] }, pyi{ py[i] }, pzi{ pz[i] };
+
+        double a_xi{}, a_yi{}, a_zi{}, phi_i{};
+
+        #pragma omp simd reduction( +:a_xi, a_yi, a_zi, phi_i )
+        for ( std::size_t j = j_begin; j < j_end; ++j ) {
+            double const mask{ ( i == j ) ? 0.0 : 1.0 };
+
+            if constexpr ( POT ) {
+                Gravity::accumulate_pairwise_pot (
+                    pxi, pyi, pzi,
+                    px[j], py[j], pz[j], mass[j],
+                    a_xi, a_yi, a_zi, phi_i,
+                    G, eps_sq, mask
+                );
+            } else {
+                Gravity::accumulate_pairwise (
+                    pxi, pyi, pzi,
+                    px[j], py[j], pz[j], mass[j],
+                    a_xi, a_yi, a_zi,
+                    G, eps_sq, mask
+                );
+            }
+        }
+
+        arrays.ax[i] += a_xi;
+        arrays.ay[i] += a_yi;
+        arrays.az[i] += a_zi;
+        if constexpr ( POT ) arrays.pot[i] += phi_i;
+    }
+}
+
+void kernel_scalar( Direct_Arrays const &arrays,
+                    std::size_t const i_begin, std::size_t const i_end,
+                    std::size_t const j_begin, std::size_t const j_end ) {
+    scalar_impl<false>( arrays, i_begin, i_end, j_begin, j_end );
+}
+
+void kernel_scalar_pot( Direct_Arrays const &arrays,
+                        std::size_t const i_begin, std::size_t const i_end,
+                        std::size_t const j_begin, std::size_t const j_end ) {
+    scalar_impl<true>( arrays, i_begin, i_end, j_begin, j_end );
+}
+
+// g(u) of the short-range kernels as a degree-12 Chebyshev fit on
+// [0, SHORT_RANGE_CUTOFF], in monomial form over t = 2 u / cutoff - 1
+// (max error 1.7e-6).
+static_assert( SHORT_RANGE_CUTOFF == 5.0, "short-range fit is for a cutoff of 5 r_split" );
+static constexpr std::array<double, 13> SHORT_RANGE_FIT{
+     0.3727512748026565,   -0.9239310958689689,    0.5197035718688633,
+     0.5948632369317969,   -0.7651475777293266,   -0.09309023617229087,
+     0.5282294430738013,   -0.15131052219250474,  -0.18222967088488784,
+     0.09680034488330044,   0.03138789718556067,  -0.020406694476220694,
+    -0.0017684182657175232
+};
+
+void kernel_short_range_scalar( Direct_Arrays const &arrays,
+                                std::size_t const i_begin, std::size_t const i_end,
+                                std::size_t const j_begin, std::size_t const j_end,
+                                double const r_split ) {
+    constexpr double eps_sq{ config::EPS * config::EPS };
+    constexpr double G{ config::G };
+    double const scale{ 2.0 / ( SHORT_RANGE_CUTOFF * r_split ) };
+
+    double const* RESTRICT px{ arrays.px };
+    double const* RESTRICT py{ arrays.py };
+    double const* RESTRICT pz{ arrays.pz };
+    double const* RESTRICT mass{ arrays.mass };
+
+    for ( std::size_t i = i_begin; i < i_end; ++i ) {
+        double const pxi{ px[i] }, pyi{ py[i] }, pzi{ pz[i] };
+
+        double a_xi{}, a_yi{}, a_zi{};
+
+        #pragma omp simd reduction( +:a_xi, a_yi, a_zi )
+        for ( std::size_t j = j_begin; j < j_end; ++j ) {
+            double const dx{ px[j] - pxi };
+            double const dy{ py[j] - pyi };
+            double const dz{ pz[j] - pzi };
+
+            double const d_sq{ dx*dx + dy*dy + dz*dz };
+            double const R_inv{ 1.0 / std::sqrt( d_sq + eps_sq ) };
+            double const t{ std::min( d_sq * R_inv * scale - 1.0, 1.0 ) };
+            double g{ SHORT_RANGE_FIT.back() };
+            for ( std::size_t c{ SHORT_RANGE_FIT.size() - 1 }; c-- > 0; ) g = g * t + SHORT_RANGE_FIT[c];
+
+            double const s{ ( d_sq > 0.0 && t < 1.0 ) ? G * mass[j] * g * R_inv * R_inv * R_inv : 0.0 };
+            a_xi += s * dx;
+            a_yi += s * dy;
+            a_zi += s * dz;
+        }
+
+        arrays.ax[i] += a_xi;
+        arrays.ay[i] += a_yi;
+        arrays.az[i] += a_zi;
+    }
+}
+
+template <bool POT>
+static void fixed_scalar( Direct_Arrays const &arrays, std::size_t const n,
+                          std::size_t const n_sources ) {
+    scalar_impl<POT>( arrays, 0, n, 0, n_sources );
+}
+
+void kernel_mixed_scalar( Mixed_Arrays const &arrays,
+                          std::size_t const i_begin, std::size_t const i_end,
+                          std::size_t const j_begin, std::size_t const j_end ) {
+    float const* RESTRICT x_hi{ arrays.x_hi };
+    float const* RESTRICT x_lo{ arrays.x_lo };
+    float const* RESTRICT y_hi{ arrays.y_hi };
+    float const* RESTRICT y_lo{ arrays.y_lo };
+    float const* RESTRICT z_hi{ arrays.z_hi };
+    float const* RESTRICT z_lo{ arrays.z_lo };
+    float const* RESTRICT w{ arrays.w };
+    float const eps_sq{ arrays.eps_sq };
+
+    for ( std::size_t i = i_begin; i < i_end; ++i ) {
+        float const xhi{ x_hi[i] }, xlo{ x_lo[i] };
+        float const yhi{ y_hi[i] }, ylo{ y_lo[i] };
+        float const zhi{ z_hi[i] }, zlo{ z_lo[i] };
+
+        double a_xi{}, a_yi{}, a_zi{};
+
+        for ( std::size_t j0 = j_begin; j0 < j_end; j0 += MIXED_FLUSH ) {
+            std::size_t const j1{ std::min( j_end, j0 + MIXED_FLUSH ) };
+
+            float f_x{}, f_y{}, f_z{};
+
+            // The hi difference is exact for nearby pairs (Sterbenz), so the
+            // lo correction restores the offset bits lost to the float cast.
+            // The weight is applied as ((w * R_inv) * R_inv) * R_inv so no
+            // intermediate leaves float range.
+            #pragma omp simd reduction( +:f_x, f_y, f_z )
+            for ( std::size_t j = j0; j < j1; ++j ) {
+                float const dx{ ( x_hi[j] - xhi ) + ( x_lo[j] - xlo ) };
+                float const dy{ ( y_hi[j] - yhi ) + ( y_lo[j] - ylo ) };
+                float const dz{ ( z_hi[j] - zhi ) + ( z_lo[j] - zlo ) };
+
+                float const d_sq{ dx*dx + dy*dy + dz*dz };
+                float const R_inv{ 1.0f / std::sqrt( d_sq + eps_sq ) };
+                float const s{ ( d_sq > 0.0f ) ? w[j] * R_inv * R_inv * R_inv : 0.0f };
+
+                f_x += s * dx;
+                f_y += s * dy;
+                f_z += s * dz;
+            }
+
+            a_xi += f_x;
+            a_yi += f_y;
+            a_zi += f_z;
+        }
+
+        arrays.ax[i] += a_xi;
+        arrays.ay[i] += a_yi;
+        arrays.az[i] += a_zi;
+    }
+}
+
+void kernel_symmetric_scalar( Direct_Arrays const &arrays,
+                              std::size_t const i_begin, std::size_t const i_end,
+                              std::size_t const j_begin, std::size_t const j_end ) {
+    constexpr double eps_sq{ config::EPS * config::EPS };
+    constexpr double G{ config::G };
+
+    double const* RESTRICT px{ arrays.px };
+    double const* RESTRICT py{ arrays.py };
+    double const* RESTRICT pz{ arrays.pz };
+    double const* RESTRICT mass{ arrays.mass };
+    double* RESTRICT bx{ arrays.ax };
+    double* RESTRICT by{ arrays.ay };
+    double* RESTRICT bz{ arrays.az };
+
+    for ( std::size_t i = i_begin; i < i_end; ++i ) {
+        double const pxi{ px[i] }, pyi{ py[i] }, pzi{ pz[i] };
+        double const G_mi{ G * mass[i] };
+
+        double a_xi{}, a_yi{}, a_zi{};
+
+        #pragma omp simd reduction( +:a_xi, a_yi, a_zi )
+        for ( std::size_t j = std::max( j_begin, i + 1 ); j < j_end; ++j ) {
+            double const dx{ px[j] - pxi };
+            double const dy{ py[j] - pyi };
+            double const dz{ pz[j] - pzi };
+
+            double const R_inv{ 1.0 / std::sqrt( dx*dx + dy*dy + dz*dz + eps_sq ) };
+            double const R_inv_cb{ R_inv * R_inv * R_inv };
+
+            double const s_i{ G * mass[j] * R_inv_cb };
+            double const s_j{ G_mi * R_inv_cb };
+
+            a_xi += s_i * dx; a_yi += s_i * dy; a_zi += s_i * dz;
+            bx[j] -= s_j * dx; by[j] -= s_j * dy; bz[j] -= s_j * dz;
+        }
+
+        bx[i] += a_xi;
+        by[i] += a_yi;
+        bz[i] += a_zi;
+    }
+}
+
+#if NBODY_X86
+
+// 1/sqrt(r_sq) to full double precision. AVX2 has no double-precision
+// estimate, so the exponent is split off first: r_sq * 2^(-2k) lies in [1, 4)
+// and converts to float without overflow or underflow for any normal input.
+// The ~12-bit float estimate is rescaled by 2^(-k) and refined by three
+// Newton steps (12 -> 24 -> 48 -> 53 bits).
+TARGET_AVX2 static inline __m256d rsqrt_avx2( __m256d const r_sq ) {
+    __m256i const bits{ _mm256_castpd_si256( r_sq ) };
+    __m256i const h{ _mm256_srli_epi64( _mm256_add_epi64( _mm256_srli_epi64( bits, 52 ),
+                                                          _mm256_set1_epi64x( 1 ) ), 1 ) };
+    __m256d const scale{ _mm256_castsi256_pd( _mm256_slli_epi64(
+        _mm256_sub_epi64( _mm256_set1_epi64x( 2047 ), _mm256_add_epi64( h, h ) ), 52 ) ) };
+    __m256d const rescale{ _mm256_castsi256_pd( _mm256_slli_epi64(
+        _mm256_sub_epi64( _mm256_set1_epi64x( 1535 ), h ), 52 ) ) };
+
+    __m128 const est{ _mm_rsqrt_ps( _mm256_cvtpd_ps( _mm256_mul_pd( r_sq, scale ) ) ) };
+    __m256d y{ _mm256_mul_pd( _mm256_cvtps_pd( est ), rescale ) };
+
+    __m256d const half_r_sq{ _mm256_mul_pd( _mm256_set1_pd( 0.5 ), r_sq ) };
+    __m256d const three_halves{ _mm256_set1_pd( 1.5 ) };
+    for ( int it{}; it < 3; ++it ) {
+        y = _mm256_mul_pd( y, _mm256_fnmadd_pd( half_r_sq, _mm256_mul_pd( y, y ), three_halves ) );
+    }
+    return y;
+}
+
+// R target vectors share every broadcast source, and their independent
+// dependency chains hide the latency of the reciprocal-sqrt refinement.
+// SHORT scales each pair by the short-range factor, `scale` being
+// 2 / (SHORT_RANGE_CUTOFF r_split).
+template <std::size_t R, bool POT, bool SHORT = false>
+TARGET_AVX2 static inline void group_avx2( Direct_Arrays const &arrays, std::size_t const i,
+                                           std::size_t const j_begin, std::size_t const j_end,
+                                           double const scale = 0.0 ) {
+    static_assert( !( POT && SHORT ) );
+    constexpr std::size_t W{ 4 };
+    constexpr double eps_sq{ config::EPS * config::EPS };
+    constexpr double G{ config::G };
+
+    double const* RESTRICT px{ arrays.px };
+    double const* RESTRICT py{ arrays.py };
+    double const* RESTRICT pz{ arrays.pz };
+    double const* RESTRICT mass{ arrays.mass };
+
+    __m256d const eps{ _mm256_set1_pd( eps_sq ) };
+    __m256d const zero{ _mm256_setzero_pd() };
+    __m256d const one{ _mm256_set1_pd( 1.0 ) };
+
+    __m256d xi[R], yi[R], zi[R];
+    __m256d a_xi[R], a_yi[R], a_zi[R], phi_i[R];
+    for ( std::size_t r{}; r < R; ++r ) {
+        xi[r] = _mm256_loadu_pd( px + i + r * W );
+        yi[r] = _mm256_loadu_pd( py + i + r * W );
+        zi[r] = _mm256_loadu_pd( pz + i + r * W );
+        a_xi[r] = a_yi[r] = a_zi[r] = phi_i[r] = zero;
+    }
+
+    for ( std::size_t j = j_begin; j < j_end; ++j ) {
+        __m256d const xj{ _mm256_set1_pd( px[j] ) };
+        __m256d const yj{ _mm256_set1_pd( py[j] ) };
+        __m256d const zj{ _mm256_set1_pd( pz[j] ) };
+        __m256d const G_mj{ _mm256_set1_pd( G * mass[j] ) };
+
+        for ( std::size_t r{}; r < R; ++r ) {
+            __m256d const dx{ _mm256_sub_pd( xj, xi[r] ) };
+            __m256d const dy{ _mm256_sub_pd( yj, yi[r] ) };
+            __m256d const dz{ _mm256_sub_pd( zj, zi[r] ) };
+
+            __m256d const d_sq{ _mm256_fmadd_pd( dx, dx, _mm256_fmadd_pd( dy, dy, _mm256_mul_pd( dz, dz ) ) ) };
+            __m256d const R_inv{ rsqrt_avx2( _mm256_add_pd( d_sq, eps ) ) };
+            __m256d const R_inv_cb{ _mm256_mul_pd( R_inv, _mm256_mul_pd( R_inv, R_inv ) ) };
+
+            // Zero separation only occurs for the self-term (or exact
+            // coincidence, which contributes nothing either way).
+            __m256d const mask{ _mm256_cmp_pd( d_sq, zero, _CMP_GT_OQ ) };
+            __m256d s{ _mm256_and_pd( mask, _mm256_mul_pd( G_mj, R_inv_cb ) ) };
+
+            // Pairs past the cutoff (t >= 1) are masked off, so the fit is
+            // never used outside its range.
+            if constexpr ( SHORT ) {
+                __m256d const t{ _mm256_fmsub_pd( _mm256_mul_pd( d_sq, R_inv ), _mm256_set1_pd( scale ), one ) };
+                __m256d g{ _mm256_set1_pd( SHORT_RANGE_FIT.back() ) };
+                for ( std::size_t c{ SHORT_RANGE_FIT.size() - 1 }; c-- > 0; ) {
+                    g = _mm256_fmadd_pd( g, t, _mm256_set1_pd( SHORT_RANGE_FIT[c] ) );
+                }
+                s = _mm256_and_pd( _mm256_cmp_pd( t, one, _CMP_LT_OQ ), _mm256_mul_pd( s, g ) );
+            }
+
+            a_xi[r] = _mm256_fmadd_pd( s, dx, a_xi[r] );
+            a_yi[r] = _mm256_fmadd_pd( s, dy, a_yi[r] );
+            a_zi[r] = _mm256_fmadd_pd( s, dz, a_zi[r] );
+
+            if constexpr ( POT ) {
+                phi_i[r] = _mm256_fnmadd_pd( _mm256_and_pd( mask, G_mj ), R_inv, phi_i[r] );
+            }
+        }
+    }
+
+    for ( std::size_t r{}; r < R; ++r ) {
+        std::size_t const k{ i + r * W };
+        _mm256_storeu_pd( arrays.ax + k, _mm256_add_pd( _mm256_loadu_pd( arrays.ax + k ), a_xi[r] ) );
+        _mm256_storeu_pd( arrays.ay + k, _mm256_add_pd( _mm256_loadu_pd( arrays.ay + k ), a_yi[r] ) );
+        _mm256_storeu_pd( arrays.az + k, _mm256_add_pd( _mm256_loadu_pd( arrays.az + k ), a_zi[r] ) );
+        if constexpr ( POT ) {
+            _mm256_storeu_pd( arrays.pot + k, _mm256_add_pd( _mm256_loadu_pd( arrays.pot + k ), phi_i[r] ) );
+        }
+    }
+}
+
+template <bool POT, bool SHORT = false>
+TARGET_AVX2 static inline void avx2_impl( Direct_Arrays const &arrays,
+                                          std::size_t const i_begin, std::size_t const i_end,
+                                          std::size_t const j_begin, std::size_t const j_end,
+                                          double const r_split = 0.0 ) {
+    constexpr std::size_t W{ 4 };
+    constexpr std::size_t R{ 2 };
+    double const scale{ SHORT ? 2.0 / ( SHORT_RANGE_CUTOFF * r_split ) : 0.0 };
+
+    std::size_t i{ i_begin };
+    for ( ; i + R * W <= i_end; i += R * W ) {
+        group_avx2<R, POT, SHORT>( arrays, i, j_begin, j_end, scale );
+    }
+    for ( ; i + W <= i_end; i += W ) {
+        group_avx2<1, POT, SHORT>( arrays, i, j_begin, j_end, scale );
+    }
+
+    if ( i < i_end ) {
+        if constexpr ( SHORT ) {
+            kernel_short_range_scalar( arrays, i, i_end, j_begin, j_end, r_split );
+        } else {
+            scalar_impl<POT>( arrays, i, i_end, j_begin, j_end );
+        }
+    }
+}
+
+TARGET_AVX2 void kernel_avx2( Direct_Arrays const &arrays,
+                              std::size_t const i_begin, std::size_t const i_end,
+                              std::size_t const j_begin, std::size_t const j_end ) {
+    avx2_impl<false>( arrays, i_begin, i_end, j_begin, j_end );
+}
+
+TARGET_AVX2 void kernel_avx2_pot( Direct_Arrays const &arrays,
+                                  std::size_t const i_begin, std::size_t const i_end,
+                                  std::size_t const j_begin, std::size_t const j_end ) {
+    avx2_impl<true>( arrays, i_begin, i_end, j_begin, j_end );
+}
+
+TARGET_AVX2 void kernel_short_range_avx2( Direct_Arrays const &arrays,
+                                          std::size_t const i_begin, std::size_t const i_end,
+                                          std::size_t const j_begin, std::size_t const j_end,
+                                          double const r_split ) {
+    avx2_impl<false, true>( arrays, i_begin, i_end, j_begin, j_end, r_split );
+}
+
+// rsqrt14 gives 14 bits; two Newton steps reach full double precision.
+TARGET_AVX512 static inline __m512d rsqrt_avx512( __m512d const r_sq ) {
+    __m512d y{ _mm512_rsqrt14_pd( r_sq ) };
+
+    __m512d const half_r_sq{ _mm512_mul_pd( _mm512_set1_pd( 0.5 ), r_sq ) };
+    __m512d const three_halves{ _mm512_set1_pd( 1.5 ) };
+    for ( int it{}; it < 2; ++it ) {
+        y = _mm512_mul_pd( y, _mm512_fnmadd_pd( half_r_sq, _mm512_mul_pd( y, y ), three_halves ) );
+    }
+    return y;
+}
+
+// As group_avx2; `tail` masks the lanes of the last vector in the group.
+template <std::size_t R, bool POT, bool SHORT = false>
+TARGET_AVX512 static inline void group_avx512( Direct_Arrays const &arrays, std::size_t const i,
+                                               __mmask8 const tail,
+                                               std::size_t const j_begin, std::size_t const j_end,
+                                               double const scale = 0.0 ) {
+    static_assert( !( POT && SHORT ) );
+    constexpr std::size_t W{ 8 };
+    constexpr double eps_sq{ config::EPS * config::EPS };
+    constexpr double G{ config::G };
+
+    double const* RESTRICT px{ arrays.px };
+    double const* RESTRICT py{ arrays.py };
+    double const* RESTRICT pz{ arrays.pz };
+    double const* RESTRICT mass{ arrays.mass };
+
+    __m512d const eps{ _mm512_set1_pd( eps_sq ) };
+    __m512d const zero{ _mm512_setzero_pd() };
+    __m512d const one{ _mm512_set1_pd( 1.0 ) };
+
+    __mmask8 live[R];
+    __m512d xi[R], yi[R], zi[R];
+    __m512d a_xi[R], a_yi[R], a_zi[R], phi_i[R];
+    for ( std::size_t r{}; r < R; ++r ) {
+        live[r] = ( r + 1 == R ) ? tail : static_cast<__mmask8>( 0xFF );
+        xi[r] = _mm512_maskz_loadu_pd( live[r], px + i + r * W );
+        yi[r] = _mm512_maskz_loadu_pd( live[r], py + i + r * W );
+        zi[r] = _mm512_maskz_loadu_pd( live[r], pz + i + r * W );
+        a_xi[r] = a_yi[r] = a_zi[r] = phi_i[r] = zero;
+    }
+
+    for ( std::size_t j = j_begin; j < j_end; ++j ) {
+        __m512d const xj{ _mm512_set1_pd( px[j] ) };
+        __m512d const yj{ _mm512_set1_pd( py[j] ) };
+        __m512d const zj{ _mm512_set1_pd( pz[j] ) };
+        __m512d const G_mj{ _mm512_set1_pd( G * mass[j] ) };
+
+        for ( std::size_t r{}; r < R; ++r ) {
+            __m512d const dx{ _mm512_sub_pd( xj, xi[r] ) };
+            __m512d const dy{ _mm512_sub_pd( yj, yi[r] ) };
+            __m512d const dz{ _mm512_sub_pd( zj, zi[r] ) };
+
+            __m512d const d_sq{ _mm512_fmadd_pd( dx, dx, _mm512_fmadd_pd( dy, dy, _mm512_mul_pd( dz, dz ) ) ) };
+            __m512d const R_inv{ rsqrt_avx512( _mm512_add_pd( d_sq, eps ) ) };
+            __m512d const R_inv_cb{ _mm512_mul_pd( R_inv, _mm512_mul_pd( R_inv, R_inv ) ) };
+
+            __mmask8 mask{ _mm512_cmp_pd_mask( d_sq, zero, _CMP_GT_OQ ) };
+            __m512d s{ _mm512_maskz_mul_pd( mask, G_mj, R_inv_cb ) };
+
+            if constexpr ( SHORT ) {
+                __m512d const t{ _mm512_fmsub_pd( _mm512_mul_pd( d_sq, R_inv ), _mm512_set1_pd( scale ), one ) };
+                __m512d g{ _mm512_set1_pd( SHORT_RANGE_FIT.back() ) };
+                for ( std::size_t c{ SHORT_RANGE_FIT.size() - 1 }; c-- > 0; ) {
+                    g = _mm512_fmadd_pd( g, t, _mm512_set1_pd( SHORT_RANGE_FIT[c] ) );
+                }
+                mask = _mm512_mask_cmp_pd_mask( mask, t, one, _CMP_LT_OQ );
+                s = _mm512_maskz_mul_pd( mask, s, g );
+            }
+
+            a_xi[r] = _mm512_fmadd_pd( s, dx, a_xi[r] );
+            a_yi[r] = _mm512_fmadd_pd( s, dy, a_yi[r] );
+            a_zi[r] = _mm512_fmadd_pd( s, dz, a_zi[r] );
+
+            if constexpr ( POT ) {
+                phi_i[r] = _mm512_mask3_fnmadd_pd( G_mj, R_inv, phi_i[r], mask );
+            }
+        }
+    }
+
+    for ( std::size_t r{}; r < R; ++r ) {
+        std::size_t const k{ i + r * W };
+        _mm512_mask_storeu_pd( arrays.ax + k, live[r], _mm512_add_pd( _mm512_maskz_loadu_pd( live[r], arrays.ax + k ), a_xi[r] ) );
+        _mm512_mask_storeu_pd( arrays.ay + k, live[r], _mm512_add_pd( _mm512_maskz_loadu_pd( live[r], arrays.ay + k ), a_yi[r] ) );
+        _mm512_mask_storeu_pd( arrays.az + k, live[r], _mm512_add_pd( _mm512_maskz_loadu_pd( live[r], arrays.az + k ), a_zi[r] ) );
+        if constexpr ( POT ) {
+            _mm512_mask_storeu_pd( arrays.pot + k, live[r], _mm512_add_pd( _mm512_maskz_loadu_pd( live[r], arrays.pot + k ), phi_i[r] ) );
+        }
+    }
+}
+
+template <bool POT, bool SHORT = false>
+TARGET_AVX512 static inline void avx512_impl( Direct_Arrays const &arrays,
+                                              std::size_t const i_begin, std::size_t const i_end,
+                                              std::size_t const j_begin, std::size_t const j_end,
+                                              double const r_split = 0.0 ) {
+    constexpr std::size_t W{ 8 };
+    constexpr std::size_t R{ 4 };
+    double const scale{ SHORT ? 2.0 / ( SHORT_RANGE_CUTOFF * r_split ) : 0.0 };
+
+    std::size_t i{ i_begin };
+    for ( ; i + R * W <= i_end; i += R * W ) {
+        group_avx512<R, POT, SHORT>( arrays, i, 0xFF, j_begin, j_end, scale );
+    }
+
+    // The tail is handled with lane masks rather than a scalar loop.
+    for ( ; i < i_end; i += W ) {
+        std::size_t const lanes{ std::min( W, i_end - i ) };
+        group_avx512<1, POT, SHORT>( arrays, i, static_cast<__mmask8>( ( 1u << lanes ) - 1u ), j_begin, j_end, scale );
+    }
+}
+
+TARGET_AVX512 void kernel_avx512( Direct_Arrays const &arrays,
+                                  std::size_t const i_begin, std::size_t const i_end,
+                                  std::size_t const j_begin, std::size_t const j_end ) {
+    avx512_impl<false>( arrays, i_begin, i_end, j_begin, j_end );
+}
+
+TARGET_AVX512 void kernel_avx512_pot( Direct_Arrays const &arrays,
+                                      std::size_t const i_begin, std::size_t const i_end,
+                                      std::size_t const j_begin, std::size_t const j_end ) {
+    avx512_impl<true>( arrays, i_begin, i_end, j_begin, j_end );
+}
+
+TARGET_AVX512 void kernel_short_range_avx512( Direct_Arrays const &arrays,
+                                              std::size_t const i_begin, std::size_t const i_end,
+                                              std::size_t const j_begin, std::size_t const j_end,
+                                              double const r_split ) {
+    avx512_impl<false, true>( arrays, i_begin, i_end, j_begin, j_end, r_split );
+}
+
+// The whole system is one group of BLOCKS vectors; only the last carries
+// a lane mask.
+template <std::size_t BLOCKS, bool POT>
+TARGET_AVX512 static void fixed_avx512( Direct_Arrays const &arrays, std::size_t const n,
+                                        std::size_t const n_sources ) {
+    std::size_t const lanes{ n - 8 * ( BLOCKS - 1 ) };
+    group_avx512<BLOCKS, POT>( arrays, 0, static_cast<__mmask8>( ( 1u << lanes ) - 1u ), 0, n_sources );
+}
+
+// group_avx2 has no lane masks, so the bodies are staged into zero-padded
+// local arrays. Padding targets are computed and discarded; padding sources
+// are never visited.
+template <std::size_t BLOCKS, bool POT>
+TARGET_AVX2 static void fixed_avx2( Direct_Arrays const &arrays, std::size_t const n,
+                                    std::size_t const n_sources ) {
+    constexpr std::size_t P{ 8 * BLOCKS };
+    alignas( 32 ) double stage[8][P]{};
+
+    for ( std::size_t i{}; i < n; ++i ) {
+        stage[0][i] = arrays.px[i];
+        stage[1][i] = arrays.py[i];
+        stage[2][i] = arrays.pz[i];
+        stage[3][i] = arrays.mass[i];
+    }
+
+    Direct_Arrays const padded {
+        stage[0], stage[1], stage[2], stage[3],
+        stage[4], stage[5], stage[6], stage[7]
+    };
+    group_avx2<2 * BLOCKS, POT>( padded, 0, 0, n_sources );
+
+    for ( std::size_t i{}; i < n; ++i ) {
+        arrays.ax[i] += stage[4][i];
+        arrays.ay[i] += stage[5][i];
+        arrays.az[i] += stage[6][i];
+        if constexpr ( POT ) arrays.pot[i] += stage[7][i];
+    }
+}
+
+TARGET_AVX2 void kernel_mixed_avx2( Mixed_Arrays const &arrays,
+                                    std::size_t const i_begin, std::size_t const i_end,
+                                    std::size_t const j_begin, std::size_t const j_end ) {
+    constexpr std::size_t W{ 8 };
+
+    float const* RESTRICT x_hi{ arrays.x_hi };
+    float const* RESTRICT x_lo{ arrays.x_lo };
+    float const* RESTRICT y_hi{ arrays.y_hi };
+    float const* RESTRICT y_lo{ arrays.y_lo };
+    float const* RESTRICT z_hi{ arrays.z_hi };
+    float const* RESTRICT z_lo{ arrays.z_lo };
+    float const* RESTRICT w{ arrays.w };
+
+    __m256 const eps{ _mm256_set1_ps( arrays.eps_sq ) };
+    __m256 const zero{ _mm256_setzero_ps() };
+    __m256 const half{ _mm256_set1_ps( 0.5f ) };
+    __m256 const three_halves{ _mm256_set1_ps( 1.5f ) };
+
+    std::size_t i{ i_begin };
+    for ( ; i + W <= i_end; i += W ) {
+        __m256 const xhi{ _mm256_loadu_ps( x_hi + i ) }, xlo{ _mm256_loadu_ps( x_lo + i ) };
+        __m256 const yhi{ _mm256_loadu_ps( y_hi + i ) }, ylo{ _mm256_loadu_ps( y_lo + i ) };
+        __m256 const zhi{ _mm256_loadu_ps( z_hi + i ) }, zlo{ _mm256_loadu_ps( z_lo + i ) };
+
+        __m256d a_x_lo{ _mm256_setzero_pd() }, a_x_hi{ _mm256_setzero_pd() };
+        __m256d a_y_lo{ _mm256_setzero_pd() }, a_y_hi{ _mm256_setzero_pd() };
+        __m256d a_z_lo{ _mm256_setzero_pd() }, a_z_hi{ _mm256_setzero_pd() };
+
+        for ( std::size_t j0 = j_begin; j0 < j_end; j0 += MIXED_FLUSH ) {
+            std::size_t const j1{ std::min( j_end, j0 + MIXED_FLUSH ) };
+
+            __m256 f_x{ zero }, f_y{ zero }, f_z{ zero };
+
+            for ( std::size_t j = j0; j < j1; ++j ) {
+                __m256 const dx{ _mm256_add_ps( _mm256_sub_ps( _mm256_set1_ps( x_hi[j] ), xhi ),
+                                                _mm256_sub_ps( _mm256_set1_ps( x_lo[j] ), xlo ) ) };
+                __m256 const dy{ _mm256_add_ps( _mm256_sub_ps( _mm256_set1_ps( y_hi[j] ), yhi ),
+                                                _mm256_sub_ps( _mm256_set1_ps( y_lo[j] ), ylo ) ) };
+                __m256 const dz{ _mm256_add_ps( _mm256_sub_ps( _mm256_set1_ps( z_hi[j] ), zhi ),
+                                                _mm256_sub_ps( _mm256_set1_ps( z_lo[j] ), zlo ) ) };
+
+                __m256 const d_sq{ _mm256_fmadd_ps( dx, dx, _mm256_fmadd_ps( dy, dy, _mm256_mul_ps( dz, dz ) ) ) };
+                __m256 const r_sq{ _mm256_add_ps( d_sq, eps ) };
+
+                // 12-bit estimate plus one Newton step (~23 bits).
+                __m256 R_inv{ _mm256_rsqrt_ps( r_sq ) };
+                R_inv = _mm256_mul_ps( R_inv, _mm256_fnmadd_ps( _mm256_mul_ps( half, r_sq ),
+                                                                _mm256_mul_ps( R_inv, R_inv ), three_halves ) );
+
+                __m256 const wj{ _mm256_set1_ps( w[j] ) };
+                __m256 const mask{ _mm256_cmp_ps( d_sq, zero, _CMP_GT_OQ ) };
+                __m256 const s{ _mm256_and_ps( mask, _mm256_mul_ps( _mm256_mul_ps( _mm256_mul_ps( wj, R_inv ), R_inv ), R_inv ) ) };
+
+                f_x = _mm256_fmadd_ps( s, dx, f_x );
+                f_y = _mm256_fmadd_ps( s, dy, f_y );
+                f_z = _mm256_fmadd_ps( s, dz, f_z );
+            }
+
+            a_x_lo = _mm256_add_pd( a_x_lo, _mm256_cvtps_pd( _mm256_castps256_ps128( f_x ) ) );
+            a_x_hi = _mm256_add_pd( a_x_hi, _mm256_cvtps_pd( _mm256_extractf128_ps( f_x, 1 ) ) );
+            a_y_lo = _mm256_add_pd( a_y_lo, _mm256_cvtps_pd( _mm256_castps256_ps128( f_y ) ) );
+            a_y_hi = _mm256_add_pd( a_y_hi, _mm256_cvtps_pd( _mm256_extractf128_ps( f_y, 1 ) ) );
+            a_z_lo = _mm256_add_pd( a_z_lo, _mm256_cvtps_pd( _mm256_castps256_ps128( f_z ) ) );
+            a_z_hi = _mm256_add_pd( a_z_hi, _mm256_cvtps_pd( _mm256_extractf128_ps( f_z, 1 ) ) );
+        }
+
+        _mm256_storeu_pd( arrays.ax + i,     _mm256_add_pd( _mm256_loadu_pd( arrays.ax + i ), a_x_lo ) );
+        _mm256_storeu_pd( arrays.ax + i + 4, _mm256_add_pd( _mm256_loadu_pd( arrays.ax + i + 4 ), a_x_hi ) );
+        _mm256_storeu_pd( arrays.ay + i,     _mm256_add_pd( _mm256_loadu_pd( arrays.ay + i ), a_y_lo ) );
+        _mm256_storeu_pd( arrays.ay + i + 4, _mm256_add_pd( _mm256_loadu_pd( arrays.ay + i + 4 ), a_y_hi ) );
+        _mm256_storeu_pd( arrays.az + i,     _mm256_add_pd( _mm256_loadu_pd( arrays.az + i ), a_z_lo ) );
+        _mm256_storeu_pd( arrays.az + i + 4, _mm256_add_pd( _mm256_loadu_pd( arrays.az + i + 4 ), a_z_hi ) );
+    }
+
+    if ( i < i_end ) {
+        kernel_mixed_scalar( arrays, i, i_end, j_begin, j_end );
+    }
+}
+
+TARGET_AVX512 static inline __m512d upper_avx512( __m512 const f ) {
+    return _mm512_cvtps_pd( _mm256_castpd_ps( _mm512_extractf64x4_pd( _mm512_castps_pd( f ), 1 ) ) );
+}
+
+TARGET_AVX512 void kernel_mixed_avx512( Mixed_Arrays const &arrays,
+                                        std::size_t const i_begin, std::size_t const i_end,
+                                        std::size_t const j_begin, std::size_t const j_end ) {
+    constexpr std::size_t W{ 16 };
+
+    float const* RESTRICT x_hi{ arrays.x_hi };
+    float const* RESTRICT x_lo{ arrays.x_lo };
+    float const* RESTRICT y_hi{ arrays.y_hi };
+    float const* RESTRICT y_lo{ arrays.y_lo };
+    float const* RESTRICT z_hi{ arrays.z_hi };
+    float const* RESTRICT z_lo{ arrays.z_lo };
+    float const* RESTRICT w{ arrays.w };
+
+    __m512 const eps{ _mm512_set1_ps( arrays.eps_sq ) };
+    __m512 const zero{ _mm512_setzero_ps() };
+    __m512 const half{ _mm512_set1_ps( 0.5f ) };
+    __m512 const three_halves{ _mm512_set1_ps( 1.5f ) };
+
+    for ( std::size_t i = i_begin; i < i_end; i += W ) {
+        std::size_t const lanes{ std::min( W, i_end - i ) };
+        __mmask16 const live{ static_cast<__mmask16>( ( 1u << lanes ) - 1u ) };
+        __mmask8 const live_lo{ static_cast<__mmask8>( live ) };
+        __mmask8 const live_hi{ static_cast<__mmask8>( live >> 8 ) };
+
+        __m512 const xhi{ _mm512_maskz_loadu_ps( live, x_hi + i ) }, xlo{ _mm512_maskz_loadu_ps( live, x_lo + i ) };
+        __m512 const yhi{ _mm512_maskz_loadu_ps( live, y_hi + i ) }, ylo{ _mm512_maskz_loadu_ps( live, y_lo + i ) };
+        __m512 const zhi{ _mm512_maskz_loadu_ps( live, z_hi + i ) }, zlo{ _mm512_maskz_loadu_ps( live, z_lo + i ) };
+
+        __m512d a_x_lo{ _mm512_setzero_pd() }, a_x_hi{ _mm512_setzero_pd() };
+        __m512d a_y_lo{ _mm512_setzero_pd() }, a_y_hi{ _mm512_setzero_pd() };
+        __m512d a_z_lo{ _mm512_setzero_pd() }, a_z_hi{ _mm512_setzero_pd() };
+
+        for ( std::size_t j0 = j_begin; j0 < j_end; j0 += MIXED_FLUSH ) {
+            std::size_t const j1{ std::min( j_end, j0 + MIXED_FLUSH ) };
+
+            __m512 f_x{ zero }, f_y{ zero }, f_z{ zero };
+
+            for ( std::size_t j = j0; j < j1; ++j ) {
+                __m512 const dx{ _mm512_add_ps( _mm512_sub_ps( _mm512_set1_ps( x_hi[j] ), xhi ),
+                                                _mm512_sub_ps( _mm512_set1_ps( x_lo[j] ), xlo ) ) };
+                __m512 const dy{ _mm512_add_ps( _mm512_sub_ps( _mm512_set1_ps( y_hi[j] ), yhi ),
+                                                _mm512_sub_ps( _mm512_set1_ps( y_lo[j] ), ylo ) ) };
+                __m512 const dz{ _mm512_add_ps( _mm512_sub_ps( _mm512_set1_ps( z_hi[j] ), zhi ),
+                                                _mm512_sub_ps( _mm512_set1_ps( z_lo[j] ), zlo ) ) };
+
+                __m512 const d_sq{ _mm512_fmadd_ps( dx, dx, _mm512_fmadd_ps( dy, dy, _mm512_mul_ps( dz, dz ) ) ) };
+                __m512 const r_sq{ _mm512_add_ps( d_sq, eps ) };
+
+                // 14-bit estimate plus one Newton step reaches float precision.
+                __m512 R_inv{ _mm512_rsqrt14_ps( r_sq ) };
+                R_inv = _mm512_mul_ps( R_inv, _mm512_fnmadd_ps( _mm512_mul_ps( half, r_sq ),
+                                                                _mm512_mul_ps( R_inv, R_inv ), three_halves ) );
+
+                __m512 const wj{ _mm512_set1_ps( w[j] ) };
+                __mmask16 const mask{ _mm512_cmp_ps_mask( d_sq, zero, _CMP_GT_OQ ) };
+                __m512 const s{ _mm512_maskz_mul_ps( mask, _mm512_mul_ps( _mm512_mul_ps( wj, R_inv ), R_inv ), R_inv ) };
+
+                f_x = _mm512_fmadd_ps( s, dx, f_x );
+                f_y = _mm512_fmadd_ps( s, dy, f_y );
+                f_z = _mm512_fmadd_ps( s, dz, f_z );
+            }
+
+            a_x_lo = _mm512_add_pd( a_x_lo, _mm512_cvtps_pd( _mm512_castps512_ps256( f_x ) ) );
+            a_x_hi = _mm512_add_pd( a_x_hi, upper_avx512( f_x ) );
+            a_y_lo = _mm512_add_pd( a_y_lo, _mm512_cvtps_pd( _mm512_castps512_ps256( f_y ) ) );
+            a_y_hi = _mm512_add_pd( a_y_hi, upper_avx512( f_y ) );
+            a_z_lo = _mm512_add_pd( a_z_lo, _mm512_cvtps_pd( _mm512_castps512_ps256( f_z ) ) );
+            a_z_hi = _mm512_add_pd( a_z_hi, upper_avx512( f_z ) );
+        }
+
+        _mm512_mask_storeu_pd( arrays.ax + i,     live_lo, _mm512_add_pd( _mm512_maskz_loadu_pd( live_lo, arrays.ax + i ), a_x_lo ) );
+        _mm512_mask_storeu_pd( arrays.ax + i + 8, live_hi, _mm512_add_pd( _mm512_maskz_loadu_pd( live_hi, arrays.ax + i + 8 ), a_x_hi ) );
+        _mm512_mask_storeu_pd( arrays.ay + i,     live_lo, _mm512_add_pd( _mm512_maskz_loadu_pd( live_lo, arrays.ay + i ), a_y_lo ) );
+        _mm512_mask_storeu_pd( arrays.ay + i + 8, live_hi, _mm512_add_pd( _mm512_maskz_loadu_pd( live_hi, arrays.ay + i + 8 ), a_y_hi ) );
+        _mm512_mask_storeu_pd( arrays.az + i,     live_lo, _mm512_add_pd( _mm512_maskz_loadu_pd( live_lo, arrays.az + i ), a_z_lo ) );
+        _mm512_mask_storeu_pd( arrays.az + i + 8, live_hi, _mm512_add_pd( _mm512_maskz_loadu_pd( live_hi, arrays.az + i + 8 ), a_z_hi ) );
+    }
+}
+
+TARGET_AVX2 static inline double hsum_avx2( __m256d const v ) {
+    __m128d const s{ _mm_add_pd( _mm256_castpd256_pd128( v ), _mm256_extractf128_pd( v, 1 ) ) };
+    return _mm_cvtsd_f64( _mm_add_sd( s, _mm_unpackhi_pd( s, s ) ) );
+}
+
+// Targets i .. i+R-1 are broadcast and sources sit in lanes, so each source
+// vector's reaction from all R targets is a single read-modify-write of the
+// buffer. Requires j_begin >= i + R (every pair is above the diagonal).
+template <std::size_t R>
+TARGET_AVX2 static inline void sym_rows_avx2( Direct_Arrays const &arrays, std::size_t const i,
+                                              std::size_t const j_begin, std::size_t const j_end ) {
+    constexpr std::size_t W{ 4 };
+    constexpr double eps_sq{ config::EPS * config::EPS };
+    constexpr double G{ config::G };
+
+    double const* RESTRICT px{ arrays.px };
+    double const* RESTRICT py{ arrays.py };
+    double const* RESTRICT pz{ arrays.pz };
+    double const* RESTRICT mass{ arrays.mass };
+    double* RESTRICT bx{ arrays.ax };
+    double* RESTRICT by{ arrays.ay };
+    double* RESTRICT bz{ arrays.az };
+
+    __m256d const eps{ _mm256_set1_pd( eps_sq ) };
+    __m256d const G_v{ _mm256_set1_pd( G ) };
+
+    __m256d xi[R], yi[R], zi[R], G_mi[R];
+    __m256d a_xi[R], a_yi[R], a_zi[R];
+    for ( std::size_t r{}; r < R; ++r ) {
+        xi[r] = _mm256_set1_pd( px[i + r] );
+        yi[r] = _mm256_set1_pd( py[i + r] );
+        zi[r] = _mm256_set1_pd( pz[i + r] );
+        G_mi[r] = _mm256_set1_pd( G * mass[i + r] );
+        a_xi[r] = a_yi[r] = a_zi[r] = _mm256_setzero_pd();
+    }
+
+    std::size_t j{ j_begin };
+    for ( ; j + W <= j_end; j += W ) {
+        __m256d const xj{ _mm256_loadu_pd( px + j ) };
+        __m256d const yj{ _mm256_loadu_pd( py + j ) };
+        __m256d const zj{ _mm256_loadu_pd( pz + j ) };
+        __m256d const G_mj{ _mm256_mul_pd( G_v, _mm256_loadu_pd( mass + j ) ) };
+
+        __m256d b_xj{ _mm256_loadu_pd( bx + j ) };
+        __m256d b_yj{ _mm256_loadu_pd( by + j ) };
+        __m256d b_zj{ _mm256_loadu_pd( bz + j ) };
+
+        for ( std::size_t r{}; r < R; ++r ) {
+            __m256d const dx{ _mm256_sub_pd( xj, xi[r] ) };
+            __m256d const dy{ _mm256_sub_pd( yj, yi[r] ) };
+            __m256d const dz{ _mm256_sub_pd( zj, zi[r] ) };
+
+            __m256d const d_sq{ _mm256_fmadd_pd( dx, dx, _mm256_fmadd_pd( dy, dy, _mm256_mul_pd( dz, dz ) ) ) };
+            __m256d const R_inv{ rsqrt_avx2( _mm256_add_pd( d_sq, eps ) ) };
+            __m256d const R_inv_cb{ _mm256_mul_pd( R_inv, _mm256_mul_pd( R_inv, R_inv ) ) };
+
+            __m256d const s_i{ _mm256_mul_pd( G_mj, R_inv_cb ) };
+            __m256d const s_j{ _mm256_mul_pd( G_mi[r], R_inv_cb ) };
+
+            a_xi[r] = _mm256_fmadd_pd( s_i, dx, a_xi[r] );
+            a_yi[r] = _mm256_fmadd_pd( s_i, dy, a_yi[r] );
+            a_zi[r] = _mm256_fmadd_pd( s_i, dz, a_zi[r] );
+
+            b_xj = _mm256_fnmadd_pd( s_j, dx, b_xj );
+            b_yj = _mm256_fnmadd_pd( s_j, dy, b_yj );
+            b_zj = _mm256_fnmadd_pd( s_j, dz, b_zj );
+        }
+
+        _mm256_storeu_pd( bx + j, b_xj );
+        _mm256_storeu_pd( by + j, b_yj );
+        _mm256_storeu_pd( bz + j, b_zj );
+    }
+
+    for ( std::size_t r{}; r < R; ++r ) {
+        bx[i + r] += hsum_avx2( a_xi[r] );
+        by[i + r] += hsum_avx2( a_yi[r] );
+        bz[i + r] += hsum_avx2( a_zi[r] );
+    }
+
+    if ( j < j_end ) {
+        kernel_symmetric_scalar( arrays, i, i + R, j, j_end );
+    }
+}
+
+TARGET_AVX2 void kernel_symmetric_avx2( Direct_Arrays const &arrays,
+                                        std::size_t const i_begin, std::size_t const i_end,
+                                        std::size_t const j_begin, std::size_t const j_end ) {
+    constexpr std::size_t R{ 4 };
+
+    std::size_t i{ i_begin };
+    for ( ; i + R <= i_end; i += R ) {
+        // Pairs inside the group's own triangle, then the rectangle beyond it.
+        for ( std::size_t r{}; r < R; ++r ) {
+            sym_rows_avx2<1>( arrays, i + r, std::max( j_begin, i + r + 1 ), std::min( j_end, i + R ) );
+        }
+        sym_rows_avx2<R>( arrays, i, std::max( j_begin, i + R ), j_end );
+    }
+    for ( ; i < i_end; ++i ) {
+        sym_rows_avx2<1>( arrays, i, std::max( j_begin, i + 1 ), j_end );
+    }
+}
+
+// As sym_rows_avx2; the source tail uses lane masks. Dead lanes load zero
+// mass, so they add nothing to the targets, and are never stored.
+template <std::size_t R>
+TARGET_AVX512 static inline void sym_rows_avx512( Direct_Arrays const &arrays, std::size_t const i,
+                                                  std::size_t const j_begin, std::size_t const j_end ) {
+    constexpr std::size_t W{ 8 };
+    constexpr double eps_sq{ config::EPS * config::EPS };
+    constexpr double G{ config::G };
+
+    double const* RESTRICT px{ arrays.px };
+    double const* RESTRICT py{ arrays.py };
+    double const* RESTRICT pz{ arrays.pz };
+    double const* RESTRICT mass{ arrays.mass };
+    double* RESTRICT bx{ arrays.ax };
+    double* RESTRICT by{ arrays.ay };
+    double* RESTRICT bz{ arrays.az };
+
+    __m512d const eps{ _mm512_set1_pd( eps_sq ) };
+    __m512d const G_v{ _mm512_set1_pd( G ) };
+
+    __m512d xi[R], yi[R], zi[R], G_mi[R];
+    __m512d a_xi[R], a_yi[R], a_zi[R];
+    for ( std::size_t r{}; r < R; ++r ) {
+        xi[r] = _mm512_set1_pd( px[i + r] );
+        yi[r] = _mm512_set1_pd( py[i + r] );
+        zi[r] = _mm512_set1_pd( pz[i + r] );
+        G_mi[r] = _mm512_set1_pd( G * mass[i + r] );
+        a_xi[r] = a_yi[r] = a_zi[r] = _mm512_setzero_pd();
+    }
+
+    for ( std::size_t j = j_begin; j < j_end; j += W ) {
+        std::size_t const lanes{ std::min( W, j_end - j ) };
+        __mmask8 const live{ static_cast<__mmask8>( ( 1u << lanes ) - 1u ) };
+
+        __m512d const xj{ _mm512_maskz_loadu_pd( live, px + j ) };
+        __m512d const yj{ _mm512_maskz_loadu_pd( live, py + j ) };
+        __m512d const zj{ _mm512_maskz_loadu_pd( live, pz + j ) };
+        __m512d const G_mj{ _mm512_mul_pd( G_v, _mm512_maskz_loadu_pd( live, mass + j ) ) };
+
+        __m512d b_xj{ _mm512_maskz_loadu_pd( live, bx + j ) };
+        __m512d b_yj{ _mm512_maskz_loadu_pd( live, by + j ) };
+        __m512d b_zj{ _mm512_maskz_loadu_pd( live, bz + j ) };
+
+        for ( std::size_t r{}; r < R; ++r ) {
+            __m512d const dx{ _mm512_sub_pd( xj, xi[r] ) };
+            __m512d const dy{ _mm512_sub_pd( yj, yi[r] ) };
+            __m512d const dz{ _mm512_sub_pd( zj, zi[r] ) };
+
+            __m512d const d_sq{ _mm512_fmadd_pd( dx, dx, _mm512_fmadd_pd( dy, dy, _mm512_mul_pd( dz, dz ) ) ) };
+            __m512d const R_inv{ rsqrt_avx512( _mm512_add_pd( d_sq, eps ) ) };
+            __m512d const R_inv_cb{ _mm512_mul_pd( R_inv, _mm512_mul_pd( R_inv, R_inv ) ) };
+
+            __m512d const s_i{ _mm512_mul_pd( G_mj, R_inv_cb ) };
+            __m512d const s_j{ _mm512_mul_pd( G_mi[r], R_inv_cb ) };
+
+            a_xi[r] = _mm512_fmadd_pd( s_i, dx, a_xi[r] );
+            a_yi[r] = _mm512_fmadd_pd( s_i, dy, a_yi[r] );
+            a_zi[r] = _mm512_fmadd_pd( s_i, dz, a_zi[r] );
+
+            b_xj = _mm512_fnmadd_pd( s_j, dx, b_xj );
+            b_yj = _mm512_fnmadd_pd( s_j, dy, b_yj );
+            b_zj = _mm512_fnmadd_pd( s_j, dz, b_zj );
+        }
+
+        _mm512_mask_storeu_pd( bx + j, live, b_xj );
+        _mm512_mask_storeu_pd( by + j, live, b_yj );
+        _mm512_mask_storeu_pd( bz + j, live, b_zj );
+    }
+
+    for ( std::size_t r{}; r < R; ++r ) {
+        bx[i + r] += _mm512_reduce_add_pd( a_xi[r] );
+        by[i + r] += _mm512_reduce_add_pd( a_yi[r] );
+        bz[i + r] += _mm512_reduce_add_pd( a_zi[r] );
+    }
+}
+
+TARGET_AVX512 void kernel_symmetric_avx512( Direct_Arrays const &arrays,
+                                            std::size_t const i_begin, std::size_t const i_end,
+                                            std::size_t const j_begin, std::size_t const j_end ) {
+    constexpr std::size_t R{ 4 };
+
+    std::size_t i{ i_begin };
+    for ( ; i + R <= i_end; i += R ) {
+        for ( std::size_t r{}; r < R; ++r ) {
+            sym_rows_avx512<1>( arrays, i + r, std::max( j_begin, i + r + 1 ), std::min( j_end, i + R ) );
+        }
+        sym_rows_avx512<R>( arrays, i, std::max( j_begin, i + R ), j_end );
+    }
+    for ( ; i < i_end; ++i ) {
+        sym_rows_avx512<1>( arrays, i, std::max( j_begin, i + 1 ), j_end );
+    }
+}
+
+#else
+
+template <std::size_t BLOCKS, bool POT>
+static void fixed_avx2( Direct_Arrays const &arrays, std::size_t const n,
+                        std::size_t const n_sources ) {
+    fixed_scalar<POT>( arrays, n, n_sources );
+}
+
+template <std::size_t BLOCKS, bool POT>
+static void fixed_avx512( Direct_Arrays const &arrays, std::size_t const n,
+                          std::size_t const n_sources ) {
+    fixed_scalar<POT>( arrays, n, n_sources );
+}
+
+void kernel_avx2( Direct_Arrays const &arrays,
+                  std::size_t const i_begin, std::size_t const i_end,
+                  std::size_t const j_begin, std::size_t const j_end ) {
+    kernel_scalar( arrays, i_begin, i_end, j_begin, j_end );
+}
+
+void kernel_avx2_pot( Direct_Arrays const &arrays,
+                      std::size_t const i_begin, std::size_t const i_end,
+                      std::size_t const j_begin, std::size_t const j_end ) {
+    kernel_scalar_pot( arrays, i_begin, i_end, j_begin, j_end );
+}
+
+void kernel_avx512_pot( Direct_Arrays const &arrays,
+                        std::size_t const i_begin, std::size_t const i_end,
+                        std::size_t const j_begin, std::size_t const j_end ) {
+    kernel_scalar_pot( arrays, i_begin, i_end, j_begin, j_end );
+}
+
+void kernel_avx512( Direct_Arrays const &arrays,
+                    std::size_t const i_begin, std::size_t const i_end,
+                    std::size_t const j_begin, std::size_t const j_end ) {
+    kernel_scalar( arrays, i_begin, i_end, j_begin, j_end );
+}
+
+void kernel_mixed_avx2( Mixed_Arrays const &arrays,
+                        std::size_t const i_begin, std::size_t const i_end,
+                        std::size_t const j_begin, std::size_t const j_end ) {
+    kernel_mixed_scalar( arrays, i_begin, i_end, j_begin, j_end );
+}
+
+void kernel_mixed_avx512( Mixed_Arrays const &arrays,
+                          std::size_t const i_begin, std::size_t const i_end,
+                          std::size_t const j_begin, std::size_t const j_end ) {
+    kernel_mixed_scalar( arrays, i_begin, i_end, j_begin, j_end );
+}
+
+void kernel_symmetric_avx2( Direct_Arrays const &arrays,
+                            std::size_t const i_begin, std::size_t const i_end,
+                            std::size_t const j_begin, std::size_t const j_end ) {
+    kernel_symmetric_scalar( arrays, i_begin, i_end, j_begin, j_end );
+}
+
+void kernel_symmetric_avx512( Direct_Arrays const &arrays,
+                              std::size_t const i_begin, std::size_t const i_end,
+                              std::size_t const j_begin, std::size_t const j_end ) {
+    kernel_symmetric_scalar( arrays, i_begin, i_end, j_begin, j_end );
+}
+
+void kernel_short_range_avx2( Direct_Arrays const &arrays,
+                              std::size_t const i_begin, std::size_t const i_end,
+                              std::size_t const j_begin, std::size_t const j_end,
+                              double const r_split ) {
+    kernel_short_range_scalar( arrays, i_begin, i_end, j_begin, j_end, r_split );
+}
+
+void kernel_short_range_avx512( Direct_Arrays const &arrays,
+                                std::size_t const i_begin, std::size_t const i_end,
+                                std::size_t const j_begin, std::size_t const j_end,
+                                double const r_split ) {
+    kernel_short_range_scalar( arrays, i_begin, i_end, j_begin, j_end, r_split );
+}
+
+#endif
+
+Direct_Kernel select( simd::Isa const isa, bool const potential ) {
+    simd::Isa const usable{ std::min( isa, simd::detect() ) };
+    switch ( usable ) {
+        case simd::Isa::AVX512: return potential ? &kernel_avx512_pot : &kernel_avx512;
+        case simd::Isa::AVX2:   return potential ? &kernel_avx2_pot : &kernel_avx2;
+        case simd::Isa::Scalar: return potential ? &kernel_scalar_pot : &kernel_scalar;
+    }
+    return potential ? &kernel_scalar_pot : &kernel_scalar;
+}
+
+Direct_Kernel select_symmetric( simd::Isa const isa ) {
+    simd::Isa const usable{ std::min( isa, simd::detect() ) };
+    switch ( usable ) {
+        case simd::Isa::AVX512: return &kernel_symmetric_avx512;
+        case simd::Isa::AVX2:   return &kernel_symmetric_avx2;
+        case simd::Isa::Scalar: return &kernel_symmetric_scalar;
+    }
+    return &kernel_symmetric_scalar;
+}
+
+template <std::size_t BLOCKS>
+Fixed_Kernel select_fixed( simd::Isa const isa, bool const potential ) {
+    static_assert( BLOCKS >= 1 && BLOCKS <= FIXED_MAX_BLOCKS );
+    simd::Isa const usable{ std::min( isa, simd::detect() ) };
+    switch ( usable ) {
+        case simd::Isa::AVX512: return potential ? &fixed_avx512<BLOCKS, true> : &fixed_avx512<BLOCKS, false>;
+        case simd::Isa::AVX2:   return potential ? &fixed_avx2<BLOCKS, true> : &fixed_avx2<BLOCKS, false>;
+        case simd::Isa::Scalar: return potential ? &fixed_scalar<true> : &fixed_scalar<false>;
+    }
+    return potential ? &fixed_scalar<true> : &fixed_scalar<false>;
+}
+
+template Fixed_Kernel select_fixed<1>( simd::Isa const, bool const );
+template Fixed_Kernel select_fixed<2>( simd::Isa const, bool const );
+template Fixed_Kernel select_fixed<3>( simd::Isa const, bool const );
+template Fixed_Kernel select_fixed<4>( simd::Isa const, bool const );
+template Fixed_Kernel select_fixed<5>( simd::Isa const, bool const );
+template Fixed_Kernel select_fixed<6>( simd::Isa const, bool const );
+template Fixed_Kernel select_fixed<7>( simd::Isa const, bool const );
+template Fixed_Kernel select_fixed<8>( simd::Isa const, bool const );
+
+Direct_Tiling auto_tiling() {
+    simd::Cache_Sizes const caches{ simd::cache_sizes() };
+
+    // Multiples of 64 keep every block and tile a whole number of vectors.
+    std::size_t const j_tile{ std::clamp<std::size_t>( caches.l1d / 2 / 32 / 64 * 64, 64, 4096 ) };
+    std::size_t const i_block{ std::clamp<std::size_t>( caches.l2 / 2 / 48 / 64 * 64, 64, 16384 ) };
+    return Direct_Tiling{ i_block, j_tile };
+}
+
+Mixed_Kernel select_mixed( simd::Isa const isa ) {
+    simd::Isa const usable{ std::min( isa, simd::detect() ) };
+    switch ( usable ) {
+        case simd::Isa::AVX512: return &kernel_mixed_avx512;
+        case simd::Isa::AVX2:   return &kernel_mixed_avx2;
+        case simd::Isa::Scalar: return &kernel_mixed_scalar;
+    }
+    return &kernel_mixed_scalar;
+}
+
+Short_Range_Kernel select_short_range( simd::Isa const isa ) {
+    simd::Isa const usable{ std::min( isa, simd::detect() ) };
+    switch ( usable ) {
+        case simd::Isa::AVX512: return &kernel_short_range_avx512;
+        case simd::Isa::AVX2:   return &kernel_short_range_avx2;
+        case simd::Isa::Scalar: return &kernel_short_range_scalar;
+    }
+    return &kernel_short_range_scalar;
+}
+
+}
@@ -0,0 +1,186 @@
+#pragma once
+
+#include "Simd.hpp"
+
+#include <cstddef>
+
+#if defined(__GNUC__) || defined(__clang__)
+    #define RESTRICT __restrict__
+#elif defined(_MSC_VER)
+    #define RESTRICT __restrict
+#else
+    #define RESTRICT
+#endif
+
+// Raw SoA views consumed by the direct-summation kernels.
+struct Direct_Arrays {
+    double const* RESTRICT px;
+    double const* RESTRICT py;
+    double const* RESTRICT pz;
+    double const* RESTRICT mass;
+    double* RESTRICT ax;
+    double* RESTRICT ay;
+    double* RESTRICT az;
+    double* RESTRICT pot;   // Only written by the *_pot kernels; may be null otherwise.
+};
+
+// Accumulates the acceleration due to sources [j_begin, j_end) onto targets
+// [i_begin, i_end). Each call owns its target range, so disjoint target
+// ranges may run concurrently. Self-interaction contributes nothing.
+using Direct_Kernel = void (*)( Direct_Arrays const &arrays,
+                                std::size_t const i_begin, std::size_t const i_end,
+                                std::size_t const j_begin, std::size_t const j_end );
+
+// Accumulates the acceleration due to sources [0, n_sources) onto targets
+// [0, n), with n_sources <= n; see direct::select_fixed.
+using Fixed_Kernel = void (*)( Direct_Arrays const &arrays, std::size_t const n,
+                               std::size_t const n_sources );
+
+// Loop blocking for direct summation. Targets are processed in blocks of up
+// to `i_block`; each block sweeps the sources in tiles of `j_tile`, so a tile
+// stays cache-resident while every target vector in the block passes over
+// it. j_tile == 0 streams all sources per block (no tiling).
+struct Direct_Tiling {
+    std::size_t i_block;
+    std::size_t j_tile;
+};
+
+// Float staging consumed by the mixed-precision kernels. Positions are
+// (x - origin) / L split into an unevaluated float pair hi + lo, with L a
+// power of two covering the bounding box, so pairwise offsets keep ~48
+// significant bits and every scaled quantity stays well inside float range.
+struct Mixed_Arrays {
+    float const* RESTRICT x_hi;
+    float const* RESTRICT x_lo;
+    float const* RESTRICT y_hi;
+    float const* RESTRICT y_lo;
+    float const* RESTRICT z_hi;
+    float const* RESTRICT z_lo;
+    float const* RESTRICT w;    // G m / L^2
+    float eps_sq;               // EPS^2 / L^2
+    double* RESTRICT ax;
+    double* RESTRICT ay;
+    double* RESTRICT az;
+};
+
+using Mixed_Kernel = void (*)( Mixed_Arrays const &arrays,
+                               std::size_t const i_begin, std::size_t const i_end,
+                               std::size_t const j_begin, std::size_t const j_end );
+
+using Short_Range_Kernel = void (*)( Direct_Arrays const &arrays,
+                                     std::size_t const i_begin, std::size_t const i_end,
+                                     std::size_t const j_begin, std::size_t const j_end,
+                                     double const r_split );
+
+namespace direct {
+    // Portable kernel: per target, an `omp simd` reduction over sources.
+    void kernel_scalar( Direct_Arrays const &arrays,
+                        std::size_t const i_begin, std::size_t const i_end,
+                        std::size_t const j_begin, std::size_t const j_end );
+
+    // Hand-vectorized kernels: targets live in vector lanes and each source is
+    // broadcast, so no horizontal reduction is needed. 1/sqrt comes from the
+    // hardware estimate refined by Newton iterations to full double accuracy.
+    void kernel_avx2( Direct_Arrays const &arrays,
+                      std::size_t const i_begin, std::size_t const i_end,
+                      std::size_t const j_begin, std::size_t const j_end );
+
+    void kernel_avx512( Direct_Arrays const &arrays,
+                        std::size_t const i_begin, std::size_t const i_end,
+                        std::size_t const j_begin, std::size_t const j_end );
+
+    // As above, also accumulating the softened potential -G m_j / R of every
+    // source into arrays.pot[i].
+    void kernel_scalar_pot( Direct_Arrays const &arrays,
+                            std::size_t const i_begin, std::size_t const i_end,
+                            std::size_t const j_begin, std::size_t const j_end );
+
+    void kernel_avx2_pot( Direct_Arrays const &arrays,
+                          std::size_t const i_begin, std::size_t const i_end,
+                          std::size_t const j_begin, std::size_t const j_end );
+
+    void kernel_avx512_pot( Direct_Arrays const &arrays,
+                            std::size_t const i_begin, std::size_t const i_end,
+                            std::size_t const j_begin, std::size_t const j_end );
+
+    // Kernel for `isa`, clamped to what the running CPU supports.
+    [[nodiscard]] Direct_Kernel select( simd::Isa const isa, bool const potential = false );
+
+    // Symmetric kernels: each pair (i, j) with j > i and j in [j_begin, j_end)
+    // is evaluated once. The pull on i is added to arrays.a*[i] and the equal
+    // and opposite pull on j to arrays.a*[j], so concurrent calls need
+    // separate accumulation buffers.
+    void kernel_symmetric_scalar( Direct_Arrays const &arrays,
+                                  std::size_t const i_begin, std::size_t const i_end,
+                                  std::size_t const j_begin, std::size_t const j_end );
+
+    void kernel_symmetric_avx2( Direct_Arrays const &arrays,
+                                std::size_t const i_begin, std::size_t const i_end,
+                                std::size_t const j_begin, std::size_t const j_end );
+
+    void kernel_symmetric_avx512( Direct_Arrays const &arrays,
+                                  std::size_t const i_begin, std::size_t const i_end,
+                                  std::size_t const j_begin, std::size_t const j_end );
+
+    [[nodiscard]] Direct_Kernel select_symmetric( simd::Isa const isa );
+
+    // Small-N kernels for a body count known at compile time. All n targets,
+    // with 8 * (BLOCKS - 1) < n <= 8 * BLOCKS, are held in registers as one
+    // group for a single sweep over the sources: no blocking, tiling or
+    // threading decisions are made per call. Instantiated for BLOCKS up to
+    // FIXED_MAX_BLOCKS.
+    inline constexpr std::size_t FIXED_MAX_BLOCKS{ 8 };
+
+    template <std::size_t BLOCKS>
+    [[nodiscard]] Fixed_Kernel select_fixed( simd::Isa const isa, bool const potential = false );
+
+    // Tile sizes from the host cache geometry: a source tile (32 B per body)
+    // fills half of L1d and a target block (48 B per body) half of L2.
+    [[nodiscard]] Direct_Tiling auto_tiling();
+
+    // Pre-tiling behaviour: 64-target blocks streaming every source.
+    inline constexpr Direct_Tiling UNTILED{ 64, 0 };
+
+    // Mixed precision: offsets, distance and inverse cube are evaluated in
+    // float at twice the lane count, and float partial sums are flushed into
+    // double accumulators every MIXED_FLUSH sources.
+    inline constexpr std::size_t MIXED_FLUSH{ 32 };
+
+    void kernel_mixed_scalar( Mixed_Arrays const &arrays,
+                              std::size_t const i_begin, std::size_t const i_end,
+                              std::size_t const j_begin, std::size_t const j_end );
+
+    void kernel_mixed_avx2( Mixed_Arrays const &arrays,
+                            std::size_t const i_begin, std::size_t const i_end,
+                            std::size_t const j_begin, std::size_t const j_end );
+
+    void kernel_mixed_avx512( Mixed_Arrays const &arrays,
+                              std::size_t const i_begin, std::size_t const i_end,
+                              std::size_t const j_begin, std::size_t const j_end );
+
+    [[nodiscard]] Mixed_Kernel select_mixed( simd::Isa const isa );
+
+    // Short-range kernels for a TreePM force split at r_split: each pair
+    // force is scaled by
+    //   g(u) = erfc(u / 2) + u / sqrt(pi) exp(-u^2 / 4),   u = r / r_split,
+    // and dropped beyond SHORT_RANGE_CUTOFF * r_split. g is a polynomial
+    // fit, so these run like the plain kernels. Force only.
+    inline constexpr double SHORT_RANGE_CUTOFF{ 5.0 };
+
+    void kernel_short_range_scalar( Direct_Arrays const &arrays,
+                                    std::size_t const i_begin, std::size_t const i_end,
+                                    std::size_t const j_begin, std::size_t const j_end,
+                                    double const r_split );
+
+    void kernel_short_range_avx2( Direct_Arrays const &arrays,
+                                  std::size_t const i_begin, std::size_t const i_end,
+                                  std::size_t const j_begin, std::size_t const j_end,
+                                  double const r_split );
+
+    void kernel_short_range_avx512( Direct_Arrays const &arrays,
+                                    std::size_t const i_begin, std::size_t const i_end,
+                                    std::size_t const j_begin, std::size_t const j_end,
+                                    double const r_split );
+
+    [[nodiscard]] Short_Range_Kernel select_short_range( simd::Isa const isa );
+}
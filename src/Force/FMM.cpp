@@ -0,0 +1,697 @@
+#include "FMM.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+#include <omp.h>
+
+Gravity_FMM::Gravity_FMM( int const order,
+                          double const theta,
+                          std::size_t const leaf_size,
+                          simd::Isa const isa )
+: order_{ order }
+, theta_{ theta }
+, leaf_size_{ leaf_size }
+, isa_{ std::min( isa, simd::detect() ) }
+, kernel_{ direct::select( isa ) }
+, pot_kernel_{ direct::select( isa, true ) }
+, num_terms_{}
+{
+    if ( order < 1 || order > MAX_ORDER ) {
+        throw std::runtime_error( "Gravity_FMM: order must lie in [1, " + std::to_string( MAX_ORDER ) + "]" );
+    }
+    if ( !( theta > 0.0 && theta < 1.0 ) ) {
+        throw std::runtime_error( "Gravity_FMM: theta must lie in (0, 1)" );
+    }
+    if ( leaf_size == 0 ) {
+        throw std::runtime_error( "Gravity_FMM: leaf size must be positive" );
+    }
+
+    // Multi-indices by degree, then by descending x and y exponent.
+    int const P{ order };
+    int const side{ P + 1 };
+    std::vector<int> index( static_cast<std::size_t>( side * side * side ), -1 );
+    auto index_of = [&]( int const a, int const b, int const c ) {
+        return ( a < 0 || b < 0 || c < 0 || a + b + c > P ) ? -1 : index[( a * side + b ) * side + c];
+    };
+    for ( int degree{}; degree <= P; ++degree ) {
+        for ( int a{ degree }; a >= 0; --a ) {
+            for ( int b{ degree - a }; b >= 0; --b ) {
+                int const c{ degree - a - b };
+                index[( a * side + b ) * side + c] = static_cast<int>( terms_.size() );
+                terms_.push_back( { a, b, c, degree, {}, {}, 0, 0.0 } );
+            }
+        }
+    }
+    num_terms_ = static_cast<int>( terms_.size() );
+
+    for ( Term &t : terms_ ) {
+        t.down[0] = index_of( t.a - 1, t.b, t.c );
+        t.down[1] = index_of( t.a, t.b - 1, t.c );
+        t.down[2] = index_of( t.a, t.b, t.c - 1 );
+        t.up[0] = index_of( t.a + 1, t.b, t.c );
+        t.up[1] = index_of( t.a, t.b + 1, t.c );
+        t.up[2] = index_of( t.a, t.b, t.c + 1 );
+        t.axis = ( t.a > 0 ) ? 0 : ( t.b > 0 ) ? 1 : 2;
+        int const exponent{ ( t.a > 0 ) ? t.a : ( t.b > 0 ) ? t.b : t.c };
+        t.inv = ( exponent > 0 ) ? 1.0 / exponent : 0.0;
+    }
+
+    // Multipole term outermost: consecutive M2L updates then go to different
+    // local terms and do not wait on each other.
+    for ( int k{}; k < num_terms_; ++k ) {
+        for ( int n{}; n < num_terms_; ++n ) {
+            Term const &tn{ terms_[n] };
+            Term const &tk{ terms_[k] };
+            if ( tn.degree + tk.degree > P ) continue;
+            pairs_.push_back( { n, k, index_of( tn.a + tk.a, tn.b + tk.b, tn.c + tk.c ) } );
+        }
+    }
+
+    // Derivatives of 1/r follow the recurrence
+    //   |t| r^2 D_t = -(2|t| - 1) sum_i t_i r_i D_{t - e_i} - (|t| - 1) sum_i t_i (t_i - 1) D_{t - 2 e_i},
+    // from differentiating r^2 grad(1/r) = -r / r. Term t reads three
+    // first-order and three second-order predecessors; absent ones point at
+    // term 0 with a zero coefficient.
+    recurrence_index_.assign( 6 * terms_.size(), 0 );
+    recurrence_coef_.assign( 6 * terms_.size(), 0.0 );
+    for ( std::size_t t{ 1 }; t < terms_.size(); ++t ) {
+        Term const &term{ terms_[t] };
+        int const e[3]{ term.a, term.b, term.c };
+        double const n{ static_cast<double>( term.degree ) };
+        for ( int i{}; i < 3; ++i ) {
+            if ( e[i] >= 1 ) {
+                recurrence_index_[6 * t + i] = term.down[i];
+                recurrence_coef_[6 * t + i] = -( 2.0 * n - 1.0 ) * e[i] / n;
+            }
+            if ( e[i] >= 2 ) {
+                recurrence_index_[6 * t + 3 + i] = terms_[term.down[i]].down[i];
+                recurrence_coef_[6 * t + 3 + i] = -( n - 1.0 ) * e[i] * ( e[i] - 1 ) / n;
+            }
+        }
+    }
+}
+
+
+void Gravity_FMM::monomials( double const sx, double const sy, double const sz, double* RESTRICT out ) const {
+    double const s[3]{ sx, sy, sz };
+    out[0] = 1.0;
+    for ( int t{ 1 }; t < num_terms_; ++t ) {
+        Term const &term{ terms_[t] };
+        out[t] = out[term.down[term.axis]] * s[term.axis] * term.inv;
+    }
+}
+
+
+void Gravity_FMM::build_tree( Particles const &particles ) const {
+    std::size_t const N{ particles.num_particles() };
+    std::size_t const N_a{ particles.num_active() };
+
+    double const* RESTRICT px{ particles.pos_x() };
+    double const* RESTRICT py{ particles.pos_y() };
+    double const* RESTRICT pz{ particles.pos_z() };
+    double const* RESTRICT mass{ particles.mass() };
+
+    // Root cube around every particle, sources and targets alike.
+    double min_x{ px[0] }, max_x{ px[0] };
+    double min_y{ py[0] }, max_y{ py[0] };
+    double min_z{ pz[0] }, max_z{ pz[0] };
+    #pragma omp parallel for reduction( min:min_x, min_y, min_z ) reduction( max:max_x, max_y, max_z ) \
+                             schedule( static ) if ( N >= config::OMP_THRESHOLD )
+    for ( std::size_t i = 1; i < N; ++i ) {
+        min_x = std::min( min_x, px[i] ); max_x = std::max( max_x, px[i] );
+        min_y = std::min( min_y, py[i] ); max_y = std::max( max_y, py[i] );
+        min_z = std::min( min_z, pz[i] ); max_z = std::max( max_z, pz[i] );
+    }
+    double edge{ std::max( { max_x - min_x, max_y - min_y, max_z - min_z } ) };
+    if ( edge <= 0.0 ) edge = 1.0;
+    edge *= 1.0 + 1e-12;
+    double const scale{ morton::CELLS / edge };
+
+    // Keys are computed in the previous call's order, which is usually
+    // still sorted (or nearly so) one step later.
+    if ( keys_.size() != N ) {
+        keys_.resize( N );
+        for ( std::size_t k{}; k < N; ++k ) keys_[k].second = static_cast<int>( k );
+    }
+    #pragma omp parallel for schedule( static ) if ( N >= config::OMP_THRESHOLD )
+    for ( std::size_t k = 0; k < N; ++k ) {
+        std::size_t const i{ static_cast<std::size_t>( keys_[k].second ) };
+        keys_[k].first = morton::encode( px[i], py[i], pz[i], min_x, min_y, min_z, scale );
+    }
+    if ( !std::is_sorted( keys_.begin(), keys_.end() ) ) std::sort( keys_.begin(), keys_.end() );
+
+    // Sorted staging copy; passive particles are massless sources.
+    staging_.resize( 8 * N );
+    double* RESTRICT sx{ staging_.data() };
+    double* RESTRICT sy{ sx + N };
+    double* RESTRICT sz{ sy + N };
+    double* RESTRICT sm{ sz + N };
+    double* RESTRICT acc{ sm + N };
+    #pragma omp parallel for schedule( static ) if ( N >= config::OMP_THRESHOLD )
+    for ( std::size_t k = 0; k < N; ++k ) {
+        std::size_t const i{ static_cast<std::size_t>( keys_[k].second ) };
+        sx[k] = px[i]; sy[k] = py[i]; sz[k] = pz[i];
+        sm[k] = ( i < N_a ) ? mass[i] : 0.0;
+        acc[k] = acc[N + k] = acc[2 * N + k] = acc[3 * N + k] = 0.0;
+    }
+
+    // Breadth-first split on the next Morton digit, so cells come out level
+    // by level and siblings are consecutive.
+    cells_.clear();
+    level_begin_.assign( 1, 0 );
+    FMM_Cell root{};
+    root.begin = 0;
+    root.end = static_cast<int>( N );
+    root.first_child = -1;
+    cells_.push_back( root );
+
+    for ( std::size_t c{}; c < cells_.size(); ++c ) {
+        FMM_Cell const cell{ cells_[c] };
+        if ( cell.level >= static_cast<int>( level_begin_.size() ) ) level_begin_.push_back( static_cast<int>( c ) );
+        if ( cell.end - cell.begin <= static_cast<int>( leaf_size_ ) || cell.level == KEY_LEVELS ) continue;
+
+        int const shift{ 3 * ( KEY_LEVELS - 1 - cell.level ) };
+        auto digit = [shift]( std::pair<std::uint64_t, int> const &key ) { return ( key.first >> shift ) & 7; };
+
+        int const first_child{ static_cast<int>( cells_.size() ) };
+        for ( int b{ cell.begin }; b < cell.end; ) {
+            std::uint64_t const d{ digit( keys_[b] ) };
+            auto const stop{ std::partition_point( keys_.begin() + b, keys_.begin() + cell.end,
+                                                   [&]( auto const &key ) { return digit( key ) == d; } ) };
+            FMM_Cell child{};
+            child.begin = b;
+            child.end = static_cast<int>( stop - keys_.begin() );
+            child.first_child = -1;
+            child.level = cell.level + 1;
+            cells_.push_back( child );
+            b = child.end;
+        }
+        cells_[c].first_child = first_child;
+        cells_[c].num_children = static_cast<int>( cells_.size() ) - first_child;
+    }
+    level_begin_.push_back( static_cast<int>( cells_.size() ) );
+}
+
+
+// Moments, centres and radii bottom-up: P2M in the leaves, M2M above.
+void Gravity_FMM::upward_pass() const {
+    std::size_t const N{ keys_.size() };
+    std::size_t const T{ static_cast<std::size_t>( num_terms_ ) };
+    double const* RESTRICT sx{ staging_.data() };
+    double const* RESTRICT sy{ sx + N };
+    double const* RESTRICT sz{ sy + N };
+    double const* RESTRICT sm{ sz + N };
+
+    multipoles_.resize( cells_.size() * T );
+
+    int const num_levels{ static_cast<int>( level_begin_.size() ) - 1 };
+    for ( int level{ num_levels - 1 }; level >= 0; --level ) {
+        int const first{ level_begin_[level] };
+        int const last{ level_begin_[level + 1] };
+
+        #pragma omp parallel for schedule( dynamic, 16 ) if ( N >= config::OMP_THRESHOLD )
+        for ( int c = first; c < last; ++c ) {
+            FMM_Cell &cell{ cells_[c] };
+            double* RESTRICT M{ multipoles_.data() + static_cast<std::size_t>( c ) * T };
+            std::fill_n( M, T, 0.0 );
+            double mono[MAX_TERMS];
+
+            double m_sum{}, x_sum{}, y_sum{}, z_sum{};
+            double lo[3]{ sx[cell.begin], sy[cell.begin], sz[cell.begin] };
+            double hi[3]{ lo[0], lo[1], lo[2] };
+            if ( cell.num_children == 0 ) {
+                for ( int k{ cell.begin }; k < cell.end; ++k ) {
+                    m_sum += sm[k];
+                    x_sum += sm[k] * sx[k]; y_sum += sm[k] * sy[k]; z_sum += sm[k] * sz[k];
+                    lo[0] = std::min( lo[0], sx[k] ); hi[0] = std::max( hi[0], sx[k] );
+                    lo[1] = std::min( lo[1], sy[k] ); hi[1] = std::max( hi[1], sy[k] );
+                    lo[2] = std::min( lo[2], sz[k] ); hi[2] = std::max( hi[2], sz[k] );
+                }
+            } else {
+                for ( int ch{ cell.first_child }; ch < cell.first_child + cell.num_children; ++ch ) {
+                    FMM_Cell const &child{ cells_[ch] };
+                    m_sum += child.mass;
+                    x_sum += child.mass * child.cx; y_sum += child.mass * child.cy; z_sum += child.mass * child.cz;
+                    for ( int i{}; i < 3; ++i ) {
+                        lo[i] = std::min( lo[i], child.lo[i] );
+                        hi[i] = std::max( hi[i], child.hi[i] );
+                    }
+                }
+            }
+
+            cell.mass = m_sum;
+            for ( int i{}; i < 3; ++i ) { cell.lo[i] = lo[i]; cell.hi[i] = hi[i]; }
+            if ( m_sum > 0.0 ) {
+                cell.cx = x_sum / m_sum; cell.cy = y_sum / m_sum; cell.cz = z_sum / m_sum;
+            } else {
+                cell.cx = 0.5 * ( lo[0] + hi[0] ); cell.cy = 0.5 * ( lo[1] + hi[1] ); cell.cz = 0.5 * ( lo[2] + hi[2] );
+            }
+
+            // Radius: the farthest bounding-box corner, tightened by the
+            // exact particle distances in a leaf or the children's spheres.
+            double const centre[3]{ cell.cx, cell.cy, cell.cz };
+            double corner_sq{};
+            for ( int i{}; i < 3; ++i ) {
+                double const d{ std::max( centre[i] - lo[i], hi[i] - centre[i] ) };
+                corner_sq += d * d;
+            }
+            double radius{};
+            if ( cell.num_children == 0 ) {
+                double r_sq{};
+                for ( int k{ cell.begin }; k < cell.end; ++k ) {
+                    double const dx{ sx[k] - cell.cx }, dy{ sy[k] - cell.cy }, dz{ sz[k] - cell.cz };
+                    r_sq = std::max( r_sq, dx*dx + dy*dy + dz*dz );
+                    if ( sm[k] == 0.0 ) continue;
+                    monomials( -dx, -dy, -dz, mono );
+                    for ( std::size_t t{}; t < T; ++t ) M[t] += sm[k] * mono[t];
+                }
+                radius = std::sqrt( r_sq );
+            } else {
+                for ( int ch{ cell.first_child }; ch < cell.first_child + cell.num_children; ++ch ) {
+                    FMM_Cell const &child{ cells_[ch] };
+                    double const dx{ child.cx - cell.cx }, dy{ child.cy - cell.cy }, dz{ child.cz - cell.cz };
+                    radius = std::max( radius, child.radius + std::sqrt( dx*dx + dy*dy + dz*dz ) );
+                    if ( child.mass == 0.0 ) continue;
+                    double const* RESTRICT child_M{ multipoles_.data() + static_cast<std::size_t>( ch ) * T };
+                    monomials( -dx, -dy, -dz, mono );
+                    for ( Term_Pair const &p : pairs_ ) M[p.nk] += child_M[p.n] * mono[p.k];
+                }
+                radius = std::min( radius, std::sqrt( corner_sq ) );
+            }
+            cell.radius = radius;
+        }
+    }
+}
+
+
+template <bool POTENTIAL>
+void Gravity_FMM::near_field( Cell_Pair const* RESTRICT near, std::size_t const count,
+                              Direct_Arrays const &arrays, Workspace &work ) const {
+    FMM_Cell const &A{ cells_[near[0].target] };
+    std::size_t const K{ static_cast<std::size_t>( A.end - A.begin ) };
+
+    // The leaf's own particles are targets and sources at once; the kernel
+    // drops the self-term.
+    std::size_t size{ K };
+    for ( std::size_t q{}; q < count; ++q ) {
+        FMM_Cell const &B{ cells_[near[q].source] };
+        if ( near[q].source != near[q].target ) size += static_cast<std::size_t>( B.end - B.begin );
+    }
+    if ( work.x.size() < size ) {
+        work.x.resize( size ); work.y.resize( size ); work.z.resize( size ); work.m.resize( size );
+    }
+    if ( work.ax.size() < K ) {
+        work.ax.resize( K ); work.ay.resize( K ); work.az.resize( K ); work.pot.resize( K );
+    }
+
+    auto stage = [&]( FMM_Cell const &cell, std::size_t const at ) {
+        std::size_t const n{ static_cast<std::size_t>( cell.end - cell.begin ) };
+        std::copy_n( arrays.px + cell.begin, n, work.x.data() + at );
+        std::copy_n( arrays.py + cell.begin, n, work.y.data() + at );
+        std::copy_n( arrays.pz + cell.begin, n, work.z.data() + at );
+        std::copy_n( arrays.mass + cell.begin, n, work.m.data() + at );
+        return at + n;
+    };
+    std::size_t at{ stage( A, 0 ) };
+    for ( std::size_t q{}; q < count; ++q ) {
+        if ( near[q].source != near[q].target ) at = stage( cells_[near[q].source], at );
+    }
+    std::fill_n( work.ax.begin(), K, 0.0 );
+    std::fill_n( work.ay.begin(), K, 0.0 );
+    std::fill_n( work.az.begin(), K, 0.0 );
+    std::fill_n( work.pot.begin(), K, 0.0 );
+
+    Direct_Arrays const list{ work.x.data(), work.y.data(), work.z.data(), work.m.data(),
+                              work.ax.data(), work.ay.data(), work.az.data(), work.pot.data() };
+    ( POTENTIAL ? pot_kernel_ : kernel_ )( list, 0, K, 0, size );
+
+    for ( std::size_t k{}; k < K; ++k ) {
+        arrays.ax[A.begin + k] += work.ax[k];
+        arrays.ay[A.begin + k] += work.ay[k];
+        arrays.az[A.begin + k] += work.az[k];
+        if constexpr ( POTENTIAL ) arrays.pot[A.begin + k] += work.pot[k];
+    }
+}
+
+
+// Multipole-to-local translations from up to M2L_LANES source cells into
+// one target, one source per lane so that every loop runs across lanes.
+// Arrays are term-major (term t of lane l at t * W + l): M holds each
+// source's multipole, L accumulates each lane's local contribution and D
+// receives the derivatives of 1/r at the lane's offset r = target - source.
+// Unused lanes need a zero multipole and a non-zero offset.
+static constexpr std::size_t M2L_LANES{ 8 };
+
+template <typename Pair>
+static inline void m2l_impl( std::size_t const terms, Pair const* RESTRICT pairs, std::size_t const num_pairs,
+                             int const* RESTRICT rec_index, double const* RESTRICT rec_coef,
+                             double const* RESTRICT rx, double const* RESTRICT ry, double const* RESTRICT rz,
+                             double const* RESTRICT M, double* RESTRICT D, double* RESTRICT L ) {
+    constexpr std::size_t W{ M2L_LANES };
+    double inv_r_sq[W];
+
+    #pragma omp simd
+    for ( std::size_t l = 0; l < W; ++l ) {
+        inv_r_sq[l] = 1.0 / ( rx[l] * rx[l] + ry[l] * ry[l] + rz[l] * rz[l] );
+        D[l] = std::sqrt( inv_r_sq[l] );
+    }
+    for ( std::size_t t{ 1 }; t < terms; ++t ) {
+        int const* RESTRICT i{ rec_index + 6 * t };
+        double const* RESTRICT c{ rec_coef + 6 * t };
+        double const* RESTRICT d0{ D + i[0] * W };
+        double const* RESTRICT d1{ D + i[1] * W };
+        double const* RESTRICT d2{ D + i[2] * W };
+        double const* RESTRICT d3{ D + i[3] * W };
+        double const* RESTRICT d4{ D + i[4] * W };
+        double const* RESTRICT d5{ D + i[5] * W };
+        double* RESTRICT out{ D + t * W };
+
+        #pragma omp simd
+        for ( std::size_t l = 0; l < W; ++l ) {
+            out[l] = inv_r_sq[l] * ( c[0] * rx[l] * d0[l] + c[1] * ry[l] * d1[l] + c[2] * rz[l] * d2[l]
+                                   + c[3] * d3[l] + c[4] * d4[l] + c[5] * d5[l] );
+        }
+    }
+    for ( std::size_t q{}; q < num_pairs; ++q ) {
+        double const* RESTRICT m{ M + pairs[q].k * W };
+        double const* RESTRICT d{ D + pairs[q].nk * W };
+        double* RESTRICT out{ L + pairs[q].n * W };
+
+        #pragma omp simd
+        for ( std::size_t l = 0; l < W; ++l ) out[l] += m[l] * d[l];
+    }
+}
+
+// The same loops compiled for each ISA; see simd::detect.
+template <typename Pair>
+TARGET_AVX512 static void m2l_avx512( std::size_t const terms, Pair const* RESTRICT pairs, std::size_t const num_pairs,
+                                      int const* RESTRICT rec_index, double const* RESTRICT rec_coef,
+                                      double const* RESTRICT rx, double const* RESTRICT ry, double const* RESTRICT rz,
+                                      double const* RESTRICT M, double* RESTRICT D, double* RESTRICT L ) {
+    m2l_impl( terms, pairs, num_pairs, rec_index, rec_coef, rx, ry, rz, M, D, L );
+}
+
+template <typename Pair>
+TARGET_AVX2 static void m2l_avx2( std::size_t const terms, Pair const* RESTRICT pairs, std::size_t const num_pairs,
+                                  int const* RESTRICT rec_index, double const* RESTRICT rec_coef,
+                                  double const* RESTRICT rx, double const* RESTRICT ry, double const* RESTRICT rz,
+                                  double const* RESTRICT M, double* RESTRICT D, double* RESTRICT L ) {
+    m2l_impl( terms, pairs, num_pairs, rec_index, rec_coef, rx, ry, rz, M, D, L );
+}
+
+
+void Gravity_FMM::far_field( Cell_Pair const* RESTRICT far, std::size_t const count, Workspace &work ) const {
+    constexpr std::size_t W{ M2L_LANES };
+    std::size_t const T{ static_cast<std::size_t>( num_terms_ ) };
+    FMM_Cell const &A{ cells_[far[0].target] };
+
+    work.lanes.resize( ( 3 + 3 * T ) * W );
+    double* RESTRICT rx{ work.lanes.data() };
+    double* RESTRICT ry{ rx + W };
+    double* RESTRICT rz{ ry + W };
+    double* RESTRICT M{ rz + W };
+    double* RESTRICT D{ M + T * W };
+    double* RESTRICT L{ D + T * W };
+    std::fill_n( L, T * W, 0.0 );
+
+    for ( std::size_t q{}; q < count; q += W ) {
+        std::size_t const lanes{ std::min( W, count - q ) };
+        for ( std::size_t l{}; l < W; ++l ) {
+            if ( l >= lanes ) {
+                rx[l] = 1.0; ry[l] = 0.0; rz[l] = 0.0;
+                for ( std::size_t t{}; t < T; ++t ) M[t * W + l] = 0.0;
+                continue;
+            }
+            int const b{ far[q + l].source };
+            FMM_Cell const &B{ cells_[b] };
+            rx[l] = A.cx - B.cx; ry[l] = A.cy - B.cy; rz[l] = A.cz - B.cz;
+            double const* RESTRICT source_M{ multipoles_.data() + static_cast<std::size_t>( b ) * T };
+            for ( std::size_t t{}; t < T; ++t ) M[t * W + l] = source_M[t];
+        }
+
+        switch ( isa_ ) {
+            case simd::Isa::AVX512:
+                m2l_avx512( T, pairs_.data(), pairs_.size(), recurrence_index_.data(), recurrence_coef_.data(),
+                            rx, ry, rz, M, D, L );
+                break;
+            case simd::Isa::AVX2:
+                m2l_avx2( T, pairs_.data(), pairs_.size(), recurrence_index_.data(), recurrence_coef_.data(),
+                          rx, ry, rz, M, D, L );
+                break;
+            case simd::Isa::Scalar:
+                m2l_impl( T, pairs_.data(), pairs_.size(), recurrence_index_.data(), recurrence_coef_.data(),
+                          rx, ry, rz, M, D, L );
+                break;
+        }
+    }
+
+    double* RESTRICT target_L{ locals_.data() + static_cast<std::size_t>( far[0].target ) * T };
+    for ( std::size_t t{}; t < T; ++t ) {
+        double sum{};
+        for ( std::size_t l{}; l < W; ++l ) sum += L[t * W + l];
+        target_L[t] += sum;
+    }
+}
+
+
+// Continues the pair walk from the task's seeds, collecting accepted pairs
+// in `far` and leaf pairs in `near`, sums both per target cell (M2L, P2P),
+// then shifts the locals down (L2L) and evaluates them at the particles
+// (L2P).
+template <bool POTENTIAL>
+void Gravity_FMM::evaluate( int const task, Cell_Pair const* RESTRICT seeds, std::size_t const num_seeds,
+                            Direct_Arrays const &arrays, Workspace &work ) const {
+    std::size_t const T{ static_cast<std::size_t>( num_terms_ ) };
+    double const theta_sq{ theta_ * theta_ };
+    double scratch[MAX_TERMS];
+    std::vector<Cell_Pair> &stack{ work.stack };
+    std::vector<Cell_Pair> &far{ work.far };
+    std::vector<Cell_Pair> &near{ work.near };
+
+    stack.clear();
+    far.clear();
+    near.clear();
+    stack.assign( seeds, seeds + num_seeds );
+    while ( !stack.empty() ) {
+        Cell_Pair const pair{ stack.back() };
+        stack.pop_back();
+        FMM_Cell const &A{ cells_[pair.target] };
+        FMM_Cell const &B{ cells_[pair.source] };
+        if ( B.mass == 0.0 ) continue;
+
+        double const rx{ A.cx - B.cx }, ry{ A.cy - B.cy }, rz{ A.cz - B.cz };
+        double const r_sum{ A.radius + B.radius };
+        if ( r_sum * r_sum < theta_sq * ( rx*rx + ry*ry + rz*rz ) ) {
+            far.push_back( pair );
+            continue;
+        }
+
+        bool const a_leaf{ A.num_children == 0 };
+        bool const b_leaf{ B.num_children == 0 };
+        if ( a_leaf && b_leaf ) {
+            near.push_back( pair );
+        } else if ( !a_leaf && ( b_leaf || A.radius >= B.radius ) ) {
+            for ( int ch{ A.first_child }; ch < A.first_child + A.num_children; ++ch ) {
+                stack.push_back( { ch, pair.source } );
+            }
+        } else {
+            for ( int ch{ B.first_child }; ch < B.first_child + B.num_children; ++ch ) {
+                stack.push_back( { pair.target, ch } );
+            }
+        }
+    }
+
+    // Both lists are summed per target cell.
+    auto by_target = []( Cell_Pair const &l, Cell_Pair const &r ) { return l.target < r.target; };
+    std::sort( far.begin(), far.end(), by_target );
+    for ( std::size_t q{}; q < far.size(); ) {
+        std::size_t r{ q + 1 };
+        while ( r < far.size() && far[r].target == far[q].target ) ++r;
+        far_field( far.data() + q, r - q, work );
+        q = r;
+    }
+    std::sort( near.begin(), near.end(), by_target );
+    for ( std::size_t q{}; q < near.size(); ) {
+        std::size_t r{ q + 1 };
+        while ( r < near.size() && near[r].target == near[q].target ) ++r;
+        near_field<POTENTIAL>( near.data() + q, r - q, arrays, work );
+        q = r;
+    }
+
+    double const G{ config::G };
+    stack.push_back( { task, 0 } );
+    while ( !stack.empty() ) {
+        int const c{ stack.back().target };
+        stack.pop_back();
+        FMM_Cell const &cell{ cells_[c] };
+        double const* RESTRICT L{ locals_.data() + static_cast<std::size_t>( c ) * T };
+
+        if ( cell.num_children > 0 ) {
+            for ( int ch{ cell.first_child }; ch < cell.first_child + cell.num_children; ++ch ) {
+                FMM_Cell const &child{ cells_[ch] };
+                double* RESTRICT child_L{ locals_.data() + static_cast<std::size_t>( ch ) * T };
+                monomials( child.cx - cell.cx, child.cy - cell.cy, child.cz - cell.cz, scratch );
+                for ( Term_Pair const &p : pairs_ ) child_L[p.n] += L[p.nk] * scratch[p.k];
+                stack.push_back( { ch, 0 } );
+            }
+            continue;
+        }
+
+        for ( int k{ cell.begin }; k < cell.end; ++k ) {
+            monomials( arrays.px[k] - cell.cx, arrays.py[k] - cell.cy, arrays.pz[k] - cell.cz, scratch );
+            double phi{}, gx{}, gy{}, gz{};
+            for ( std::size_t t{}; t < T; ++t ) {
+                Term const &term{ terms_[t] };
+                if constexpr ( POTENTIAL ) phi += L[t] * scratch[t];
+                if ( term.up[0] < 0 ) continue;  // top degree: no gradient term
+                gx += L[term.up[0]] * scratch[t];
+                gy += L[term.up[1]] * scratch[t];
+                gz += L[term.up[2]] * scratch[t];
+            }
+            arrays.ax[k] += G * gx;
+            arrays.ay[k] += G * gy;
+            arrays.az[k] += G * gz;
+            if constexpr ( POTENTIAL ) arrays.pot[k] -= G * phi;
+        }
+    }
+}
+
+
+void Gravity_FMM::apply( Particles &particles ) const {
+    if ( particles.num_active() == 0 ) return;
+
+    std::size_t const N{ particles.num_particles() };
+    build_tree( particles );
+    upward_pass();
+    locals_.assign( cells_.size() * static_cast<std::size_t>( num_terms_ ), 0.0 );
+
+    // Task level: the shallowest with enough cells to balance the threads.
+    int const num_levels{ static_cast<int>( level_begin_.size() ) - 1 };
+    int const wanted{ 8 * omp_get_max_threads() };
+    int task_level{};
+    while ( task_level + 1 < num_levels && level_begin_[task_level + 1] - level_begin_[task_level] < wanted ) {
+        ++task_level;
+    }
+    tasks_.clear();
+    for ( int c{}; c < level_begin_[task_level + 1]; ++c ) {
+        if ( cells_[c].level == task_level || cells_[c].num_children == 0 ) tasks_.push_back( c );
+    }
+
+    double* RESTRICT s{ staging_.data() };
+    Direct_Arrays const arrays{ s, s + N, s + 2 * N, s + 3 * N, s + 4 * N, s + 5 * N, s + 6 * N, s + 7 * N };
+    bool const pot{ potential() };
+
+    workspaces_.resize( static_cast<std::size_t>( omp_get_max_threads() ) );
+    std::size_t const num_tasks{ tasks_.size() };
+
+    // The walk from (root, root) down to the task level, serially, so that
+    // every pair is decided as in one walk whatever the thread count; a
+    // task walking from (task, root) would split pairs the mirror walk
+    // accepts, and the forces would no longer cancel pairwise. Pairs still
+    // open when their target reaches a task become its seeds.
+    {
+        Workspace &work{ workspaces_[0] };
+        double const theta_sq{ theta_ * theta_ };
+        std::vector<Cell_Pair> &stack{ work.stack };
+        std::vector<Cell_Pair> &far{ work.far };
+        stack.clear();
+        far.clear();
+        seeds_.clear();
+        stack.push_back( { 0, 0 } );
+        while ( !stack.empty() ) {
+            Cell_Pair const pair{ stack.back() };
+            stack.pop_back();
+            FMM_Cell const &A{ cells_[pair.target] };
+            FMM_Cell const &B{ cells_[pair.source] };
+            if ( B.mass == 0.0 ) continue;
+
+            double const rx{ A.cx - B.cx }, ry{ A.cy - B.cy }, rz{ A.cz - B.cz };
+            double const r_sum{ A.radius + B.radius };
+            if ( r_sum * r_sum < theta_sq * ( rx*rx + ry*ry + rz*rz ) ) {
+                far.push_back( pair );
+                continue;
+            }
+            if ( A.level >= task_level || A.num_children == 0 ) {
+                seeds_.push_back( pair );
+                continue;
+            }
+
+            if ( B.num_children == 0 || A.radius >= B.radius ) {
+                for ( int ch{ A.first_child }; ch < A.first_child + A.num_children; ++ch ) {
+                    stack.push_back( { ch, pair.source } );
+                }
+            } else {
+                for ( int ch{ B.first_child }; ch < B.first_child + B.num_children; ++ch ) {
+                    stack.push_back( { pair.target, ch } );
+                }
+            }
+        }
+
+        auto by_target = []( Cell_Pair const &l, Cell_Pair const &r ) { return l.target < r.target; };
+        std::sort( far.begin(), far.end(), by_target );
+        for ( std::size_t q{}; q < far.size(); ) {
+            std::size_t r{ q + 1 };
+            while ( r < far.size() && far[r].target == far[q].target ) ++r;
+            far_field( far.data() + q, r - q, work );
+            q = r;
+        }
+
+        // Locals above the task level are shifted to their children here;
+        // cells are stored level by level, so parents come first.
+        std::size_t const T{ static_cast<std::size_t>( num_terms_ ) };
+        double scratch[MAX_TERMS];
+        for ( int c{}; c < level_begin_[task_level]; ++c ) {
+            FMM_Cell const &cell{ cells_[c] };
+            double const* RESTRICT L{ locals_.data() + static_cast<std::size_t>( c ) * T };
+            for ( int ch{ cell.first_child }; ch < cell.first_child + cell.num_children; ++ch ) {
+                FMM_Cell const &child{ cells_[ch] };
+                double* RESTRICT child_L{ locals_.data() + static_cast<std::size_t>( ch ) * T };
+                monomials( child.cx - cell.cx, child.cy - cell.cy, child.cz - cell.cz, scratch );
+                for ( Term_Pair const &p : pairs_ ) child_L[p.n] += L[p.nk] * scratch[p.k];
+            }
+        }
+
+        // tasks_ is ascending, like the sorted seeds.
+        std::sort( seeds_.begin(), seeds_.end(), by_target );
+        seed_begin_.assign( num_tasks + 1, 0 );
+        std::size_t q{};
+        for ( std::size_t t{}; t < num_tasks; ++t ) {
+            seed_begin_[t] = q;
+            while ( q < seeds_.size() && seeds_[q].target == tasks_[t] ) ++q;
+        }
+        seed_begin_[num_tasks] = q;
+    }
+
+    // Subtrees differ in density and hence in walk cost.
+    #pragma omp parallel if ( N >= config::OMP_THRESHOLD )
+    {
+        Workspace &work{ workspaces_[static_cast<std::size_t>( omp_get_thread_num() )] };
+
+        #pragma omp for schedule( dynamic, 1 )
+        for ( std::size_t t = 0; t < num_tasks; ++t ) {
+            Cell_Pair const* seeds{ seeds_.data() + seed_begin_[t] };
+            std::size_t const num_seeds{ seed_begin_[t + 1] - seed_begin_[t] };
+            if ( pot ) {
+                evaluate<true>( tasks_[t], seeds, num_seeds, arrays, work );
+            } else {
+                evaluate<false>( tasks_[t], seeds, num_seeds, arrays, work );
+            }
+        }
+    }
+
+    double* RESTRICT ax{ particles.acc_x() };
+    double* RESTRICT ay{ particles.acc_y() };
+    double* RESTRICT az{ particles.acc_z() };
+    double* RESTRICT phi{ particles.pot() };
+    #pragma omp parallel for schedule( static ) if ( N >= config::OMP_THRESHOLD )
+    for ( std::size_t k = 0; k < N; ++k ) {
+        std::size_t const i{ static_cast<std::size_t>( keys_[k].second ) };
+        ax[i] += arrays.ax[k];
+        ay[i] += arrays.ay[k];
+        az[i] += arrays.az[k];
+        if ( pot ) phi[i] += arrays.pot[k];
+    }
+}
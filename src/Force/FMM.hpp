@@ -0,0 +1,152 @@
+#pragma once
+
+#include "Force.hpp"
+#include "../Particle/Morton.hpp"
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+// One cell of the FMM octree. Cells are stored level by level; the children
+// of an internal cell are consecutive from first_child, and a leaf has
+// num_children == 0. The cell holds particles [begin, end) of the
+// Morton-sorted staging copy. Expansions are taken about (cx, cy, cz), the
+// centre of mass (or the bounding-box centre of a massless cell), and
+// radius bounds the distance from there to any particle of the cell.
+struct FMM_Cell {
+    double cx, cy, cz;
+    double radius;
+    double mass;
+    double lo[3], hi[3];
+    int begin, end;
+    int first_child, num_children;
+    int level;
+};
+
+// Fast Multipole Method. Every cell carries a Cartesian multipole expansion
+// of its mass and a local (Taylor) expansion of the far-field potential,
+// both to degree `order`. Cells A and B interact through one
+// multipole-to-local translation when (r_A + r_B) < theta |z_A - z_B|;
+// otherwise the larger is split, down to leaf pairs summed by the direct
+// kernel for `isa`. Locals are then shifted down the tree and evaluated at
+// the particles, so the cost is O(N) at fixed order and theta.
+//
+// The tree holds every particle so that passive ones are targets too;
+// their mass is taken as zero, and massless source cells are skipped. The
+// far field is unsoftened, which only matters when the softening length is
+// comparable to the cell separation.
+class Gravity_FMM : public Force {
+public:
+    static constexpr int MAX_ORDER{ 10 };
+
+    // Throws std::runtime_error unless 1 <= order <= MAX_ORDER,
+    // 0 < theta < 1 and leaf_size >= 1.
+    explicit Gravity_FMM( int const order = 6,
+                          double const theta = 0.75,
+                          std::size_t const leaf_size = 128,
+                          simd::Isa const isa = simd::detect() );
+
+    void apply( Particles &particles ) const override;
+
+    // The potential comes from the same expansions and leaf sums.
+    [[nodiscard]] bool supports_potential() const override { return true; }
+
+    [[nodiscard]] int order() const { return order_; }
+    [[nodiscard]] double theta() const { return theta_; }
+    [[nodiscard]] std::size_t leaf_size() const { return leaf_size_; }
+    [[nodiscard]] simd::Isa isa() const { return isa_; }
+
+private:
+    int order_;
+    double theta_;
+    std::size_t leaf_size_;
+    simd::Isa isa_;
+    Direct_Kernel kernel_;
+    Direct_Kernel pot_kernel_;
+
+    // Expansion terms are the multi-indices (a, b, c) with a + b + c <= order,
+    // ordered by degree. About a cell centre z, multipole term t is
+    // sum m (z - y)^t / t! (the sign makes M2L a plain product) and local
+    // term t the t-th derivative of sum m / |x - y| at z.
+    static constexpr int MAX_TERMS{ ( MAX_ORDER + 1 ) * ( MAX_ORDER + 2 ) * ( MAX_ORDER + 3 ) / 6 };
+
+    struct Term {
+        int a, b, c;
+        int degree;
+        int down[3];    // index of t - e_i, or -1
+        int up[3];      // index of t + e_i, or -1 past the order
+        int axis;       // first axis with a non-zero exponent
+        double inv;     // 1 / that exponent
+    };
+
+    // Every (n, k) with |n| + |k| <= order, with nk the index of n + k.
+    // Drives the translations: M2M and L2L shift by a monomial in k, M2L
+    // pairs local term n with multipole term k through derivative n + k.
+    struct Term_Pair {
+        int n, k, nk;
+    };
+
+    std::vector<Term> terms_;
+    std::vector<Term_Pair> pairs_;
+    int num_terms_;
+
+    // Derivative recurrence for 1/r: six predecessor terms and
+    // coefficients per term; see the constructor.
+    std::vector<int> recurrence_index_;
+    std::vector<double> recurrence_coef_;
+
+    // Tree state, rebuilt every apply(); capacity is sticky.
+    mutable std::vector<FMM_Cell> cells_;
+    mutable std::vector<int> level_begin_;
+    mutable std::vector<std::pair<std::uint64_t, int>> keys_;
+    mutable std::vector<double> staging_;     // x, y, z, m, ax, ay, az, pot, each of N
+    mutable std::vector<double> multipoles_;  // num_terms_ per cell
+    mutable std::vector<double> locals_;      // num_terms_ per cell
+
+    // Traversal work: every cell on the task level plus shallower leaves.
+    // Each task owns its subtree, so tasks never write the same data. The
+    // walk above the task level runs serially, and the pairs it leaves
+    // open seed the task of their target: seeds_[seed_begin_[t],
+    // seed_begin_[t + 1]) for tasks_[t].
+    struct Cell_Pair {
+        int target, source;
+    };
+    mutable std::vector<int> tasks_;
+    mutable std::vector<Cell_Pair> seeds_;
+    mutable std::vector<std::size_t> seed_begin_;
+
+    // Per-thread traversal state. Accepted pairs are collected in `far` and
+    // translated a few sources at a time in vector lanes (`lanes` holds
+    // the batch). Leaf pairs that fail the test go to `near` and are summed
+    // per target leaf: its particles are staged first, then every source
+    // leaf's, for one kernel call.
+    struct Workspace {
+        std::vector<Cell_Pair> stack, far, near;
+        std::vector<double> lanes;
+        std::vector<double> x, y, z, m;
+        std::vector<double> ax, ay, az, pot;
+    };
+    mutable std::vector<Workspace> workspaces_;
+
+    static constexpr int KEY_LEVELS{ morton::LEVELS };
+
+    void build_tree( Particles const &particles ) const;
+    void upward_pass() const;
+
+    template <bool POTENTIAL>
+    void evaluate( int const task, Cell_Pair const* RESTRICT seeds, std::size_t const num_seeds,
+                   Direct_Arrays const &arrays, Workspace &work ) const;
+
+    // Sums far[0, count), which share one target cell, into its local.
+    void far_field( Cell_Pair const* RESTRICT far, std::size_t const count, Workspace &work ) const;
+
+    // Sums near[0, count), which share one target leaf, into its particles.
+    template <bool POTENTIAL>
+    void near_field( Cell_Pair const* RESTRICT near, std::size_t const count,
+                     Direct_Arrays const &arrays, Workspace &work ) const;
+
+    // out[t] = s^t / t! for every term.
+    void monomials( double const sx, double const sy, double const sz, double* RESTRICT out ) const;
+
+};
@@ -1,59 +1,273 @@
 #include "Force.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
 #include <omp.h>
 
-Gravity::Gravity()
-{ }
+Gravity::Gravity( simd::Isa const isa, Direct_Tiling const tiling )
+: isa_{ std::min( isa, simd::detect() ) }
+, kernel_{ direct::select( isa ) }
+, pot_kernel_{ direct::select( isa, true ) }
+, tiling_{ tiling }
+{
+    if ( tiling.i_block == 0 || tiling.i_block % 64 != 0 || tiling.j_tile % 64 != 0 ) {
+        throw std::runtime_error( "Gravity: tile sizes must be multiples of 64 (i_block > 0)" );
+    }
+}
 
 void Gravity::apply( Particles &particles ) const {
     std::size_t const N{ particles.num_particles() };
 
+    Direct_Arrays const arrays {
+        particles.pos_x(), particles.pos_y(), particles.pos_z(),
+        particles.mass(),
+        particles.acc_x(), particles.acc_y(), particles.acc_z(),
+        potential() ? particles.pot() : nullptr
+    };
+
+    // Each body sums over all N others (j = 0..N-1) rather than using j > i symmetry.
+    // This doubles FLOPs but preserves regular access patterns for SIMD and
+    // avoids write conflicts under OpenMP without atomic operations;
+    // Gravity_Symmetric is the opt-in pair-once alternative.
+    // Every particle is a target; only the active ones are sources.
+    sweep( arrays, potential() ? pot_kernel_ : kernel_, N, 0, particles.num_active() );
+}
+
+void Gravity::sweep( Direct_Arrays const &arrays, Direct_Kernel const kernel, std::size_t const n,
+                     std::size_t const j_begin, std::size_t const j_end ) const {
+    // Target blocks are a multiple of every vector width, so only the final
+    // block carries a partial (masked or scalar) tail. The block is capped so
+    // every thread still receives several blocks.
+    constexpr std::size_t UNIT{ 64 };
+    std::size_t const threads{ static_cast<std::size_t>( omp_get_max_threads() ) };
+    std::size_t const share{ ( n / ( 4 * threads ) ) / UNIT * UNIT };
+    std::size_t const block{ std::clamp( share, UNIT, tiling_.i_block ) };
+    std::size_t const tile{ tiling_.j_tile == 0 ? std::max<std::size_t>( j_end - j_begin, 1 ) : tiling_.j_tile };
+    std::size_t const num_blocks{ ( n + block - 1 ) / block };
+
+    #pragma omp parallel for schedule( static ) if ( n >= config::OMP_THRESHOLD )
+    for ( std::size_t b = 0; b < num_blocks; ++b ) {
+        std::size_t const i_begin{ b * block };
+        std::size_t const i_end{ std::min( n, i_begin + block ) };
+        for ( std::size_t j = j_begin; j < j_end; j += tile ) {
+            kernel( arrays, i_begin, i_end, j, std::min( j_end, j + tile ) );
+        }
+    }
+}
+
+void Gravity::apply_subset( Particles &particles, std::vector<std::size_t> const &targets ) const {
+    std::size_t const N{ particles.num_particles() };
+    std::size_t const N_a{ particles.num_active() };
+    std::size_t const K{ targets.size() };
+    if ( K == 0 ) return;
+
     double const* RESTRICT px{ particles.pos_x() };
     double const* RESTRICT py{ particles.pos_y() };
     double const* RESTRICT pz{ particles.pos_z() };
+    double const* RESTRICT mass{ particles.mass() };
+
+    // Staged order: [passive targets | active targets | active non-targets].
+    // Targets are then [0, K) and sources [P, P + N_a), both contiguous, and
+    // every particle appears once, so the kernels' self-term mask holds.
+    is_target_.assign( N, 0 );
+    for ( std::size_t const t : targets ) is_target_[t] = 1;
+
+    order_.clear();
+    order_.reserve( N );
+    for ( std::size_t const t : targets ) if ( t >= N_a ) order_.push_back( t );
+    std::size_t const P{ order_.size() };
+    for ( std::size_t const t : targets ) if ( t < N_a ) order_.push_back( t );
+    for ( std::size_t i{}; i < N_a; ++i ) if ( !is_target_[i] ) order_.push_back( i );
+
+    std::size_t const M{ order_.size() };
+    staging_.resize( 7 * M );
+    double* RESTRICT sx{ staging_.data() };
+    double* RESTRICT sy{ sx + M };
+    double* RESTRICT sz{ sy + M };
+    double* RESTRICT sm{ sz + M };
+    double* RESTRICT sax{ sm + M };
+    double* RESTRICT say{ sax + M };
+    double* RESTRICT saz{ say + M };
+
+    for ( std::size_t k{}; k < M; ++k ) {
+        std::size_t const i{ order_[k] };
+        sx[k] = px[i]; sy[k] = py[i]; sz[k] = pz[i]; sm[k] = mass[i];
+        sax[k] = 0.0;  say[k] = 0.0;  saz[k] = 0.0;
+    }
+
+    Direct_Arrays const arrays{ sx, sy, sz, sm, sax, say, saz, nullptr };
+    sweep( arrays, kernel_, K, P, P + N_a );
 
     double* RESTRICT ax{ particles.acc_x() };
     double* RESTRICT ay{ particles.acc_y() };
     double* RESTRICT az{ particles.acc_z() };
+    for ( std::size_t k{}; k < K; ++k ) {
+        std::size_t const i{ order_[k] };
+        ax[i] += sax[k];
+        ay[i] += say[k];
+        az[i] += saz[k];
+    }
+}
 
-    double const* RESTRICT mass{ particles.mass() };
+Gravity_Mixed::Gravity_Mixed( simd::Isa const isa )
+: isa_{ std::min( isa, simd::detect() ) }
+, kernel_{ direct::select_mixed( isa ) }
+{ }
 
-    constexpr double eps_sq{ config::EPS * config::EPS };
-    constexpr double G{ config::G };
+void Gravity_Mixed::apply( Particles &particles ) const {
+    std::size_t const N{ particles.num_particles() };
+    if ( N == 0 ) return;
 
-    // Each body sums over all N others (j = 0..N-1) rather than using j > i symmetry.
-    // This doubles FLOPs but preserves regular access patterns for SIMD and
-    // avoids write conflicts under OpenMP without atomic operations.
-    auto apply_kernel = [px, py, pz, ax, ay, az, mass, N]( std::size_t i ) {
-        double const pxi{ px[i] }, pyi{ py[i] }, pzi{ pz[i] };
-        
-        double a_xi{}, a_yi{}, a_zi{};
-
-        #pragma omp simd reduction( +:a_xi, a_yi, a_zi )
-        for ( std::size_t j = 0; j < N; ++j ) {
-            double const mask{ ( i == j ) ? 0.0 : 1.0 };
-
-            accumulate_pairwise (
-                pxi, pyi, pzi,
-                px[j], py[j], pz[j], mass[j],
-                a_xi, a_yi, a_zi,
-                G, eps_sq, mask
-            );
-        }
+    double const* RESTRICT px{ particles.pos_x() };
+    double const* RESTRICT py{ particles.pos_y() };
+    double const* RESTRICT pz{ particles.pos_z() };
+
+    // Length scale: the smallest power of two covering the bounding box, so
+    // every pairwise offset maps into [-1, 1] and the rescale is exact.
+    double min_x{ px[0] }, max_x{ px[0] };
+    double min_y{ py[0] }, max_y{ py[0] };
+    double min_z{ pz[0] }, max_z{ pz[0] };
+
+    #pragma omp parallel for reduction( min:min_x, min_y, min_z ) reduction( max:max_x, max_y, max_z ) \
+                             schedule( static ) if ( N >= config::OMP_THRESHOLD )
+    for ( std::size_t i = 0; i < N; ++i ) {
+        min_x = std::min( min_x, px[i] ); max_x = std::max( max_x, px[i] );
+        min_y = std::min( min_y, py[i] ); max_y = std::max( max_y, py[i] );
+        min_z = std::min( min_z, pz[i] ); max_z = std::max( max_z, pz[i] );
+    }
+
+    double const extent{ std::max( { max_x - min_x, max_y - min_y, max_z - min_z } ) };
+    int exponent{};
+    std::frexp( extent > 0.0 ? extent : 1.0, &exponent );
+    double const inv_length{ std::ldexp( 1.0, -exponent ) };
+    double const w_scale{ config::G * inv_length * inv_length };
 
-        ax[i] += a_xi;
-        ay[i] += a_yi;
-        az[i] += a_zi;
+    double const c_x{ 0.5 * ( min_x + max_x ) };
+    double const c_y{ 0.5 * ( min_y + max_y ) };
+    double const c_z{ 0.5 * ( min_z + max_z ) };
+
+    staging_.resize( 7 * N );
+    float* RESTRICT x_hi{ staging_.data() };
+    float* RESTRICT x_lo{ x_hi + N };
+    float* RESTRICT y_hi{ x_lo + N };
+    float* RESTRICT y_lo{ y_hi + N };
+    float* RESTRICT z_hi{ y_lo + N };
+    float* RESTRICT z_lo{ z_hi + N };
+    float* RESTRICT w{ z_lo + N };
+    double const* RESTRICT mass{ particles.mass() };
+
+    // Scaled coordinates lie in [-1/2, 1/2]; hi + lo carries ~48 bits of them.
+    #pragma omp parallel for simd schedule( static ) if ( N >= config::OMP_THRESHOLD )
+    for ( std::size_t i = 0; i < N; ++i ) {
+        double const sx{ ( px[i] - c_x ) * inv_length };
+        double const sy{ ( py[i] - c_y ) * inv_length };
+        double const sz{ ( pz[i] - c_z ) * inv_length };
+        x_hi[i] = static_cast<float>( sx ); x_lo[i] = static_cast<float>( sx - x_hi[i] );
+        y_hi[i] = static_cast<float>( sy ); y_lo[i] = static_cast<float>( sy - y_hi[i] );
+        z_hi[i] = static_cast<float>( sz ); z_lo[i] = static_cast<float>( sz - z_hi[i] );
+        w[i] = static_cast<float>( w_scale * mass[i] );
+    }
+
+    Mixed_Arrays const arrays {
+        x_hi, x_lo, y_hi, y_lo, z_hi, z_lo, w,
+        static_cast<float>( config::EPS * config::EPS * inv_length * inv_length ),
+        particles.acc_x(), particles.acc_y(), particles.acc_z()
     };
 
-    if ( N >= config::OMP_THRESHOLD ) {
-        #pragma omp parallel for schedule( static )
-        for ( std::size_t i = 0; i < N; ++i ) {
-            apply_kernel(i);
+    constexpr std::size_t BLOCK{ 64 };
+    std::size_t const N_a{ particles.num_active() };
+    std::size_t const num_blocks{ ( N + BLOCK - 1 ) / BLOCK };
+    Mixed_Kernel const kernel{ kernel_ };
+
+    #pragma omp parallel for schedule( static ) if ( N >= config::OMP_THRESHOLD )
+    for ( std::size_t b = 0; b < num_blocks; ++b ) {
+        std::size_t const i_begin{ b * BLOCK };
+        std::size_t const i_end{ std::min( N, i_begin + BLOCK ) };
+        kernel( arrays, i_begin, i_end, 0, N_a );
+    }
+}
+
+Gravity_Symmetric::Gravity_Symmetric( simd::Isa const isa )
+: isa_{ std::min( isa, simd::detect() ) }
+, kernel_{ direct::select_symmetric( isa ) }
+, passive_kernel_{ direct::select( isa ) }
+{ }
+
+void Gravity_Symmetric::apply( Particles &particles ) const {
+    std::size_t const N_total{ particles.num_particles() };
+    // Pairs are evaluated among the active bodies only; passive targets
+    // receive their one-way pull from the direct kernel at the end.
+    std::size_t const N{ particles.num_active() };
+    if ( N_total < 2 ) return;
+
+    bool const parallel{ N_total >= config::OMP_THRESHOLD };
+    std::size_t const threads{ parallel ? static_cast<std::size_t>( omp_get_max_threads() ) : 1 };
+    // Rounded to a cache line so neighbouring threads never share one.
+    std::size_t const stride{ ( N + 7 ) / 8 * 8 };
+    buffers_.resize( threads * 3 * stride );
+
+    double* RESTRICT acc_x{ particles.acc_x() };
+    double* RESTRICT acc_y{ particles.acc_y() };
+    double* RESTRICT acc_z{ particles.acc_z() };
+
+    // Row i holds N - 1 - i pairs, so blocks shrink in cost; handing them
+    // out dynamically from the front keeps the threads balanced.
+    constexpr std::size_t BLOCK{ 64 };
+    std::size_t const num_blocks{ ( N + BLOCK - 1 ) / BLOCK };
+    std::size_t const tile{ direct::auto_tiling().j_tile };
+    Direct_Kernel const kernel{ kernel_ };
+
+    #pragma omp parallel num_threads( static_cast<int>( threads ) ) if ( parallel )
+    {
+        // The team may be smaller than requested; only its buffers are used.
+        std::size_t const team{ static_cast<std::size_t>( omp_get_num_threads() ) };
+        std::size_t const t{ static_cast<std::size_t>( omp_get_thread_num() ) };
+        double* RESTRICT buffer{ buffers_.data() + t * 3 * stride };
+        std::fill( buffer, buffer + 3 * stride, 0.0 );
+
+        Direct_Arrays const arrays {
+            particles.pos_x(), particles.pos_y(), particles.pos_z(),
+            particles.mass(),
+            buffer, buffer + stride, buffer + 2 * stride,
+            nullptr
+        };
+
+        #pragma omp for schedule( dynamic, 1 )
+        for ( std::size_t b = 0; b < num_blocks; ++b ) {
+            std::size_t const i_begin{ b * BLOCK };
+            std::size_t const i_end{ std::min( N, i_begin + BLOCK ) };
+            for ( std::size_t j_begin = i_begin + 1; j_begin < N; j_begin += tile ) {
+                kernel( arrays, i_begin, i_end, j_begin, std::min( N, j_begin + tile ) );
+            }
         }
-    } else {
+
+        // The implicit barrier above makes every buffer complete.
+        #pragma omp for schedule( static )
         for ( std::size_t i = 0; i < N; ++i ) {
-            apply_kernel(i);
+            double a_x{}, a_y{}, a_z{};
+            for ( std::size_t k{}; k < team; ++k ) {
+                double const* RESTRICT src{ buffers_.data() + k * 3 * stride };
+                a_x += src[i];
+                a_y += src[stride + i];
+                a_z += src[2 * stride + i];
+            }
+            acc_x[i] += a_x;
+            acc_y[i] += a_y;
+            acc_z[i] += a_z;
+        }
+
+        Direct_Arrays const passive {
+            particles.pos_x(), particles.pos_y(), particles.pos_z(),
+            particles.mass(),
+            acc_x, acc_y, acc_z,
+            nullptr
+        };
+
+        #pragma omp for schedule( static )
+        for ( std::size_t i_begin = N; i_begin < N_total; i_begin += BLOCK ) {
+            passive_kernel_( passive, i_begin, std::min( N_total, i_begin + BLOCK ), 0, N );
         }
     }
-}
\ No newline at end of file
+}
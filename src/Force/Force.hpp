@@ -2,10 +2,14 @@
 
 #include "../Particle/Particle.hpp"
 #include "../Config.hpp"
+#include "DirectKernels.hpp"
+#include "Simd.hpp"
 
+#include <algorithm>
 #include <vector>
 #include <cmath>
 #include <cstddef>
+#include <stdexcept>
 
 #if defined(__GNUC__) || defined(__clang__)
     #define RESTRICT __restrict__
@@ -16,14 +20,47 @@
 #endif
 
 class Force {
+protected:
+    bool potential_{ false };
+
 public:
     virtual ~Force() = default;
     virtual void apply( Particles &particles ) const = 0;
+
+    // Potential mode: while enabled, apply() also accumulates each body's
+    // softened potential (energy per unit mass) into particles.pot(), so the
+    // potential energy is 1/2 sum m_i pot_i. Only honoured by forces that
+    // report supports_potential(); the caller zeroes pot beforehand.
+    [[nodiscard]] virtual bool supports_potential() const { return false; }
+    void set_potential( bool const enabled ) { potential_ = enabled; }
+    [[nodiscard]] bool potential() const { return potential_; }
+
+    // Target subset: accumulates accelerations onto the listed particles only,
+    // still summing over every active source; all other accelerations are
+    // left untouched. Used by individual-timestep integrators, which update
+    // a few particles per sub-step. Potential mode is not honoured here.
+    [[nodiscard]] virtual bool supports_subset() const { return false; }
+    virtual void apply_subset( Particles &, std::vector<std::size_t> const & ) const {
+        throw std::runtime_error( "Force: target subsets are not supported" );
+    }
 };
 
 class Gravity : public Force {
+private:
+    simd::Isa isa_;
+    Direct_Kernel kernel_;
+    Direct_Kernel pot_kernel_;
+    Direct_Tiling tiling_;
+
 public:
-    Gravity();
+    // Defaults to the widest kernel the running CPU supports. Requesting a
+    // wider ISA than is available silently falls back to the best supported.
+    // Tile sizes default to the host cache geometry; see direct::auto_tiling.
+    explicit Gravity( simd::Isa const isa = simd::detect(),
+                      Direct_Tiling const tiling = direct::auto_tiling() );
+
+    [[nodiscard]] simd::Isa isa() const { return isa_; }
+    [[nodiscard]] Direct_Tiling tiling() const { return tiling_; }
 
     // Accumulates gravitational acceleration on body i due to body j.
     // mask = 0.0 for self-interaction (i == j), 1.0 otherwise.
@@ -53,5 +90,131 @@ public:
         a_zi += mask * f_z;
     }
 
+    // As accumulate_pairwise, also accumulating the softened potential
+    // -G m_j / R into phi_i.
+    static inline void accumulate_pairwise_pot (
+        double const pxi, double const pyi, double const pzi,
+        double const pxj, double const pyj, double const pzj, double const mj,
+        double &a_xi, double &a_yi, double &a_zi, double &phi_i,
+        double const G, double const eps_sq, double const mask ) {
+
+        double const dx{ pxj - pxi };
+        double const dy{ pyj - pyi };
+        double const dz{ pzj - pzi };
+
+        double const R_sq{ dx*dx + dy*dy + dz*dz + eps_sq };
+        double const R_inv{ 1.0 / std::sqrt( R_sq ) };
+
+        double const G_mj_R_inv{ mask * G * mj * R_inv };
+        double const G_mj_R_inv_cb{ G_mj_R_inv * R_inv * R_inv };
+
+        a_xi += G_mj_R_inv_cb * dx;
+        a_yi += G_mj_R_inv_cb * dy;
+        a_zi += G_mj_R_inv_cb * dz;
+        phi_i -= G_mj_R_inv;
+    }
+
+    [[nodiscard]] bool supports_potential() const override { return true; }
+    [[nodiscard]] bool supports_subset() const override { return true; }
+
+    void apply( Particles &particles ) const override;
+
+    // Targets are gathered ahead of the active sources into a staging copy,
+    // so the regular blocked kernels run over them unchanged.
+    void apply_subset( Particles &particles, std::vector<std::size_t> const &targets ) const override;
+
+private:
+    // Blocked, tiled sweep of targets [0, n) over sources [j_begin, j_end).
+    void sweep( Direct_Arrays const &arrays, Direct_Kernel const kernel, std::size_t const n,
+                std::size_t const j_begin, std::size_t const j_end ) const;
+
+    // Subset staging: px, py, pz, mass, ax, ay, az, each of length N.
+    mutable std::vector<double> staging_;
+    mutable std::vector<std::size_t> order_;
+    mutable std::vector<unsigned char> is_target_;
+};
+
+// Mixed-precision direct summation. Positions are staged once per call as
+// float-float pairs in box-scaled units; offsets, distance and inverse cube
+// are evaluated in float at twice the vector width; partial sums are
+// accumulated in double. Per-pair relative force error is ~1e-6,
+// well below Barnes-Hut truncation error, so it suits large-N runs where
+// the double kernel's cost dominates but exact pair forces are not needed.
+class Gravity_Mixed : public Force {
+private:
+    simd::Isa isa_;
+    Mixed_Kernel kernel_;
+
+    // Float staging (7 arrays of N), reused across calls.
+    mutable std::vector<float> staging_;
+
+public:
+    explicit Gravity_Mixed( simd::Isa const isa = simd::detect() );
+
+    [[nodiscard]] simd::Isa isa() const { return isa_; }
+
     void apply( Particles &particles ) const override;
-};
\ No newline at end of file
+};
+
+// Direct summation exploiting Newton's third law: each pair is evaluated
+// once and its equal and opposite contributions go to per-thread buffers,
+// which are then reduced in parallel. Half the pair work of Gravity; total
+// momentum is conserved to rounding, pair by pair. Passive particles feel
+// the active bodies through the ordinary direct kernel.
+class Gravity_Symmetric : public Force {
+private:
+    simd::Isa isa_;
+    Direct_Kernel kernel_;
+    Direct_Kernel passive_kernel_;
+
+    // One 3 x stride block per thread, reused across calls.
+    mutable std::vector<double> buffers_;
+
+public:
+    explicit Gravity_Symmetric( simd::Isa const isa = simd::detect() );
+
+    [[nodiscard]] simd::Isa isa() const { return isa_; }
+
+    void apply( Particles &particles ) const override;
+};
+
+// Direct summation for a body count fixed at compile time, aimed at small
+// systems such as the solar-system run, where Gravity's per-call blocking,
+// tiling and threading decisions are a visible share of each evaluation.
+// The whole system is evaluated by one kernel call holding every target in
+// registers (see direct::select_fixed). N is limited to
+// 8 * direct::FIXED_MAX_BLOCKS.
+template <std::size_t N>
+class Gravity_Fixed : public Force {
+    static_assert( N >= 1 && N <= 8 * direct::FIXED_MAX_BLOCKS,
+                   "Gravity_Fixed: N out of range, use Gravity" );
+
+private:
+    simd::Isa isa_;
+    Fixed_Kernel kernel_;
+    Fixed_Kernel pot_kernel_;
+
+public:
+    explicit Gravity_Fixed( simd::Isa const isa = simd::detect() )
+    : isa_{ std::min( isa, simd::detect() ) }
+    , kernel_{ direct::select_fixed<( N + 7 ) / 8>( isa ) }
+    , pot_kernel_{ direct::select_fixed<( N + 7 ) / 8>( isa, true ) }
+    { }
+
+    [[nodiscard]] simd::Isa isa() const { return isa_; }
+    [[nodiscard]] bool supports_potential() const override { return true; }
+
+    void apply( Particles &particles ) const override {
+        if ( particles.num_particles() != N ) {
+            throw std::runtime_error( "Gravity_Fixed: particle count does not match N" );
+        }
+
+        Direct_Arrays const arrays {
+            particles.pos_x(), particles.pos_y(), particles.pos_z(),
+            particles.mass(),
+            particles.acc_x(), particles.acc_y(), particles.acc_z(),
+            potential() ? particles.pot() : nullptr
+        };
+        ( potential() ? pot_kernel_ : kernel_ )( arrays, N, particles.num_active() );
+    }
+};
@@ -0,0 +1,345 @@
+#include "PM.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <numbers>
+#include <stdexcept>
+
+#include <omp.h>
+
+// Potential at the centre of a uniform cube of unit side and unit mass,
+// in units of G: the self term of the unsplit Green's function.
+static constexpr double CUBE_SELF_POTENTIAL{ -2.3800772 };
+
+Gravity_PM::Gravity_PM( std::size_t const mesh, double const split )
+: mesh_{ mesh }
+, split_{ split }
+, padded_{ 2 * mesh }
+{
+    if ( mesh < 16 || !std::has_single_bit( mesh ) || !( split >= 0.0 ) ) {
+        throw std::runtime_error( "Gravity_PM: mesh must be a power of two >= 16 and split >= 0" );
+    }
+
+    std::size_t const P{ padded_ };
+    int const bits{ std::countr_zero( P ) };
+    bit_reverse_.resize( P );
+    for ( std::size_t i{}; i < P; ++i ) {
+        std::size_t r{};
+        for ( int b{}; b < bits; ++b ) r |= ( ( i >> b ) & 1 ) << ( bits - 1 - b );
+        bit_reverse_[i] = r;
+    }
+    twiddles_.resize( P / 2 );
+    for ( std::size_t k{}; k < P / 2; ++k ) {
+        double const angle{ -2.0 * std::numbers::pi * static_cast<double>( k ) / static_cast<double>( P ) };
+        twiddles_[k] = { std::cos( angle ), std::sin( angle ) };
+    }
+
+    // Green's function at every offset of the padded grid, offsets past
+    // P/2 wrapping to negative ones, transformed once.
+    grid_.assign( P * P * P, 0.0 );
+    #pragma omp parallel for schedule( static )
+    for ( std::size_t k = 0; k < P; ++k ) {
+        double const dz{ k <= P / 2 ? static_cast<double>( k ) : static_cast<double>( k ) - static_cast<double>( P ) };
+        for ( std::size_t j{}; j < P; ++j ) {
+            double const dy{ j <= P / 2 ? static_cast<double>( j ) : static_cast<double>( j ) - static_cast<double>( P ) };
+            for ( std::size_t i{}; i < P; ++i ) {
+                double const dx{ i <= P / 2 ? static_cast<double>( i ) : static_cast<double>( i ) - static_cast<double>( P ) };
+                double const r{ std::sqrt( dx*dx + dy*dy + dz*dz ) };
+                double g;
+                if ( split_ > 0.0 ) {
+                    g = r > 0.0 ? -std::erf( 0.5 * r / split_ ) / r : -std::numbers::inv_sqrtpi / split_;
+                } else {
+                    g = r > 0.0 ? -1.0 / r : CUBE_SELF_POTENTIAL;
+                }
+                grid_[i + P * ( j + P * k )] = g;
+            }
+        }
+    }
+    fft_3d( false, P );
+
+    // With a split, the long-range modes are also divided by the square
+    // of the cloud-in-cell window, sinc^2(pi n / P) per axis, which
+    // assignment and interpolation each apply once. Without one the
+    // deconvolution would only sharpen the unresolved short range.
+    std::size_t const H{ P / 2 + 1 };
+    std::vector<double> window( H, 1.0 );
+    if ( split_ > 0.0 ) {
+        for ( std::size_t n{ 1 }; n < H; ++n ) {
+            double const x{ std::numbers::pi * static_cast<double>( n ) / static_cast<double>( P ) };
+            double const sinc{ std::sin( x ) / x };
+            window[n] = sinc * sinc;
+        }
+    }
+    green_.resize( H * H * H );
+    for ( std::size_t k{}; k < H; ++k ) {
+        for ( std::size_t j{}; j < H; ++j ) {
+            for ( std::size_t i{}; i < H; ++i ) {
+                double const w{ window[i] * window[j] * window[k] };
+                green_[i + H * ( j + H * k )] = grid_[i + P * ( j + P * k )].real() / ( w * w );
+            }
+        }
+    }
+}
+
+
+void Gravity_PM::fft_lines( double* RESTRICT re, double* RESTRICT im, bool const inverse ) const {
+    constexpr std::size_t W{ LANES };
+    std::size_t const P{ padded_ };
+
+    for ( std::size_t n{}; n < P; ++n ) {
+        std::size_t const r{ bit_reverse_[n] };
+        if ( n >= r ) continue;
+        for ( std::size_t l{}; l < W; ++l ) {
+            std::swap( re[n * W + l], re[r * W + l] );
+            std::swap( im[n * W + l], im[r * W + l] );
+        }
+    }
+
+    // Radix-2 butterflies; every twiddle is shared by the W lines, so the
+    // lane loop is the vector loop.
+    double const sign{ inverse ? -1.0 : 1.0 };
+    for ( std::size_t len{ 2 }; len <= P; len <<= 1 ) {
+        std::size_t const half{ len / 2 };
+        std::size_t const step{ P / len };
+        for ( std::size_t k{}; k < half; ++k ) {
+            double const wr{ twiddles_[k * step].real() };
+            double const wi{ sign * twiddles_[k * step].imag() };
+            for ( std::size_t n{ k }; n < P; n += len ) {
+                double* RESTRICT u_re{ re + n * W };
+                double* RESTRICT u_im{ im + n * W };
+                double* RESTRICT v_re{ re + ( n + half ) * W };
+                double* RESTRICT v_im{ im + ( n + half ) * W };
+                #pragma omp simd
+                for ( std::size_t l = 0; l < W; ++l ) {
+                    double const t_re{ v_re[l] * wr - v_im[l] * wi };
+                    double const t_im{ v_re[l] * wi + v_im[l] * wr };
+                    v_re[l] = u_re[l] - t_re;
+                    v_im[l] = u_im[l] - t_im;
+                    u_re[l] += t_re;
+                    u_im[l] += t_im;
+                }
+            }
+        }
+    }
+}
+
+
+void Gravity_PM::fft_3d( bool const inverse, std::size_t const block ) const {
+    constexpr std::size_t W{ LANES };
+    std::size_t const P{ padded_ };
+    std::complex<double>* RESTRICT data{ grid_.data() };
+
+    // Every pass gathers W lines into a split buffer, transforms them and
+    // scatters them back. Along x the W lines are neighbouring rows; along
+    // y and z they are W neighbouring columns, so each gathered element
+    // pulls in a whole cache line. Forward passes run x, y, z and skip
+    // lines that are still all zero; inverse passes run z, y, x and skip
+    // lines outside the block.
+    auto transform = [&]( std::complex<double>* RESTRICT base, std::size_t const line_stride,
+                          std::size_t const stride, double* RESTRICT re, double* RESTRICT im ) {
+        for ( std::size_t n{}; n < P; ++n ) {
+            for ( std::size_t l{}; l < W; ++l ) {
+                std::complex<double> const c{ base[l * line_stride + n * stride] };
+                re[n * W + l] = c.real();
+                im[n * W + l] = c.imag();
+            }
+        }
+        fft_lines( re, im, inverse );
+        for ( std::size_t n{}; n < P; ++n ) {
+            for ( std::size_t l{}; l < W; ++l ) {
+                base[l * line_stride + n * stride] = { re[n * W + l], im[n * W + l] };
+            }
+        }
+    };
+    auto pass_x = [&]( double* re, double* im ) {
+        std::size_t const rows{ block / W };
+        #pragma omp for schedule( static )
+        for ( std::size_t g = 0; g < rows * block; ++g ) {
+            std::size_t const j{ g % rows * W };
+            std::size_t const k{ g / rows };
+            transform( data + P * ( j + P * k ), P, 1, re, im );
+        }
+    };
+    auto pass_y = [&]( double* re, double* im ) {
+        std::size_t const columns{ P / W };
+        #pragma omp for schedule( static )
+        for ( std::size_t g = 0; g < columns * block; ++g ) {
+            std::size_t const i{ g % columns * W };
+            std::size_t const k{ g / columns };
+            transform( data + i + P * P * k, 1, P, re, im );
+        }
+    };
+    auto pass_z = [&]( double* re, double* im ) {
+        #pragma omp for schedule( static )
+        for ( std::size_t g = 0; g < P * P / W; ++g ) {
+            transform( data + g * W, 1, P * P, re, im );
+        }
+    };
+
+    #pragma omp parallel
+    {
+        std::vector<double> re( P * W ), im( P * W );
+        if ( !inverse ) {
+            pass_x( re.data(), im.data() );
+            pass_y( re.data(), im.data() );
+            pass_z( re.data(), im.data() );
+        } else {
+            pass_z( re.data(), im.data() );
+            pass_y( re.data(), im.data() );
+            pass_x( re.data(), im.data() );
+        }
+    }
+}
+
+
+void Gravity_PM::apply( Particles &particles ) const {
+    std::size_t const N{ particles.num_particles() };
+    std::size_t const N_a{ particles.num_active() };
+    if ( N_a == 0 ) return;
+
+    double const* RESTRICT px{ particles.pos_x() };
+    double const* RESTRICT py{ particles.pos_y() };
+    double const* RESTRICT pz{ particles.pos_z() };
+    double const* RESTRICT mass{ particles.mass() };
+
+    // Cube around every particle, leaving two cells on the low side and
+    // three on the high side for the stencils and the assignment.
+    double min_x{ px[0] }, max_x{ px[0] };
+    double min_y{ py[0] }, max_y{ py[0] };
+    double min_z{ pz[0] }, max_z{ pz[0] };
+    #pragma omp parallel for reduction( min:min_x, min_y, min_z ) reduction( max:max_x, max_y, max_z ) \
+                             schedule( static ) if ( N >= config::OMP_THRESHOLD )
+    for ( std::size_t i = 1; i < N; ++i ) {
+        min_x = std::min( min_x, px[i] ); max_x = std::max( max_x, px[i] );
+        min_y = std::min( min_y, py[i] ); max_y = std::max( max_y, py[i] );
+        min_z = std::min( min_z, pz[i] ); max_z = std::max( max_z, pz[i] );
+    }
+    double extent{ std::max( { max_x - min_x, max_y - min_y, max_z - min_z } ) };
+    if ( extent <= 0.0 ) extent = 1.0;
+    extent *= 1.0 + 1e-12;
+
+    std::size_t const M{ mesh_ };
+    std::size_t const P{ padded_ };
+    double const h{ extent / static_cast<double>( M - 6 ) };
+    double const inv_h{ 1.0 / h };
+    double const ox{ 0.5 * ( min_x + max_x - extent ) - 2.0 * h };
+    double const oy{ 0.5 * ( min_y + max_y - extent ) - 2.0 * h };
+    double const oz{ 0.5 * ( min_z + max_z - extent ) - 2.0 * h };
+    cell_ = h;
+
+    // Cloud-in-cell assignment of the active masses. Particles rarely
+    // share a cell, so atomic adds contend little.
+    grid_.assign( P * P * P, 0.0 );
+    double* RESTRICT rho{ reinterpret_cast<double*>( grid_.data() ) };
+
+    #pragma omp parallel for schedule( static ) if ( N_a >= config::OMP_THRESHOLD )
+    for ( std::size_t j = 0; j < N_a; ++j ) {
+        double const u{ ( px[j] - ox ) * inv_h };
+        double const v{ ( py[j] - oy ) * inv_h };
+        double const w{ ( pz[j] - oz ) * inv_h };
+        std::size_t const i0{ static_cast<std::size_t>( u ) };
+        std::size_t const j0{ static_cast<std::size_t>( v ) };
+        std::size_t const k0{ static_cast<std::size_t>( w ) };
+        double const fx{ u - static_cast<double>( i0 ) };
+        double const fy{ v - static_cast<double>( j0 ) };
+        double const fz{ w - static_cast<double>( k0 ) };
+        for ( int c{}; c < 8; ++c ) {
+            double const weight{ ( c & 1 ? fx : 1.0 - fx ) * ( c & 2 ? fy : 1.0 - fy ) * ( c & 4 ? fz : 1.0 - fz ) };
+            std::size_t const cell{ ( i0 + ( c & 1 ) ) + P * ( ( j0 + ( c >> 1 & 1 ) ) + P * ( k0 + ( c >> 2 ) ) ) };
+            #pragma omp atomic
+            rho[2 * cell] += weight * mass[j];
+        }
+    }
+
+    // Convolution with the Green's function, folded into its octant,
+    // scaled for the cell width and the unnormalised inverse transform.
+    fft_3d( false, M );
+    std::size_t const H{ P / 2 + 1 };
+    double const scale{ config::G * inv_h / static_cast<double>( P * P * P ) };
+    #pragma omp parallel for schedule( static )
+    for ( std::size_t k = 0; k < P; ++k ) {
+        std::size_t const gk{ std::min( k, P - k ) };
+        for ( std::size_t j{}; j < P; ++j ) {
+            std::size_t const gj{ std::min( j, P - j ) };
+            std::complex<double>* RESTRICT row{ grid_.data() + P * ( j + P * k ) };
+            double const* RESTRICT green{ green_.data() + H * ( gj + H * gk ) };
+            for ( std::size_t i{}; i < P; ++i ) row[i] *= scale * green[std::min( i, P - i )];
+        }
+    }
+    fft_3d( true, M );
+
+    // Fourth-order differences of the potential at the grid points any
+    // particle interpolates from, [2, M - 3] per axis.
+    field_.resize( 3 * M * M * M );
+    double* RESTRICT fx_grid{ field_.data() };
+    double* RESTRICT fy_grid{ fx_grid + M * M * M };
+    double* RESTRICT fz_grid{ fy_grid + M * M * M };
+    double const* RESTRICT phi{ reinterpret_cast<double const*>( grid_.data() ) };
+    auto at = [phi, P]( std::size_t const i, std::size_t const j, std::size_t const k ) {
+        return phi[2 * ( i + P * ( j + P * k ) )];
+    };
+    double const d{ inv_h / 12.0 };
+    #pragma omp parallel for schedule( static )
+    for ( std::size_t k = 2; k < M - 2; ++k ) {
+        for ( std::size_t j{ 2 }; j < M - 2; ++j ) {
+            for ( std::size_t i{ 2 }; i < M - 2; ++i ) {
+                std::size_t const g{ i + M * ( j + M * k ) };
+                fx_grid[g] = d * ( at( i + 2, j, k ) - 8.0 * at( i + 1, j, k ) + 8.0 * at( i - 1, j, k ) - at( i - 2, j, k ) );
+                fy_grid[g] = d * ( at( i, j + 2, k ) - 8.0 * at( i, j + 1, k ) + 8.0 * at( i, j - 1, k ) - at( i, j - 2, k ) );
+                fz_grid[g] = d * ( at( i, j, k + 2 ) - 8.0 * at( i, j, k + 1 ) + 8.0 * at( i, j, k - 1 ) - at( i, j, k - 2 ) );
+            }
+        }
+    }
+
+    // Cloud-in-cell interpolation to every particle, active or passive.
+    double* RESTRICT ax{ particles.acc_x() };
+    double* RESTRICT ay{ particles.acc_y() };
+    double* RESTRICT az{ particles.acc_z() };
+    #pragma omp parallel for schedule( static ) if ( N >= config::OMP_THRESHOLD )
+    for ( std::size_t i = 0; i < N; ++i ) {
+        double const u{ ( px[i] - ox ) * inv_h };
+        double const v{ ( py[i] - oy ) * inv_h };
+        double const w{ ( pz[i] - oz ) * inv_h };
+        std::size_t const i0{ static_cast<std::size_t>( u ) };
+        std::size_t const j0{ static_cast<std::size_t>( v ) };
+        std::size_t const k0{ static_cast<std::size_t>( w ) };
+        double const fx{ u - static_cast<double>( i0 ) };
+        double const fy{ v - static_cast<double>( j0 ) };
+        double const fz{ w - static_cast<double>( k0 ) };
+        double a_x{}, a_y{}, a_z{};
+        for ( int c{}; c < 8; ++c ) {
+            double const weight{ ( c & 1 ? fx : 1.0 - fx ) * ( c & 2 ? fy : 1.0 - fy ) * ( c & 4 ? fz : 1.0 - fz ) };
+            std::size_t const g{ ( i0 + ( c & 1 ) ) + M * ( ( j0 + ( c >> 1 & 1 ) ) + M * ( k0 + ( c >> 2 ) ) ) };
+            a_x += weight * fx_grid[g];
+            a_y += weight * fy_grid[g];
+            a_z += weight * fz_grid[g];
+        }
+        ax[i] += a_x;
+        ay[i] += a_y;
+        az[i] += a_z;
+    }
+}
+
+
+Gravity_TreePM::Gravity_TreePM( std::size_t const mesh,
+                                double const split,
+                                double const theta,
+                                std::size_t const leaf_bucket,
+                                simd::Isa const isa )
+: pm_{ mesh, split }
+, tree_{ theta, leaf_bucket, BH_Build::Morton, 64, isa }
+{
+    if ( !( split > 0.0 ) ) {
+        throw std::runtime_error( "Gravity_TreePM: split must be positive" );
+    }
+}
+
+
+void Gravity_TreePM::apply( Particles &particles ) const {
+    if ( particles.num_active() == 0 ) return;
+
+    pm_.apply( particles );
+    tree_.set_short_range( pm_.split() * pm_.cell() );
+    tree_.apply( particles );
+}
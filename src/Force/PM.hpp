@@ -0,0 +1,93 @@
+#pragma once
+
+#include "Force.hpp"
+#include "BarnesHut.hpp"
+
+#include <complex>
+#include <vector>
+#include <cstddef>
+
+// Particle-mesh gravity with isolated boundaries. Active masses are
+// assigned to a mesh^3 grid by cloud-in-cell, convolved with the Green's
+// function on a zero-padded (2 mesh)^3 grid by FFT (Hockney-Eastwood), so
+// there are no periodic images, and the potential is differenced with a
+// fourth-order stencil and interpolated back by cloud-in-cell, which keeps
+// the self-force at zero. The grid is a cube around every particle, active
+// or passive, redrawn each call; a call costs O(N + M log M) for
+// M = (2 mesh)^3.
+//
+// With split > 0 only the long-range part is computed: the Green's
+// function becomes -erf(r / 2 r_s) / r with r_s = split cells, whose
+// complement is Gravity_BarnesHut's short-range mode (see Gravity_TreePM),
+// and the cloud-in-cell window is deconvolved from it.
+// Otherwise it is -1/r, and forces are smoothed over about two cells.
+class Gravity_PM : public Force {
+public:
+    // Throws std::runtime_error unless mesh is a power of two >= 16 and
+    // split >= 0.
+    explicit Gravity_PM( std::size_t const mesh = 64, double const split = 0.0 );
+
+    void apply( Particles &particles ) const override;
+
+    [[nodiscard]] std::size_t mesh() const { return mesh_; }
+    [[nodiscard]] double split() const { return split_; }
+
+    // Cell width of the last call (0 before the first).
+    [[nodiscard]] double cell() const { return cell_; }
+
+private:
+    std::size_t mesh_;
+    double split_;
+
+    // Padded transform length P = 2 mesh: bit-reversal permutation and
+    // twiddles exp(-2 pi i k / P) for k < P / 2.
+    std::size_t padded_;
+    std::vector<std::size_t> bit_reverse_;
+    std::vector<std::complex<double>> twiddles_;
+
+    // Transform of the Green's function for unit cell width and G = 1.
+    // It is real and even in each axis, so only the octant
+    // [0, P/2]^3 is kept.
+    std::vector<double> green_;
+
+    // Per-call state, capacity sticky: the padded grid and the field at
+    // the grid points (x, y, z, each mesh^3).
+    mutable std::vector<std::complex<double>> grid_;
+    mutable std::vector<double> field_;
+    mutable double cell_{};
+
+    // In-place transforms of length P along LANES lines at once, held
+    // split and interleaved: re[n * LANES + l], im[n * LANES + l].
+    static constexpr std::size_t LANES{ 8 };
+    void fft_lines( double* RESTRICT re, double* RESTRICT im, bool const inverse ) const;
+
+    // 3D transform of grid_. The forward transform assumes the input is
+    // zero outside [0, block)^3 and the inverse only produces that block,
+    // which skips the lines the zero padding makes trivial.
+    void fft_3d( bool const inverse, std::size_t const block ) const;
+};
+
+// TreePM: the long-range force from Gravity_PM with split r_s = split
+// cells, plus the short-range remainder from a Barnes-Hut walk truncated at
+// Gravity_BarnesHut::SHORT_RANGE_CUTOFF * r_s. The tree only sees each
+// group's neighbourhood, so its list stops growing with N. theta defaults
+// wider than for a plain Barnes-Hut pass, above 1/sqrt(3); that relies on
+// the group walk opening every cell that overlaps the group, so a nearby
+// dense cell holding the group is never taken as one point.
+class Gravity_TreePM : public Force {
+public:
+    explicit Gravity_TreePM( std::size_t const mesh = 64,
+                             double const split = 1.25,
+                             double const theta = 0.7,
+                             std::size_t const leaf_bucket = 8,
+                             simd::Isa const isa = simd::detect() );
+
+    void apply( Particles &particles ) const override;
+
+    [[nodiscard]] Gravity_PM const &pm() const { return pm_; }
+    [[nodiscard]] Gravity_BarnesHut const &tree() const { return tree_; }
+
+private:
+    Gravity_PM pm_;
+    mutable Gravity_BarnesHut tree_;
+};
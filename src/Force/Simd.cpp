@@ -0,0 +1,93 @@
+#include "Simd.hpp"
+
+#include <cstdint>
+
+#if NBODY_X86 && defined(_MSC_VER)
+    #include <intrin.h>
+    #include <immintrin.h>
+#endif
+
+#if defined(__linux__)
+    #include <unistd.h>
+#elif defined(__APPLE__)
+    #include <sys/sysctl.h>
+#endif
+
+namespace {
+    simd::Isa probe() {
+#if NBODY_X86 && ( defined(__GNUC__) || defined(__clang__) )
+        // libgcc / compiler-rt also check OSXSAVE and XCR0, so a feature is
+        // only reported when the OS saves the wide registers on context switch.
+        __builtin_cpu_init();
+        if ( __builtin_cpu_supports( "avx512f" ) ) return simd::Isa::AVX512;
+        if ( __builtin_cpu_supports( "avx2" ) && __builtin_cpu_supports( "fma" ) ) return simd::Isa::AVX2;
+        return simd::Isa::Scalar;
+#elif NBODY_X86 && defined(_MSC_VER)
+        int regs[4]{};
+        __cpuid( regs, 0 );
+        if ( regs[0] < 7 ) return simd::Isa::Scalar;
+
+        __cpuid( regs, 1 );
+        bool const osxsave{ ( regs[2] & ( 1 << 27 ) ) != 0 };
+        bool const fma{ ( regs[2] & ( 1 << 12 ) ) != 0 };
+        if ( !osxsave ) return simd::Isa::Scalar;
+
+        // XCR0: bits 1-2 = SSE/AVX state, bits 5-7 = opmask/ZMM state.
+        unsigned long long const xcr0{ _xgetbv( 0 ) };
+        bool const os_avx{ ( xcr0 & 0x6 ) == 0x6 };
+        bool const os_avx512{ ( xcr0 & 0xE6 ) == 0xE6 };
+
+        __cpuidex( regs, 7, 0 );
+        bool const avx2{ ( regs[1] & ( 1 << 5 ) ) != 0 };
+        bool const avx512f{ ( regs[1] & ( 1 << 16 ) ) != 0 };
+
+        if ( avx512f && os_avx512 ) return simd::Isa::AVX512;
+        if ( avx2 && fma && os_avx ) return simd::Isa::AVX2;
+        return simd::Isa::Scalar;
+#else
+        return simd::Isa::Scalar;
+#endif
+    }
+
+    constexpr std::size_t FALLBACK_L1D{ 32 * 1024 };
+    constexpr std::size_t FALLBACK_L2{ 1024 * 1024 };
+
+    simd::Cache_Sizes probe_caches() {
+        long l1d{}, l2{};
+#if defined(__linux__) && defined(_SC_LEVEL1_DCACHE_SIZE)
+        l1d = sysconf( _SC_LEVEL1_DCACHE_SIZE );
+        l2 = sysconf( _SC_LEVEL2_CACHE_SIZE );
+#elif defined(__APPLE__)
+        std::int64_t value{};
+        std::size_t size{ sizeof( value ) };
+        if ( sysctlbyname( "hw.l1dcachesize", &value, &size, nullptr, 0 ) == 0 ) l1d = static_cast<long>( value );
+        size = sizeof( value );
+        if ( sysctlbyname( "hw.l2cachesize", &value, &size, nullptr, 0 ) == 0 ) l2 = static_cast<long>( value );
+#endif
+        return simd::Cache_Sizes {
+            l1d > 0 ? static_cast<std::size_t>( l1d ) : FALLBACK_L1D,
+            l2 > 0 ? static_cast<std::size_t>( l2 ) : FALLBACK_L2
+        };
+    }
+}
+
+namespace simd {
+    Isa detect() {
+        static Isa const isa{ probe() };
+        return isa;
+    }
+
+    char const* isa_name( Isa const isa ) {
+        switch ( isa ) {
+            case Isa::AVX512: return "AVX-512";
+            case Isa::AVX2:   return "AVX2";
+            case Isa::Scalar: return "Scalar";
+        }
+        return "Scalar";
+    }
+
+    Cache_Sizes cache_sizes() {
+        static Cache_Sizes const sizes{ probe_caches() };
+        return sizes;
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+
+// Runtime instruction-set selection for the hand-vectorized force kernels.
+// The binary is built for the baseline target; wide-vector kernels are
+// compiled with per-function target attributes and only entered after the
+// running CPU (and OS) has been checked for support.
+
+#if defined(__GNUC__) || defined(__clang__)
+    #define TARGET_AVX2   __attribute__(( target( "avx2,fma" ) ))
+    #define TARGET_AVX512 __attribute__(( target( "avx512f,avx2,fma" ) ))
+#else
+    #define TARGET_AVX2
+    #define TARGET_AVX512
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #define NBODY_X86 1
+#else
+    #define NBODY_X86 0
+#endif
+
+namespace simd {
+    // Ordered by width: a CPU supporting Isa k also supports every Isa < k.
+    enum class Isa {
+        Scalar,
+        AVX2,
+        AVX512
+    };
+
+    // Widest ISA supported by the running CPU. Probed once, then cached.
+    [[nodiscard]] Isa detect();
+
+    [[nodiscard]] char const* isa_name( Isa const isa );
+
+    // Per-core data cache capacities in bytes. Probed once; falls back to
+    // 32 KiB / 1 MiB when the platform does not report them.
+    struct Cache_Sizes {
+        std::size_t l1d;
+        std::size_t l2;
+    };
+
+    [[nodiscard]] Cache_Sizes cache_sizes();
+}
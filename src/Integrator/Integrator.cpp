@@ -1,4 +1,9 @@
 #include "Integrator.hpp"
+#include "Kepler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
 
 #include <omp.h>
 
@@ -65,7 +70,113 @@ Yoshida::Yoshida( double const dt )
 , d_3_{ w_1() }
 { }
 
+// One Yoshida sub-step over particles [begin, end): kick with the last
+// force, drift, and clear the accelerations for the next force call, so
+// the arrays are streamed once between force calls.
+template <bool KICK, bool CLEAR>
+static void kick_drift( Particles &particles, std::size_t const begin, std::size_t const end,
+                        double const d_dt, double const c_dt ) {
+    double* RESTRICT px{ particles.pos_x() };
+    double* RESTRICT py{ particles.pos_y() };
+    double* RESTRICT pz{ particles.pos_z() };
+
+    double* RESTRICT vx{ particles.vel_x() };
+    double* RESTRICT vy{ particles.vel_y() };
+    double* RESTRICT vz{ particles.vel_z() };
+
+    double* RESTRICT ax{ particles.acc_x() };
+    double* RESTRICT ay{ particles.acc_y() };
+    double* RESTRICT az{ particles.acc_z() };
+
+    #pragma omp simd
+    for ( std::size_t i = begin; i < end; ++i ) {
+        if constexpr ( KICK ) {
+            vx[i] += d_dt * ax[i];
+            vy[i] += d_dt * ay[i];
+            vz[i] += d_dt * az[i];
+        }
+        px[i] += c_dt * vx[i];
+        py[i] += c_dt * vy[i];
+        pz[i] += c_dt * vz[i];
+        if constexpr ( CLEAR ) {
+            ax[i] = 0.0;
+            ay[i] = 0.0;
+            az[i] = 0.0;
+        }
+    }
+}
+
+// The whole sub-step, split statically across threads. Small systems skip
+// the parallel region, whose entry alone costs more than their sweep.
+template <bool KICK, bool CLEAR>
+static void kick_drift( Particles &particles, double const d_dt, double const c_dt ) {
+    std::size_t const N{ particles.num_particles() };
+    if ( N < config::OMP_THRESHOLD ) {
+        kick_drift<KICK, CLEAR>( particles, 0, N, d_dt, c_dt );
+        return;
+    }
+
+    #pragma omp parallel
+    {
+        std::size_t const T{ static_cast<std::size_t>( omp_get_num_threads() ) };
+        std::size_t const t{ static_cast<std::size_t>( omp_get_thread_num() ) };
+        kick_drift<KICK, CLEAR>( particles, N * t / T, N * ( t + 1 ) / T, d_dt, c_dt );
+    }
+}
+
 void Yoshida::integrate( Particles &particles, std::vector<std::unique_ptr<Force>> const &forces ) const {
+    auto apply_force = [&forces, &particles]() {
+        for ( auto const &force : forces ) {
+            force->apply( particles );
+        }
+    };
+
+    double const h{ dt() };
+
+    // d2 (= w0) is negative: the backward sub-step cancels lower-order error terms.
+    kick_drift<false, true>( particles, 0.0, c_1() * h );
+    apply_force();
+    kick_drift<true, true>( particles, d_1() * h, c_2() * h );
+    apply_force();
+    kick_drift<true, true>( particles, d_2() * h, c_3() * h );
+    apply_force();
+    kick_drift<true, false>( particles, d_3() * h, c_4() * h );
+}
+
+template <typename Scheme>
+void Composition<Scheme>::integrate( Particles &particles, std::vector<std::unique_ptr<Force>> const &forces ) const {
+    auto apply_force = [&forces, &particles]() {
+        for ( auto const &force : forces ) {
+            force->apply( particles );
+        }
+    };
+
+    double const h{ dt() };
+
+    kick_drift<false, true>( particles, 0.0, drift( 0 ) * h );
+    [&]<std::size_t... K>( std::index_sequence<K...> ) {
+        ( ( apply_force(), kick_drift<true, K + 1 < STAGES>( particles, kick( K ) * h, drift( K + 1 ) * h ) ), ... );
+    }( std::make_index_sequence<STAGES>{} );
+}
+
+template class Composition<Yoshida_4>;
+template class Composition<Yoshida_6>;
+template class Composition<Kahan_Li_8>;
+
+Block_Leapfrog::Block_Leapfrog( double const dt, int const max_level, double const eta )
+: Integrator{ dt, "Block Leapfrog" }
+, max_level_{ max_level }
+, eta_{ eta }
+{
+    if ( max_level < 0 || max_level > 30 ) {
+        throw std::runtime_error( "Block_Leapfrog: max_level must be in [0, 30]" );
+    }
+    if ( eta <= 0.0 ) {
+        throw std::runtime_error( "Block_Leapfrog: eta must be positive" );
+    }
+}
+
+void Block_Leapfrog::integrate( Particles &particles, std::vector<std::unique_ptr<Force>> const &forces ) const {
     std::size_t const N{ particles.num_particles() };
 
     double* RESTRICT px{ particles.pos_x() };
@@ -80,18 +191,185 @@ void Yoshida::integrate( Particles &particles, std::vector<std::unique_ptr<Force
     double* RESTRICT ay{ particles.acc_y() };
     double* RESTRICT az{ particles.acc_z() };
 
-    auto calculate_pos = [this, px, py, pz, vx, vy, vz, N]( double const c ) {
-        double const c_dt{ c * dt() };
+    double* RESTRICT o_ax{ particles.old_acc_x() };
+    double* RESTRICT o_ay{ particles.old_acc_y() };
+    double* RESTRICT o_az{ particles.old_acc_z() };
 
-        #pragma omp simd
-        for ( std::size_t i = 0; i < N; ++i ) {
-            px[i] += c_dt * vx[i];
-            py[i] += c_dt * vy[i];
-            pz[i] += c_dt * vz[i];
+    for ( auto const &force : forces ) {
+        if ( !force->supports_subset() ) {
+            throw std::runtime_error( "Block_Leapfrog: every force must support target subsets" );
         }
+    }
+
+    std::size_t const num_sub{ std::size_t{ 1 } << max_level_ };
+    double const h{ dt() / static_cast<double>( num_sub ) };
+
+    // Sub-steps between force evaluations of a particle at `level`.
+    auto stride = [this]( int const level ) -> std::size_t {
+        return std::size_t{ 1 } << ( max_level_ - level );
     };
 
-    auto apply_force = [&forces, &particles, ax, ay, az, N]() {
+    // First step: full force pass, everyone on the finest level. Levels
+    // coarsen as soon as two evaluations give a rate of change.
+    if ( levels_.size() != N ) {
+        levels_.assign( N, max_level_ );
+        for ( std::size_t i{}; i < N; ++i ) {
+            ax[i] = 0.0;
+            ay[i] = 0.0;
+            az[i] = 0.0;
+        }
+        for ( auto const &force : forces ) {
+            force->apply( particles );
+        }
+        evaluations_ += N;
+    }
+
+    // Sub-steps where no particle starts or ends a step are skipped: each
+    // pass jumps straight to the next block boundary.
+    for ( std::size_t s{}; s < num_sub; ) {
+        std::size_t t{ num_sub };
+        for ( std::size_t i{}; i < N; ++i ) {
+            std::size_t const n_i{ stride( levels_[i] ) };
+            t = std::min( t, ( s / n_i + 1 ) * n_i );
+        }
+        double const drift_dt{ h * static_cast<double>( t - s ) };
+
+        // Opening half-kick for every particle starting a step here.
+        #pragma omp parallel for schedule( static ) if ( N >= config::OMP_THRESHOLD )
+        for ( std::size_t i = 0; i < N; ++i ) {
+            std::size_t const n_i{ stride( levels_[i] ) };
+            if ( s % n_i != 0 ) continue;
+            double const half_dt{ 0.5 * h * static_cast<double>( n_i ) };
+            vx[i] += half_dt * ax[i];
+            vy[i] += half_dt * ay[i];
+            vz[i] += half_dt * az[i];
+        }
+
+        // Inactive particles drift on their mid-step velocity, so sources
+        // are at the right positions whenever a target is evaluated.
+        #pragma omp parallel for simd schedule( static ) if ( N >= config::OMP_THRESHOLD )
+        for ( std::size_t i = 0; i < N; ++i ) {
+            px[i] += drift_dt * vx[i];
+            py[i] += drift_dt * vy[i];
+            pz[i] += drift_dt * vz[i];
+        }
+
+        targets_.clear();
+        for ( std::size_t i{}; i < N; ++i ) {
+            if ( t % stride( levels_[i] ) == 0 ) targets_.push_back( i );
+        }
+
+        for ( std::size_t const i : targets_ ) {
+            o_ax[i] = ax[i]; o_ay[i] = ay[i]; o_az[i] = az[i];
+            ax[i] = 0.0;     ay[i] = 0.0;     az[i] = 0.0;
+        }
+        if ( targets_.size() == N ) {
+            for ( auto const &force : forces ) force->apply( particles );
+        } else {
+            for ( auto const &force : forces ) force->apply_subset( particles, targets_ );
+        }
+        evaluations_ += targets_.size();
+
+        // Closing half-kick, then the next level from the change in
+        // acceleration over the step just completed.
+        std::size_t const K{ targets_.size() };
+        #pragma omp parallel for schedule( static ) if ( K >= config::OMP_THRESHOLD )
+        for ( std::size_t k = 0; k < K; ++k ) {
+            std::size_t const i{ targets_[k] };
+            double const step{ h * static_cast<double>( stride( levels_[i] ) ) };
+            vx[i] += 0.5 * step * ax[i];
+            vy[i] += 0.5 * step * ay[i];
+            vz[i] += 0.5 * step * az[i];
+
+            double const a_sq{ ax[i]*ax[i] + ay[i]*ay[i] + az[i]*az[i] };
+            double const dax{ ax[i] - o_ax[i] }, day{ ay[i] - o_ay[i] }, daz{ az[i] - o_az[i] };
+            double const da_sq{ dax*dax + day*day + daz*daz };
+
+            int wanted{ 0 };
+            if ( da_sq > 0.0 ) {
+                double const dt_i{ eta_ * step * std::sqrt( a_sq / da_sq ) };
+                wanted = static_cast<int>( std::ceil( std::log2( dt() / dt_i ) ) );
+                wanted = std::clamp( wanted, 0, max_level_ );
+            }
+
+            // Refine freely; coarsen only onto an aligned coarser block.
+            int level{ levels_[i] };
+            if ( wanted > level ) {
+                level = wanted;
+            } else {
+                while ( level > wanted && t % stride( level - 1 ) == 0 ) --level;
+            }
+            levels_[i] = level;
+        }
+
+        s = t;
+    }
+}
+
+void Block_Leapfrog::permute( std::vector<std::size_t> const &order ) const {
+    if ( levels_.size() != order.size() ) return;
+
+    std::vector<int> levels( levels_.size() );
+    for ( std::size_t k{}; k < order.size(); ++k ) {
+        levels[k] = levels_[order[k]];
+    }
+    levels_ = std::move( levels );
+}
+
+Wisdom_Holman::Wisdom_Holman( double const dt )
+: Integrator{ dt, "Wisdom-Holman" }
+{ }
+
+void Wisdom_Holman::integrate( Particles &particles, std::vector<std::unique_ptr<Force>> const &forces ) const {
+    std::size_t const N{ particles.num_particles() };
+    std::size_t const N_a{ particles.num_active() };
+
+    double* RESTRICT px{ particles.pos_x() };
+    double* RESTRICT py{ particles.pos_y() };
+    double* RESTRICT pz{ particles.pos_z() };
+
+    double* RESTRICT vx{ particles.vel_x() };
+    double* RESTRICT vy{ particles.vel_y() };
+    double* RESTRICT vz{ particles.vel_z() };
+
+    double* RESTRICT ax{ particles.acc_x() };
+    double* RESTRICT ay{ particles.acc_y() };
+    double* RESTRICT az{ particles.acc_z() };
+
+    double* RESTRICT mass{ particles.mass() };
+
+    if ( N_a == 0 || mass[0] <= 0.0 ) {
+        throw std::runtime_error( "Wisdom_Holman: body 0 must be an active central mass" );
+    }
+
+    double const m_0{ mass[0] };
+    double const mu{ config::G * m_0 };
+    double const h{ dt() };
+
+    // To democratic heliocentric coordinates: positions relative to body 0,
+    // velocities relative to the barycentre. Slot 0 carries the barycentre.
+    double m_tot{}, cx{}, cy{}, cz{}, cvx{}, cvy{}, cvz{};
+    for ( std::size_t i = 0; i < N_a; ++i ) {
+        m_tot += mass[i];
+        cx  += mass[i] * px[i]; cy  += mass[i] * py[i]; cz  += mass[i] * pz[i];
+        cvx += mass[i] * vx[i]; cvy += mass[i] * vy[i]; cvz += mass[i] * vz[i];
+    }
+    cx /= m_tot; cy /= m_tot; cz /= m_tot;
+    cvx /= m_tot; cvy /= m_tot; cvz /= m_tot;
+
+    double const x_0{ px[0] }, y_0{ py[0] }, z_0{ pz[0] };
+    #pragma omp parallel for schedule( static ) if ( N >= config::OMP_THRESHOLD )
+    for ( std::size_t i = 1; i < N; ++i ) {
+        px[i] -= x_0;  py[i] -= y_0;  pz[i] -= z_0;
+        vx[i] -= cvx;  vy[i] -= cvy;  vz[i] -= cvz;
+    }
+    px[0] = cx;  py[0] = cy;  pz[0] = cz;
+    vx[0] = cvx; vy[0] = cvy; vz[0] = cvz;
+
+    // Planet-planet interaction. Heliocentric separations equal inertial
+    // ones, so the regular forces apply unchanged once the central mass is
+    // taken out of the source set.
+    auto kick = [&]( double const k_dt ) {
         #pragma omp simd
         for ( std::size_t i = 0; i < N; ++i ) {
             ax[i] = 0.0;
@@ -99,34 +377,64 @@ void Yoshida::integrate( Particles &particles, std::vector<std::unique_ptr<Force
             az[i] = 0.0;
         }
 
+        mass[0] = 0.0;
         for ( auto const &force : forces ) {
             force->apply( particles );
-        };
+        }
+        mass[0] = m_0;
+
+        #pragma omp simd
+        for ( std::size_t i = 1; i < N; ++i ) {
+            vx[i] += k_dt * ax[i];
+            vy[i] += k_dt * ay[i];
+            vz[i] += k_dt * az[i];
+        }
     };
 
-    auto calculate_vel = [this, vx, vy, vz, ax, ay, az, N]( double const d ) {
-        double const d_dt{ d * dt() };
+    // Central-body recoil: every body shifts by the total planet momentum
+    // over the central mass. Passive bodies carry no momentum but still shift.
+    auto jump = [&]( double const j_dt ) {
+        double sx{}, sy{}, sz{};
+        for ( std::size_t i = 1; i < N_a; ++i ) {
+            sx += mass[i] * vx[i];
+            sy += mass[i] * vy[i];
+            sz += mass[i] * vz[i];
+        }
+        double const f{ j_dt / m_0 };
+        sx *= f; sy *= f; sz *= f;
 
         #pragma omp simd
-        for ( std::size_t i = 0; i < N; ++i ) {
-            vx[i] += d_dt * ax[i];
-            vy[i] += d_dt * ay[i];
-            vz[i] += d_dt * az[i];
+        for ( std::size_t i = 1; i < N; ++i ) {
+            px[i] += sx;
+            py[i] += sy;
+            pz[i] += sz;
         }
     };
 
-    // d2 (= w0) is negative: the backward sub-step cancels lower-order error terms.
-    calculate_pos( c_1() );
-    apply_force();
-    calculate_vel( d_1() );
-
-    calculate_pos( c_2() );
-    apply_force();
-    calculate_vel( d_2() );
+    kick( 0.5 * h );
+    jump( 0.5 * h );
+    kepler::drift_batch( px, py, pz, vx, vy, vz, 1, N, mu, h );
+    px[0] += h * cvx; py[0] += h * cvy; pz[0] += h * cvz;
+    jump( 0.5 * h );
+    kick( 0.5 * h );
 
-    calculate_pos( c_3() );
-    apply_force();
-    calculate_vel( d_3() );
+    // Back to inertial coordinates.
+    double qx{}, qy{}, qz{}, ux{}, uy{}, uz{};
+    for ( std::size_t i = 1; i < N_a; ++i ) {
+        qx += mass[i] * px[i]; qy += mass[i] * py[i]; qz += mass[i] * pz[i];
+        ux += mass[i] * vx[i]; uy += mass[i] * vy[i]; uz += mass[i] * vz[i];
+    }
+    double const x_c{ px[0] - qx / m_tot };
+    double const y_c{ py[0] - qy / m_tot };
+    double const z_c{ pz[0] - qz / m_tot };
 
-    calculate_pos( c_4() );
-}
\ No newline at end of file
+    #pragma omp parallel for schedule( static ) if ( N >= config::OMP_THRESHOLD )
+    for ( std::size_t i = 1; i < N; ++i ) {
+        px[i] += x_c;  py[i] += y_c;  pz[i] += z_c;
+        vx[i] += cvx;  vy[i] += cvy;  vz[i] += cvz;
+    }
+    px[0] = x_c; py[0] = y_c; pz[0] = z_c;
+    vx[0] = cvx - ux / m_0;
+    vy[0] = cvy - uy / m_0;
+    vz[0] = cvz - uz / m_0;
+}
@@ -4,9 +4,11 @@
 #include "../Force/Force.hpp"
 
 #include <vector>
+#include <array>
 #include <cstddef>
 #include <memory>
 #include <string>
+#include <stdexcept>
 
 #if defined(__GNUC__) || defined(__clang__)
     #define RESTRICT __restrict__
@@ -29,6 +31,19 @@ public:
     
     virtual ~Integrator() = default;
     virtual void integrate( Particles &particles, std::vector<std::unique_ptr<Force>> const &forces ) const = 0;
+
+    // True if each step evaluates the forces exactly once, at the step's
+    // final positions, so a potential-mode pass yields the end-of-step potential.
+    [[nodiscard]] virtual bool synchronised_force() const { return false; }
+
+    // Particles [0, pinned_bodies()) have a fixed role in the scheme and
+    // must keep their index when the arrays are reordered.
+    [[nodiscard]] virtual std::size_t pinned_bodies() const { return 0; }
+
+    // Called after Particles::permute( order ) so per-particle state kept
+    // between steps follows its particle.
+    virtual void permute( std::vector<std::size_t> const & ) const { }
+
     [[nodiscard]] double dt() const { return dt_; }
     [[nodiscard]] std::string const &name() const { return name_; }
 };
@@ -37,6 +52,7 @@ class Velocity_Verlet : public Integrator {
 public:
     Velocity_Verlet( double dt = 360.0 );
     void integrate( Particles &particles, std::vector<std::unique_ptr<Force>> const &forces ) const override;
+    [[nodiscard]] bool synchronised_force() const override { return true; }
 };
 
 class Yoshida : public Integrator {
@@ -70,4 +86,215 @@ public:
     [[nodiscard]] double d_1() const { return d_1_; }
     [[nodiscard]] double d_2() const { return d_2_; }
     [[nodiscard]] double d_3() const { return d_3_; }
-};
\ No newline at end of file
+};
+
+// Stage weights of a symmetric composition: the outer half w_1 .. w_m is
+// mirrored about a middle weight that makes the sum 1.
+template <std::size_t M>
+[[nodiscard]] constexpr std::array<double, 2 * M + 1> symmetric_weights( std::array<double, M> const &outer ) {
+    std::array<double, 2 * M + 1> w{};
+    double sum{};
+    for ( std::size_t k{}; k < M; ++k ) {
+        w[k] = outer[k];
+        w[2 * M - k] = outer[k];
+        sum += outer[k];
+    }
+    w[M] = 1.0 - 2.0 * sum;
+    return w;
+}
+
+// Coefficient tables for Composition.
+struct Yoshida_4 {
+    static constexpr char const* name{ "Yoshida" };
+    static constexpr int order{ 4 };
+    static constexpr std::array<double, 3> weights{ Yoshida::w_1(), Yoshida::w_0(), Yoshida::w_1() };
+};
+
+// Yoshida (1990), solution A: seven stages.
+struct Yoshida_6 {
+    static constexpr char const* name{ "Yoshida 6th-order" };
+    static constexpr int order{ 6 };
+    static constexpr std::array<double, 7> weights{ symmetric_weights<3>( {
+        0.784513610477560, 0.235573213359357, -1.17767998417887 } ) };
+};
+
+// Kahan and Li (1997), s15odr8: fifteen stages.
+struct Kahan_Li_8 {
+    static constexpr char const* name{ "Kahan-Li 8th-order" };
+    static constexpr int order{ 8 };
+    static constexpr std::array<double, 15> weights{ symmetric_weights<7>( {
+        0.74167036435061295344822780, -0.40910082580003159399730010, 0.19075471029623837995387626,
+        -0.57386247111608226665638773, 0.29906418130365592384446354, 0.33462491824529818378495798,
+        0.31529309239676659663205666 } ) };
+};
+
+// Symmetric composition of the drift-kick-drift leapfrog with the stage
+// weights of Scheme: stage k drifts w_k dt / 2, kicks w_k dt and drifts
+// w_k dt / 2 again. Adjacent drifts are merged, so a step takes s force
+// evaluations and s + 1 drifts for s stages, and the stage loop is
+// unrolled at compile time. Composition<Yoshida_4> reproduces Yoshida.
+// Instantiated in Integrator.cpp for the tables above.
+template <typename Scheme>
+class Composition : public Integrator {
+public:
+    static constexpr std::size_t STAGES{ Scheme::weights.size() };
+
+    explicit Composition( double const dt )
+    : Integrator{ dt, Scheme::name }
+    { }
+
+    void integrate( Particles &particles, std::vector<std::unique_ptr<Force>> const &forces ) const override;
+
+    [[nodiscard]] static constexpr int order() { return Scheme::order; }
+
+    // Drift k (of STAGES + 1) and kick k (of STAGES), as fractions of dt.
+    [[nodiscard]] static constexpr double drift( std::size_t const k ) { return drifts_[k]; }
+    [[nodiscard]] static constexpr double kick( std::size_t const k ) { return Scheme::weights[k]; }
+
+private:
+    static constexpr std::array<double, STAGES + 1> drifts_{ [] {
+        std::array<double, STAGES + 1> c{};
+        for ( std::size_t k{}; k <= STAGES; ++k ) {
+            double const before{ k > 0 ? Scheme::weights[k - 1] : 0.0 };
+            double const after{ k < STAGES ? Scheme::weights[k] : 0.0 };
+            c[k] = ( before + after ) / 2.0;
+        }
+        return c;
+    }() };
+};
+
+// Kick-drift-kick leapfrog with hierarchical block timesteps. Each particle
+// steps with dt / 2^level, level in [0, max_level], so the step dt() is
+// split into 2^max_level sub-steps. Every sub-step drifts all particles, but
+// forces are evaluated only for the particles whose own step ends there, via
+// Force::apply_subset. Levels follow an acceleration-based criterion,
+//   dt_i = eta |a_i| / |da_i/dt|,
+// with the rate of change taken from the last two force evaluations, so a
+// moon steps at a fraction of its orbit while an outer planet takes the
+// full dt. A level may coarsen only where the coarser step starts on the
+// block grid, which keeps all particles synchronised at every step end.
+class Block_Leapfrog : public Integrator {
+private:
+    int max_level_;
+    double eta_;
+
+    mutable std::vector<int> levels_;
+    mutable std::vector<std::size_t> targets_;
+    mutable std::size_t evaluations_{};
+
+public:
+    explicit Block_Leapfrog( double const dt = 87660.0, int const max_level = 8, double const eta = 0.02 );
+
+    void integrate( Particles &particles, std::vector<std::unique_ptr<Force>> const &forces ) const override;
+
+    [[nodiscard]] int max_level() const { return max_level_; }
+    [[nodiscard]] double eta() const { return eta_; }
+
+    // Current level of each particle (empty before the first step).
+    [[nodiscard]] std::vector<int> const &levels() const { return levels_; }
+
+    void permute( std::vector<std::size_t> const &order ) const override;
+
+    // Per-particle force evaluations so far, counting the initial pass; a
+    // shared-step scheme with the finest sub-step would make
+    // N * 2^max_level per step.
+    [[nodiscard]] std::size_t evaluations() const { return evaluations_; }
+};
+
+// Wisdom-Holman mixed-variable map in democratic heliocentric coordinates.
+// The Hamiltonian splits into a Kepler part about the central body, solved
+// exactly, and a small planet-planet interaction part, applied as kicks. The
+// error scales with the interaction, not the dominant central force, so
+// hierarchical systems (a star and planets) take far larger steps than with
+// Yoshida at the same accuracy.
+//
+// Body 0 is the central body and must be active with non-zero mass. Every
+// other body drifts on its own Kepler orbit about it, so dt must still
+// resolve any sub-hierarchy (e.g. a moon orbiting its planet).
+class Wisdom_Holman : public Integrator {
+public:
+    explicit Wisdom_Holman( double const dt = 87660.0 );
+
+    [[nodiscard]] std::size_t pinned_bodies() const override { return 1; }
+
+    // kick(dt/2) -> jump(dt/2) -> Kepler drift(dt) -> jump(dt/2) -> kick(dt/2)
+    // One interaction force evaluation per step with the central mass removed.
+    void integrate( Particles &particles, std::vector<std::unique_ptr<Force>> const &forces ) const override;
+};
+
+// Yoshida step for a body count fixed at compile time. Every drift, kick and
+// acceleration reset runs over exactly N bodies, so the loops carry no
+// runtime trip counts and no threading checks. Pairs with Gravity_Fixed<N>
+// for small systems, where per-step latency sets the wall-clock time.
+template <std::size_t N>
+class Yoshida_Fixed : public Yoshida {
+public:
+    explicit Yoshida_Fixed( double const dt = 900.0 )
+    : Yoshida{ dt }
+    { }
+
+    void integrate( Particles &particles, std::vector<std::unique_ptr<Force>> const &forces ) const override {
+        if ( particles.num_particles() != N ) {
+            throw std::runtime_error( "Yoshida_Fixed: particle count does not match N" );
+        }
+
+        double* RESTRICT px{ particles.pos_x() };
+        double* RESTRICT py{ particles.pos_y() };
+        double* RESTRICT pz{ particles.pos_z() };
+
+        double* RESTRICT vx{ particles.vel_x() };
+        double* RESTRICT vy{ particles.vel_y() };
+        double* RESTRICT vz{ particles.vel_z() };
+
+        double* RESTRICT ax{ particles.acc_x() };
+        double* RESTRICT ay{ particles.acc_y() };
+        double* RESTRICT az{ particles.acc_z() };
+
+        auto calculate_pos = [px, py, pz, vx, vy, vz]( double const c_dt ) {
+            #pragma omp simd
+            for ( std::size_t i = 0; i < N; ++i ) {
+                px[i] += c_dt * vx[i];
+                py[i] += c_dt * vy[i];
+                pz[i] += c_dt * vz[i];
+            }
+        };
+
+        auto apply_force = [&forces, &particles, ax, ay, az]() {
+            #pragma omp simd
+            for ( std::size_t i = 0; i < N; ++i ) {
+                ax[i] = 0.0;
+                ay[i] = 0.0;
+                az[i] = 0.0;
+            }
+
+            for ( auto const &force : forces ) {
+                force->apply( particles );
+            }
+        };
+
+        auto calculate_vel = [vx, vy, vz, ax, ay, az]( double const d_dt ) {
+            #pragma omp simd
+            for ( std::size_t i = 0; i < N; ++i ) {
+                vx[i] += d_dt * ax[i];
+                vy[i] += d_dt * ay[i];
+                vz[i] += d_dt * az[i];
+            }
+        };
+
+        double const h{ dt() };
+
+        calculate_pos( c_1() * h );
+        apply_force();
+        calculate_vel( d_1() * h );
+
+        calculate_pos( c_2() * h );
+        apply_force();
+        calculate_vel( d_2() * h );
+
+        calculate_pos( c_3() * h );
+        apply_force();
+        calculate_vel( d_3() * h );
+
+        calculate_pos( c_4() * h );
+    }
+};
@@ -0,0 +1,111 @@
+#include "Kepler.hpp"
+#include "../Config.hpp"
+
+#include <cmath>
+#include <numbers>
+
+#include <omp.h>
+
+namespace kepler {
+
+void stumpff( double const z, double &c0, double &c1, double &c2, double &c3 ) {
+    if ( z > 0.1 ) {
+        double const s{ std::sqrt( z ) };
+        c0 = std::cos( s );
+        c1 = std::sin( s ) / s;
+    } else if ( z < -0.1 ) {
+        double const s{ std::sqrt( -z ) };
+        c0 = std::cosh( s );
+        c1 = std::sinh( s ) / s;
+    } else {
+        // c_k(z) = sum_n (-z)^n / (k + 2n)!, truncated well below rounding.
+        c3 = ( 1.0 - z / 20.0 * ( 1.0 - z / 42.0 * ( 1.0 - z / 72.0 * ( 1.0 - z / 110.0
+             * ( 1.0 - z / 156.0 * ( 1.0 - z / 210.0 ) ) ) ) ) ) / 6.0;
+        c2 = ( 1.0 - z / 12.0 * ( 1.0 - z / 30.0 * ( 1.0 - z / 56.0 * ( 1.0 - z / 90.0
+             * ( 1.0 - z / 132.0 * ( 1.0 - z / 182.0 ) ) ) ) ) ) / 2.0;
+        c1 = 1.0 - z * c3;
+        c0 = 1.0 - z * c2;
+        return;
+    }
+    // Recurrence c_k = 1/k! - z c_{k+2}.
+    c2 = ( 1.0 - c0 ) / z;
+    c3 = ( 1.0 - c1 ) / z;
+}
+
+void drift( double &x, double &y, double &z,
+            double &vx, double &vy, double &vz,
+            double const mu, double const dt ) {
+    double const r0{ std::sqrt( x*x + y*y + z*z ) };
+    double const v0_sq{ vx*vx + vy*vy + vz*vz };
+    double const eta0{ x*vx + y*vy + z*vz };
+    double const beta{ 2.0 * mu / r0 - v0_sq };    // mu / a; > 0 when bound
+
+    // Whole periods of a bound orbit are exact no-ops; dropping them keeps
+    // the universal anomaly small.
+    double t{ dt };
+    if ( beta > 0.0 ) {
+        double const period{ 2.0 * std::numbers::pi * mu / ( beta * std::sqrt( beta ) ) };
+        t = std::fmod( dt, period );
+    }
+
+    // Solve r0 G1 + eta0 G2 + mu G3 = t for the universal anomaly X with
+    // Laguerre-Conway iterations (n = 5), which converge from the crude
+    // starting guess t / r0 for any orbit type.
+    constexpr double n{ 5.0 };
+    constexpr int MAX_ITERATIONS{ 50 };
+
+    double X{ t / r0 };
+    double G0{}, G1{}, G2{}, G3{};
+    for ( int it{}; it < MAX_ITERATIONS; ++it ) {
+        double c0{}, c1{}, c2{}, c3{};
+        stumpff( beta * X * X, c0, c1, c2, c3 );
+        G0 = c0;
+        G1 = X * c1;
+        G2 = X * X * c2;
+        G3 = X * X * X * c3;
+
+        double const F{ r0 * G1 + eta0 * G2 + mu * G3 - t };
+        double const dF{ r0 * G0 + eta0 * G1 + mu * G2 };
+        double const ddF{ eta0 * G0 + ( mu - beta * r0 ) * G1 };
+
+        double const disc{ std::abs( ( n - 1.0 ) * ( n - 1.0 ) * dF * dF - n * ( n - 1.0 ) * F * ddF ) };
+        double const dX{ n * F / ( dF + std::copysign( std::sqrt( disc ), dF ) ) };
+        X -= dX;
+
+        if ( std::abs( dX ) <= 1e-14 * std::abs( X ) ) {
+            stumpff( beta * X * X, c0, c1, c2, c3 );
+            G0 = c0;
+            G1 = X * c1;
+            G2 = X * X * c2;
+            G3 = X * X * X * c3;
+            break;
+        }
+    }
+
+    // Gauss f and g functions.
+    double const r{ r0 * G0 + eta0 * G1 + mu * G2 };
+    double const f{ 1.0 - mu * G2 / r0 };
+    double const g{ t - mu * G3 };
+    double const f_dot{ -mu * G1 / ( r0 * r ) };
+    double const g_dot{ 1.0 - mu * G2 / r };
+
+    double const x0{ x }, y0{ y }, z0{ z };
+    x = f * x0 + g * vx;
+    y = f * y0 + g * vy;
+    z = f * z0 + g * vz;
+    vx = f_dot * x0 + g_dot * vx;
+    vy = f_dot * y0 + g_dot * vy;
+    vz = f_dot * z0 + g_dot * vz;
+}
+
+void drift_batch( double* RESTRICT x, double* RESTRICT y, double* RESTRICT z,
+                  double* RESTRICT vx, double* RESTRICT vy, double* RESTRICT vz,
+                  std::size_t const begin, std::size_t const end,
+                  double const mu, double const dt ) {
+    #pragma omp parallel for schedule( static ) if ( end - begin >= config::OMP_THRESHOLD )
+    for ( std::size_t i = begin; i < end; ++i ) {
+        drift( x[i], y[i], z[i], vx[i], vy[i], vz[i], mu, dt );
+    }
+}
+
+}
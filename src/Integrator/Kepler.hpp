@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+
+#if defined(__GNUC__) || defined(__clang__)
+    #define RESTRICT __restrict__
+#elif defined(_MSC_VER)
+    #define RESTRICT __restrict
+#else
+    #define RESTRICT
+#endif
+
+// Two-body propagation in universal variables (Danby, ch. 6). One solver
+// covers elliptic, parabolic and hyperbolic orbits, so no case split on
+// eccentricity is needed.
+namespace kepler {
+    // Stumpff functions c0..c3 at z. Closed forms away from zero; a series
+    // near zero, where the closed forms cancel.
+    void stumpff( double const z, double &c0, double &c1, double &c2, double &c3 );
+
+    // Advances one relative state (x, v) by dt on the Kepler orbit about a
+    // fixed centre with gravitational parameter mu = G M.
+    void drift( double &x, double &y, double &z,
+                double &vx, double &vy, double &vz,
+                double const mu, double const dt );
+
+    // Batch form over bodies [begin, end) of SoA state arrays. Each body is
+    // solved independently, so the loop is split across threads for large
+    // batches.
+    void drift_batch( double* RESTRICT x, double* RESTRICT y, double* RESTRICT z,
+                      double* RESTRICT vx, double* RESTRICT vy, double* RESTRICT vz,
+                      std::size_t const begin, std::size_t const end,
+                      double const mu, double const dt );
+}
@@ -27,7 +27,7 @@ void Binary_Output::write(
     std::size_t const step,
     double const time ) {
 
-    buffer_.clear();
+    buffer_.assign( 2 + num_bodies_ * 6, 0.0 );
 
     // Step is uint64 but the buffer is double[]. Reinterpret via memcpy
     // to avoid a separate write call. Python reader reverses this with
@@ -35,16 +35,21 @@ void Binary_Output::write(
     uint64_t const s{ step };
     double step_bits;
     std::memcpy( &step_bits, &s, sizeof( double ) );
-    buffer_.push_back( step_bits );
-    buffer_.push_back( time );
-
-    for ( std::size_t i = 0; i < num_bodies_; ++i ) {
-        buffer_.push_back( particles.pos_x()[i] );
-        buffer_.push_back( particles.pos_y()[i] );
-        buffer_.push_back( particles.pos_z()[i] );
-        buffer_.push_back( particles.vel_x()[i] );
-        buffer_.push_back( particles.vel_y()[i] );
-        buffer_.push_back( particles.vel_z()[i] );
+    buffer_[0] = step_bits;
+    buffer_[1] = time;
+
+    // Bodies are written at their original index, so frames stay in header
+    // order however the particle arrays have been permuted.
+    std::vector<std::size_t> const &ids{ particles.ids() };
+    for ( std::size_t i = 0; i < particles.num_particles(); ++i ) {
+        if ( ids[i] >= num_bodies_ ) continue;
+        double* out{ buffer_.data() + 2 + ids[i] * 6 };
+        out[0] = particles.pos_x()[i];
+        out[1] = particles.pos_y()[i];
+        out[2] = particles.pos_z()[i];
+        out[3] = particles.vel_x()[i];
+        out[4] = particles.vel_y()[i];
+        out[5] = particles.vel_z()[i];
     }
 
     file_.write( reinterpret_cast<char const*>( buffer_.data() ),
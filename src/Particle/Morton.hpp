@@ -0,0 +1,45 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+// 63-bit Morton (Z-order) keys: 21 bits per axis, interleaved so that bits
+// 3k, 3k+1, 3k+2 hold bit k of x, y, z. Each 3-bit digit, read from the top,
+// is an octant index (x | y << 1 | z << 2) one octree level further down.
+namespace morton {
+    inline constexpr int LEVELS{ 21 };
+    inline constexpr double CELLS{ static_cast<double>( 1 << LEVELS ) };
+
+    // Spreads the low 21 bits of v so that bit k lands on bit 3k.
+    [[nodiscard]] inline std::uint64_t spread_bits( std::uint64_t v ) {
+        v &= 0x1fffffULL;
+        v = ( v | ( v << 32 ) ) & 0x1f00000000ffffULL;
+        v = ( v | ( v << 16 ) ) & 0x1f0000ff0000ffULL;
+        v = ( v | ( v << 8 ) )  & 0x100f00f00f00f00fULL;
+        v = ( v | ( v << 4 ) )  & 0x10c30c30c30c30c3ULL;
+        v = ( v | ( v << 2 ) )  & 0x1249249249249249ULL;
+        return v;
+    }
+
+    // Inverse of spread_bits: gathers bits 0, 3, 6, ... into the low 21 bits.
+    [[nodiscard]] inline std::uint64_t compact_bits( std::uint64_t v ) {
+        v &= 0x1249249249249249ULL;
+        v = ( v ^ ( v >> 2 ) )  & 0x10c30c30c30c30c3ULL;
+        v = ( v ^ ( v >> 4 ) )  & 0x100f00f00f00f00fULL;
+        v = ( v ^ ( v >> 8 ) )  & 0x1f0000ff0000ffULL;
+        v = ( v ^ ( v >> 16 ) ) & 0x1f00000000ffffULL;
+        v = ( v ^ ( v >> 32 ) ) & 0x1fffffULL;
+        return v;
+    }
+
+    // Key of a point given the root cube's low corner and cells per unit
+    // length (CELLS / edge); points outside the cube clamp to its faces.
+    [[nodiscard]] inline std::uint64_t encode( double const x, double const y, double const z,
+                                               double const lo_x, double const lo_y, double const lo_z,
+                                               double const scale ) {
+        auto const qx{ static_cast<std::uint64_t>( std::clamp( ( x - lo_x ) * scale, 0.0, CELLS - 1.0 ) ) };
+        auto const qy{ static_cast<std::uint64_t>( std::clamp( ( y - lo_y ) * scale, 0.0, CELLS - 1.0 ) ) };
+        auto const qz{ static_cast<std::uint64_t>( std::clamp( ( z - lo_z ) * scale, 0.0, CELLS - 1.0 ) ) };
+        return spread_bits( qx ) | ( spread_bits( qy ) << 1 ) | ( spread_bits( qz ) << 2 );
+    }
+}
@@ -2,12 +2,17 @@
 
 #include "aligned_soa.hpp"
 
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
 class Particles {
 private:
     std::size_t N_;
+    std::size_t num_active_;
     
     // SoA field indices into the contiguous memory block.
-    // All 13 arrays are packed end-to-end: [pos_x|pos_y|...|mass], each of length N.
+    // All 14 arrays are packed end-to-end: [pos_x|pos_y|...|mass|pot], each of length N.
     enum ArrayIndex : std::size_t {
         POS_X,
         POS_Y,
@@ -22,18 +27,26 @@ private:
         OLD_ACC_Y,
         OLD_ACC_Z,
         MASS,
+        POT,
         NUM_SUB_ARRAYS
     };
 
-    // Single contiguous allocation: 13 * N doubles.
+    // Single contiguous allocation: 14 * N doubles.
     // Eliminates per-array allocation overhead and guarantees spatial locality.
     AlignedSoA<double> mem_block_;
 
+    // ids_[i] is the index slot i had at construction; permute() keeps it
+    // current so output can be written in the original order.
+    std::vector<std::size_t> ids_;
+
 public:
     explicit Particles( std::size_t const num_particles )
     : N_{ num_particles }
+    , num_active_{ num_particles }
     , mem_block_{ num_particles, NUM_SUB_ARRAYS }
-    { }
+    , ids_( num_particles ) {
+        std::iota( ids_.begin(), ids_.end(), std::size_t{} );
+    }
 
     // Move-only: unique_ptr member prevents copying implicitly,
     // but explicit declarations make ownership semantics clear.
@@ -44,6 +57,55 @@ public:
 
     [[nodiscard]] std::size_t num_particles() const { return N_; }
 
+    // Active/passive split. Particles [0, num_active) are gravitating
+    // sources; [num_active, N) are massless test particles that feel the
+    // active bodies but exert no force, so forces cost O(N_active * N).
+    // Passive masses are ignored. Defaults to all particles active.
+    [[nodiscard]] std::size_t num_active() const { return num_active_; }
+    void set_num_active( std::size_t const num_active ) {
+        if ( num_active > N_ ) {
+            throw std::runtime_error( "Particles: num_active exceeds the particle count" );
+        }
+        num_active_ = num_active;
+    }
+
+    [[nodiscard]] std::vector<std::size_t> const& ids() const { return ids_; }
+
+    // Reorders every array so slot k takes the contents of old slot
+    // order[k]. order must be a permutation that keeps the active/passive
+    // split, i.e. maps [0, num_active) onto itself.
+    void permute( std::vector<std::size_t> const &order ) {
+        if ( order.size() != N_ ) {
+            throw std::runtime_error( "Particles: permutation size does not match the particle count" );
+        }
+        std::vector<bool> seen( N_ );
+        for ( std::size_t k{}; k < N_; ++k ) {
+            if ( order[k] >= N_ || seen[order[k]] ) {
+                throw std::runtime_error( "Particles: order is not a permutation" );
+            }
+            if ( ( k < num_active_ ) != ( order[k] < num_active_ ) ) {
+                throw std::runtime_error( "Particles: permutation must keep the active/passive split" );
+            }
+            seen[order[k]] = true;
+        }
+
+        AlignedSoA<double> permuted{ N_, NUM_SUB_ARRAYS };
+        for ( std::size_t a{}; a < NUM_SUB_ARRAYS; ++a ) {
+            double const* src{ mem_block_[a] };
+            double* dst{ permuted[a] };
+            for ( std::size_t k{}; k < N_; ++k ) {
+                dst[k] = src[order[k]];
+            }
+        }
+        mem_block_ = std::move( permuted );
+
+        std::vector<std::size_t> ids( N_ );
+        for ( std::size_t k{}; k < N_; ++k ) {
+            ids[k] = ids_[order[k]];
+        }
+        ids_ = std::move( ids );
+    }
+
     // Mutable raw pointers:
     [[nodiscard]] double* pos_x() { return mem_block_[POS_X]; }
     [[nodiscard]] double* pos_y() { return mem_block_[POS_Y]; }
@@ -58,6 +120,8 @@ public:
     [[nodiscard]] double* old_acc_y() { return mem_block_[OLD_ACC_Y]; }
     [[nodiscard]] double* old_acc_z() { return mem_block_[OLD_ACC_Z]; }
     [[nodiscard]] double* mass() { return mem_block_[MASS]; }
+    // Per-unit-mass potential; only written by forces in potential mode.
+    [[nodiscard]] double* pot() { return mem_block_[POT]; }
 
     // Const raw pointers:
     [[nodiscard]] double const* pos_x() const { return mem_block_[POS_X]; }
@@ -73,4 +137,5 @@ public:
     [[nodiscard]] double const* old_acc_y() const { return mem_block_[OLD_ACC_Y]; }
     [[nodiscard]] double const* old_acc_z() const { return mem_block_[OLD_ACC_Z]; }
     [[nodiscard]] double const* mass() const { return mem_block_[MASS]; }
+    [[nodiscard]] double const* pot() const { return mem_block_[POT]; }
 };
\ No newline at end of file
@@ -0,0 +1,90 @@
+#include "Reorder.hpp"
+#include "Morton.hpp"
+#include "../Config.hpp"
+
+#include <algorithm>
+#include <numeric>
+
+#include <omp.h>
+
+Morton_Reorder::Morton_Reorder( std::size_t const every, double const max_disorder )
+: every_{ every }
+, max_disorder_{ max_disorder }
+{ }
+
+void Morton_Reorder::compute_keys( Particles const &particles ) const {
+    std::size_t const N{ particles.num_particles() };
+    double const* RESTRICT px{ particles.pos_x() };
+    double const* RESTRICT py{ particles.pos_y() };
+    double const* RESTRICT pz{ particles.pos_z() };
+
+    keys_.resize( N );
+    if ( N == 0 ) return;
+
+    // Bounding cube of every particle, passive ones included.
+    double min_x{ px[0] }, max_x{ px[0] };
+    double min_y{ py[0] }, max_y{ py[0] };
+    double min_z{ pz[0] }, max_z{ pz[0] };
+
+    #pragma omp parallel for reduction( min:min_x, min_y, min_z ) reduction( max:max_x, max_y, max_z ) \
+                             schedule( static ) if ( N >= config::OMP_THRESHOLD )
+    for ( std::size_t i = 1; i < N; ++i ) {
+        min_x = std::min( min_x, px[i] ); max_x = std::max( max_x, px[i] );
+        min_y = std::min( min_y, py[i] ); max_y = std::max( max_y, py[i] );
+        min_z = std::min( min_z, pz[i] ); max_z = std::max( max_z, pz[i] );
+    }
+    double edge{ std::max( { max_x - min_x, max_y - min_y, max_z - min_z } ) };
+    if ( edge <= 0.0 ) edge = 1.0;
+    double const scale{ morton::CELLS / edge };
+
+    std::uint64_t* RESTRICT keys{ keys_.data() };
+    #pragma omp parallel for schedule( static ) if ( N >= config::OMP_THRESHOLD )
+    for ( std::size_t i = 0; i < N; ++i ) {
+        keys[i] = morton::encode( px[i], py[i], pz[i], min_x, min_y, min_z, scale );
+    }
+}
+
+double Morton_Reorder::disorder( Particles const &particles, std::size_t const pinned ) const {
+    std::size_t const N{ particles.num_particles() };
+    std::size_t const N_a{ particles.num_active() };
+
+    compute_keys( particles );
+    std::uint64_t const* RESTRICT keys{ keys_.data() };
+
+    std::size_t descents{}, pairs{};
+    auto count = [&]( std::size_t const begin, std::size_t const end ) {
+        if ( end - begin < 2 ) return;
+        pairs += end - begin - 1;
+        for ( std::size_t i = begin + 1; i < end; ++i ) {
+            descents += keys[i] < keys[i - 1];
+        }
+    };
+    count( std::min( pinned, N_a ), N_a );
+    count( N_a, N );
+
+    return pairs > 0 ? static_cast<double>( descents ) / static_cast<double>( pairs ) : 0.0;
+}
+
+bool Morton_Reorder::due( Particles const &particles, std::size_t const pinned ) {
+    ++steps_;
+    if ( every_ > 0 && steps_ % every_ == 0 ) return true;
+    return max_disorder_ > 0.0 && disorder( particles, pinned ) > max_disorder_;
+}
+
+std::vector<std::size_t> const &Morton_Reorder::reorder( Particles &particles, std::size_t const pinned ) {
+    std::size_t const N{ particles.num_particles() };
+    std::size_t const N_a{ particles.num_active() };
+
+    compute_keys( particles );
+
+    order_.resize( N );
+    std::iota( order_.begin(), order_.end(), std::size_t{} );
+
+    // Stable, so bodies sharing a cell keep their relative order.
+    auto by_key = [this]( std::size_t const a, std::size_t const b ) { return keys_[a] < keys_[b]; };
+    std::stable_sort( order_.begin() + std::min( pinned, N_a ), order_.begin() + N_a, by_key );
+    std::stable_sort( order_.begin() + N_a, order_.end(), by_key );
+
+    particles.permute( order_ );
+    return order_;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "Particle.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__GNUC__) || defined(__clang__)
+    #define RESTRICT __restrict__
+#elif defined(_MSC_VER)
+    #define RESTRICT __restrict
+#else
+    #define RESTRICT
+#endif
+
+// Keeps the particle arrays in Morton (Z-order) order, so bodies that are
+// close in space are close in memory. Tree buckets then cover consecutive
+// slots and are streamed rather than gathered, and neighbouring targets in
+// a force loop touch the same cache lines.
+//
+// The active and passive ranges are sorted separately, keeping the split
+// intact, and the first `pinned` active bodies never move. Particles::ids() maps
+// each slot back to its original index.
+class Morton_Reorder {
+public:
+    // Reorders every `every` steps (0: never on a schedule) and whenever
+    // disorder() exceeds `max_disorder` (0: never on disorder).
+    explicit Morton_Reorder( std::size_t const every, double const max_disorder = 0.0 );
+
+    // Fraction of neighbouring slots, within each sorted range, whose keys
+    // are out of order: 0 right after a reorder, about 1/2 for a random order.
+    [[nodiscard]] double disorder( Particles const &particles, std::size_t const pinned = 0 ) const;
+
+    // Counts a step and reports whether the arrays should be reordered now.
+    [[nodiscard]] bool due( Particles const &particles, std::size_t const pinned = 0 );
+
+    // Sorts the arrays into key order and returns the permutation applied
+    // (slot k took old slot order[k]).
+    std::vector<std::size_t> const &reorder( Particles &particles, std::size_t const pinned = 0 );
+
+    [[nodiscard]] std::size_t every() const { return every_; }
+    [[nodiscard]] double max_disorder() const { return max_disorder_; }
+
+private:
+    std::size_t every_;
+    double max_disorder_;
+    std::size_t steps_{};
+
+    mutable std::vector<std::uint64_t> keys_;
+    std::vector<std::size_t> order_;
+
+    void compute_keys( Particles const &particles ) const;
+};
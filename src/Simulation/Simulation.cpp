@@ -1,5 +1,7 @@
 #include "Simulation.hpp"
 
+#include <algorithm>
+
 Simulation::Simulation( 
     std::size_t const num_particles,
     std::size_t const steps, 
@@ -14,6 +16,8 @@ Simulation::Simulation(
 , output_interval_{ output_interval }
 , body_names_{ std::move( names ) }
 , output_path_{ std::move( output_path ) }
+, acc_scratch_{}
+, reorder_{ nullptr }
 { }
 
 void Simulation::run() {
@@ -28,17 +32,23 @@ void Simulation::run() {
     // on their first step (e.g. Velocity Verlet) start from a valid state.
     // Yoshida does not need this (it computes forces internally), but it is
     // harmless and makes the API contract explicit: after run() begins,
-    // accelerations are always valid.
+    // accelerations are always valid. The same pass yields the initial potential.
+    bool const fused{ fused_potential() };
+    bool const synchronised{ fused && integrator()->synchronised_force() };
+
     for ( std::size_t i{}; i < num_bodies(); ++i ) {
         particles().acc_x()[i] = 0.0;
         particles().acc_y()[i] = 0.0;
         particles().acc_z()[i] = 0.0;
     }
+    zero_potential();
+    set_potential( fused );
     for ( auto const &force : forces() ) {
         force->apply( particles() );
     }
+    set_potential( false );
 
-    double const initial_energy{ total_energy() };
+    double const initial_energy{ total_energy( fused ) };
     double min_energy{ initial_energy };
     double max_energy{ initial_energy };
 
@@ -62,14 +72,31 @@ void Simulation::run() {
     auto const start_time{ std::chrono::high_resolution_clock::now() };
 
     for ( std::size_t curr_step{1}; curr_step <= steps(); ++curr_step ) {
+        // Sample conservation quantities at 10x the output cadence.
+        // This is infrequent enough to be cheap but frequent enough to capture
+        // the symplectic oscillation envelope, whose period is dominated by
+        // Jupiter's ~12 year orbit. The potential comes from the step's own
+        // force pass when the integrator ends on one, else from one extra
+        // potential-mode pass with the configured force.
+        bool const sample{ curr_step % ( 10*output_interval() ) == 0 };
+
+        if ( sample && synchronised ) {
+            zero_potential();
+            set_potential( true );
+        }
         integrator()->integrate( particles(), forces() );
+        if ( sample && synchronised ) {
+            set_potential( false );
+        }
 
-        // Sample conservation quantities at 10x the output cadence.
-        // This is infrequent enough to be cheap (energy is O(N^2)) but frequent
-        // enough to capture the symplectic oscillation envelope, whose period
-        // is dominated by Jupiter's ~12 year orbit.
-        if ( curr_step % ( 10*output_interval() ) == 0 ) {
-            double const E{ total_energy() };
+        std::size_t const pinned{ integrator()->pinned_bodies() };
+        if ( reorder_ && reorder_->due( particles(), pinned ) ) {
+            integrator()->permute( reorder_->reorder( particles(), pinned ) );
+        }
+
+        if ( sample ) {
+            if ( fused && !synchronised ) evaluate_potential();
+            double const E{ total_energy( fused ) };
             max_energy = std::max( E, max_energy );
             min_energy = std::min( E, min_energy );
 
@@ -89,7 +116,7 @@ void Simulation::run() {
         }
 
         if ( curr_step % output_interval() == 0 ) {
-            bin.write( particles(), curr_step, curr_step * config::dt );
+            bin.write( particles(), curr_step, curr_step * integrator()->dt() );
         }
     }
     std::cout << "\rProgress: 100%" << std::flush;
@@ -124,9 +151,59 @@ void Simulation::set_integrator( std::unique_ptr<Integrator> sim_integrator ) {
     integrator() = std::move( sim_integrator );
 }
 
-double Simulation::total_energy() const {
+void Simulation::set_reorder( std::size_t const every, double const max_disorder ) {
+    reorder_ = std::make_unique<Morton_Reorder>( every, max_disorder );
+}
+
+bool Simulation::fused_potential() const {
+    return std::all_of( forces_.begin(), forces_.end(),
+                        []( auto const &force ) { return force->supports_potential(); } );
+}
+
+void Simulation::set_potential( bool const enabled ) {
+    for ( auto const &force : forces() ) {
+        force->set_potential( enabled );
+    }
+}
+
+void Simulation::zero_potential() {
+    double* RESTRICT pot{ particles().pot() };
     std::size_t const N{ particles().num_particles() };
 
+    #pragma omp simd
+    for ( std::size_t i = 0; i < N; ++i ) {
+        pot[i] = 0.0;
+    }
+}
+
+void Simulation::evaluate_potential() {
+    std::size_t const N{ particles().num_particles() };
+    double* RESTRICT ax{ particles().acc_x() };
+    double* RESTRICT ay{ particles().acc_y() };
+    double* RESTRICT az{ particles().acc_z() };
+
+    acc_scratch_.resize( 3 * N );
+    double* RESTRICT saved{ acc_scratch_.data() };
+    for ( std::size_t i = 0; i < N; ++i ) {
+        saved[i] = ax[i]; saved[N + i] = ay[i]; saved[2*N + i] = az[i];
+        ax[i] = 0.0; ay[i] = 0.0; az[i] = 0.0;
+    }
+
+    zero_potential();
+    set_potential( true );
+    for ( auto const &force : forces() ) {
+        force->apply( particles() );
+    }
+    set_potential( false );
+
+    for ( std::size_t i = 0; i < N; ++i ) {
+        ax[i] = saved[i]; ay[i] = saved[N + i]; az[i] = saved[2*N + i];
+    }
+}
+
+double Simulation::total_energy( bool const from_pot ) const {
+    std::size_t const N{ particles().num_active() };
+
     double const* RESTRICT px{ particles().pos_x() };
     double const* RESTRICT py{ particles().pos_y() };
     double const* RESTRICT pz{ particles().pos_z() };
@@ -134,6 +211,7 @@ double Simulation::total_energy() const {
     double const* RESTRICT vy{ particles().vel_y() };
     double const* RESTRICT vz{ particles().vel_z() };
     double const* RESTRICT mass{ particles().mass() };
+    double const* RESTRICT pot{ particles().pot() };
 
     constexpr double eps_sq{ config::EPS * config::EPS };
     constexpr double G{ config::G };
@@ -179,7 +257,13 @@ double Simulation::total_energy() const {
         }
     }
 
-    if ( N >= OMP_THRESHOLD ) {
+    if ( from_pot ) {
+        // Each pair appears in both bodies' potentials, hence the 1/2.
+        #pragma omp parallel for simd reduction( +:potential_energy ) schedule( static ) if ( N >= OMP_THRESHOLD )
+        for ( std::size_t i = 0; i < N; ++i ) {
+            potential_energy += 0.5 * mass[i] * pot[i];
+        }
+    } else if ( N >= OMP_THRESHOLD ) {
         #pragma omp parallel for reduction( +:potential_energy ) schedule( guided )
         for ( std::size_t i = 0; i < N; ++i ) {
             potential_energy += potential_kernel(i);
@@ -194,7 +278,7 @@ double Simulation::total_energy() const {
 }
 
 void Simulation::total_ang_momentum_vec( double &Lx, double &Ly, double &Lz ) const {
-    std::size_t const N{ particles().num_particles() };
+    std::size_t const N{ particles().num_active() };
     double const* RESTRICT m{ particles().mass() };
 
     double const* RESTRICT px{ particles().pos_x() };
@@ -215,7 +299,7 @@ void Simulation::total_ang_momentum_vec( double &Lx, double &Ly, double &Lz ) co
 }
 
 void Simulation::total_lin_momentum_vec( double &Px, double &Py, double &Pz ) const {
-    std::size_t const N{ particles().num_particles() };
+    std::size_t const N{ particles().num_active() };
 
     double const* RESTRICT m{ particles().mass() };
 
@@ -248,7 +332,7 @@ void Simulation::initial_output() {
     std::cout << "\n<--- Solar System Simulation --->" << std::endl;
     std::cout << "Bodies: " << num_bodies() << std::endl;
     std::cout << "Integrator: " << integrator()->name() << std::endl;
-    std::cout << "Dt: " << config::dt << " seconds" << std::endl;
+    std::cout << "Dt: " << integrator()->dt() << " seconds" << std::endl;
     std::cout << "Duration: " << config::num_years << " years" << std::endl;
     std::cout << "Parallelization: " << ( ( config::OMP_THRESHOLD <= num_bodies() ) ? "Enabled" : "Disabled" ) << std::endl;
     std::cout << std::endl;
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "../Particle/Particle.hpp"
+#include "../Particle/Reorder.hpp"
 #include "../Force/Force.hpp"
 #include "../Integrator/Integrator.hpp"
 #include "../Config.hpp"
@@ -35,7 +36,27 @@ private:
     std::vector<std::string> body_names_;
     std::string output_path_;
 
-    double total_energy() const;
+    // Scratch for the accelerations while a potential pass runs.
+    std::vector<double> acc_scratch_;
+
+    // Optional space-filling-curve reordering between steps.
+    std::unique_ptr<Morton_Reorder> reorder_;
+
+    // Energy of the current state. With `from_pot` the potential is read
+    // from particles().pot(), which must be current; otherwise it is summed
+    // pairwise (O(N^2)). Like the momentum diagnostics below, it covers the
+    // active bodies only: test particles carry no energy or momentum.
+    double total_energy( bool const from_pot ) const;
+
+    // True if every force can produce the potential alongside the force.
+    [[nodiscard]] bool fused_potential() const;
+    void set_potential( bool const enabled );
+    void zero_potential();
+
+    // One potential-mode force pass at the current positions. Accelerations
+    // are preserved, so integrators that carry them between steps are unaffected.
+    void evaluate_potential();
+
     double total_ang_momentum() const;
     double total_lin_momentum() const;
 
@@ -74,5 +95,10 @@ public:
     void run();
     void add_force( std::unique_ptr<Force> force );
     void set_integrator( std::unique_ptr<Integrator> sim_integrator );
+
+    // Reorders the particle arrays into Morton order every `every` steps
+    // and/or once the order has decayed past `max_disorder` (see
+    // Morton_Reorder). Output stays in the original body order.
+    void set_reorder( std::size_t const every, double const max_disorder = 0.0 );
     void initial_output();
 };
\ No newline at end of file
@@ -1,5 +1,8 @@
 #include "Force/Force.hpp"
 #include "Force/BarnesHut.hpp"
+#include "Force/BarnesHutTuner.hpp"
+#include "Force/FMM.hpp"
+#include "Force/PM.hpp"
 #include "Integrator/Integrator.hpp"
 #include "Particle/Particle.hpp"
 #include "Simulation/Simulation.hpp"
@@ -8,34 +11,124 @@
 #include <iostream>
 #include <iomanip>
 #include <cstddef>
+#include <bit>
 #include <cmath>
 #include <string>
 #include <string_view>
 
 int main( int argc, char* argv[] ) {
     std::string_view force_kind{ "direct" };
-    double theta{ 0.5 };
+    double theta{ 0.0 };    // 0: the force's default
+    int order{ 6 };
+    double refit{ 0.0 };
+    double alpha{ 0.0 };
+    double tune{ 0.0 };
+    std::size_t mesh{ 64 };
+    std::string_view integrator_kind{ "yoshida" };
+    double dt{ 0.0 };
+    std::size_t reorder_every{ 0 };
 
     for ( int i{ 1 }; i < argc; ++i ) {
         std::string_view const arg{ argv[i] };
         if ( arg == "--force" && i + 1 < argc ) { force_kind = argv[++i]; }
         else if ( arg == "--theta" && i + 1 < argc ) { theta = std::stod( argv[++i] ); }
+        else if ( arg == "--order" && i + 1 < argc ) { order = std::stoi( argv[++i] ); }
+        else if ( arg == "--refit" && i + 1 < argc ) { refit = std::stod( argv[++i] ); }
+        else if ( arg == "--alpha" && i + 1 < argc ) { alpha = std::stod( argv[++i] ); }
+        else if ( arg == "--tune" && i + 1 < argc ) { tune = std::stod( argv[++i] ); }
+        else if ( arg == "--mesh" && i + 1 < argc ) { mesh = std::stoul( argv[++i] ); }
+        else if ( arg == "--integrator" && i + 1 < argc ) { integrator_kind = argv[++i]; }
+        else if ( arg == "--dt" && i + 1 < argc ) { dt = std::stod( argv[++i] ); }
+        else if ( arg == "--reorder" && i + 1 < argc ) { reorder_every = std::stoul( argv[++i] ); }
         else if ( arg == "-h" || arg == "--help" ) {
-            std::cout << "Usage: main [--force {direct|bh}] [--theta T]\n"
-                      << "  --force direct  Direct O(N^2) summation (default)\n"
+            std::cout << "Usage: main [--force {direct|sym|mixed|bh|bhdual|fmm|pm|treepm}] [--theta T] [--order P] [--refit F] [--alpha A] [--tune E] [--mesh M] [--integrator {yoshida|yoshida6|kl8|wh|block}] [--dt S] [--reorder K]\n"
+                      << "  --force direct  Direct O(N^2) summation (default; fixed-size kernel for N <= 64)\n"
+                      << "  --force sym     Direct summation, each pair once (Newton's third law)\n"
+                      << "  --force mixed   Direct summation with float pair math, double accumulation\n"
                       << "  --force bh      Barnes-Hut O(N log N) approximation\n"
-                      << "  --theta T       Opening angle for BH (default 0.5)\n";
+                      << "  --force bhdual  Barnes-Hut with quadrupoles and a dual-tree walk: each cell pair\n"
+                      << "                  once, so forces are antisymmetric and momentum is conserved\n"
+                      << "  --force fmm     Fast Multipole Method, O(N)\n"
+                      << "  --force pm      Particle-mesh (FFT) on an isolated grid, O(N + M log M)\n"
+                      << "  --force treepm  Particle-mesh long range plus a cutoff Barnes-Hut short range\n"
+                      << "  --theta T       Opening angle (default 0.5 for bh, 0.6 for bhdual, 0.7 for treepm,\n"
+                      << "                  0.75 for fmm)\n"
+                      << "  --order P       FMM expansion order, 1 to 10 (default 6)\n"
+                      << "  --refit F       BH: refit the tree between rebuilds while at most a fraction F\n"
+                      << "                  of bodies leave their leaf cells (default 0: rebuild every call)\n"
+                      << "  --alpha A       BH: open nodes whose estimated force error exceeds A times the\n"
+                      << "                  body's previous acceleration (default 0: geometric theta test)\n"
+                      << "  --tune E        BH: choose theta and leaf bucket for an RMS force error E,\n"
+                      << "                  re-tuned every 3000000 force calls (overrides --theta)\n"
+                      << "  --mesh M        PM grid cells per side, a power of two >= 16 (default 64)\n"
+                      << "  --integrator yoshida  4th-order Yoshida (default)\n"
+                      << "  --integrator yoshida6 6th-order Yoshida composition, 7 force evaluations per step\n"
+                      << "  --integrator kl8      8th-order Kahan-Li composition, 15 force evaluations per step\n"
+                      << "  --integrator wh       Wisdom-Holman, Kepler drift about body 0\n"
+                      << "  --integrator block    Leapfrog with per-body power-of-two timesteps (direct or bh)\n"
+                      << "  --dt S          Timestep in seconds; must divide the output interval\n"
+                      << "                  (default 900 for yoshida, 3600 for yoshida6, 7305 for kl8,\n"
+                      << "                  87660 for wh and block)\n"
+                      << "  --reorder K     Sort bodies into Morton order every K steps (default off)\n";
             return 0;
         }
     }
 
-    if ( force_kind != "direct" && force_kind != "bh" ) {
-        std::cerr << "error: --force must be 'direct' or 'bh'\n";
+    if ( force_kind != "direct" && force_kind != "sym" && force_kind != "mixed" && force_kind != "bh"
+         && force_kind != "bhdual" && force_kind != "fmm" && force_kind != "pm" && force_kind != "treepm" ) {
+        std::cerr << "error: --force must be 'direct', 'sym', 'mixed', 'bh', 'bhdual', 'fmm', 'pm', or 'treepm'\n";
         return 1;
     }
 
+    if ( force_kind == "bhdual" && alpha > 0.0 ) {
+        std::cerr << "error: --force bhdual uses the geometric theta test; drop --alpha\n";
+        return 1;
+    }
+
+    if ( force_kind == "fmm" && ( order < 1 || order > Gravity_FMM::MAX_ORDER || theta >= 1.0 ) ) {
+        std::cerr << "error: --force fmm needs --order in [1, " << Gravity_FMM::MAX_ORDER << "] and --theta below 1\n";
+        return 1;
+    }
+
+    if ( ( force_kind == "pm" || force_kind == "treepm" ) && ( mesh < 16 || !std::has_single_bit( mesh ) ) ) {
+        std::cerr << "error: --mesh must be a power of two >= 16\n";
+        return 1;
+    }
+
+    if ( integrator_kind != "yoshida" && integrator_kind != "yoshida6" && integrator_kind != "kl8"
+         && integrator_kind != "wh" && integrator_kind != "block" ) {
+        std::cerr << "error: --integrator must be 'yoshida', 'yoshida6', 'kl8', 'wh', or 'block'\n";
+        return 1;
+    }
+
+    if ( integrator_kind == "block" && force_kind != "direct" && force_kind != "bh" ) {
+        std::cerr << "error: --integrator block needs --force direct or bh\n";
+        return 1;
+    }
+
+    if ( dt == 0.0 ) {
+        if ( integrator_kind == "yoshida" ) dt = config::dt;
+        else if ( integrator_kind == "yoshida6" ) dt = 4 * config::dt;
+        else if ( integrator_kind == "kl8" ) dt = 7305.0;  // 487 * 15 s: 7200 does not divide the output interval
+        else dt = 87660.0;
+    }
+
+    // Snapshots must land on the JPL --step grid, so dt has to divide it.
+    std::size_t const output_seconds{ config::output_hours * static_cast<std::size_t>( config::SECONDS_PER_HOUR ) };
+    if ( dt < 1.0 || dt != std::floor( dt ) || output_seconds % static_cast<std::size_t>( dt ) != 0 ) {
+        std::cerr << "error: --dt must be a whole number of seconds dividing " << output_seconds << "\n";
+        return 1;
+    }
+    std::size_t const total_steps{ static_cast<std::size_t>( config::SECONDS_PER_YEAR / dt ) * config::num_years };
+    std::size_t const output_interval{ output_seconds / static_cast<std::size_t>( dt ) };
+
     static constexpr std::size_t num_bodies{ sizeof( bodies ) / sizeof( bodies[0] ) };
 
+    // The body count is a compile-time constant, so small systems get the
+    // fixed-size direct force and step, which skip all per-call loop-bound
+    // and threading logic.
+    static constexpr bool fixed_size{ num_bodies <= 8 * direct::FIXED_MAX_BLOCKS };
+
     std::vector<std::string> names{};
     names.reserve( num_bodies );
     for ( std::size_t i{}; i < num_bodies; ++i ) {
@@ -44,19 +137,59 @@ int main( int argc, char* argv[] ) {
 
     Simulation sim{
         num_bodies,
-        config::total_steps,
-        config::output_interval,
+        total_steps,
+        output_interval,
         std::move( names ),
         "tests/sim_output.bin"
     };
 
-    if ( force_kind == "bh" ) {
-        sim.add_force( std::make_unique<Gravity_BarnesHut>( theta ) );
+    if ( force_kind == "bh" && tune > 0.0 ) {
+        sim.add_force( std::make_unique<Gravity_BarnesHut_Tuned>( tune, 3000000, 256, BH_Expansion::Monopole,
+                                                                  simd::detect(), &std::cout ) );
+    } else if ( force_kind == "bh" ) {
+        sim.add_force( std::make_unique<Gravity_BarnesHut>( theta > 0.0 ? theta : 0.5, 8, BH_Build::Morton, 64,
+                                                            simd::detect(),
+                                                            BH_Options{ .refit_tolerance = refit, .alpha = alpha } ) );
+    } else if ( force_kind == "bhdual" ) {
+        sim.add_force( std::make_unique<Gravity_BarnesHut>( theta > 0.0 ? theta : 0.6, 8, BH_Build::Morton, 64,
+                                                            simd::detect(),
+                                                            BH_Options{ .expansion = BH_Expansion::Quadrupole,
+                                                                        .refit_tolerance = refit,
+                                                                        .traversal = BH_Traversal::Dual } ) );
+    } else if ( force_kind == "fmm" ) {
+        sim.add_force( std::make_unique<Gravity_FMM>( order, theta > 0.0 ? theta : 0.75 ) );
+    } else if ( force_kind == "pm" ) {
+        sim.add_force( std::make_unique<Gravity_PM>( mesh ) );
+    } else if ( force_kind == "treepm" ) {
+        sim.add_force( std::make_unique<Gravity_TreePM>( mesh, 1.25, theta > 0.0 ? theta : 0.7 ) );
+    } else if ( force_kind == "sym" ) {
+        sim.add_force( std::make_unique<Gravity_Symmetric>() );
+    } else if ( force_kind == "mixed" ) {
+        sim.add_force( std::make_unique<Gravity_Mixed>() );
+    } else if ( integrator_kind == "block" ) {
+        // Gravity_Fixed always evaluates the whole system; block steps need subsets.
+        sim.add_force( std::make_unique<Gravity>() );
+    } else if constexpr ( fixed_size ) {
+        sim.add_force( std::make_unique<Gravity_Fixed<num_bodies>>() );
     } else {
         sim.add_force( std::make_unique<Gravity>() );
     }
-    sim.set_integrator( std::make_unique<Yoshida>( config::dt ) );
+
+    if ( integrator_kind == "wh" ) {
+        sim.set_integrator( std::make_unique<Wisdom_Holman>( dt ) );
+    } else if ( integrator_kind == "block" ) {
+        sim.set_integrator( std::make_unique<Block_Leapfrog>( dt ) );
+    } else if ( integrator_kind == "yoshida6" ) {
+        sim.set_integrator( std::make_unique<Composition<Yoshida_6>>( dt ) );
+    } else if ( integrator_kind == "kl8" ) {
+        sim.set_integrator( std::make_unique<Composition<Kahan_Li_8>>( dt ) );
+    } else if ( fixed_size && force_kind == "direct" ) {
+        sim.set_integrator( std::make_unique<Yoshida_Fixed<num_bodies>>( dt ) );
+    } else {
+        sim.set_integrator( std::make_unique<Yoshida>( dt ) );
+    }
     initialize_bodies( sim.particles(), num_bodies );
+    if ( reorder_every > 0 ) sim.set_reorder( reorder_every );
 
     sim.run();
 
@@ -11,10 +11,25 @@
 //         ./build/benchmark --force bh --theta 0.3
 //         ./build/benchmark --force direct
 //         ./build/benchmark --include-direct-above 32768
+//         ./build/benchmark --force mixed
+//         ./build/benchmark --force tiling --max-n 65536
+//         ./build/benchmark --force sym
+//         ./build/benchmark --force fixed
+//         ./build/benchmark --force bhbuild --max-n 1048576
+//         ./build/benchmark --force reorder --reorder 10
+//         ./build/benchmark --force refit --refit 0.05
+//         ./build/benchmark --force multipole --accuracy 1e-3
+//         ./build/benchmark --force fmm --max-n 1048576
+//         ./build/benchmark --force dual --theta 0.6
+//         ./build/benchmark --active 35
 
 #include "../src/Particle/Particle.hpp"
+#include "../src/Particle/Reorder.hpp"
 #include "../src/Force/Force.hpp"
 #include "../src/Force/BarnesHut.hpp"
+#include "../src/Force/BarnesHutTuner.hpp"
+#include "../src/Force/FMM.hpp"
+#include "../src/Force/PM.hpp"
 #include "../src/Integrator/Integrator.hpp"
 #include "../src/Config.hpp"
 
@@ -27,18 +42,30 @@
 #include <random>
 #include <string>
 #include <algorithm>
+#include <bit>
+#include <utility>
 
 #include <omp.h>
 
-enum class ForceKind { Direct, BarnesHut };
+enum class ForceKind { Direct, DirectUntiled, Symmetric, BarnesHut, BarnesHutRecursive, BarnesHutRefit };
 
 static char const* force_kind_label( ForceKind k ) {
-    return k == ForceKind::Direct ? "direct" : "bh";
+    switch ( k ) {
+        case ForceKind::Direct:        return "direct";
+        case ForceKind::DirectUntiled: return "direct-untiled";
+        case ForceKind::Symmetric:     return "sym";
+        case ForceKind::BarnesHut:     return "bh";
+        case ForceKind::BarnesHutRecursive: return "bh-recursive";
+        case ForceKind::BarnesHutRefit: return "bh-refit";
+    }
+    return "direct";
 }
 
 // Populate N bodies with random state. Enforces a minimum pairwise separation
 // of `min_sep` meters to avoid near-singular force evaluations that would
-// produce non-representative dynamics during the timed integration.
+// produce non-representative dynamics during the timed integration. The
+// check is O(N^2); min_sep = 0 skips it for single force evaluations at
+// large N.
 static void populate_random( Particles &p, std::size_t const N, double const min_sep = 1e9,
                              unsigned const seed = 42 ) {
     std::mt19937_64 rng{ seed };
@@ -56,7 +83,7 @@ static void populate_random( Particles &p, std::size_t const N, double const min
             double const pz{ pos_dist( rng ) };
 
             accepted = true;
-            for ( std::size_t j{}; j < i; ++j ) {
+            for ( std::size_t j{}; min_sep > 0.0 && j < i; ++j ) {
                 double const dx{ px - p.pos_x()[j] };
                 double const dy{ py - p.pos_y()[j] };
                 double const dz{ pz - p.pos_z()[j] };
@@ -83,6 +110,21 @@ static void populate_random( Particles &p, std::size_t const N, double const min
     }
 }
 
+// --active K: only the first K bodies are gravitating sources; the rest are
+// massless test particles. 0 keeps every body active.
+static std::size_t g_num_active{ 0 };
+
+static std::size_t num_sources( std::size_t const N ) {
+    return g_num_active == 0 ? N : std::min( g_num_active, N );
+}
+
+// Timed runs sort the bodies into Morton order every g_reorder_every steps
+// (and once before timing); 0 keeps the generation order.
+static std::size_t g_reorder_every{ 0 };
+
+// Refit tolerance of ForceKind::BarnesHutRefit (--refit F).
+static double g_refit_tolerance{ 0.05 };
+
 struct BenchResult {
     std::size_t N;
     std::size_t steps;
@@ -107,6 +149,19 @@ static std::unique_ptr<Force> make_force( ForceKind kind, double theta ) {
     if ( kind == ForceKind::BarnesHut ) {
         return std::make_unique<Gravity_BarnesHut>( theta );
     }
+    if ( kind == ForceKind::BarnesHutRecursive ) {
+        return std::make_unique<Gravity_BarnesHut>( theta, 8, BH_Build::Recursive );
+    }
+    if ( kind == ForceKind::BarnesHutRefit ) {
+        return std::make_unique<Gravity_BarnesHut>( theta, 8, BH_Build::Morton, 64, simd::detect(),
+                                                    BH_Options{ .refit_tolerance = g_refit_tolerance } );
+    }
+    if ( kind == ForceKind::Symmetric ) {
+        return std::make_unique<Gravity_Symmetric>();
+    }
+    if ( kind == ForceKind::DirectUntiled ) {
+        return std::make_unique<Gravity>( simd::detect(), direct::UNTILED );
+    }
     return std::make_unique<Gravity>();
 }
 
@@ -115,11 +170,15 @@ static double run_timed( std::size_t const N, std::size_t const steps,
                          ForceKind const kind, double const theta ) {
     Particles p{ N };
     populate_random( p, N );
+    p.set_num_active( num_sources( N ) );
 
     std::vector<std::unique_ptr<Force>> forces;
     forces.push_back( make_force( kind, theta ) );
     Yoshida integ{ 900.0 };
 
+    Morton_Reorder reorder{ g_reorder_every };
+    if ( g_reorder_every > 0 ) reorder.reorder( p );
+
     // Warmup: 3 steps to stabilize thread pool and caches.
     for ( std::size_t s{}; s < 3; ++s ) {
         integ.integrate( p, forces );
@@ -129,6 +188,7 @@ static double run_timed( std::size_t const N, std::size_t const steps,
 
     for ( std::size_t s{}; s < steps; ++s ) {
         integ.integrate( p, forces );
+        if ( g_reorder_every > 0 && reorder.due( p ) ) reorder.reorder( p );
     }
 
     auto const end{ std::chrono::high_resolution_clock::now() };
@@ -152,12 +212,264 @@ static double run_median( std::size_t const N, std::size_t const steps,
     return timings[trials / 2];
 }
 
-// 3 force evaluations x N x N pairwise interactions x ~27 FLOPs per pair
-// (sub, mul, add for dx/dy/dz, R_sq, 1/sqrt, mul chain, mask, accumulate)
+// 3 force evaluations x N x N_active pairwise interactions x ~27 FLOPs per
+// pair (sub, mul, add for dx/dy/dz, R_sq, 1/sqrt, mul chain, mask, accumulate)
 // plus drift/kick updates: ~84N FLOPs per step. The BH kernel is data
 // dependent and is not modeled here.
 static double direct_flops_per_step( std::size_t const N ) {
-    return 3.0 * N * N * 27.0 + 84.0 * N;
+    return 3.0 * N * num_sources( N ) * 27.0 + 84.0 * N;
+}
+
+// Mixed-precision report: times single force evaluations of the double and
+// mixed direct kernels on the same state and measures the per-body relative
+// acceleration error of the mixed kernel against the double one.
+struct MixedResult {
+    double direct_ms;
+    double mixed_ms;
+    double rms_rel_err;
+    double max_rel_err;
+};
+
+template <typename F>
+static double time_apply( F const &force, Particles &p, std::size_t const trials ) {
+    std::vector<double> timings;
+    timings.reserve( trials );
+    force.apply( p );  // warmup
+    for ( std::size_t t{}; t < trials; ++t ) {
+        auto const start{ std::chrono::high_resolution_clock::now() };
+        force.apply( p );
+        auto const end{ std::chrono::high_resolution_clock::now() };
+        timings.push_back( std::chrono::duration<double, std::milli>( end - start ).count() );
+    }
+    std::sort( timings.begin(), timings.end() );
+    return timings[trials / 2];
+}
+
+static MixedResult run_mixed( std::size_t const N, std::size_t const trials ) {
+    Particles ref{ N };
+    populate_random( ref, N );
+    Particles mix{ N };
+    populate_random( mix, N );
+
+    Gravity const direct{};
+    Gravity_Mixed const mixed{};
+
+    MixedResult r{};
+    r.direct_ms = time_apply( direct, ref, trials );
+    r.mixed_ms = time_apply( mixed, mix, trials );
+
+    // Fresh single evaluations for the error measurement.
+    for ( std::size_t i{}; i < N; ++i ) {
+        ref.acc_x()[i] = ref.acc_y()[i] = ref.acc_z()[i] = 0.0;
+        mix.acc_x()[i] = mix.acc_y()[i] = mix.acc_z()[i] = 0.0;
+    }
+    direct.apply( ref );
+    mixed.apply( mix );
+
+    double sum_sq{};
+    for ( std::size_t i{}; i < N; ++i ) {
+        double const dx{ mix.acc_x()[i] - ref.acc_x()[i] };
+        double const dy{ mix.acc_y()[i] - ref.acc_y()[i] };
+        double const dz{ mix.acc_z()[i] - ref.acc_z()[i] };
+        double const a_sq{ ref.acc_x()[i]*ref.acc_x()[i] + ref.acc_y()[i]*ref.acc_y()[i]
+                         + ref.acc_z()[i]*ref.acc_z()[i] };
+        double const rel{ std::sqrt( ( dx*dx + dy*dy + dz*dz ) / a_sq ) };
+        sum_sq += rel * rel;
+        r.max_rel_err = std::max( r.max_rel_err, rel );
+    }
+    r.rms_rel_err = std::sqrt( sum_sq / static_cast<double>( N ) );
+    return r;
+}
+
+// Direct-summation accelerations of S evenly spaced targets, x, y, z per
+// target, for measuring the approximate forces; S = N is the full reference.
+struct SampledReference {
+    std::vector<std::size_t> targets;
+    std::vector<double> acc;
+};
+
+static SampledReference sampled_reference( Particles &p, std::size_t const S ) {
+    std::size_t const N{ p.num_particles() };
+    SampledReference ref{ std::vector<std::size_t>( S ), std::vector<double>( 3 * S ) };
+    for ( std::size_t s{}; s < S; ++s ) {
+        std::size_t const i{ s * ( N / S ) };
+        ref.targets[s] = i;
+        p.acc_x()[i] = p.acc_y()[i] = p.acc_z()[i] = 0.0;
+    }
+    Gravity{}.apply_subset( p, ref.targets );
+    for ( std::size_t s{}; s < S; ++s ) {
+        std::size_t const i{ ref.targets[s] };
+        ref.acc[3*s] = p.acc_x()[i]; ref.acc[3*s + 1] = p.acc_y()[i]; ref.acc[3*s + 2] = p.acc_z()[i];
+    }
+    return ref;
+}
+
+// Accelerations from `force` alone.
+static void apply_alone( Force const &force, Particles &p ) {
+    for ( std::size_t i{}; i < p.num_particles(); ++i ) p.acc_x()[i] = p.acc_y()[i] = p.acc_z()[i] = 0.0;
+    force.apply( p );
+}
+
+// RMS relative error of the current accelerations over the sampled targets.
+static double rms_rel_error( Particles const &p, SampledReference const &ref ) {
+    std::vector<double> const &a{ ref.acc };
+    double sum_sq{};
+    for ( std::size_t s{}; s < ref.targets.size(); ++s ) {
+        std::size_t const i{ ref.targets[s] };
+        double const dx{ p.acc_x()[i] - a[3*s] };
+        double const dy{ p.acc_y()[i] - a[3*s + 1] };
+        double const dz{ p.acc_z()[i] - a[3*s + 2] };
+        sum_sq += ( dx*dx + dy*dy + dz*dz ) / ( a[3*s]*a[3*s] + a[3*s + 1]*a[3*s + 1] + a[3*s + 2]*a[3*s + 2] );
+    }
+    return std::sqrt( sum_sq / static_cast<double>( ref.targets.size() ) );
+}
+
+// |sum m a| / sum m |a| of the current accelerations, which vanishes for
+// exactly antisymmetric pair forces.
+static double net_force( Particles const &p ) {
+    double fx{}, fy{}, fz{}, f_abs{};
+    for ( std::size_t i{}; i < p.num_particles(); ++i ) {
+        double const m{ p.mass()[i] };
+        fx += m * p.acc_x()[i]; fy += m * p.acc_y()[i]; fz += m * p.acc_z()[i];
+        f_abs += m * std::sqrt( p.acc_x()[i]*p.acc_x()[i] + p.acc_y()[i]*p.acc_y()[i] + p.acc_z()[i]*p.acc_z()[i] );
+    }
+    return std::sqrt( fx*fx + fy*fy + fz*fz ) / f_abs;
+}
+
+// Time-to-accuracy for one BH expansion order: the opening angle is
+// widened in steps of 0.05 for as long as the RMS relative force error
+// against direct summation stays within `accuracy`; the cheapest passing
+// setting is reported.
+struct MultipoleResult {
+    double theta;
+    double rms_rel_err;
+    double ms;
+};
+
+static MultipoleResult run_multipole( Particles &p, SampledReference const &ref,
+                                      BH_Expansion const expansion, double const accuracy,
+                                      std::size_t const trials ) {
+    MultipoleResult best{ 0.0, 0.0, 0.0 };
+    for ( double theta{ 0.1 }; theta < 1.2; theta += 0.05 ) {
+        Gravity_BarnesHut const bh{ theta, 8, BH_Build::Morton, 64, simd::detect(), { .expansion = expansion } };
+        apply_alone( bh, p );
+        double const rms{ rms_rel_error( p, ref ) };
+        if ( rms > accuracy ) break;
+
+        double const ms{ time_apply( bh, p, trials ) };
+        if ( best.ms == 0.0 || ms < best.ms ) best = { theta, rms, ms };
+    }
+    return best;
+}
+
+// Auto-tuned Barnes-Hut against --accuracy: the tuner's choice, its RMS
+// force error over every body, the time of the first call (tuning plus
+// one evaluation) and of later calls.
+struct TuneResult {
+    BH_Tuning tuning;
+    double rms_rel_err;
+    double tune_ms;
+    double ms;
+};
+
+static TuneResult run_tune( Particles &p, SampledReference const &ref, double const accuracy,
+                            std::size_t const trials ) {
+    Gravity_BarnesHut_Tuned const tuned{ accuracy };
+    auto const start{ std::chrono::high_resolution_clock::now() };
+    apply_alone( tuned, p );
+    auto const end{ std::chrono::high_resolution_clock::now() };
+
+    return { tuned.tuning(), rms_rel_error( p, ref ),
+             std::chrono::duration<double, std::milli>( end - start ).count(),
+             time_apply( tuned, p, trials ) };
+}
+
+// Barnes-Hut against FMM on the same bodies: time per force evaluation,
+// RMS relative force error against direct summation over a sample of up to
+// 1024 targets, and the net force |sum m a| / sum m |a|, which vanishes
+// for exactly antisymmetric pair forces.
+struct FmmResult {
+    double bh_ms, fmm_ms;
+    double bh_rms_rel_err, fmm_rms_rel_err;
+    double bh_net_force, fmm_net_force;
+};
+
+static FmmResult run_fmm( std::size_t const N, double const theta, int const order, std::size_t const trials ) {
+    Particles p{ N };
+    populate_random( p, N, 0.0 );
+    SampledReference const ref{ sampled_reference( p, std::min<std::size_t>( N, 1024 ) ) };
+
+    Gravity_BarnesHut const bh{ theta };
+    Gravity_FMM const fmm{ order };
+    FmmResult r{};
+    apply_alone( bh, p );
+    r.bh_rms_rel_err = rms_rel_error( p, ref );
+    r.bh_net_force = net_force( p );
+    apply_alone( fmm, p );
+    r.fmm_rms_rel_err = rms_rel_error( p, ref );
+    r.fmm_net_force = net_force( p );
+    r.bh_ms = time_apply( bh, p, trials );
+    r.fmm_ms = time_apply( fmm, p, trials );
+    return r;
+}
+
+// Group against dual-tree Barnes-Hut traversal, both with quadrupoles at
+// the same theta: time per force evaluation, RMS relative force error
+// against direct summation over a sample of up to 1024 targets, and the
+// net force |sum m a| / sum m |a|, which only the dual walk keeps at
+// rounding level.
+struct DualResult {
+    double groups_ms, dual_ms;
+    double groups_rms_rel_err, dual_rms_rel_err;
+    double groups_net_force, dual_net_force;
+};
+
+static DualResult run_dual( std::size_t const N, double const theta, std::size_t const trials ) {
+    Particles p{ N };
+    populate_random( p, N, 0.0 );
+    SampledReference const ref{ sampled_reference( p, std::min<std::size_t>( N, 1024 ) ) };
+
+    Gravity_BarnesHut const groups{ theta, 8, BH_Build::Morton, 64, simd::detect(),
+                                    { .expansion = BH_Expansion::Quadrupole } };
+    Gravity_BarnesHut const dual{ theta, 8, BH_Build::Morton, 64, simd::detect(),
+                                  { .expansion = BH_Expansion::Quadrupole, .traversal = BH_Traversal::Dual } };
+    DualResult r{};
+    apply_alone( groups, p );
+    r.groups_rms_rel_err = rms_rel_error( p, ref );
+    r.groups_net_force = net_force( p );
+    apply_alone( dual, p );
+    r.dual_rms_rel_err = rms_rel_error( p, ref );
+    r.dual_net_force = net_force( p );
+    r.groups_ms = time_apply( groups, p, trials );
+    r.dual_ms = time_apply( dual, p, trials );
+    return r;
+}
+
+// Barnes-Hut against TreePM on homogeneous bodies, the case TreePM is for:
+// time per force evaluation and RMS relative force error against direct
+// summation over a sample of up to 1024 targets. BH uses --theta, TreePM
+// its own default, and the PM grid has `mesh` cells per side.
+struct TreePMResult {
+    double bh_ms, treepm_ms;
+    double bh_rms_rel_err, treepm_rms_rel_err;
+};
+
+static TreePMResult run_treepm( std::size_t const N, double const theta, std::size_t const mesh,
+                                std::size_t const trials ) {
+    Particles p{ N };
+    populate_random( p, N, 0.0 );
+    SampledReference const ref{ sampled_reference( p, std::min<std::size_t>( N, 1024 ) ) };
+
+    Gravity_BarnesHut const bh{ theta };
+    Gravity_TreePM const treepm{ mesh };
+    TreePMResult r{};
+    apply_alone( bh, p );
+    r.bh_rms_rel_err = rms_rel_error( p, ref );
+    apply_alone( treepm, p );
+    r.treepm_rms_rel_err = rms_rel_error( p, ref );
+    r.bh_ms = time_apply( bh, p, trials );
+    r.treepm_ms = time_apply( treepm, p, trials );
+    return r;
 }
 
 // Calibrate step count so the chosen kernel's serial runtime is approximately
@@ -172,6 +484,127 @@ static std::size_t calibrate_steps( std::size_t const N, double const target_ms,
     return std::clamp( estimated, static_cast<std::size_t>( 3 ), static_cast<std::size_t>( 500 ) );
 }
 
+// Full tree builds per Yoshida step of a refitting BH force, over `steps`
+// steps from the benchmark's initial state.
+static double refit_builds_per_step( std::size_t const N, std::size_t const steps, double const theta ) {
+    Particles p{ N };
+    populate_random( p, N );
+    p.set_num_active( num_sources( N ) );
+
+    std::vector<std::unique_ptr<Force>> forces;
+    forces.push_back( make_force( ForceKind::BarnesHutRefit, theta ) );
+    Yoshida integ{ 900.0 };
+    for ( std::size_t s{}; s < steps; ++s ) integ.integrate( p, forces );
+
+    auto const &bh{ static_cast<Gravity_BarnesHut const&>( *forces.front() ) };
+    return static_cast<double>( bh.builds() ) / static_cast<double>( steps );
+}
+
+// Per-step tree work (build and target groups) and traversal time of a BH
+// force over `steps` Yoshida steps, from the force's own timers.
+struct PhaseResult {
+    double build_ms;
+    double traversal_ms;
+};
+
+static PhaseResult bh_phases( std::size_t const N, std::size_t const steps, int const num_threads,
+                              ForceKind const kind, double const theta ) {
+    omp_set_num_threads( num_threads );
+    Particles p{ N };
+    populate_random( p, N );
+    p.set_num_active( num_sources( N ) );
+
+    std::vector<std::unique_ptr<Force>> forces;
+    forces.push_back( make_force( kind, theta ) );
+    Yoshida integ{ 900.0 };
+    for ( std::size_t s{}; s < steps; ++s ) integ.integrate( p, forces );
+
+    auto const &bh{ static_cast<Gravity_BarnesHut const&>( *forces.front() ) };
+    return { 1e3 * bh.build_seconds() / static_cast<double>( steps ),
+             1e3 * bh.traversal_seconds() / static_cast<double>( steps ) };
+}
+
+// Side-by-side direct-kernel variants at the OMP setting. GFLOP/s uses the
+// full-sum cost model for both, so a variant doing less work (symmetric)
+// reports an effective rate.
+static void compare_direct( std::vector<std::size_t> const &N_values,
+                            ForceKind const base, ForceKind const variant,
+                            std::string const &base_label, std::string const &variant_label,
+                            double const target_ms, int const omp_threads,
+                            std::size_t const trials, double const theta ) {
+    std::cout << std::left
+              << std::setw( 8 )  << "N"
+              << std::setw( 8 )  << "Steps"
+              << std::setw( 14 ) << base_label + "(ms)"
+              << std::setw( 14 ) << variant_label + "(ms)"
+              << std::setw( 14 ) << base_label + " GF/s"
+              << std::setw( 14 ) << variant_label + " GF/s"
+              << std::setw( 11 ) << "Gain"
+              << "\n";
+    std::cout << std::string( 83, '=' ) << "\n";
+
+    for ( std::size_t const N : N_values ) {
+        std::size_t const steps{ calibrate_steps( N, target_ms, ForceKind::Direct, theta ) };
+        double const base_ms{ run_median( N, steps, omp_threads, trials, base, theta ) };
+        double const variant_ms{ run_median( N, steps, omp_threads, trials, variant, theta ) };
+        double const tot_flops{ direct_flops_per_step( N ) * steps };
+        std::cout << std::left << std::fixed
+                  << std::setw( 8 )  << N
+                  << std::setw( 8 )  << steps
+                  << std::setw( 14 ) << std::setprecision( 1 ) << base_ms
+                  << std::setw( 14 ) << std::setprecision( 1 ) << variant_ms
+                  << std::setw( 14 ) << std::setprecision( 2 ) << tot_flops / ( base_ms * 1e6 )
+                  << std::setw( 14 ) << std::setprecision( 2 ) << tot_flops / ( variant_ms * 1e6 )
+                  << std::setw( 11 ) << std::setprecision( 3 ) << base_ms / variant_ms
+                  << "\n" << std::flush;
+    }
+    std::cout << std::string( 83, '=' ) << "\n";
+}
+
+// Per-step latency at small N, where a compile-time body count applies:
+// Yoshida + Gravity against Yoshida_Fixed<N> + Gravity_Fixed<N>.
+template <typename Step>
+static double time_steps( Particles &p, Step const &step, std::size_t const steps,
+                          std::size_t const trials ) {
+    std::vector<double> timings;
+    timings.reserve( trials );
+    for ( std::size_t t{}; t < trials; ++t ) {
+        auto const start{ std::chrono::high_resolution_clock::now() };
+        for ( std::size_t s{}; s < steps; ++s ) step( p );
+        auto const end{ std::chrono::high_resolution_clock::now() };
+        timings.push_back( std::chrono::duration<double, std::micro>( end - start ).count() / steps );
+    }
+    std::sort( timings.begin(), timings.end() );
+    return timings[trials / 2];
+}
+
+template <std::size_t N>
+static void compare_fixed( std::size_t const steps, std::size_t const trials ) {
+    Particles p_gen{ N };
+    populate_random( p_gen, N );
+    Particles p_fix{ N };
+    populate_random( p_fix, N );
+
+    std::vector<std::unique_ptr<Force>> generic;
+    generic.push_back( std::make_unique<Gravity>() );
+    std::vector<std::unique_ptr<Force>> fixed;
+    fixed.push_back( std::make_unique<Gravity_Fixed<N>>() );
+    Yoshida const integ_gen{ 900.0 };
+    Yoshida_Fixed<N> const integ_fix{ 900.0 };
+
+    double const gen_us{ time_steps( p_gen, [&]( Particles &p ) { integ_gen.integrate( p, generic ); },
+                                     steps, trials ) };
+    double const fix_us{ time_steps( p_fix, [&]( Particles &p ) { integ_fix.integrate( p, fixed ); },
+                                     steps, trials ) };
+
+    std::cout << std::left << std::fixed
+              << std::setw( 8 )  << N
+              << std::setw( 16 ) << std::setprecision( 3 ) << gen_us
+              << std::setw( 16 ) << std::setprecision( 3 ) << fix_us
+              << std::setw( 11 ) << std::setprecision( 3 ) << gen_us / fix_us
+              << "\n" << std::flush;
+}
+
 int main( int argc, char* argv[] ) {
     std::size_t max_n{ 8192 };
     std::size_t num_trials{ 3 };
@@ -179,6 +612,10 @@ int main( int argc, char* argv[] ) {
     double theta{ 0.5 };
     std::string mode{ "both" };
     std::size_t include_direct_above{ 16384 };
+    std::size_t reorder_every{ 10 };
+    double accuracy{ 1e-3 };
+    std::size_t mesh{ 0 };
+    int order{ 6 };
 
     int const max_threads{ omp_get_max_threads() };
     int omp_threads{ max_threads };
@@ -191,37 +628,90 @@ int main( int argc, char* argv[] ) {
         else if ( arg == "--threads" && i + 1 < argc ) { omp_threads = std::stoi( argv[++i] ); }
         else if ( arg == "--theta" && i + 1 < argc ) { theta = std::stod( argv[++i] ); }
         else if ( arg == "--force" && i + 1 < argc ) { mode = argv[++i]; }
+        else if ( arg == "--active" && i + 1 < argc ) { g_num_active = std::stoull( argv[++i] ); }
+        else if ( arg == "--reorder" && i + 1 < argc ) { reorder_every = std::stoull( argv[++i] ); }
+        else if ( arg == "--refit" && i + 1 < argc ) { g_refit_tolerance = std::stod( argv[++i] ); }
+        else if ( arg == "--accuracy" && i + 1 < argc ) { accuracy = std::stod( argv[++i] ); }
+        else if ( arg == "--order" && i + 1 < argc ) { order = std::stoi( argv[++i] ); }
+        else if ( arg == "--mesh" && i + 1 < argc ) { mesh = std::stoull( argv[++i] ); }
         else if ( arg == "--include-direct-above" && i + 1 < argc ) {
             include_direct_above = std::stoull( argv[++i] );
         }
         else if ( arg == "-h" || arg == "--help" ) {
             std::cout << "Usage: benchmark [--max-n N] [--trials N] [--target-ms MS]\n"
-                      << "                 [--threads N] [--force {direct|bh|both}]\n"
-                      << "                 [--theta T] [--include-direct-above N]\n"
+                      << "                 [--threads N] [--force {direct|bh|both|mixed|tiling|sym|fixed|bhbuild|reorder|refit|\n"
+                      << "                                         multipole|tune|fmm|treepm|dual}]\n"
+                      << "                 [--theta T] [--include-direct-above N] [--active K] [--reorder K]\n"
+                      << "                 [--refit F] [--accuracy E] [--order P]\n"
                       << "  --max-n N               Maximum N for sweep (default: 8192)\n"
                       << "  --trials N              Trials per config, reports median (default: 3)\n"
                       << "  --target-ms MS          Target serial runtime per trial in ms (default: 2000)\n"
                       << "  --threads N             OMP thread count for parallel runs (default: max)\n"
-                      << "  --force MODE            'direct', 'bh', or 'both' (default: both)\n"
+                      << "  --force MODE            'direct', 'bh', 'both', 'mixed', 'tiling', 'sym', 'fixed',\n"
+                      << "                          'bhbuild', 'reorder', 'refit', 'multipole', 'tune', 'fmm',\n"
+                      << "                          'treepm', or 'dual'\n"
+                      << "                          (default: both)\n"
+                      << "                          'mixed' compares the mixed-precision direct kernel\n"
+                      << "                          against the double one (time per force evaluation)\n"
+                      << "                          'tiling' compares cache-tiled vs untiled direct GFLOP/s\n"
+                      << "                          'sym' compares the symmetric (j > i) kernel vs direct\n"
+                      << "                          'fixed' compares compile-time-N force and step vs\n"
+                      << "                          the generic ones at small N (time per step)\n"
+                      << "                          'bhbuild' compares the recursive and Morton BH tree\n"
+                      << "                          builds (time per Yoshida step), with the build and\n"
+                      << "                          traversal share of each step\n"
+                      << "                          'reorder' compares BH steps on randomly ordered bodies\n"
+                      << "                          against steps with Morton reordering every K steps\n"
+                      << "                          'refit' compares BH steps rebuilding the tree every force\n"
+                      << "                          call against refitting it (time per Yoshida step)\n"
+                      << "                          'multipole' reports, per BH expansion order, the cheapest\n"
+                      << "                          force evaluation within the --accuracy RMS force error\n"
+                      << "                          'tune' reports the auto-tuned BH choice for --accuracy\n"
+                      << "                          against the best theta found by a full-error scan\n"
+                      << "                          'fmm' compares BH and FMM force evaluations: time,\n"
+                      << "                          sampled force error and net force\n"
+                      << "                          'treepm' compares BH and TreePM force evaluations on\n"
+                      << "                          homogeneous bodies: time and sampled force error\n"
+                      << "                          'dual' compares the group and dual-tree BH walks with\n"
+                      << "                          quadrupoles: time, sampled force error and net force\n"
                       << "  --theta T               BH opening angle (default: 0.5)\n"
-                      << "  --include-direct-above N  Skip direct above this N in 'both' mode (default: 16384)\n";
+                      << "  --include-direct-above N  Skip direct above this N in 'both' mode (default: 16384)\n"
+                      << "  --active K              Only the first K bodies gravitate; the rest are massless\n"
+                      << "                          test particles (default: all active)\n"
+                      << "  --reorder K             Reorder interval for 'reorder' mode (default: 10)\n"
+                      << "  --refit F               Fraction of bodies allowed outside their leaf cell before\n"
+                      << "                          'refit' mode rebuilds the tree (default: 0.05)\n"
+                      << "  --accuracy E            RMS relative force error for 'multipole' and 'tune' (default: 1e-3)\n"
+                      << "  --order P               FMM expansion order for 'fmm' mode (default: 6)\n"
+                      << "  --mesh M                PM cells per side for 'treepm' mode, a power of two >= 16\n"
+                      << "                          (default: at most one body per cell, up to 128)\n";
             return 0;
         }
     }
 
-    if ( mode != "direct" && mode != "bh" && mode != "both" ) {
-        std::cerr << "error: --force must be 'direct', 'bh', or 'both'\n";
+    if ( mode != "direct" && mode != "bh" && mode != "both" && mode != "mixed" && mode != "tiling"
+         && mode != "sym" && mode != "fixed" && mode != "bhbuild" && mode != "reorder" && mode != "refit"
+         && mode != "multipole" && mode != "tune" && mode != "fmm" && mode != "treepm" && mode != "dual" ) {
+        std::cerr << "error: --force must be 'direct', 'bh', 'both', 'mixed', 'tiling', 'sym', 'fixed', 'bhbuild',\n"
+                  << "       'reorder', 'refit', 'multipole', 'tune', 'fmm', 'treepm', or 'dual'\n"
+                      << "                          (default: both)\n";
         return 1;
     }
 
     std::cout << "\n<--- N-Body Scaling Benchmark --->\n"
               << "  Integrator:        Yoshida 4th-order (dt = 900 s)\n"
               << "  Force mode:        " << mode << "\n"
+              << "  Direct kernel:     " << simd::isa_name( simd::detect() ) << "\n"
+              << "  Direct tiling:     " << direct::auto_tiling().i_block << " targets x "
+                                         << direct::auto_tiling().j_tile << " sources\n"
               << "  Theta (BH):        " << theta << "\n"
               << "  OMP threads:       " << omp_threads << "\n"
               << "  Trials/config:     " << num_trials << " (median)\n"
               << "  Target serial:     " << std::fixed << std::setprecision( 0 ) << target_ms << " ms per trial\n"
               << "  OMP threshold:     N >= " << config::OMP_THRESHOLD << "\n";
+    if ( g_num_active > 0 ) {
+        std::cout << "  Active bodies:     " << g_num_active << " (rest passive)\n";
+    }
     if ( mode == "both" ) {
         std::cout << "  Skip direct above: N > " << include_direct_above << "\n";
     }
@@ -236,6 +726,335 @@ int main( int argc, char* argv[] ) {
         N_values.push_back( n );
     }
 
+    if ( mode == "mixed" ) {
+        omp_set_num_threads( omp_threads );
+
+        std::cout << std::left
+                  << std::setw( 8 )  << "N"
+                  << std::setw( 14 ) << "Double(ms)"
+                  << std::setw( 14 ) << "Mixed(ms)"
+                  << std::setw( 11 ) << "Speedup"
+                  << std::setw( 14 ) << "RMS rel err"
+                  << std::setw( 14 ) << "Max rel err"
+                  << "\n";
+        std::cout << std::string( 75, '=' ) << "\n";
+
+        for ( std::size_t const N : N_values ) {
+            MixedResult const r{ run_mixed( N, num_trials ) };
+            std::cout << std::left << std::fixed
+                      << std::setw( 8 )  << N
+                      << std::setw( 14 ) << std::setprecision( 2 ) << r.direct_ms
+                      << std::setw( 14 ) << std::setprecision( 2 ) << r.mixed_ms
+                      << std::setw( 11 ) << std::setprecision( 2 ) << r.direct_ms / r.mixed_ms
+                      << std::scientific
+                      << std::setw( 14 ) << std::setprecision( 2 ) << r.rms_rel_err
+                      << std::setw( 14 ) << std::setprecision( 2 ) << r.max_rel_err
+                      << "\n" << std::flush;
+        }
+        std::cout << std::string( 75, '=' ) << "\n";
+
+        omp_set_num_threads( max_threads );
+        return 0;
+    }
+
+    if ( mode == "fixed" ) {
+        std::cout << std::left
+                  << std::setw( 8 )  << "N"
+                  << std::setw( 16 ) << "Generic(us)"
+                  << std::setw( 16 ) << "Fixed(us)"
+                  << std::setw( 11 ) << "Speedup"
+                  << "\n";
+        std::cout << std::string( 51, '=' ) << "\n";
+        compare_fixed<8>( 100000, num_trials );
+        compare_fixed<16>( 50000, num_trials );
+        compare_fixed<35>( 20000, num_trials );
+        compare_fixed<64>( 10000, num_trials );
+        std::cout << std::string( 51, '=' ) << "\n";
+        return 0;
+    }
+
+    if ( mode == "tiling" || mode == "sym" ) {
+        bool const tiling{ mode == "tiling" };
+        compare_direct( N_values, tiling ? ForceKind::DirectUntiled : ForceKind::Direct,
+                        tiling ? ForceKind::Direct : ForceKind::Symmetric,
+                        tiling ? "Untiled" : "Direct", tiling ? "Tiled" : "Sym",
+                        target_ms, omp_threads, num_trials, theta );
+        omp_set_num_threads( max_threads );
+        return 0;
+    }
+
+    if ( mode == "bhbuild" ) {
+        std::cout << std::left
+                  << std::setw( 10 ) << "N"
+                  << std::setw( 8 )  << "Steps"
+                  << std::setw( 16 ) << "Recursive(ms)"
+                  << std::setw( 14 ) << "Morton(ms)"
+                  << std::setw( 11 ) << "Gain"
+                  << std::setw( 12 ) << "Rec build"
+                  << std::setw( 12 ) << "Mor build"
+                  << std::setw( 12 ) << "Traversal"
+                  << "\n";
+        std::cout << std::string( 95, '=' ) << "\n";
+        for ( std::size_t const N : N_values ) {
+            std::size_t const steps{ calibrate_steps( N, target_ms, ForceKind::BarnesHutRecursive, theta ) };
+            double const rec_ms{ run_median( N, steps, omp_threads, num_trials, ForceKind::BarnesHutRecursive, theta ) };
+            double const mor_ms{ run_median( N, steps, omp_threads, num_trials, ForceKind::BarnesHut, theta ) };
+            PhaseResult const rec{ bh_phases( N, steps, omp_threads, ForceKind::BarnesHutRecursive, theta ) };
+            PhaseResult const mor{ bh_phases( N, steps, omp_threads, ForceKind::BarnesHut, theta ) };
+            std::cout << std::left << std::fixed
+                      << std::setw( 10 ) << N
+                      << std::setw( 8 )  << steps
+                      << std::setw( 16 ) << std::setprecision( 1 ) << rec_ms
+                      << std::setw( 14 ) << std::setprecision( 1 ) << mor_ms
+                      << std::setw( 11 ) << std::setprecision( 3 ) << rec_ms / mor_ms
+                      << std::setw( 12 ) << std::setprecision( 2 ) << rec.build_ms
+                      << std::setw( 12 ) << std::setprecision( 2 ) << mor.build_ms
+                      << std::setw( 12 ) << std::setprecision( 2 ) << mor.traversal_ms
+                      << "\n" << std::flush;
+        }
+        std::cout << std::string( 95, '=' ) << "\n";
+        omp_set_num_threads( max_threads );
+        return 0;
+    }
+
+    if ( mode == "refit" ) {
+        std::cout << "  Refit tolerance:   " << std::setprecision( 2 ) << g_refit_tolerance << "\n\n";
+        std::cout << std::left
+                  << std::setw( 10 ) << "N"
+                  << std::setw( 8 )  << "Steps"
+                  << std::setw( 14 ) << "Rebuild(ms)"
+                  << std::setw( 12 ) << "Refit(ms)"
+                  << std::setw( 13 ) << "Builds/step"
+                  << std::setw( 11 ) << "Gain"
+                  << "\n";
+        std::cout << std::string( 68, '=' ) << "\n";
+        for ( std::size_t const N : N_values ) {
+            std::size_t const steps{ calibrate_steps( N, target_ms, ForceKind::BarnesHut, theta ) };
+            double const build_ms{ run_median( N, steps, omp_threads, num_trials, ForceKind::BarnesHut, theta ) };
+            double const refit_ms{ run_median( N, steps, omp_threads, num_trials, ForceKind::BarnesHutRefit, theta ) };
+            double const builds{ refit_builds_per_step( N, steps, theta ) };
+            std::cout << std::left << std::fixed
+                      << std::setw( 10 ) << N
+                      << std::setw( 8 )  << steps
+                      << std::setw( 14 ) << std::setprecision( 1 ) << build_ms
+                      << std::setw( 12 ) << std::setprecision( 1 ) << refit_ms
+                      << std::setw( 13 ) << std::setprecision( 3 ) << builds
+                      << std::setw( 11 ) << std::setprecision( 3 ) << build_ms / refit_ms
+                      << "\n" << std::flush;
+        }
+        std::cout << std::string( 68, '=' ) << "\n";
+        omp_set_num_threads( max_threads );
+        return 0;
+    }
+
+    if ( mode == "multipole" ) {
+        omp_set_num_threads( omp_threads );
+
+        std::cout << "  Target RMS error:  " << std::scientific << std::setprecision( 1 ) << accuracy << "\n\n";
+        std::cout << std::left
+                  << std::setw( 8 )  << "N"
+                  << std::setw( 12 ) << "Expansion"
+                  << std::setw( 8 )  << "Theta"
+                  << std::setw( 14 ) << "RMS rel err"
+                  << std::setw( 12 ) << "Force(ms)"
+                  << std::setw( 11 ) << "Gain"
+                  << "\n";
+        std::cout << std::string( 65, '=' ) << "\n";
+        for ( std::size_t const N : N_values ) {
+            Particles p{ N };
+            populate_random( p, N );
+            SampledReference const ref{ sampled_reference( p, N ) };
+
+            MultipoleResult const mono{ run_multipole( p, ref, BH_Expansion::Monopole, accuracy, num_trials ) };
+            MultipoleResult const quad{ run_multipole( p, ref, BH_Expansion::Quadrupole, accuracy, num_trials ) };
+            for ( auto const &[label, r] : { std::pair{ "monopole", mono }, std::pair{ "quadrupole", quad } } ) {
+                std::cout << std::left << std::fixed
+                          << std::setw( 8 )  << N
+                          << std::setw( 12 ) << label
+                          << std::setw( 8 )  << std::setprecision( 2 ) << r.theta
+                          << std::scientific
+                          << std::setw( 14 ) << std::setprecision( 2 ) << r.rms_rel_err
+                          << std::fixed
+                          << std::setw( 12 ) << std::setprecision( 2 ) << r.ms
+                          << std::setw( 11 ) << std::setprecision( 2 ) << mono.ms / r.ms
+                          << "\n" << std::flush;
+            }
+        }
+        std::cout << std::string( 65, '=' ) << "\n";
+        omp_set_num_threads( max_threads );
+        return 0;
+    }
+
+    if ( mode == "tune" ) {
+        omp_set_num_threads( omp_threads );
+
+        std::cout << "  Target RMS error:  " << std::scientific << std::setprecision( 1 ) << accuracy << "\n\n";
+        std::cout << std::left
+                  << std::setw( 8 )  << "N"
+                  << std::setw( 8 )  << "Theta"
+                  << std::setw( 8 )  << "Bucket"
+                  << std::setw( 14 ) << "RMS rel err"
+                  << std::setw( 12 ) << "Tune(ms)"
+                  << std::setw( 12 ) << "Force(ms)"
+                  << std::setw( 12 ) << "Scan(ms)"
+                  << std::setw( 11 ) << "Gain"
+                  << "\n";
+        std::cout << std::string( 85, '=' ) << "\n";
+        for ( std::size_t const N : N_values ) {
+            Particles p{ N };
+            populate_random( p, N );
+            SampledReference const ref{ sampled_reference( p, N ) };
+
+            // Scan: the best theta at leaf bucket 8 from the full error.
+            TuneResult const r{ run_tune( p, ref, accuracy, num_trials ) };
+            MultipoleResult const scan{ run_multipole( p, ref, BH_Expansion::Monopole, accuracy, num_trials ) };
+            std::cout << std::left << std::fixed
+                      << std::setw( 8 )  << N
+                      << std::setw( 8 )  << std::setprecision( 2 ) << r.tuning.theta
+                      << std::setw( 8 )  << r.tuning.leaf_bucket
+                      << std::scientific
+                      << std::setw( 14 ) << std::setprecision( 2 ) << r.rms_rel_err
+                      << std::fixed
+                      << std::setw( 12 ) << std::setprecision( 1 ) << r.tune_ms
+                      << std::setw( 12 ) << std::setprecision( 2 ) << r.ms
+                      << std::setw( 12 ) << std::setprecision( 2 ) << scan.ms
+                      << std::setw( 11 ) << std::setprecision( 2 ) << scan.ms / r.ms
+                      << "\n" << std::flush;
+        }
+        std::cout << std::string( 85, '=' ) << "\n";
+        omp_set_num_threads( max_threads );
+        return 0;
+    }
+
+    if ( mode == "fmm" ) {
+        omp_set_num_threads( omp_threads );
+
+        std::cout << "  FMM order:         " << order << "\n\n";
+        std::cout << std::left
+                  << std::setw( 10 ) << "N"
+                  << std::setw( 12 ) << "BH(ms)"
+                  << std::setw( 12 ) << "FMM(ms)"
+                  << std::setw( 10 ) << "BH/FMM"
+                  << std::setw( 12 ) << "BH err"
+                  << std::setw( 12 ) << "FMM err"
+                  << std::setw( 12 ) << "BH net"
+                  << std::setw( 12 ) << "FMM net"
+                  << "\n";
+        std::cout << std::string( 92, '=' ) << "\n";
+        for ( std::size_t const N : N_values ) {
+            FmmResult const r{ run_fmm( N, theta, order, num_trials ) };
+            std::cout << std::left << std::fixed
+                      << std::setw( 10 ) << N
+                      << std::setw( 12 ) << std::setprecision( 1 ) << r.bh_ms
+                      << std::setw( 12 ) << std::setprecision( 1 ) << r.fmm_ms
+                      << std::setw( 10 ) << std::setprecision( 2 ) << r.bh_ms / r.fmm_ms
+                      << std::scientific
+                      << std::setw( 12 ) << std::setprecision( 2 ) << r.bh_rms_rel_err
+                      << std::setw( 12 ) << std::setprecision( 2 ) << r.fmm_rms_rel_err
+                      << std::setw( 12 ) << std::setprecision( 2 ) << r.bh_net_force
+                      << std::setw( 12 ) << std::setprecision( 2 ) << r.fmm_net_force
+                      << "\n" << std::flush;
+        }
+        std::cout << std::string( 92, '=' ) << "\n";
+        omp_set_num_threads( max_threads );
+        return 0;
+    }
+
+    if ( mode == "dual" ) {
+        omp_set_num_threads( omp_threads );
+
+        std::cout << std::left
+                  << std::setw( 10 ) << "N"
+                  << std::setw( 12 ) << "Group(ms)"
+                  << std::setw( 12 ) << "Dual(ms)"
+                  << std::setw( 10 ) << "G/D"
+                  << std::setw( 12 ) << "Group err"
+                  << std::setw( 12 ) << "Dual err"
+                  << std::setw( 12 ) << "Group net"
+                  << std::setw( 12 ) << "Dual net"
+                  << "\n";
+        std::cout << std::string( 92, '=' ) << "\n";
+        for ( std::size_t const N : N_values ) {
+            DualResult const r{ run_dual( N, theta, num_trials ) };
+            std::cout << std::left << std::fixed
+                      << std::setw( 10 ) << N
+                      << std::setw( 12 ) << std::setprecision( 1 ) << r.groups_ms
+                      << std::setw( 12 ) << std::setprecision( 1 ) << r.dual_ms
+                      << std::setw( 10 ) << std::setprecision( 2 ) << r.groups_ms / r.dual_ms
+                      << std::scientific
+                      << std::setw( 12 ) << std::setprecision( 2 ) << r.groups_rms_rel_err
+                      << std::setw( 12 ) << std::setprecision( 2 ) << r.dual_rms_rel_err
+                      << std::setw( 12 ) << std::setprecision( 2 ) << r.groups_net_force
+                      << std::setw( 12 ) << std::setprecision( 2 ) << r.dual_net_force
+                      << "\n" << std::flush;
+        }
+        std::cout << std::string( 92, '=' ) << "\n";
+        omp_set_num_threads( max_threads );
+        return 0;
+    }
+
+    if ( mode == "treepm" ) {
+        omp_set_num_threads( omp_threads );
+
+        std::cout << std::left
+                  << std::setw( 10 ) << "N"
+                  << std::setw( 8 ) << "Mesh"
+                  << std::setw( 12 ) << "BH(ms)"
+                  << std::setw( 12 ) << "TreePM(ms)"
+                  << std::setw( 10 ) << "BH/TPM"
+                  << std::setw( 12 ) << "BH err"
+                  << std::setw( 12 ) << "TPM err"
+                  << "\n";
+        std::cout << std::string( 76, '=' ) << "\n";
+        for ( std::size_t const N : N_values ) {
+            std::size_t const cells{ mesh > 0 ? mesh : std::clamp<std::size_t>(
+                std::bit_ceil( static_cast<std::size_t>( std::cbrt( static_cast<double>( N ) ) ) ), 16, 128 ) };
+            TreePMResult const r{ run_treepm( N, theta, cells, num_trials ) };
+            std::cout << std::left << std::fixed
+                      << std::setw( 10 ) << N
+                      << std::setw( 8 ) << cells
+                      << std::setw( 12 ) << std::setprecision( 1 ) << r.bh_ms
+                      << std::setw( 12 ) << std::setprecision( 1 ) << r.treepm_ms
+                      << std::setw( 10 ) << std::setprecision( 2 ) << r.bh_ms / r.treepm_ms
+                      << std::scientific
+                      << std::setw( 12 ) << std::setprecision( 2 ) << r.bh_rms_rel_err
+                      << std::setw( 12 ) << std::setprecision( 2 ) << r.treepm_rms_rel_err
+                      << "\n" << std::flush;
+        }
+        std::cout << std::string( 76, '=' ) << "\n";
+        omp_set_num_threads( max_threads );
+        return 0;
+    }
+
+    if ( mode == "reorder" ) {
+        std::cout << std::left
+                  << std::setw( 10 ) << "N"
+                  << std::setw( 8 )  << "Steps"
+                  << std::setw( 16 ) << "Unsorted(ms)"
+                  << std::setw( 14 ) << "Morton(ms)"
+                  << std::setw( 11 ) << "Gain"
+                  << "\n";
+        std::cout << std::string( 59, '=' ) << "\n";
+        for ( std::size_t const N : N_values ) {
+            g_reorder_every = 0;
+            std::size_t const steps{ calibrate_steps( N, target_ms, ForceKind::BarnesHut, theta ) };
+            double const raw_ms{ run_median( N, steps, omp_threads, num_trials, ForceKind::BarnesHut, theta ) };
+            g_reorder_every = reorder_every;
+            double const sfc_ms{ run_median( N, steps, omp_threads, num_trials, ForceKind::BarnesHut, theta ) };
+            g_reorder_every = 0;
+            std::cout << std::left << std::fixed
+                      << std::setw( 10 ) << N
+                      << std::setw( 8 )  << steps
+                      << std::setw( 16 ) << std::setprecision( 1 ) << raw_ms
+                      << std::setw( 14 ) << std::setprecision( 1 ) << sfc_ms
+                      << std::setw( 11 ) << std::setprecision( 3 ) << raw_ms / sfc_ms
+                      << "\n" << std::flush;
+        }
+        std::cout << std::string( 59, '=' ) << "\n";
+        omp_set_num_threads( max_threads );
+        return 0;
+    }
+
     std::vector<BenchResult> results;
 
     std::cout << std::left
@@ -7,20 +7,32 @@
 // Run:    ./build/tests
 
 #include "../src/Particle/Particle.hpp"
+#include "../src/Particle/Reorder.hpp"
 #include "../src/Force/Force.hpp"
 #include "../src/Force/BarnesHut.hpp"
+#include "../src/Force/BarnesHutTuner.hpp"
+#include "../src/Force/FMM.hpp"
+#include "../src/Force/PM.hpp"
 #include "../src/Integrator/Integrator.hpp"
+#include "../src/Integrator/Kepler.hpp"
 #include "../src/Config.hpp"
 
 #include <iostream>
 #include <iomanip>
 #include <cmath>
 #include <string>
+#include <sstream>
 #include <vector>
 #include <memory>
 #include <functional>
+#include <algorithm>
 #include <numbers>
+#include <numeric>
 #include <random>
+#include <stdexcept>
+
+#include <omp.h>
+#include <utility>
 
 // Minimal test harness
 
@@ -152,6 +164,100 @@ static void setup_two_body( Particles &p, double const M, double const m, double
     }
 }
 
+// Two Gaussian clumps 5e11 m apart, flattened in z, with every third
+// body in the offset clump.
+static void populate_two_clumps( Particles &p, std::uint64_t const seed ) {
+    std::mt19937_64 rng{ seed };
+    std::normal_distribution<double> cluster{ 0.0, 1e11 };
+    std::uniform_real_distribution<double> mass_dist{ 1e22, 1e26 };
+
+    for ( std::size_t i{}; i < p.num_particles(); ++i ) {
+        double const offset{ ( i % 3 == 0 ) ? 5e11 : 0.0 };
+        p.pos_x()[i] = cluster( rng ) + offset;
+        p.pos_y()[i] = cluster( rng );
+        p.pos_z()[i] = 0.1 * cluster( rng );
+        p.mass()[i]  = mass_dist( rng );
+    }
+}
+
+// A tight clump of light bodies 1e12 m from a wide clump of the first
+// `N_heavy` bodies, heavy ones, along the diagonal of the cube holding both.
+static void populate_heavy_light_clumps( Particles &p, std::size_t const N_heavy ) {
+    std::mt19937_64 rng{ 41 };
+    std::normal_distribution<double> heavy_clump{ 0.0, 1e10 };
+    std::normal_distribution<double> light_clump{ 0.0, 1e8 };
+
+    for ( std::size_t i{}; i < p.num_particles(); ++i ) {
+        bool const heavy{ i < N_heavy };
+        auto &clump{ heavy ? heavy_clump : light_clump };
+        double const offset{ heavy ? 0.0 : 1e12 / std::numbers::sqrt3 };
+        p.pos_x()[i] = offset + clump( rng );
+        p.pos_y()[i] = offset + clump( rng );
+        p.pos_z()[i] = offset + clump( rng );
+        p.mass()[i]  = heavy ? 1e28 : 1e24;
+    }
+}
+
+// Acceleration and potential of every body from `force` alone, as
+// x, y, z, pot per body; the potential stays zero unless the force is in
+// potential mode.
+static std::vector<double> evaluate( Particles &p, Force const &force ) {
+    std::size_t const N{ p.num_particles() };
+    for ( std::size_t i{}; i < N; ++i ) p.acc_x()[i] = p.acc_y()[i] = p.acc_z()[i] = p.pot()[i] = 0.0;
+    force.apply( p );
+    std::vector<double> a( 4 * N );
+    for ( std::size_t i{}; i < N; ++i ) {
+        a[4*i] = p.acc_x()[i]; a[4*i + 1] = p.acc_y()[i]; a[4*i + 2] = p.acc_z()[i]; a[4*i + 3] = p.pot()[i];
+    }
+    return a;
+}
+
+// RMS relative error of evaluate() forces over bodies [begin, end).
+static double rms_rel_error( std::vector<double> const &a, std::vector<double> const &ref,
+                             std::size_t const begin, std::size_t const end ) {
+    double sum{};
+    for ( std::size_t i{ begin }; i < end; ++i ) {
+        double const dx{ a[4*i] - ref[4*i] }, dy{ a[4*i + 1] - ref[4*i + 1] }, dz{ a[4*i + 2] - ref[4*i + 2] };
+        sum += ( dx*dx + dy*dy + dz*dz )
+             / ( ref[4*i]*ref[4*i] + ref[4*i + 1]*ref[4*i + 1] + ref[4*i + 2]*ref[4*i + 2] );
+    }
+    return std::sqrt( sum / static_cast<double>( end - begin ) );
+}
+
+// Worst relative error of evaluate() forces over bodies [begin, end).
+static double max_rel_error( std::vector<double> const &a, std::vector<double> const &ref,
+                             std::size_t const begin, std::size_t const end ) {
+    double worst{};
+    for ( std::size_t i{ begin }; i < end; ++i ) {
+        double const dx{ a[4*i] - ref[4*i] }, dy{ a[4*i + 1] - ref[4*i + 1] }, dz{ a[4*i + 2] - ref[4*i + 2] };
+        double const r{ ref[4*i]*ref[4*i] + ref[4*i + 1]*ref[4*i + 1] + ref[4*i + 2]*ref[4*i + 2] };
+        worst = std::max( worst, std::sqrt( ( dx*dx + dy*dy + dz*dz ) / r ) );
+    }
+    return worst;
+}
+
+// The same for the potential.
+static double rms_rel_pot_error( std::vector<double> const &a, std::vector<double> const &ref,
+                                 std::size_t const begin, std::size_t const end ) {
+    double sum{};
+    for ( std::size_t i{ begin }; i < end; ++i ) {
+        double const e{ ( a[4*i + 3] - ref[4*i + 3] ) / ref[4*i + 3] };
+        sum += e * e;
+    }
+    return std::sqrt( sum / static_cast<double>( end - begin ) );
+}
+
+// |sum m a| / sum m |a| over the active bodies, for evaluate() forces.
+static double net_force( Particles const &p, std::vector<double> const &a ) {
+    double fx{}, fy{}, fz{}, f_abs{};
+    for ( std::size_t i{}; i < p.num_active(); ++i ) {
+        double const m{ p.mass()[i] };
+        fx += m * a[4*i]; fy += m * a[4*i + 1]; fz += m * a[4*i + 2];
+        f_abs += m * std::sqrt( a[4*i]*a[4*i] + a[4*i + 1]*a[4*i + 1] + a[4*i + 2]*a[4*i + 2] );
+    }
+    return std::sqrt( fx*fx + fy*fy + fz*fz ) / f_abs;
+}
+
 static void step_n( Particles &p, Integrator &integ,
                     std::vector<std::unique_ptr<Force>> &forces, std::size_t const n ) {
     for ( std::size_t s{}; s < n; ++s ) {
@@ -277,6 +383,424 @@ TEST( gravity_accumulates_not_overwrites ) {
 }
 
 
+TEST( gravity_simd_kernels_match_scalar ) {
+    // Every ISA the host supports must agree with the scalar kernel to a few
+    // ulps. N = 37 leaves a partial tail block for each vector width, and the
+    // 1e-3 .. 1e20 m spread exercises the AVX2 exponent-split rsqrt estimate.
+    constexpr std::size_t N{ 37 };
+    std::mt19937_64 rng{ 2024 };
+    std::uniform_real_distribution<double> exp_dist{ -3.0, 20.0 };
+    std::uniform_real_distribution<double> sign_dist{ -1.0, 1.0 };
+    std::uniform_real_distribution<double> mass_dist{ 1e20, 1e30 };
+
+    auto populate = [&]( Particles &p ) {
+        rng.seed( 2024 );
+        for ( std::size_t i{}; i < N; ++i ) {
+            p.pos_x()[i] = sign_dist( rng ) * std::pow( 10.0, exp_dist( rng ) );
+            p.pos_y()[i] = sign_dist( rng ) * std::pow( 10.0, exp_dist( rng ) );
+            p.pos_z()[i] = sign_dist( rng ) * std::pow( 10.0, exp_dist( rng ) );
+            p.mass()[i] = mass_dist( rng );
+            p.acc_x()[i] = 0.0; p.acc_y()[i] = 0.0; p.acc_z()[i] = 0.0;
+        }
+    };
+
+    Particles p_ref{ N }; populate( p_ref );
+    Gravity{ simd::Isa::Scalar }.apply( p_ref );
+
+    for ( simd::Isa const isa : { simd::Isa::AVX2, simd::Isa::AVX512 } ) {
+        if ( isa > simd::detect() ) continue;
+
+        Particles p{ N }; populate( p );
+        Gravity{ isa }.apply( p );
+
+        for ( std::size_t i{}; i < N; ++i ) {
+            double const scale{ std::sqrt( p_ref.acc_x()[i]*p_ref.acc_x()[i]
+                                         + p_ref.acc_y()[i]*p_ref.acc_y()[i]
+                                         + p_ref.acc_z()[i]*p_ref.acc_z()[i] ) };
+            double const dx{ p.acc_x()[i] - p_ref.acc_x()[i] };
+            double const dy{ p.acc_y()[i] - p_ref.acc_y()[i] };
+            double const dz{ p.acc_z()[i] - p_ref.acc_z()[i] };
+            ASSERT_LT( std::sqrt( dx*dx + dy*dy + dz*dz ) / scale, 1e-13 );
+        }
+    }
+    ++g_pass;
+}
+
+TEST( gravity_potential_mode_matches_pairwise ) {
+    // Potential mode must reproduce 1/2 sum m_i phi_i = sum_{i<j} -G m_i m_j / r
+    // for every ISA, without perturbing the accelerations. N = 37 leaves a
+    // partial tail block for each vector width.
+    constexpr std::size_t N{ 37 };
+    std::mt19937_64 rng{ 77 };
+    std::uniform_real_distribution<double> pos_dist{ -1e11, 1e11 };
+    std::uniform_real_distribution<double> mass_dist{ 1e23, 1e26 };
+
+    auto populate = [&]( Particles &p ) {
+        rng.seed( 77 );
+        for ( std::size_t i{}; i < N; ++i ) {
+            p.pos_x()[i] = pos_dist( rng );
+            p.pos_y()[i] = pos_dist( rng );
+            p.pos_z()[i] = pos_dist( rng );
+            p.mass()[i] = mass_dist( rng );
+            p.acc_x()[i] = 0.0; p.acc_y()[i] = 0.0; p.acc_z()[i] = 0.0;
+            p.pot()[i] = 0.0;
+        }
+    };
+
+    Particles p_ref{ N }; populate( p_ref );
+    double const pe_ref{ potential_energy( p_ref ) };
+
+    for ( simd::Isa const isa : { simd::Isa::Scalar, simd::Isa::AVX2, simd::Isa::AVX512 } ) {
+        if ( isa > simd::detect() ) continue;
+
+        Particles p_acc{ N }; populate( p_acc );
+        Gravity{ isa }.apply( p_acc );
+
+        Particles p{ N }; populate( p );
+        Gravity g{ isa };
+        g.set_potential( true );
+        g.apply( p );
+
+        double pe{};
+        for ( std::size_t i{}; i < N; ++i ) {
+            pe += 0.5 * p.mass()[i] * p.pot()[i];
+            ASSERT_NEAR( p.acc_x()[i], p_acc.acc_x()[i], 1e-14 * std::abs( p_acc.acc_x()[i] ) );
+            ASSERT_NEAR( p.acc_y()[i], p_acc.acc_y()[i], 1e-14 * std::abs( p_acc.acc_y()[i] ) );
+            ASSERT_NEAR( p.acc_z()[i], p_acc.acc_z()[i], 1e-14 * std::abs( p_acc.acc_z()[i] ) );
+        }
+        ASSERT_LT( std::abs( ( pe - pe_ref ) / pe_ref ), 1e-13 );
+    }
+    ++g_pass;
+}
+
+TEST( gravity_fixed_matches_direct ) {
+    // N = 35 is the solar-system size: four full 8-lane vectors plus a
+    // 3-lane tail, and a padded staging block on AVX2. Forces and potential
+    // must agree with Gravity on every ISA.
+    constexpr std::size_t N{ 35 };
+    std::mt19937_64 rng{ 35 };
+    std::uniform_real_distribution<double> pos_dist{ -1e12, 1e12 };
+    std::uniform_real_distribution<double> mass_dist{ 1e20, 1e30 };
+
+    auto populate = [&]( Particles &p ) {
+        rng.seed( 35 );
+        for ( std::size_t i{}; i < N; ++i ) {
+            p.pos_x()[i] = pos_dist( rng );
+            p.pos_y()[i] = pos_dist( rng );
+            p.pos_z()[i] = pos_dist( rng );
+            p.mass()[i] = mass_dist( rng );
+        }
+    };
+
+    for ( simd::Isa const isa : { simd::Isa::Scalar, simd::Isa::AVX2, simd::Isa::AVX512 } ) {
+        if ( isa > simd::detect() ) continue;
+
+        Particles p_ref{ N }; populate( p_ref );
+        Gravity g{ isa };
+        g.set_potential( true );
+        g.apply( p_ref );
+
+        Particles p{ N }; populate( p );
+        Gravity_Fixed<N> g_fixed{ isa };
+        g_fixed.set_potential( true );
+        g_fixed.apply( p );
+
+        for ( std::size_t i{}; i < N; ++i ) {
+            double const scale{ std::sqrt( p_ref.acc_x()[i]*p_ref.acc_x()[i]
+                                         + p_ref.acc_y()[i]*p_ref.acc_y()[i]
+                                         + p_ref.acc_z()[i]*p_ref.acc_z()[i] ) };
+            double const dx{ p.acc_x()[i] - p_ref.acc_x()[i] };
+            double const dy{ p.acc_y()[i] - p_ref.acc_y()[i] };
+            double const dz{ p.acc_z()[i] - p_ref.acc_z()[i] };
+            ASSERT_LT( std::sqrt( dx*dx + dy*dy + dz*dz ) / scale, 1e-14 );
+            ASSERT_LT( std::abs( ( p.pot()[i] - p_ref.pot()[i] ) / p_ref.pot()[i] ), 1e-14 );
+        }
+    }
+
+    Particles wrong{ N + 1 };
+    bool threw{ false };
+    try { Gravity_Fixed<N>{}.apply( wrong ); } catch ( std::runtime_error const& ) { threw = true; }
+    ASSERT_TRUE( threw );
+    ++g_pass;
+}
+
+TEST( passive_particles_exert_no_force ) {
+    // Passive particles keep a nonzero mass to prove it is ignored. The
+    // reference zeroes those masses and keeps every particle active, which
+    // must give the same accelerations for every force implementation.
+    constexpr std::size_t N{ 45 };
+    constexpr std::size_t N_active{ 13 };
+    std::mt19937_64 rng{ 4545 };
+    std::uniform_real_distribution<double> pos_dist{ -1e11, 1e11 };
+    std::uniform_real_distribution<double> mass_dist{ 1e23, 1e26 };
+
+    auto populate = [&]( Particles &p, bool const passive ) {
+        rng.seed( 4545 );
+        for ( std::size_t i{}; i < N; ++i ) {
+            p.pos_x()[i] = pos_dist( rng );
+            p.pos_y()[i] = pos_dist( rng );
+            p.pos_z()[i] = pos_dist( rng );
+            double const m{ mass_dist( rng ) };
+            p.mass()[i] = ( passive || i < N_active ) ? m : 0.0;
+        }
+        if ( passive ) p.set_num_active( N_active );
+    };
+
+    std::vector<std::pair<std::unique_ptr<Force>, double>> cases{};
+    for ( simd::Isa const isa : { simd::Isa::Scalar, simd::Isa::AVX2, simd::Isa::AVX512 } ) {
+        if ( isa > simd::detect() ) continue;
+        cases.emplace_back( std::make_unique<Gravity>( isa ), 1e-13 );
+        cases.emplace_back( std::make_unique<Gravity_Symmetric>( isa ), 1e-12 );
+        cases.emplace_back( std::make_unique<Gravity_Mixed>( isa ), 1e-5 );
+        cases.emplace_back( std::make_unique<Gravity_Fixed<N>>( isa ), 1e-13 );
+    }
+    cases.emplace_back( std::make_unique<Gravity_BarnesHut>( 0.05, 1 ), 1e-9 );
+
+    Particles p_ref{ N }; populate( p_ref, false );
+    Gravity{ simd::Isa::Scalar }.apply( p_ref );
+
+    for ( auto const &[force, tol] : cases ) {
+        Particles p{ N }; populate( p, true );
+        force->apply( p );
+
+        for ( std::size_t i{}; i < N; ++i ) {
+            double const scale{ std::sqrt( p_ref.acc_x()[i]*p_ref.acc_x()[i]
+                                         + p_ref.acc_y()[i]*p_ref.acc_y()[i]
+                                         + p_ref.acc_z()[i]*p_ref.acc_z()[i] ) };
+            double const dx{ p.acc_x()[i] - p_ref.acc_x()[i] };
+            double const dy{ p.acc_y()[i] - p_ref.acc_y()[i] };
+            double const dz{ p.acc_z()[i] - p_ref.acc_z()[i] };
+            ASSERT_LT( std::sqrt( dx*dx + dy*dy + dz*dz ) / scale, tol );
+        }
+    }
+
+    Particles p{ N };
+    bool threw{ false };
+    try { p.set_num_active( N + 1 ); } catch ( std::runtime_error const& ) { threw = true; }
+    ASSERT_TRUE( threw );
+    ++g_pass;
+}
+
+TEST( subset_apply_matches_full_apply ) {
+    // Listed targets (active and passive, in arbitrary order) must get the
+    // full-apply accelerations; every other particle must be left untouched.
+    constexpr std::size_t N{ 45 };
+    constexpr std::size_t N_active{ 30 };
+    std::vector<std::size_t> const targets{ 44, 0, 17, 29, 30, 5, 38 };
+
+    std::mt19937_64 rng{ 77 };
+    std::uniform_real_distribution<double> pos_dist{ -1e11, 1e11 };
+    std::uniform_real_distribution<double> mass_dist{ 1e23, 1e26 };
+    auto populate = [&]( Particles &p ) {
+        rng.seed( 77 );
+        for ( std::size_t i{}; i < N; ++i ) {
+            p.pos_x()[i] = pos_dist( rng );
+            p.pos_y()[i] = pos_dist( rng );
+            p.pos_z()[i] = pos_dist( rng );
+            p.mass()[i]  = mass_dist( rng );
+            p.acc_x()[i] = p.acc_y()[i] = p.acc_z()[i] = -1.0;
+        }
+        p.set_num_active( N_active );
+    };
+
+    std::vector<std::unique_ptr<Force>> cases{};
+    for ( simd::Isa const isa : { simd::Isa::Scalar, simd::Isa::AVX2, simd::Isa::AVX512 } ) {
+        if ( isa > simd::detect() ) continue;
+        cases.push_back( std::make_unique<Gravity>( isa ) );
+    }
+    cases.push_back( std::make_unique<Gravity_BarnesHut>( 0.5, 4 ) );
+
+    for ( auto const &force : cases ) {
+        ASSERT_TRUE( force->supports_subset() );
+        Particles p_ref{ N }; populate( p_ref );
+        Particles p{ N };     populate( p );
+        force->apply( p_ref );
+        force->apply_subset( p, targets );
+
+        for ( std::size_t i{}; i < N; ++i ) {
+            bool const listed{ std::find( targets.begin(), targets.end(), i ) != targets.end() };
+            if ( !listed ) {
+                ASSERT_TRUE( p.acc_x()[i] == -1.0 && p.acc_y()[i] == -1.0 && p.acc_z()[i] == -1.0 );
+                continue;
+            }
+            double const scale{ std::abs( p_ref.acc_x()[i] ) + std::abs( p_ref.acc_y()[i] ) + std::abs( p_ref.acc_z()[i] ) };
+            ASSERT_LT( std::abs( p.acc_x()[i] - p_ref.acc_x()[i] ) / scale, 1e-13 );
+            ASSERT_LT( std::abs( p.acc_y()[i] - p_ref.acc_y()[i] ) / scale, 1e-13 );
+            ASSERT_LT( std::abs( p.acc_z()[i] - p_ref.acc_z()[i] ) / scale, 1e-13 );
+        }
+    }
+
+    Particles p{ N }; populate( p );
+    bool threw{ false };
+    try { Gravity_Mixed{}.apply_subset( p, targets ); } catch ( std::runtime_error const& ) { threw = true; }
+    ASSERT_TRUE( threw );
+    ++g_pass;
+}
+
+TEST( gravity_isa_clamped_to_host ) {
+    Gravity const g{ simd::Isa::AVX512 };
+    ASSERT_TRUE( g.isa() <= simd::detect() );
+    ++g_pass;
+}
+
+TEST( gravity_tiled_matches_untiled ) {
+    // Source tiles only reorder the per-target sums. N = 300 leaves a partial
+    // final tile and a partial target tail for every vector width.
+    constexpr std::size_t N{ 300 };
+    std::mt19937_64 rng{ 7 };
+    std::uniform_real_distribution<double> pos_dist{ -1e12, 1e12 };
+    std::uniform_real_distribution<double> mass_dist{ 1e20, 1e30 };
+
+    auto populate = [&]( Particles &p ) {
+        rng.seed( 7 );
+        for ( std::size_t i{}; i < N; ++i ) {
+            p.pos_x()[i] = pos_dist( rng );
+            p.pos_y()[i] = pos_dist( rng );
+            p.pos_z()[i] = pos_dist( rng );
+            p.mass()[i] = mass_dist( rng );
+            p.acc_x()[i] = 0.0; p.acc_y()[i] = 0.0; p.acc_z()[i] = 0.0;
+        }
+    };
+
+    for ( simd::Isa const isa : { simd::Isa::Scalar, simd::Isa::AVX2, simd::Isa::AVX512 } ) {
+        if ( isa > simd::detect() ) continue;
+
+        Particles p_ref{ N }; populate( p_ref );
+        Gravity{ isa, direct::UNTILED }.apply( p_ref );
+
+        Particles p{ N }; populate( p );
+        Gravity{ isa, Direct_Tiling{ 128, 64 } }.apply( p );
+
+        for ( std::size_t i{}; i < N; ++i ) {
+            double const scale{ std::sqrt( p_ref.acc_x()[i]*p_ref.acc_x()[i]
+                                         + p_ref.acc_y()[i]*p_ref.acc_y()[i]
+                                         + p_ref.acc_z()[i]*p_ref.acc_z()[i] ) };
+            double const dx{ p.acc_x()[i] - p_ref.acc_x()[i] };
+            double const dy{ p.acc_y()[i] - p_ref.acc_y()[i] };
+            double const dz{ p.acc_z()[i] - p_ref.acc_z()[i] };
+            ASSERT_LT( std::sqrt( dx*dx + dy*dy + dz*dz ) / scale, 1e-13 );
+        }
+    }
+
+    bool threw{ false };
+    try { Gravity{ simd::Isa::Scalar, Direct_Tiling{ 100, 64 } }; }
+    catch ( std::runtime_error const& ) { threw = true; }
+    ASSERT_TRUE( threw );
+    ++g_pass;
+}
+
+TEST( gravity_symmetric_matches_direct ) {
+    // N = 413 spans several row blocks and leaves partial vector tails.
+    constexpr std::size_t N{ 413 };
+    std::mt19937_64 rng{ 11 };
+    std::uniform_real_distribution<double> pos_dist{ -1e12, 1e12 };
+    std::uniform_real_distribution<double> mass_dist{ 1e20, 1e30 };
+
+    auto populate = [&]( Particles &p ) {
+        rng.seed( 11 );
+        for ( std::size_t i{}; i < N; ++i ) {
+            p.pos_x()[i] = pos_dist( rng );
+            p.pos_y()[i] = pos_dist( rng );
+            p.pos_z()[i] = pos_dist( rng );
+            p.mass()[i] = mass_dist( rng );
+            p.acc_x()[i] = 0.0; p.acc_y()[i] = 0.0; p.acc_z()[i] = 0.0;
+        }
+    };
+
+    Particles p_ref{ N }; populate( p_ref );
+    Gravity{}.apply( p_ref );
+
+    for ( simd::Isa const isa : { simd::Isa::Scalar, simd::Isa::AVX2, simd::Isa::AVX512 } ) {
+        if ( isa > simd::detect() ) continue;
+
+        Particles p{ N }; populate( p );
+        Gravity_Symmetric{ isa }.apply( p );
+
+        for ( std::size_t i{}; i < N; ++i ) {
+            double const scale{ std::sqrt( p_ref.acc_x()[i]*p_ref.acc_x()[i]
+                                         + p_ref.acc_y()[i]*p_ref.acc_y()[i]
+                                         + p_ref.acc_z()[i]*p_ref.acc_z()[i] ) };
+            double const dx{ p.acc_x()[i] - p_ref.acc_x()[i] };
+            double const dy{ p.acc_y()[i] - p_ref.acc_y()[i] };
+            double const dz{ p.acc_z()[i] - p_ref.acc_z()[i] };
+            ASSERT_LT( std::sqrt( dx*dx + dy*dy + dz*dz ) / scale, 1e-12 );
+        }
+    }
+    ++g_pass;
+}
+
+TEST( gravity_symmetric_conserves_momentum ) {
+    // Sum of m a vanishes to rounding relative to the sum of |m a|.
+    constexpr std::size_t N{ 500 };
+    std::mt19937_64 rng{ 12 };
+    std::uniform_real_distribution<double> pos_dist{ -1e12, 1e12 };
+    std::uniform_real_distribution<double> mass_dist{ 1e20, 1e30 };
+
+    Particles p{ N };
+    for ( std::size_t i{}; i < N; ++i ) {
+        p.pos_x()[i] = pos_dist( rng );
+        p.pos_y()[i] = pos_dist( rng );
+        p.pos_z()[i] = pos_dist( rng );
+        p.mass()[i] = mass_dist( rng );
+        p.acc_x()[i] = 0.0; p.acc_y()[i] = 0.0; p.acc_z()[i] = 0.0;
+    }
+    Gravity_Symmetric{}.apply( p );
+
+    double F_x{}, F_y{}, F_z{}, F_abs{};
+    for ( std::size_t i{}; i < N; ++i ) {
+        double const m{ p.mass()[i] };
+        F_x += m * p.acc_x()[i];
+        F_y += m * p.acc_y()[i];
+        F_z += m * p.acc_z()[i];
+        F_abs += m * std::sqrt( p.acc_x()[i]*p.acc_x()[i] + p.acc_y()[i]*p.acc_y()[i]
+                              + p.acc_z()[i]*p.acc_z()[i] );
+    }
+    ASSERT_LT( std::sqrt( F_x*F_x + F_y*F_y + F_z*F_z ) / F_abs, 1e-14 );
+    ++g_pass;
+}
+
+TEST( gravity_mixed_matches_double ) {
+    // Float pair math should stay within ~1e-6 relative of the double kernel
+    // on every supported ISA, including the masked/scalar tails at N = 53.
+    constexpr std::size_t N{ 53 };
+    std::mt19937_64 rng{ 99 };
+    std::uniform_real_distribution<double> pos_dist{ -5e12, 5e12 };
+    std::uniform_real_distribution<double> mass_dist{ 1e20, 1e30 };
+
+    auto populate = [&]( Particles &p ) {
+        rng.seed( 99 );
+        for ( std::size_t i{}; i < N; ++i ) {
+            p.pos_x()[i] = pos_dist( rng );
+            p.pos_y()[i] = pos_dist( rng );
+            p.pos_z()[i] = pos_dist( rng );
+            p.mass()[i] = mass_dist( rng );
+            p.acc_x()[i] = 0.0; p.acc_y()[i] = 0.0; p.acc_z()[i] = 0.0;
+        }
+    };
+
+    Particles p_ref{ N }; populate( p_ref );
+    Gravity{}.apply( p_ref );
+
+    for ( simd::Isa const isa : { simd::Isa::Scalar, simd::Isa::AVX2, simd::Isa::AVX512 } ) {
+        if ( isa > simd::detect() ) continue;
+
+        Particles p{ N }; populate( p );
+        Gravity_Mixed{ isa }.apply( p );
+
+        for ( std::size_t i{}; i < N; ++i ) {
+            double const scale{ std::sqrt( p_ref.acc_x()[i]*p_ref.acc_x()[i]
+                                         + p_ref.acc_y()[i]*p_ref.acc_y()[i]
+                                         + p_ref.acc_z()[i]*p_ref.acc_z()[i] ) };
+            double const dx{ p.acc_x()[i] - p_ref.acc_x()[i] };
+            double const dy{ p.acc_y()[i] - p_ref.acc_y()[i] };
+            double const dz{ p.acc_z()[i] - p_ref.acc_z()[i] };
+            ASSERT_LT( std::sqrt( dx*dx + dy*dy + dz*dz ) / scale, 1e-5 );
+        }
+    }
+    ++g_pass;
+}
+
+
 // 3. Two-body Kepler orbit
 
 TEST( kepler_circular_orbit_energy_conservation ) {
@@ -415,6 +939,157 @@ TEST( yoshida_fourth_order_convergence ) {
     ++g_pass;
 }
 
+TEST( yoshida_fixed_matches_yoshida ) {
+    // Same force, same coefficients, same operation order: the fixed-size
+    // step must reproduce the generic one exactly.
+    constexpr std::size_t N{ 3 };
+    Particles p_gen{ N };
+    Particles p_fix{ N };
+    for ( Particles *p : { &p_gen, &p_fix } ) {
+        setup_two_body( *p, 1.989e30, 5.972e24, 1.496e11 );
+        p->pos_x()[2] = 0.0; p->pos_y()[2] = 7.78e11; p->pos_z()[2] = 1e9;
+        p->vel_x()[2] = -1.307e4; p->mass()[2] = 1.898e27;
+    }
+
+    std::vector<std::unique_ptr<Force>> forces{};
+    forces.push_back( std::make_unique<Gravity>() );
+
+    Yoshida integ_gen{ 3600.0 };
+    Yoshida_Fixed<N> integ_fix{ 3600.0 };
+    step_n( p_gen, integ_gen, forces, 1000 );
+    step_n( p_fix, integ_fix, forces, 1000 );
+
+    for ( std::size_t i{}; i < N; ++i ) {
+        ASSERT_TRUE( p_fix.pos_x()[i] == p_gen.pos_x()[i] );
+        ASSERT_TRUE( p_fix.pos_y()[i] == p_gen.pos_y()[i] );
+        ASSERT_TRUE( p_fix.vel_z()[i] == p_gen.vel_z()[i] );
+    }
+    ++g_pass;
+}
+
+TEST( yoshida_fused_sweeps_match_separate_loops ) {
+    // Above the threading threshold each sub-step is one fused, threaded
+    // sweep; it must reproduce drift, reset, force and kick done as
+    // separate serial loops exactly.
+    constexpr std::size_t N{ 1000 };
+    std::mt19937_64 rng{ 24 };
+    std::uniform_real_distribution<double> pos_dist{ -1e12, 1e12 };
+    std::uniform_real_distribution<double> vel_dist{ -3e4, 3e4 };
+    std::uniform_real_distribution<double> mass_dist{ 1e20, 1e30 };
+
+    Particles p_fused{ N };
+    Particles p_ref{ N };
+    for ( std::size_t i{}; i < N; ++i ) {
+        double const x{ pos_dist( rng ) }, y{ pos_dist( rng ) }, z{ pos_dist( rng ) };
+        double const vx{ vel_dist( rng ) }, vy{ vel_dist( rng ) }, vz{ vel_dist( rng ) };
+        double const m{ mass_dist( rng ) };
+        for ( Particles *p : { &p_fused, &p_ref } ) {
+            p->pos_x()[i] = x; p->pos_y()[i] = y; p->pos_z()[i] = z;
+            p->vel_x()[i] = vx; p->vel_y()[i] = vy; p->vel_z()[i] = vz;
+            p->mass()[i] = m;
+        }
+    }
+
+    std::vector<std::unique_ptr<Force>> forces{};
+    forces.push_back( std::make_unique<Gravity>() );
+    Yoshida integ{ 3600.0 };
+    step_n( p_fused, integ, forces, 3 );
+
+    double const h{ integ.dt() };
+    double const c[4]{ integ.c_1(), integ.c_2(), integ.c_3(), integ.c_4() };
+    double const d[3]{ integ.d_1(), integ.d_2(), integ.d_3() };
+    for ( int step{}; step < 3; ++step ) {
+        for ( int k{}; k < 4; ++k ) {
+            for ( std::size_t i{}; i < N; ++i ) {
+                p_ref.pos_x()[i] += c[k] * h * p_ref.vel_x()[i];
+                p_ref.pos_y()[i] += c[k] * h * p_ref.vel_y()[i];
+                p_ref.pos_z()[i] += c[k] * h * p_ref.vel_z()[i];
+            }
+            if ( k == 3 ) break;
+            for ( std::size_t i{}; i < N; ++i ) {
+                p_ref.acc_x()[i] = 0.0; p_ref.acc_y()[i] = 0.0; p_ref.acc_z()[i] = 0.0;
+            }
+            forces[0]->apply( p_ref );
+            for ( std::size_t i{}; i < N; ++i ) {
+                p_ref.vel_x()[i] += d[k] * h * p_ref.acc_x()[i];
+                p_ref.vel_y()[i] += d[k] * h * p_ref.acc_y()[i];
+                p_ref.vel_z()[i] += d[k] * h * p_ref.acc_z()[i];
+            }
+        }
+    }
+
+    for ( std::size_t i{}; i < N; ++i ) {
+        ASSERT_TRUE( p_fused.pos_x()[i] == p_ref.pos_x()[i] );
+        ASSERT_TRUE( p_fused.pos_z()[i] == p_ref.pos_z()[i] );
+        ASSERT_TRUE( p_fused.vel_y()[i] == p_ref.vel_y()[i] );
+        ASSERT_TRUE( p_fused.acc_x()[i] == p_ref.acc_x()[i] );
+    }
+    ++g_pass;
+}
+
+TEST( composition_yoshida_4_matches_yoshida ) {
+    // Same weights, same merged drifts: the table-driven step must
+    // reproduce the hand-written one exactly.
+    Particles p_yos{ 2 };
+    Particles p_comp{ 2 };
+    setup_two_body( p_yos, 1.989e30, 5.972e24, 1.496e11 );
+    setup_two_body( p_comp, 1.989e30, 5.972e24, 1.496e11 );
+
+    std::vector<std::unique_ptr<Force>> forces{};
+    forces.push_back( std::make_unique<Gravity>() );
+
+    Yoshida integ_yos{ 3600.0 };
+    Composition<Yoshida_4> integ_comp{ 3600.0 };
+    step_n( p_yos, integ_yos, forces, 1000 );
+    step_n( p_comp, integ_comp, forces, 1000 );
+
+    for ( std::size_t i{}; i < 2; ++i ) {
+        ASSERT_TRUE( p_comp.pos_x()[i] == p_yos.pos_x()[i] );
+        ASSERT_TRUE( p_comp.pos_y()[i] == p_yos.pos_y()[i] );
+        ASSERT_TRUE( p_comp.vel_x()[i] == p_yos.vel_x()[i] );
+    }
+    ASSERT_TRUE( Composition<Yoshida_6>::STAGES == 7 );
+    ASSERT_TRUE( Composition<Kahan_Li_8>::STAGES == 15 );
+    ++g_pass;
+}
+
+TEST( composition_sixth_and_eighth_order_convergence ) {
+    // One orbit of an eccentric (e = 0.44) Earth-Sun pair with steps of
+    // 2 to 19 days, against an eighth-order run at 3.5 hours. Halving dt
+    // should cut the error by 2^6 = 64 and 2^8 = 256; both stay far above
+    // the round-off floor (~2 cm).
+    double const M{ 1.989e30 };
+    double const m{ 5.972e24 };
+    double const r{ 1.496e11 };
+    double const T_phys{ 3.2e7 };
+
+    auto run = [&]<typename Scheme>( Scheme, double const dt ) -> std::pair<double, double> {
+        Particles p{ 2 };
+        setup_two_body( p, M, m, r );
+        p.vel_y()[0] *= 1.2;
+        p.vel_y()[1] *= 1.2;
+        std::vector<std::unique_ptr<Force>> forces;
+        forces.push_back( std::make_unique<Gravity>() );
+        Composition<Scheme> integ{ dt };
+        step_n( p, integ, forces, static_cast<std::size_t>( T_phys / dt ) );
+        return { p.pos_x()[1], p.pos_y()[1] };
+    };
+    auto error = [&]( std::pair<double, double> const &a, std::pair<double, double> const &b ) {
+        return std::hypot( a.first - b.first, a.second - b.second );
+    };
+
+    auto const ref{ run( Kahan_Li_8{}, 12500.0 ) };
+
+    double const ratio_6{ error( run( Yoshida_6{}, 4e5 ), ref ) / error( run( Yoshida_6{}, 2e5 ), ref ) };
+    ASSERT_TRUE( ratio_6 > 40.0 );
+    ASSERT_TRUE( ratio_6 < 100.0 );
+
+    double const ratio_8{ error( run( Kahan_Li_8{}, 1.6e6 ), ref ) / error( run( Kahan_Li_8{}, 8e5 ), ref ) };
+    ASSERT_TRUE( ratio_8 > 150.0 );
+    ASSERT_TRUE( ratio_8 < 400.0 );
+    ++g_pass;
+}
+
 TEST( verlet_second_order_convergence ) {
     // Same approach for Velocity Verlet: dt ratio = 2, expect ratio near 2^2 = 4.
     double const M{ 1.989e30 };
@@ -493,6 +1168,100 @@ TEST( three_body_energy_conservation ) {
     ++g_pass;
 }
 
+TEST( kepler_drift_exact_for_elliptic_and_hyperbolic ) {
+    double const mu{ config::G * 1.989e30 };
+
+    // Eccentric orbit (e ~ 0.6): one full period must return to the start,
+    // however coarse the step, since each drift is solved exactly.
+    double const r{ 1.496e11 };
+    double const v{ 1.25 * std::sqrt( mu / r ) };
+    double const a{ 1.0 / ( 2.0 / r - 1.01 * v * v / mu ) };
+    double const T{ 2.0 * std::numbers::pi * std::sqrt( a*a*a / mu ) };
+
+    double x{ r }, y{}, z{}, vx{}, vy{ v }, vz{ 0.1 * v };
+    for ( int k{}; k < 7; ++k ) kepler::drift( x, y, z, vx, vy, vz, mu, T / 7.0 );
+    ASSERT_LT( std::abs( x - r ) / r, 1e-10 );
+    ASSERT_LT( std::abs( y ) / r, 1e-10 );
+    ASSERT_LT( std::abs( vy - v ) / v, 1e-10 );
+
+    // Hyperbolic flyby: forward then backward restores the state.
+    double hx{ r }, hy{}, hz{}, hvx{ -0.3 * v }, hvy{ 2.0 * v }, hvz{};
+    kepler::drift( hx, hy, hz, hvx, hvy, hvz, mu, 5.0e7 );
+    kepler::drift( hx, hy, hz, hvx, hvy, hvz, mu, -5.0e7 );
+    ASSERT_LT( std::abs( hx - r ) / r, 1e-9 );
+    ASSERT_LT( std::abs( hy ) / r, 1e-9 );
+    ASSERT_LT( std::abs( hvx + 0.3 * v ) / v, 1e-9 );
+    ++g_pass;
+}
+
+TEST( wisdom_holman_energy_bounded_at_large_dt ) {
+    // Sun-Jupiter-Saturn at 20 steps per Jupiter orbit. The Kepler part is
+    // exact, so only the small planet-planet term limits the error.
+    Particles p{ 3 };
+    p.mass()[0] = 1.989e30;
+
+    double const rJ{ 5.2 * config::AU };
+    double const vJ{ std::sqrt( config::G * p.mass()[0] / rJ ) };
+    p.pos_x()[1] = rJ;  p.vel_y()[1] = vJ;  p.mass()[1] = 1.898e27;
+
+    double const rS{ 9.5 * config::AU };
+    double const vS{ std::sqrt( config::G * p.mass()[0] / rS ) };
+    p.pos_y()[2] = rS;  p.vel_x()[2] = -vS; p.mass()[2] = 5.683e26;
+
+    double const E0{ total_energy( p ) };
+    double const T_jup{ 2.0 * std::numbers::pi * std::sqrt( rJ*rJ*rJ / ( config::G * p.mass()[0] ) ) };
+
+    std::vector<std::unique_ptr<Force>> forces;
+    forces.push_back( std::make_unique<Gravity>() );
+    Wisdom_Holman integ{ T_jup / 20.0 };
+
+    double max_dE{};
+    for ( int k{}; k < 50 * 20; ++k ) {
+        step_n( p, integ, forces, 1 );
+        max_dE = std::max( max_dE, std::abs( ( total_energy( p ) - E0 ) / E0 ) );
+    }
+    ASSERT_LT( max_dE, 2e-5 );
+    ASSERT_LT( std::abs( p.mass()[0] - 1.989e30 ), 1.0 );
+    ++g_pass;
+}
+
+TEST( block_leapfrog_moon_steps_finer_than_outer_planet ) {
+    // Sun, Earth, Moon, Neptune for one year. The Moon must sit on a finer
+    // level than Neptune, stay bound to the Earth, and the whole run must
+    // need far fewer force evaluations than the finest shared step.
+    Particles p{ 4 };
+    double const M_sun{ 1.989e30 }, M_earth{ 5.972e24 }, M_moon{ 7.342e22 };
+    p.mass()[0] = M_sun;
+
+    double const rE{ config::AU };
+    double const vE{ std::sqrt( config::G * M_sun / rE ) };
+    double const rM{ 3.844e8 };
+    double const vM{ std::sqrt( config::G * M_earth / rM ) };
+    p.pos_x()[1] = rE;       p.vel_y()[1] = vE;       p.mass()[1] = M_earth;
+    p.pos_x()[2] = rE + rM;  p.vel_y()[2] = vE + vM;  p.mass()[2] = M_moon;
+
+    double const rN{ 30.07 * config::AU };
+    p.pos_y()[3] = rN;  p.vel_x()[3] = -std::sqrt( config::G * M_sun / rN );  p.mass()[3] = 1.024e26;
+
+    double const E0{ total_energy( p ) };
+
+    std::vector<std::unique_ptr<Force>> forces;
+    forces.push_back( std::make_unique<Gravity>() );
+    Block_Leapfrog integ{ 87660.0, 8, 0.02 };
+    std::size_t const steps{ 360 };
+    step_n( p, integ, forces, steps );
+
+    ASSERT_TRUE( integ.levels()[2] > integ.levels()[3] );
+    ASSERT_LT( static_cast<double>( integ.evaluations() ), 0.05 * 4.0 * 256.0 * steps );
+
+    double const dx{ p.pos_x()[2] - p.pos_x()[1] };
+    double const dy{ p.pos_y()[2] - p.pos_y()[1] };
+    double const dz{ p.pos_z()[2] - p.pos_z()[1] };
+    ASSERT_LT( std::abs( std::sqrt( dx*dx + dy*dy + dz*dz ) / rM - 1.0 ), 0.05 );
+    ASSERT_LT( std::abs( ( total_energy( p ) - E0 ) / E0 ), 1e-6 );
+    ++g_pass;
+}
+
 
 // 6. Particle SoA layout
 
@@ -606,6 +1375,619 @@ TEST( bh_small_cluster_matches_direct_at_low_theta ) {
     ++g_pass;
 }
 
+TEST( bh_morton_build_matches_recursive_build ) {
+    // Both builds cut the same root cube into the same octants, so they give
+    // the same tree and the same forces. Rebuilding after small and large
+    // moves exercises the presorted, insertion and radix sort paths.
+    constexpr std::size_t N{ 3000 };
+    Particles p{ N };
+    populate_two_clumps( p, 2024 );
+
+    Gravity_BarnesHut const recursive{ 0.5, 8, BH_Build::Recursive };
+    Gravity_BarnesHut const morton{ 0.5, 8, BH_Build::Morton };
+    ASSERT_TRUE( morton.build() == BH_Build::Morton );
+
+    std::vector<double> ref_ax( N ), ref_ay( N ), ref_az( N );
+    auto check = [&]() {
+        for ( std::size_t i{}; i < N; ++i ) p.acc_x()[i] = p.acc_y()[i] = p.acc_z()[i] = 0.0;
+        recursive.apply( p );
+        for ( std::size_t i{}; i < N; ++i ) {
+            ref_ax[i] = p.acc_x()[i]; ref_ay[i] = p.acc_y()[i]; ref_az[i] = p.acc_z()[i];
+            p.acc_x()[i] = p.acc_y()[i] = p.acc_z()[i] = 0.0;
+        }
+        morton.apply( p );
+        for ( std::size_t i{}; i < N; ++i ) {
+            double const scale{ std::abs( ref_ax[i] ) + std::abs( ref_ay[i] ) + std::abs( ref_az[i] ) };
+            ASSERT_LT( ( std::abs( p.acc_x()[i] - ref_ax[i] ) + std::abs( p.acc_y()[i] - ref_ay[i] )
+                       + std::abs( p.acc_z()[i] - ref_az[i] ) ) / scale, 1e-12 );
+        }
+    };
+
+    check();
+    check();                                         // same order: no sort work
+    for ( std::size_t i{}; i < N; i += 97 ) p.pos_x()[i] += 2e9;
+    check();                                         // a few moved cells: insertion
+    for ( std::size_t i{}; i < N; ++i ) p.pos_y()[i] = -p.pos_y()[i];
+    check();                                         // reflected: full radix
+    ++g_pass;
+}
+
+TEST( bh_parallel_recursive_build_matches_serial ) {
+    // Enough bodies to split the top of the tree into tasks: whichever
+    // thread builds a part, the stitched pool must give bit-identical
+    // forces and quadrupole moments to a single-threaded build.
+    constexpr std::size_t N{ 20000 };
+    Particles p{ N };
+    populate_two_clumps( p, 12 );
+
+    int const threads{ omp_get_max_threads() };
+    for ( BH_Expansion const expansion : { BH_Expansion::Monopole, BH_Expansion::Quadrupole } ) {
+        Gravity_BarnesHut const bh{ 0.7, 8, BH_Build::Recursive, 64, simd::detect(), { .expansion = expansion } };
+        omp_set_num_threads( 1 );
+        std::vector<double> const serial{ evaluate( p, bh ) };
+        omp_set_num_threads( 4 );
+        std::vector<double> const parallel{ evaluate( p, bh ) };
+        omp_set_num_threads( threads );
+        ASSERT_TRUE( parallel == serial );
+        ASSERT_TRUE( bh.build_seconds() > 0.0 && bh.traversal_seconds() > 0.0 );
+    }
+    ++g_pass;
+}
+
+TEST( bh_refit_reuses_tree_until_bodies_escape ) {
+    // Small moves keep the tree and only refit it, with the node sizes
+    // grown to cover strays, so forces stay within the usual BH error. A
+    // reflection moves most bodies out of their leaf cells and forces a
+    // rebuild, after which the forces match a freshly built tree.
+    constexpr std::size_t N{ 3000 };
+    std::mt19937_64 rng{ 77 };
+    std::normal_distribution<double> jitter{ 0.0, 2e8 };
+
+    Particles p{ N };
+    populate_two_clumps( p, 77 );
+
+    Gravity_BarnesHut const rebuild{ 0.5 };
+    Gravity_BarnesHut const refit{ 0.5, 8, BH_Build::Morton, 64, simd::detect(), { .refit_tolerance = 0.05 } };
+
+    ASSERT_LT( rms_rel_error( evaluate( p, refit ), evaluate( p, rebuild ), 0, N ), 1e-12 );
+
+    for ( int step{}; step < 3; ++step ) {
+        for ( std::size_t i{}; i < N; ++i ) {
+            p.pos_x()[i] += jitter( rng ); p.pos_y()[i] += jitter( rng ); p.pos_z()[i] += jitter( rng );
+        }
+        ASSERT_LT( rms_rel_error( evaluate( p, refit ), evaluate( p, Gravity{} ), 0, N ), 5e-3 );
+    }
+    ASSERT_TRUE( refit.builds() == 1 );
+
+    for ( std::size_t i{}; i < N; ++i ) p.pos_y()[i] = -p.pos_y()[i];
+    ASSERT_LT( rms_rel_error( evaluate( p, refit ), evaluate( p, rebuild ), 0, N ), 1e-12 );
+    ASSERT_TRUE( refit.builds() == 2 );           // five calls, two builds
+    ++g_pass;
+}
+
+TEST( bh_deep_tree_matches_direct ) {
+    // A tight clump inside a wide field drives both builds to their depth
+    // caps. The stackless walk must still visit every subtree exactly once.
+    constexpr std::size_t N{ 2000 };
+    std::mt19937_64 rng{ 31 };
+    std::uniform_real_distribution<double> field{ -1e12, 1e12 };
+    std::normal_distribution<double> clump{ 0.0, 1e3 };
+    std::uniform_real_distribution<double> mass_dist{ 1e22, 1e26 };
+
+    Particles p{ N };
+    for ( std::size_t i{}; i < N; ++i ) {
+        bool const in_clump{ i % 2 == 0 };
+        p.pos_x()[i] = in_clump ? 3e11 + clump( rng ) : field( rng );
+        p.pos_y()[i] = in_clump ? clump( rng ) : field( rng );
+        p.pos_z()[i] = in_clump ? clump( rng ) : field( rng );
+        p.mass()[i]  = mass_dist( rng );
+    }
+
+    std::vector<double> const direct{ evaluate( p, Gravity{} ) };
+    ASSERT_LT( rms_rel_error( evaluate( p, Gravity_BarnesHut{ 0.5, 8, BH_Build::Recursive } ), direct, 0, N ), 5e-3 );
+    ASSERT_LT( rms_rel_error( evaluate( p, Gravity_BarnesHut{ 0.5, 8, BH_Build::Morton } ), direct, 0, N ), 5e-3 );
+    ++g_pass;
+}
+
+TEST( bh_group_walk_opens_cells_holding_the_group ) {
+    // The root holds both clumps of populate_heavy_light_clumps and its
+    // centre of mass lies about sqrt(3) cell widths from the light group:
+    // far enough to pass the group test above theta = 1/sqrt(3), yet
+    // accepting the root would count the light bodies twice and collapse
+    // their neighbours.
+    constexpr std::size_t N_heavy{ 400 };
+    constexpr std::size_t N{ N_heavy + 16 };
+    Particles p{ N };
+    populate_heavy_light_clumps( p, N_heavy );
+
+    std::vector<double> const ref{ evaluate( p, Gravity{} ) };
+    for ( double const theta : { 0.7, 0.9 } ) {
+        for ( std::size_t const group_size : { std::size_t{ 1 }, std::size_t{ 8 } } ) {
+            Gravity_BarnesHut const bh{ theta, 8, BH_Build::Morton, group_size };
+            ASSERT_LT( max_rel_error( evaluate( p, bh ), ref, N_heavy, N ), 1e-3 );
+        }
+    }
+    ++g_pass;
+}
+
+TEST( bh_group_traversal_matches_direct ) {
+    // Group lists feed the direct kernels, so every ISA must give the same
+    // forces. The group opening test is conservative: larger groups open
+    // more nodes and can only tighten the error against direct summation.
+    constexpr std::size_t N{ 3000 };
+    constexpr std::size_t N_active{ 2500 };
+    Particles p{ N };
+    populate_two_clumps( p, 5 );
+    p.set_num_active( N_active );
+
+    std::vector<double> const direct{ evaluate( p, Gravity{} ) };
+    std::vector<double> const single{ evaluate( p, Gravity_BarnesHut{ 0.5, 8, BH_Build::Morton, 1, simd::Isa::Scalar } ) };
+    std::vector<double> const grouped{ evaluate( p, Gravity_BarnesHut{ 0.5, 8, BH_Build::Morton, 64, simd::Isa::Scalar } ) };
+    ASSERT_LT( rms_rel_error( grouped, direct, 0, N ), 5e-3 );
+    ASSERT_TRUE( rms_rel_error( grouped, direct, 0, N ) <= rms_rel_error( single, direct, 0, N ) );
+
+    for ( simd::Isa const isa : { simd::Isa::AVX2, simd::Isa::AVX512 } ) {
+        if ( isa > simd::detect() ) continue;
+        std::vector<double> const a{ evaluate( p, Gravity_BarnesHut{ 0.5, 8, BH_Build::Morton, 64, isa } ) };
+        ASSERT_LT( rms_rel_error( a, grouped, 0, N ), 1e-12 );
+    }
+    ++g_pass;
+}
+
+TEST( bh_passive_groups_ignore_slot_order ) {
+    // Passive groups are cut in Morton order, not slot order, so shuffling
+    // the passive slots of a reordered set must leave every passive force
+    // unchanged.
+    constexpr std::size_t N{ 3000 };
+    constexpr std::size_t N_active{ 1000 };
+    Particles p_ref{ N };
+    Particles p{ N };
+    populate_two_clumps( p_ref, 17 );
+    populate_two_clumps( p, 17 );
+    p_ref.set_num_active( N_active );
+    p.set_num_active( N_active );
+    Morton_Reorder reorder{ 0 };
+    p.permute( reorder.reorder( p_ref ) );
+
+    std::vector<std::size_t> order( N );
+    std::iota( order.begin(), order.end(), std::size_t{} );
+    std::mt19937_64 rng{ 17 };
+    std::shuffle( order.begin() + N_active, order.end(), rng );
+    p.permute( order );
+
+    Gravity_BarnesHut const bh{ 0.5 };
+    std::vector<double> const ref{ evaluate( p_ref, bh ) };
+    std::vector<double> const a{ evaluate( p, bh ) };
+    for ( std::size_t k{ N_active }; k < N; ++k ) {
+        std::size_t const i{ order[k] };
+        double const dx{ a[4*k] - ref[4*i] }, dy{ a[4*k + 1] - ref[4*i + 1] }, dz{ a[4*k + 2] - ref[4*i + 2] };
+        double const r{ ref[4*i]*ref[4*i] + ref[4*i + 1]*ref[4*i + 1] + ref[4*i + 2]*ref[4*i + 2] };
+        ASSERT_LT( std::sqrt( ( dx*dx + dy*dy + dz*dz ) / r ), 1e-12 );
+    }
+    ++g_pass;
+}
+
+TEST( bh_cost_zones_match_serial ) {
+    // Zones only decide which thread runs a group, so any team size and
+    // any cost history give bit-identical forces. The recorded costs must
+    // see the dense cluster as the expensive region.
+    constexpr std::size_t N{ 4000 };
+    std::mt19937_64 rng{ 8 };
+    std::normal_distribution<double> cluster{ 0.0, 2e10 };
+    std::uniform_real_distribution<double> field{ -1e12, 1e12 };
+    std::uniform_real_distribution<double> mass_dist{ 1e22, 1e26 };
+
+    Particles p{ N };
+    for ( std::size_t i{}; i < N; ++i ) {
+        bool const dense{ i % 4 != 0 };
+        p.pos_x()[i] = dense ? cluster( rng ) : field( rng );
+        p.pos_y()[i] = dense ? cluster( rng ) : field( rng );
+        p.pos_z()[i] = dense ? cluster( rng ) : field( rng );
+        p.mass()[i]  = mass_dist( rng );
+    }
+
+    int const threads{ omp_get_max_threads() };
+    omp_set_num_threads( 1 );
+    std::vector<double> const serial{ evaluate( p, Gravity_BarnesHut{} ) };
+
+    omp_set_num_threads( 4 );
+    Gravity_BarnesHut const bh{};
+    std::vector<double> const first{ evaluate( p, bh ) };      // zones by group size
+    std::vector<double> const second{ evaluate( p, bh ) };     // zones by recorded cost
+    omp_set_num_threads( threads );
+
+    ASSERT_TRUE( first == serial );
+    ASSERT_TRUE( second == serial );
+
+    double dense_cost{}, field_cost{};
+    for ( std::size_t i{}; i < N; ++i ) ( i % 4 != 0 ? dense_cost : field_cost ) += bh.costs()[i];
+    ASSERT_TRUE( dense_cost / ( 3 * N / 4 ) > 2.0 * field_cost / ( N / 4 ) );
+    ++g_pass;
+}
+
+TEST( bh_relative_opening_bounds_worst_error ) {
+    // The first call has no accelerations to compare against and must
+    // match the geometric test exactly. From the second on, the relative
+    // test must spend no more interactions than theta = 0.5 while cutting
+    // the worst per-particle force error.
+    constexpr std::size_t N{ 3000 };
+    Particles p{ N };
+    populate_two_clumps( p, 10 );
+
+    auto mean_cost = []( Gravity_BarnesHut const &bh ) {
+        return std::accumulate( bh.costs().begin(), bh.costs().end(), 0.0 ) / N;
+    };
+
+    Gravity_BarnesHut const geometric{ 0.5 };
+    Gravity_BarnesHut const relative{ 0.5, 8, BH_Build::Morton, 64, simd::detect(), { .alpha = 0.01 } };
+    ASSERT_TRUE( relative.alpha() == 0.01 );
+
+    std::vector<double> const ref{ evaluate( p, Gravity{} ) };
+    std::vector<double> const a_geometric{ evaluate( p, geometric ) };
+    std::vector<double> const first{ evaluate( p, relative ) };
+    ASSERT_TRUE( first == a_geometric );
+
+    std::vector<double> const second{ evaluate( p, relative ) };
+    ASSERT_TRUE( mean_cost( relative ) <= mean_cost( geometric ) );
+    ASSERT_LT( max_rel_error( second, ref, 0, N ), 0.5 * max_rel_error( a_geometric, ref, 0, N ) );
+    ++g_pass;
+}
+
+TEST( bh_relative_opening_follows_reordered_bodies ) {
+    // The accelerations kept for the relative test belong to bodies, not
+    // slots: shuffling the arrays between two calls must give the same
+    // forces as two calls on the unshuffled arrays.
+    constexpr std::size_t N{ 3000 };
+    Particles p_ref{ N };
+    Particles p{ N };
+    populate_two_clumps( p_ref, 16 );
+    populate_two_clumps( p, 16 );
+
+    Gravity_BarnesHut const bh_ref{ 0.5, 8, BH_Build::Morton, 64, simd::detect(), { .alpha = 0.01 } };
+    Gravity_BarnesHut const bh{ 0.5, 8, BH_Build::Morton, 64, simd::detect(), { .alpha = 0.01 } };
+    bh_ref.apply( p_ref );
+    bh.apply( p );
+
+    std::vector<std::size_t> order( N );
+    std::iota( order.begin(), order.end(), std::size_t{} );
+    std::mt19937_64 rng{ 16 };
+    std::shuffle( order.begin(), order.end(), rng );
+    p.permute( order );
+
+    std::vector<double> const ref{ evaluate( p_ref, bh_ref ) };
+    std::vector<double> const a{ evaluate( p, bh ) };
+    std::vector<std::size_t> const &ids{ p.ids() };
+    for ( std::size_t k{}; k < N; ++k ) {
+        std::size_t const i{ ids[k] };
+        double const dx{ a[4*k] - ref[4*i] }, dy{ a[4*k + 1] - ref[4*i + 1] }, dz{ a[4*k + 2] - ref[4*i + 2] };
+        double const r{ ref[4*i]*ref[4*i] + ref[4*i + 1]*ref[4*i + 1] + ref[4*i + 2]*ref[4*i + 2] };
+        ASSERT_LT( std::sqrt( ( dx*dx + dy*dy + dz*dz ) / r ), 1e-12 );
+    }
+    ++g_pass;
+}
+
+TEST( bh_tuner_meets_error_budget ) {
+    // Each tuned force must meet its budget on every body, not just the
+    // sample, with no body far beyond it, a wider or equal theta for the
+    // looser budget, and log one line per tuning run.
+    constexpr std::size_t N{ 3000 };
+    Particles p{ N };
+    populate_two_clumps( p, 11 );
+
+    std::vector<double> const ref{ evaluate( p, Gravity{} ) };
+
+    std::ostringstream log;
+    Gravity_BarnesHut_Tuned const loose{ 1e-2, 2, 256, BH_Expansion::Monopole, simd::detect(), &log };
+    Gravity_BarnesHut_Tuned const tight{ 1e-3, 0, 256, BH_Expansion::Monopole, simd::detect(), &log };
+
+    std::vector<double> const a_loose{ evaluate( p, loose ) };
+    std::vector<double> const a_tight{ evaluate( p, tight ) };
+    ASSERT_LT( rms_rel_error( a_loose, ref, 0, N ), 1.5e-2 );
+    ASSERT_LT( rms_rel_error( a_tight, ref, 0, N ), 1.5e-3 );
+    ASSERT_LT( loose.tuning().error, 1e-2 );
+    ASSERT_LT( tight.tuning().error, 1e-3 );
+    ASSERT_TRUE( loose.tuning().worst_error <= 20.0 * 1e-2 );
+    ASSERT_TRUE( tight.tuning().worst_error <= 20.0 * 1e-3 );
+    ASSERT_LT( max_rel_error( a_loose, ref, 0, N ), 0.2 );
+    ASSERT_TRUE( loose.tuning().theta >= tight.tuning().theta );
+    ASSERT_TRUE( loose.force().theta() == loose.tuning().theta );
+
+    evaluate( p, loose );
+    evaluate( p, loose );     // third call: re-tuned
+    ASSERT_TRUE( loose.tunes() == 2 && tight.tunes() == 1 );
+    std::string const text{ log.str() };
+    ASSERT_TRUE( std::count( text.begin(), text.end(), '\n' ) == 3 );
+    ++g_pass;
+}
+
+TEST( bh_quadrupole_reduces_force_error ) {
+    // At a wide opening angle the quadrupole term must cut the force and
+    // potential errors against direct summation well below the monopole's,
+    // and both tree builds must give the same moments.
+    constexpr std::size_t N{ 3000 };
+    Particles p{ N };
+    populate_two_clumps( p, 9 );
+
+    Gravity direct{};
+    Gravity_BarnesHut mono{ 0.7 };
+    Gravity_BarnesHut quad{ 0.7, 8, BH_Build::Morton, 64, simd::detect(), { .expansion = BH_Expansion::Quadrupole } };
+    Gravity_BarnesHut quad_recursive{ 0.7, 8, BH_Build::Recursive, 64, simd::detect(),
+                                      { .expansion = BH_Expansion::Quadrupole } };
+    ASSERT_TRUE( quad.expansion() == BH_Expansion::Quadrupole );
+    direct.set_potential( true ); mono.set_potential( true );
+    quad.set_potential( true ); quad_recursive.set_potential( true );
+
+    std::vector<double> const ref{ evaluate( p, direct ) };
+    std::vector<double> const a_mono{ evaluate( p, mono ) };
+    std::vector<double> const a_quad{ evaluate( p, quad ) };
+    std::vector<double> const a_quad_rec{ evaluate( p, quad_recursive ) };
+
+    ASSERT_LT( rms_rel_error( a_quad, ref, 0, N ), 0.3 * rms_rel_error( a_mono, ref, 0, N ) );
+    ASSERT_LT( rms_rel_pot_error( a_quad, ref, 0, N ), 0.3 * rms_rel_pot_error( a_mono, ref, 0, N ) );
+    ASSERT_LT( rms_rel_error( a_quad_rec, a_quad, 0, N ), 1e-10 );
+    ++g_pass;
+}
+
+TEST( bh_dual_traversal_conserves_momentum ) {
+    // The dual walk gives every cell pair equal and opposite forces, so the
+    // net force on the active bodies vanishes where the group walk's does
+    // not; quadrupoles cut its error, and passive bodies still get the
+    // group walk's forces.
+    constexpr std::size_t N{ 4000 };
+    constexpr std::size_t N_active{ 3500 };
+    Particles p{ N };
+    populate_two_clumps( p, 14 );
+    p.set_num_active( N_active );
+
+    Gravity direct{};
+    Gravity_BarnesHut groups{ 0.5, 8, BH_Build::Morton, 64, simd::detect(), { .expansion = BH_Expansion::Quadrupole } };
+    Gravity_BarnesHut mono{ 0.5, 8, BH_Build::Morton, 64, simd::detect(), { .traversal = BH_Traversal::Dual } };
+    Gravity_BarnesHut quad{ 0.5, 8, BH_Build::Morton, 64, simd::detect(),
+                            { .expansion = BH_Expansion::Quadrupole, .traversal = BH_Traversal::Dual } };
+    ASSERT_TRUE( quad.traversal() == BH_Traversal::Dual );
+    direct.set_potential( true ); groups.set_potential( true );
+    mono.set_potential( true ); quad.set_potential( true );
+
+    std::vector<double> const ref{ evaluate( p, direct ) };
+    std::vector<double> const a_groups{ evaluate( p, groups ) };
+    std::vector<double> const a_mono{ evaluate( p, mono ) };
+    std::vector<double> const a_quad{ evaluate( p, quad ) };
+
+    ASSERT_LT( rms_rel_error( a_mono, ref, 0, N ), 2e-2 );
+    ASSERT_LT( rms_rel_error( a_quad, ref, 0, N ), 5e-3 );
+    ASSERT_LT( rms_rel_error( a_quad, ref, 0, N ), 0.4 * rms_rel_error( a_mono, ref, 0, N ) );
+    ASSERT_LT( rms_rel_pot_error( a_quad, ref, 0, N ), 5e-4 );
+    ASSERT_LT( net_force( p, a_mono ), 1e-13 );
+    ASSERT_LT( net_force( p, a_quad ), 1e-13 );
+    ASSERT_LT( 1e3 * net_force( p, a_quad ), net_force( p, a_groups ) );
+    ASSERT_LT( rms_rel_error( a_quad, a_groups, N_active, N ), 1e-12 );
+
+    bool threw{ false };
+    try { Gravity_BarnesHut const bad{ 0.5, 8, BH_Build::Morton, 64, simd::detect(),
+                                       { .alpha = 1e-3, .traversal = BH_Traversal::Dual } }; }
+    catch ( std::runtime_error const& ) { threw = true; }
+    ASSERT_TRUE( threw );
+    threw = false;
+    try { mono.set_short_range( 1.0 ); } catch ( std::runtime_error const& ) { threw = true; }
+    ASSERT_TRUE( threw );
+    ++g_pass;
+}
+
+TEST( fmm_matches_direct ) {
+    // Force and potential errors shrink with the expansion order, the net
+    // force on the active bodies vanishes (cell pairs interact through
+    // equal and opposite truncated expansions), and every ISA agrees.
+    constexpr std::size_t N{ 4000 };
+    constexpr std::size_t N_active{ 3500 };
+    Particles p{ N };
+    populate_two_clumps( p, 13 );
+    p.set_num_active( N_active );
+
+    Gravity direct{};
+    Gravity_FMM fmm{};
+    Gravity_FMM low{ 2 };
+    Gravity_FMM high{ 10, 0.5, 64 };
+    direct.set_potential( true ); fmm.set_potential( true );
+    low.set_potential( true ); high.set_potential( true );
+    std::vector<double> const ref{ evaluate( p, direct ) };
+    std::vector<double> const a{ evaluate( p, fmm ) };
+    std::vector<double> const a_low{ evaluate( p, low ) };
+    std::vector<double> const a_high{ evaluate( p, high ) };
+
+    ASSERT_LT( rms_rel_error( a, ref, 0, N ), 2e-3 );
+    ASSERT_LT( rms_rel_pot_error( a, ref, 0, N ), 1e-4 );
+    ASSERT_LT( rms_rel_error( a, ref, 0, N ), 0.1 * rms_rel_error( a_low, ref, 0, N ) );
+    ASSERT_LT( rms_rel_error( a_high, ref, 0, N ), 1e-5 );
+    ASSERT_LT( rms_rel_pot_error( a_high, ref, 0, N ), 1e-6 );
+
+    Gravity_BarnesHut bh{};
+    ASSERT_LT( net_force( p, a ), 1e-12 );
+    ASSERT_LT( net_force( p, a ), net_force( p, evaluate( p, bh ) ) );
+
+    Gravity_FMM scalar{ 6, 0.75, 128, simd::Isa::Scalar };
+    ASSERT_LT( rms_rel_error( evaluate( p, scalar ), a, 0, N ), 1e-12 );
+
+    bool threw{ false };
+    try { Gravity_FMM const bad{ 0 }; } catch ( std::runtime_error const& ) { threw = true; }
+    ASSERT_TRUE( threw );
+    threw = false;
+    try { Gravity_FMM const bad{ 4, 1.0 }; } catch ( std::runtime_error const& ) { threw = true; }
+    ASSERT_TRUE( threw );
+    ++g_pass;
+}
+
+TEST( pm_far_field_is_isolated ) {
+    // Passive probes some twenty cells from a clump of active bodies must
+    // feel the clump's direct-summation pull: no periodic images, and the
+    // mesh smoothing is gone at that range.
+    constexpr std::size_t N_active{ 64 };
+    constexpr std::size_t N{ N_active + 64 };
+    std::mt19937_64 rng{ 14 };
+    std::uniform_real_distribution<double> box{ 0.0, 1e11 };
+
+    Particles p{ N };
+    for ( std::size_t i{}; i < N; ++i ) {
+        bool const probe{ i >= N_active };
+        p.pos_x()[i] = box( rng ) + ( probe ? 9e11 : 0.0 );
+        p.pos_y()[i] = box( rng ) + ( probe ? 4e11 : 0.0 );
+        p.pos_z()[i] = box( rng );
+        p.mass()[i]  = probe ? 0.0 : 1e26;
+    }
+    p.set_num_active( N_active );
+
+    Gravity_PM const pm{ 32 };
+    pm.apply( p );
+    ASSERT_TRUE( pm.cell() > 0.0 );
+
+    double worst{};
+    for ( std::size_t i{ N_active }; i < N; ++i ) {
+        double a_x{}, a_y{}, a_z{};
+        for ( std::size_t j{}; j < N_active; ++j ) {
+            Gravity::accumulate_pairwise( p.pos_x()[i], p.pos_y()[i], p.pos_z()[i],
+                                          p.pos_x()[j], p.pos_y()[j], p.pos_z()[j], p.mass()[j],
+                                          a_x, a_y, a_z, config::G, 0.0, 1.0 );
+        }
+        double const dx{ p.acc_x()[i] - a_x }, dy{ p.acc_y()[i] - a_y }, dz{ p.acc_z()[i] - a_z };
+        worst = std::max( worst, std::sqrt( ( dx*dx + dy*dy + dz*dz ) / ( a_x*a_x + a_y*a_y + a_z*a_z ) ) );
+    }
+    ASSERT_LT( worst, 3e-3 );
+
+    bool threw{ false };
+    try { Gravity_PM const bad{ 48 }; } catch ( std::runtime_error const& ) { threw = true; }
+    ASSERT_TRUE( threw );
+    ++g_pass;
+}
+
+TEST( treepm_matches_direct ) {
+    // The mesh's long-range force plus the truncated tree walk must add up
+    // to direct summation at least as well as a plain Barnes-Hut pass at
+    // the same opening angle and far better than the mesh alone, every ISA
+    // must agree, and the short-range mode must refuse quadrupole trees.
+    constexpr std::size_t N{ 3000 };
+    Particles p{ N };
+    populate_two_clumps( p, 15 );
+
+    std::vector<double> const ref{ evaluate( p, Gravity{} ) };
+    Gravity_TreePM const treepm{ 64 };
+    std::vector<double> const a{ evaluate( p, treepm ) };
+    double const error{ rms_rel_error( a, ref, 0, N ) };
+    ASSERT_LT( error, 2e-2 );
+    ASSERT_LT( error, rms_rel_error( evaluate( p, Gravity_BarnesHut{ treepm.tree().theta() } ), ref, 0, N ) );
+    ASSERT_LT( error, 0.1 * rms_rel_error( evaluate( p, Gravity_PM{ 64 } ), ref, 0, N ) );
+    ASSERT_NEAR( treepm.tree().short_range(), 1.25 * treepm.pm().cell(), 1e-6 * treepm.pm().cell() );
+    ASSERT_TRUE( !treepm.tree().supports_potential() );
+
+    Gravity_TreePM const scalar{ 64, 1.25, 0.7, 8, simd::Isa::Scalar };
+    ASSERT_LT( rms_rel_error( evaluate( p, scalar ), a, 0, N ), 1e-12 );
+
+    // At the default theta, above 1/sqrt(3), the short-range walk must
+    // still open the cells that hold a light clump next to a heavy one;
+    // the light clump spans several groups.
+    constexpr std::size_t N_heavy{ 400 };
+    constexpr std::size_t N_pair{ N_heavy + 200 };
+    Particles pair{ N_pair };
+    populate_heavy_light_clumps( pair, N_heavy );
+    std::vector<double> const pair_ref{ evaluate( pair, Gravity{} ) };
+    ASSERT_LT( max_rel_error( evaluate( pair, treepm ), pair_ref, N_heavy, N_pair ), 1e-2 );
+
+    Gravity_BarnesHut mono{};
+    mono.set_short_range( 1e10 );
+    ASSERT_TRUE( !mono.supports_potential() );
+    mono.set_short_range( 0.0 );
+    ASSERT_TRUE( mono.supports_potential() );
+
+    bool threw{ false };
+    Gravity_BarnesHut quad{ 0.5, 8, BH_Build::Morton, 64, simd::detect(), { .expansion = BH_Expansion::Quadrupole } };
+    try { quad.set_short_range( 1e10 ); } catch ( std::runtime_error const& ) { threw = true; }
+    ASSERT_TRUE( threw );
+    ++g_pass;
+}
+
+TEST( morton_reorder_preserves_bodies_and_forces ) {
+    // After a reorder every slot must hold the body its id names, the
+    // active/passive split and pinned body 0 must hold, and forces (now
+    // summed over contiguous buckets) must match the unpermuted run.
+    constexpr std::size_t N{ 2000 };
+    constexpr std::size_t N_active{ 1500 };
+    std::mt19937_64 rng{ 11 };
+    std::normal_distribution<double> cluster{ 0.0, 1e11 };
+    std::uniform_real_distribution<double> mass_dist{ 1e22, 1e26 };
+
+    Particles p_ref{ N };
+    Particles p{ N };
+    for ( std::size_t i{}; i < N; ++i ) {
+        double const x{ cluster( rng ) }, y{ cluster( rng ) }, z{ cluster( rng ) }, m{ mass_dist( rng ) };
+        p_ref.pos_x()[i] = p.pos_x()[i] = x;
+        p_ref.pos_y()[i] = p.pos_y()[i] = y;
+        p_ref.pos_z()[i] = p.pos_z()[i] = z;
+        p_ref.vel_x()[i] = p.vel_x()[i] = static_cast<double>( i );
+        p_ref.mass()[i]  = p.mass()[i]  = m;
+    }
+    p_ref.set_num_active( N_active );
+    p.set_num_active( N_active );
+
+    Morton_Reorder reorder{ 0 };
+    ASSERT_TRUE( reorder.disorder( p, 1 ) > 0.3 );
+    std::vector<std::size_t> const order{ reorder.reorder( p, 1 ) };
+    ASSERT_TRUE( reorder.disorder( p, 1 ) == 0.0 );
+
+    std::vector<std::size_t> const &ids{ p.ids() };
+    ASSERT_TRUE( ids[0] == 0 );
+    for ( std::size_t k{}; k < N; ++k ) {
+        ASSERT_TRUE( ids[k] == order[k] );
+        ASSERT_TRUE( ( k < N_active ) == ( ids[k] < N_active ) );
+        ASSERT_TRUE( p.pos_x()[k] == p_ref.pos_x()[ids[k]] && p.vel_x()[k] == static_cast<double>( ids[k] ) );
+    }
+
+    Gravity_BarnesHut const bh{ 0.5 };
+    bh.apply( p_ref );
+    bh.apply( p );
+    for ( std::size_t k{}; k < N; ++k ) {
+        std::size_t const i{ ids[k] };
+        double const scale{ std::abs( p_ref.acc_x()[i] ) + std::abs( p_ref.acc_y()[i] ) + std::abs( p_ref.acc_z()[i] ) };
+        ASSERT_LT( ( std::abs( p.acc_x()[k] - p_ref.acc_x()[i] ) + std::abs( p.acc_y()[k] - p_ref.acc_y()[i] )
+                   + std::abs( p.acc_z()[k] - p_ref.acc_z()[i] ) ) / scale, 1e-12 );
+    }
+
+    // Orders that mix active and passive slots are rejected.
+    std::vector<std::size_t> mixing( N );
+    std::iota( mixing.begin(), mixing.end(), std::size_t{} );
+    std::swap( mixing[0], mixing[N - 1] );
+    bool threw{ false };
+    try { p.permute( mixing ); } catch ( std::runtime_error const& ) { threw = true; }
+    ASSERT_TRUE( threw );
+    ++g_pass;
+}
+
+TEST( bh_potential_mode_matches_direct_at_low_theta ) {
+    // With a tight MAC the tree potential converges to the pairwise sum.
+    constexpr std::size_t N{ 20 };
+    std::mt19937_64 rng{ 12345 };
+    std::uniform_real_distribution<double> pos_dist{ -1e11, 1e11 };
+    std::uniform_real_distribution<double> mass_dist{ 1e23, 1e26 };
+
+    Particles p{ N };
+    for ( std::size_t i{}; i < N; ++i ) {
+        p.pos_x()[i] = pos_dist( rng );
+        p.pos_y()[i] = pos_dist( rng );
+        p.pos_z()[i] = pos_dist( rng );
+        p.mass()[i] = mass_dist( rng );
+    }
+
+    Gravity_BarnesHut bh{ 0.05, 1 };
+    ASSERT_TRUE( bh.supports_potential() );
+    bh.set_potential( true );
+    bh.apply( p );
+
+    double pe{};
+    for ( std::size_t i{}; i < N; ++i ) {
+        pe += 0.5 * p.mass()[i] * p.pot()[i];
+    }
+    double const pe_ref{ potential_energy( p ) };
+    ASSERT_LT( std::abs( ( pe - pe_ref ) / pe_ref ), 1e-9 );
+    ++g_pass;
+}
+
 TEST( bh_kepler_two_body_returns_to_start ) {
     // Same orbit setup as the direct version but driven by the BH force.
     // Tolerance is looser (1e-3) because BH approximates, though at N=2 the